@@ -9,42 +9,169 @@
 #include <string.h>
 #include <limits.h>
 #include "parse.h"
+#include "pipeline.h"
 #include "utils.h"
 
+#define MAX_INPUT_BUFFER_SIZE (1ul << 30)
+///< Maksymalny rozmiar bufora wejścia
+
 /**
- * Główna funkcja kalkulatora
+ * Sprawdza, czy na wejściu są jeszcze dane
+ *
+ * Zanim zaczekamy na kolejną porcję wejścia, przekazujemy zebrane wyniki
+ * i komunikaty o błędach, żeby przy pracy interaktywnej pojawiały się
+ * od razu.
+ * @param[in,out] stream : wskaźnik na InputStream
+ * @return czy wejście się nie skończyło
  */
-int main(int argc, char *argv[])
+static bool HasMoreInput(InputStream *stream)
 {
-    (void)argc;
-    (void)argv;
-    Stack   poly_stack = StackInit();
-    InputStream stream = InputStreamInit(STDIN_FILENO);
+    if (InputStreamNeedsFill(stream))
+    {
+        OutputFlush(&standard_output);
+        OutputFlush(&error_output);
+    }
+
+    return PeekCharacter(stream) != EOF;
+}
 
-    while (EOF != PeekCharacter(&stream))
+/**
+ * Przetwarza wejście wiersz po wierszu
+ *
+ * Wielomiany z wejścia odwzorowanego w pamięć, o ile się to opłaca,
+ * tylko sprawdzamy i odkładamy na stos jako literały, wczytywane dopiero
+ * przez polecenia, które potrzebują ich postaci.
+ * @param[in,out] stream : wskaźnik na InputStream
+ * @param[in,out] poly_stack : stos wielomianów
+ */
+static void ProcessInput(InputStream *stream, Stack *poly_stack)
+{
+    while (HasMoreInput(stream))
     {
-        if (IsValidCommandCharacter(PeekCharacter(&stream)))
+        if (IsValidCommandCharacter(PeekCharacter(stream)))
         {
-            ReadAndExecuteCommand(&stream, &poly_stack);
+            ReadAndExecuteCommand(stream, poly_stack);
+        }
+        else if (stream->mapped_size > 0 &&
+                 PolyLiteralPreferred(stream->line_number))
+        {
+            // Wiersz pozostaje w pamięci, więc wczytamy go dopiero wtedy,
+            // gdy polecenie będzie potrzebowało wielomianu.
+            PolyLiteral *literal = malloc(sizeof(PolyLiteral));
+            assert(literal != NULL);
+            ReadPolynomialLiteral(stream, literal);
+
+            if (stream->parse_error)
+            {
+                free(literal);
+                continue;
+            }
+
+            PolyStackPushLiteral(poly_stack, literal);
         }
         else {
             Poly *p = malloc(sizeof(Poly));
             assert(p != NULL);
-            *p = ReadPolynomial(&stream);
+            *p = ReadPolynomial(stream);
 
-            if (stream.parse_error)
+            if (stream->parse_error)
             {
                 PolyDestroy(p);
                 free(p);
                 continue;
             }
 
-            StackPush(&poly_stack, p);
+            PolyRingReduce(p);
+            StackPush(poly_stack, p);
+        }
+    }
+}
+
+/**
+ * Wczytuje liczbową wartość opcji wiersza poleceń
+ * @param[in] value : tekst wartości
+ * @param[in] max_value : maksymalna poprawna wartość
+ * @param[out] result : wartość
+ * @return czy wartość jest poprawna
+ */
+static bool ParseOptionValue(const char *value, unsigned long max_value,
+                             unsigned long *result)
+{
+    char *end;
+    *result = strtoul(value, &end, 10);
+    return IsValidDigit(value[0]) && *end == '\0' && *result <= max_value;
+}
+
+/**
+ * Główna funkcja kalkulatora
+ *
+ * Wywołanie: `calc_poly [-b rozmiar_bufora] [-j liczba_wątków] [plik]`.
+ * Polecenia czyta z podanego pliku, a w przypadku jego braku
+ * ze standardowego wejścia. Wejście, którego nie da się odwzorować
+ * w pamięć, jest czytane do buforów podanego rozmiaru (0 pozostawia
+ * mały bufor), w miarę możliwości z wyprzedzeniem przez osobny wątek.
+ * Wielomiany z pliku odwzorowanego w pamięć wczytuje potokowo podana
+ * liczba wątków (domyślnie o jeden mniej niż procesorów, 0 wyłącza potok).
+ * Wyniki są buforowane i wypisywane przed czekaniem na dalsze wejście
+ * oraz na końcu działania.
+ */
+int main(int argc, char *argv[])
+{
+    unsigned long buffer_size = LARGE_INPUT_BUFFER_SIZE;
+    unsigned long worker_count = PipelineDefaultWorkerCount();
+    int argument = 1;
+    while (argument + 1 < argc)
+    {
+        const char *value = argv[argument + 1];
+        if (strcmp(argv[argument], "-b") == 0)
+        {
+            if (!ParseOptionValue(value, MAX_INPUT_BUFFER_SIZE, &buffer_size))
+            {
+                fprintf(stderr, "ERROR WRONG BUFFER SIZE %s\n", value);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[argument], "-j") == 0)
+        {
+            if (!ParseOptionValue(value, PIPELINE_MAX_WORKERS, &worker_count))
+            {
+                fprintf(stderr, "ERROR WRONG WORKER COUNT %s\n", value);
+                return 1;
+            }
+        }
+        else {
+            break;
+        }
+        argument += 2;
+    }
+
+    InputStream stream;
+    if (argument < argc)
+    {
+        if (!InputStreamOpen(argv[argument], &stream))
+        {
+            fprintf(stderr, "ERROR CANNOT OPEN %s\n", argv[argument]);
+            return 1;
         }
     }
+    else {
+        stream = InputStreamInit(STDIN_FILENO);
+    }
+    InputStreamSetBufferSize(&stream, buffer_size);
+    Stack poly_stack = StackInit();
+
+    if (worker_count == 0 ||
+        !PipelineRun(&stream, &poly_stack, worker_count))
+    {
+        ProcessInput(&stream, &poly_stack);
+    }
 
+    OutputFlush(&standard_output);
+    OutputFlush(&error_output);
+    PolyStackDestroy(&poly_stack);
     InputStreamDestroy(&stream);
-    StackDestroy(&poly_stack, &PolyDestroy);
+    ReleaseCommandResources();
+    PolyReleaseMemory();
 
     return 0;
 }
@@ -0,0 +1,163 @@
+/** @file
+   Implementacja operacji na tablicach współczynników
+
+   @date 2017-06-05
+*/
+
+#include "coeff_kernels.h"
+#include <pthread.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+/// Czy kompilujemy wersje wektorowe operacji?
+#define COEFF_KERNELS_X86 1
+#endif
+
+/**
+ * Struktura przechowująca wybrane wersje operacji na tablicach
+ */
+typedef struct CoeffKernels
+{
+    /// Mnożenie tablicy przez stałą
+    void (*scale)(poly_coeff_t dst[], poly_coeff_t c, size_t n);
+    /// Dodawanie tablicy pomnożonej przez stałą
+    void (*mul_add)(poly_coeff_t dst[], const poly_coeff_t src[],
+                    poly_coeff_t c, size_t n);
+} CoeffKernels;
+
+/// Wersje operacji wybrane dla bieżącego procesora
+static CoeffKernels coeff_kernels;
+/// Gwarantuje jednokrotny wybór wersji operacji (także między wątkami)
+static pthread_once_t coeff_kernels_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Skalarna wersja CoeffScaleArray
+ * @param[in,out] dst : tablica współczynników
+ * @param[in] c : mnożnik
+ * @param[in] n : długość tablicy
+ */
+static void ScaleScalar(poly_coeff_t dst[], poly_coeff_t c, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        dst[i] *= c;
+    }
+}
+
+/**
+ * Skalarna wersja CoeffMulAddArray
+ * @param[in,out] dst : tablica współczynników
+ * @param[in] src : dodawana tablica
+ * @param[in] c : mnożnik dodawanej tablicy
+ * @param[in] n : długość tablic
+ */
+static void MulAddScalar(poly_coeff_t dst[], const poly_coeff_t src[],
+                         poly_coeff_t c, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        dst[i] += c * src[i];
+    }
+}
+
+#ifdef COEFF_KERNELS_X86
+
+/**
+ * Mnoży 64-bitowe liczby w wektorze AVX2 modulo 2^64
+ *
+ * AVX2 nie ma mnożenia 64-bitowego, więc składamy je z mnożeń
+ * 32-bitowych połówek: `lo(a) lo(b) + 2^32 (hi(a) lo(b) + lo(a) hi(b))`.
+ * @param[in] a : wektor czterech liczb
+ * @param[in] b : wektor czterech liczb
+ * @return wektor iloczynów
+ */
+__attribute__((target("avx2")))
+static inline __m256i Mul64Avx2(__m256i a, __m256i b)
+{
+    const __m256i low = _mm256_mul_epu32(a, b);
+    const __m256i cross = _mm256_add_epi64(
+            _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+            _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+/**
+ * Wersja CoeffScaleArray dla AVX2
+ * @param[in,out] dst : tablica współczynników
+ * @param[in] c : mnożnik
+ * @param[in] n : długość tablicy
+ */
+__attribute__((target("avx2")))
+static void ScaleAvx2(poly_coeff_t dst[], poly_coeff_t c, size_t n)
+{
+    const __m256i factor = _mm256_set1_epi64x(c);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i *ptr = (__m256i *)&dst[i];
+        _mm256_storeu_si256(ptr, Mul64Avx2(_mm256_loadu_si256(ptr), factor));
+    }
+    ScaleScalar(&dst[i], c, n - i);
+}
+
+/**
+ * Wersja CoeffMulAddArray dla AVX2
+ * @param[in,out] dst : tablica współczynników
+ * @param[in] src : dodawana tablica
+ * @param[in] c : mnożnik dodawanej tablicy
+ * @param[in] n : długość tablic
+ */
+__attribute__((target("avx2")))
+static void MulAddAvx2(poly_coeff_t dst[], const poly_coeff_t src[],
+                       poly_coeff_t c, size_t n)
+{
+    const __m256i factor = _mm256_set1_epi64x(c);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i *ptr = (__m256i *)&dst[i];
+        const __m256i product =
+                Mul64Avx2(_mm256_loadu_si256((const __m256i *)&src[i]),
+                          factor);
+        _mm256_storeu_si256(ptr, _mm256_add_epi64(_mm256_loadu_si256(ptr),
+                                                  product));
+    }
+    MulAddScalar(&dst[i], &src[i], c, n - i);
+}
+
+#endif /* COEFF_KERNELS_X86 */
+
+/**
+ * Wybiera wersje operacji najlepsze dla bieżącego procesora
+ */
+static void CoeffKernelsInit(void)
+{
+    coeff_kernels = (CoeffKernels) {.scale = ScaleScalar,
+                                    .mul_add = MulAddScalar};
+
+#ifdef COEFF_KERNELS_X86
+    // Wersje AVX-512 nie były szybsze: 64-bitowe mnożenie wektorowe
+    // (vpmullq) jest wolne, a przy tych długościach tablic i tak
+    // ogranicza nas przepustowość pamięci podręcznej.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        coeff_kernels = (CoeffKernels) {.scale = ScaleAvx2,
+                                        .mul_add = MulAddAvx2};
+    }
+#endif
+}
+
+void CoeffScaleArray(poly_coeff_t dst[], poly_coeff_t c, size_t n)
+{
+    pthread_once(&coeff_kernels_once, CoeffKernelsInit);
+    coeff_kernels.scale(dst, c, n);
+}
+
+void CoeffMulAddArray(poly_coeff_t dst[], const poly_coeff_t src[],
+                      poly_coeff_t c, size_t n)
+{
+    pthread_once(&coeff_kernels_once, CoeffKernelsInit);
+    coeff_kernels.mul_add(dst, src, c, n);
+}
@@ -0,0 +1,40 @@
+/** @file
+   Interfejs operacji na tablicach współczynników
+
+   Operacje mają wersje wektorowe (AVX2) wybierane w czasie działania
+   programu na podstawie możliwości procesora oraz wersję skalarną,
+   używaną na pozostałych procesorach.
+
+   @date 2017-06-05
+*/
+
+#ifndef __COEFF_KERNELS_H__
+#define __COEFF_KERNELS_H__
+
+#include <stddef.h>
+#include "poly.h"
+
+/**
+ * Mnoży tablicę współczynników przez stałą
+ *
+ * Liczy `dst[i] = c * dst[i]` modulo 2^64.
+ * @param[in,out] dst : tablica współczynników
+ * @param[in] c : mnożnik
+ * @param[in] n : długość tablicy
+ */
+void CoeffScaleArray(poly_coeff_t dst[], poly_coeff_t c, size_t n);
+
+/**
+ * Dodaje do tablicy współczynników inną tablicę pomnożoną przez stałą
+ *
+ * Liczy `dst[i] = dst[i] + c * src[i]` modulo 2^64. Tablice nie mogą
+ * na siebie zachodzić.
+ * @param[in,out] dst : tablica współczynników
+ * @param[in] src : dodawana tablica
+ * @param[in] c : mnożnik dodawanej tablicy
+ * @param[in] n : długość tablic
+ */
+void CoeffMulAddArray(poly_coeff_t dst[], const poly_coeff_t src[],
+                      poly_coeff_t c, size_t n);
+
+#endif /* __COEFF_KERNELS_H__ */
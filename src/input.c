@@ -0,0 +1,314 @@
+/** @file
+   Implementacja otwierania i usuwania wejścia
+
+   @date 2017-06-05
+*/
+
+// posix_madvise wymaga rozszerzeń POSIX, niedostępnych przy -std=c11.
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "input.h"
+
+/**
+ * Najmniejsza liczba procesorów, przy której czytamy z wyprzedzeniem
+ *
+ * Testy jednostkowe uruchamiają wątek wczytujący zawsze, żeby sprawdzić
+ * go także na jednym procesorze.
+ */
+#ifdef UNIT_TESTING
+#define READ_AHEAD_MIN_CPUS 1
+#else
+#define READ_AHEAD_MIN_CPUS 2
+#endif
+
+/**
+ * Struktura przechowująca stan wczytywania z wyprzedzeniem
+ *
+ * Bufory tworzą cykl: wątek wczytujący wypełnia bufor numer
+ * `produced % READ_AHEAD_BUFFER_COUNT`, a przetwarzanie pobiera bufor
+ * numer `consumed % READ_AHEAD_BUFFER_COUNT` i trzyma go do pobrania
+ * następnego. Liczniki rosną tylko pod blokadą.
+ */
+typedef struct ReadAhead
+{
+    pthread_t thread; ///< Wątek wczytujący
+    pthread_mutex_t lock; ///< Blokada chroniąca pola poniżej
+    pthread_cond_t changed; ///< Sygnalizuje zmianę liczników lub stanu
+    char *buffers[READ_AHEAD_BUFFER_COUNT]; ///< Bufory
+    ssize_t lengths[READ_AHEAD_BUFFER_COUNT]; ///< Długości wczytanych danych
+    size_t buffer_size; ///< Rozmiar każdego bufora
+    unsigned long produced; ///< Liczba wypełnionych buforów
+    unsigned long consumed; ///< Liczba pobranych buforów
+    int file_descriptor; ///< Identyfikator czytanego pliku
+    bool waiting; ///< Czy przetwarzanie czeka na kolejny bufor
+    bool finished; ///< Czy przekazano już koniec wejścia
+    bool stop; ///< Czy wątek ma zakończyć pracę
+} ReadAhead;
+
+/**
+ * Wypełnia bufor danymi z pliku
+ *
+ * Czyta do zapełnienia bufora, końca pliku lub chwili, w której
+ * przetwarzanie czeka na dane. Gdy bufor nie jest pusty, czyta dalej
+ * tylko dane gotowe od razu, żeby nie zatrzymać w read() wiersza, na
+ * który czeka odpowiedź. Anulowanie wątku jest dozwolone tylko
+ * w trakcie read().
+ * @param[in,out] state : stan wczytywania z wyprzedzeniem
+ * @param[out] buffer : wypełniany bufor
+ * @return liczba wczytanych znaków (0 na końcu pliku)
+ */
+static ssize_t ReadAheadFill(ReadAhead *state, char *buffer)
+{
+    size_t length = 0;
+    while (length < state->buffer_size)
+    {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        const ssize_t count = read(state->file_descriptor, buffer + length,
+                                   state->buffer_size - length);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (count <= 0)
+        {
+            break;
+        }
+        length += count;
+
+        pthread_mutex_lock(&state->lock);
+        const bool waiting = state->waiting;
+        pthread_mutex_unlock(&state->lock);
+        if (waiting)
+        {
+            break;
+        }
+
+        struct pollfd ready = {
+            .fd = state->file_descriptor, .events = POLLIN
+        };
+        if (poll(&ready, 1, 0) <= 0)
+        {
+            break;
+        }
+    }
+    return length;
+}
+
+/**
+ * Funkcja wątku wczytującego z wyprzedzeniem
+ * @param[in,out] arg : stan wczytywania z wyprzedzeniem
+ * @return NULL
+ */
+static void* ReadAheadThread(void *arg)
+{
+    ReadAhead *state = arg;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    bool end_of_input = false;
+    while (!end_of_input)
+    {
+        pthread_mutex_lock(&state->lock);
+        // Jeden bufor trzyma przetwarzanie, pozostałe mogą czekać wypełnione.
+        while (!state->stop &&
+               state->produced - state->consumed >= READ_AHEAD_BUFFER_COUNT - 1)
+        {
+            pthread_cond_wait(&state->changed, &state->lock);
+        }
+        const unsigned slot = state->produced % READ_AHEAD_BUFFER_COUNT;
+        const bool stop = state->stop;
+        pthread_mutex_unlock(&state->lock);
+        if (stop)
+        {
+            break;
+        }
+
+        const ssize_t length = ReadAheadFill(state, state->buffers[slot]);
+        end_of_input = length == 0;
+
+        pthread_mutex_lock(&state->lock);
+        state->lengths[slot] = length;
+        ++state->produced;
+        pthread_cond_broadcast(&state->changed);
+        pthread_mutex_unlock(&state->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Zwalnia stan wczytywania z wyprzedzeniem (wątek musi być zakończony)
+ * @param[in] state : stan wczytywania z wyprzedzeniem
+ */
+static void ReadAheadFree(ReadAhead *state)
+{
+    pthread_mutex_destroy(&state->lock);
+    pthread_cond_destroy(&state->changed);
+    for (unsigned i = 0; i < READ_AHEAD_BUFFER_COUNT; ++i)
+    {
+        free(state->buffers[i]);
+    }
+    free(state);
+}
+
+/**
+ * Uruchamia wątek wczytujący z wyprzedzeniem
+ * @param[in] file_descriptor : identyfikator czytanego pliku
+ * @param[in] buffer_size : rozmiar jednego bufora
+ * @return stan wczytywania lub NULL, jeśli nie udało się utworzyć wątku
+ */
+static ReadAhead* ReadAheadStart(int file_descriptor, size_t buffer_size)
+{
+    ReadAhead *state = calloc(1, sizeof(ReadAhead));
+    assert(state != NULL);
+    for (unsigned i = 0; i < READ_AHEAD_BUFFER_COUNT; ++i)
+    {
+        state->buffers[i] = malloc(buffer_size);
+        assert(state->buffers[i] != NULL);
+    }
+    state->buffer_size = buffer_size;
+    state->file_descriptor = file_descriptor;
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->changed, NULL);
+    if (pthread_create(&state->thread, NULL, ReadAheadThread, state) != 0)
+    {
+        ReadAheadFree(state);
+        return NULL;
+    }
+    return state;
+}
+
+void InputStreamSetBufferSize(InputStream *stream, size_t buffer_size)
+{
+    assert(stream != NULL);
+    if (stream->mapped_size > 0 || stream->read_ahead != NULL ||
+        buffer_size == 0)
+    {
+        return;
+    }
+    assert(stream->remaining_buffer_size == 0);
+
+    free(stream->buffer);
+    stream->buffer_size = buffer_size;
+    if (sysconf(_SC_NPROCESSORS_ONLN) >= READ_AHEAD_MIN_CPUS)
+    {
+        stream->read_ahead = ReadAheadStart(stream->file_descriptor,
+                                            buffer_size);
+    }
+
+    if (stream->read_ahead != NULL)
+    {
+        stream->buffer = NULL;
+    }
+    else {
+        stream->buffer = malloc(buffer_size);
+        assert(stream->buffer != NULL);
+    }
+    stream->current_character_ptr = stream->buffer;
+}
+
+void InputStreamNextBuffer(InputStream *stream)
+{
+    ReadAhead *state = stream->read_ahead;
+    assert(state != NULL);
+    if (state->finished)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&state->lock);
+    state->waiting = true;
+    while (state->produced == state->consumed)
+    {
+        pthread_cond_wait(&state->changed, &state->lock);
+    }
+    state->waiting = false;
+    const unsigned slot = state->consumed % READ_AHEAD_BUFFER_COUNT;
+    ++state->consumed;
+    pthread_cond_broadcast(&state->changed);
+    pthread_mutex_unlock(&state->lock);
+
+    stream->buffer = state->buffers[slot];
+    stream->current_character_ptr = stream->buffer;
+    stream->remaining_buffer_size = state->lengths[slot];
+    state->finished = state->lengths[slot] == 0;
+}
+
+/**
+ * Zatrzymuje wątek wczytujący z wyprzedzeniem i zwalnia jego bufory
+ * @param[in] state : stan wczytywania z wyprzedzeniem
+ */
+static void ReadAheadDestroy(ReadAhead *state)
+{
+    pthread_mutex_lock(&state->lock);
+    state->stop = true;
+    pthread_cond_broadcast(&state->changed);
+    pthread_mutex_unlock(&state->lock);
+    if (!state->finished)
+    {
+        // Wątek może czekać w read() na dane, które nigdy nie nadejdą.
+        pthread_cancel(state->thread);
+    }
+    pthread_join(state->thread, NULL);
+    ReadAheadFree(state);
+}
+
+bool InputStreamOpen(const char *path, InputStream *stream)
+{
+    assert(path != NULL && stream != NULL);
+    const int file_descriptor = open(path, O_RDONLY);
+    if (file_descriptor < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(file_descriptor, &info) == 0 && S_ISREG(info.st_mode) &&
+        info.st_size > 0)
+    {
+        void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE,
+                          file_descriptor, 0);
+        if (data != MAP_FAILED)
+        {
+            posix_madvise(data, info.st_size, POSIX_MADV_SEQUENTIAL);
+            close(file_descriptor);
+
+            stream->line_number = 0;
+            stream->column_number = 0;
+            stream->parse_error = false;
+            stream->file_descriptor = -1;
+            stream->owns_file_descriptor = false;
+            stream->read_ahead = NULL;
+            stream->mapped_size = info.st_size;
+            stream->buffer = data;
+            stream->current_character_ptr = stream->buffer;
+            stream->remaining_buffer_size = info.st_size;
+            return true;
+        }
+    }
+
+    *stream = InputStreamInit(file_descriptor);
+    stream->owns_file_descriptor = true;
+    return true;
+}
+
+void InputStreamDestroy(InputStream *stream)
+{
+    assert(stream != NULL);
+    if (stream->mapped_size > 0)
+    {
+        munmap(stream->buffer, stream->mapped_size);
+    }
+    else if (stream->read_ahead != NULL)
+    {
+        ReadAheadDestroy(stream->read_ahead);
+    }
+    else {
+        free(stream->buffer);
+    }
+    if (stream->owns_file_descriptor)
+    {
+        close(stream->file_descriptor);
+    }
+}
@@ -8,12 +8,21 @@
 #define __INPUTSTREAM_H__
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include "utils.h"
 
 #define INPUT_BUFFER_SIZE 1024
 ///< Rozmiar bufora w którym trzymamy wejście
+#define LARGE_INPUT_BUFFER_SIZE (1 << 20)
+///< Domyślny rozmiar buforów wejścia czytanego przez read()
+#define READ_AHEAD_BUFFER_COUNT 3
+///< Liczba buforów wczytywania z wyprzedzeniem
+
+struct ReadAhead;
 
 /**
  * Struktura przechowująca informacje o wejściu
@@ -22,8 +31,12 @@ typedef struct InputStream
 {
     char *buffer; ///< Tablica przechowywująca wczytane dane
     char *current_character_ptr; ///< Wskaźnik na ostatni zwrócony znak
-    int remaining_buffer_size; ///< Pozostała liczba wczytanych znaków
+    ssize_t remaining_buffer_size; ///< Pozostała liczba wczytanych znaków
+    size_t buffer_size; ///< Rozmiar bufora (dla odczytu przez read())
+    size_t mapped_size; ///< Rozmiar pliku odwzorowanego w pamięć (lub 0)
     int file_descriptor; ///< Identyfikator pliku do wcztytywania danych
+    bool owns_file_descriptor; ///< Czy zamykamy plik przy usuwaniu
+    struct ReadAhead *read_ahead; ///< Wątek wczytujący wejście (lub NULL)
     unsigned column_number; ///< Numer ostatniej zwróconej kolumny
     unsigned line_number; ///< Numer ostatniego zwróconego wiersza
     bool parse_error; ///< Oznacza błędne dane (ustawiana zewnętrznie)
@@ -40,12 +53,118 @@ static inline InputStream InputStreamInit(int file_descriptor)
     stream.column_number = 0;
     stream.parse_error = false;
     stream.file_descriptor = file_descriptor;
-    stream.buffer = calloc(INPUT_BUFFER_SIZE, sizeof(char));
+    stream.owns_file_descriptor = false;
+    stream.mapped_size = 0;
+    stream.read_ahead = NULL;
+    stream.buffer_size = INPUT_BUFFER_SIZE;
+    stream.buffer = calloc(stream.buffer_size, sizeof(char));
+    assert(stream.buffer != NULL);
     stream.current_character_ptr = stream.buffer;
     stream.remaining_buffer_size = 0;
     return stream;
 }
 
+/**
+ * Tworzy InputStream czytający fragment danych w pamięci
+ *
+ * Fragment traktujemy jak plik odwzorowany w pamięć, więc jego koniec
+ * jest końcem wejścia. Numery wierszy liczymy od @p line_number, a fragment
+ * zaczyna się na początku wiersza. Dane muszą istnieć, dopóki czytamy
+ * z utworzonego wejścia; nie usuwamy go przez InputStreamDestroy.
+ * @param[in] data : początek fragmentu
+ * @param[in] length : długość fragmentu (dodatnia)
+ * @param[in] line_number : numer wiersza, od którego zaczyna się fragment
+ */
+static inline InputStream InputStreamFromMemory(const char *data,
+                                                size_t length,
+                                                unsigned line_number)
+{
+    assert(data != NULL && length > 0);
+    InputStream stream;
+    stream.line_number = line_number;
+    stream.column_number = 0;
+    stream.parse_error = false;
+    stream.file_descriptor = -1;
+    stream.owns_file_descriptor = false;
+    stream.read_ahead = NULL;
+    stream.mapped_size = length;
+    stream.buffer = (char *)data;
+    stream.current_character_ptr = stream.buffer;
+    stream.remaining_buffer_size = length;
+    return stream;
+}
+
+/**
+ * Tworzy InputStream czytający z pliku o podanej ścieżce
+ *
+ * Zwykły plik odwzorowujemy w pamięć i czytamy bez kopiowania (jego
+ * zawartość nie może się zmieniać w trakcie działania programu).
+ * Pozostałe pliki (np. potoki) czytamy przez read(), jak w InputStreamInit.
+ * @param[in] path : ścieżka do pliku
+ * @param[out] stream : utworzony InputStream
+ * @return czy udało się otworzyć plik
+ */
+bool InputStreamOpen(const char *path, InputStream *stream);
+
+/**
+ * Zmienia rozmiar bufora wejścia czytanego przez read()
+ *
+ * Jeśli dostępny jest więcej niż jeden procesor, włącza też wczytywanie
+ * z wyprzedzeniem: osobny wątek wypełnia kolejne z READ_AHEAD_BUFFER_COUNT
+ * buforów, podczas gdy wczytane dane są przetwarzane. Wątek przekazuje
+ * bufor wcześniej, jeśli przetwarzanie czeka na dane, więc interaktywne
+ * wejście nie jest opóźniane. Na jednym procesorze wątek nie ma z czym
+ * się przeplatać, a spowalnia alokacje (biblioteka standardowa przechodzi
+ * w tryb wielowątkowy), więc czytamy synchronicznie.
+ * Nie robi nic dla pliku odwzorowanego w pamięć oraz gdy @p buffer_size
+ * jest równe 0. Wywołujemy przed wczytaniem pierwszego znaku.
+ * @param[in,out] stream : wskaźnik na InputStream
+ * @param[in] buffer_size : rozmiar jednego bufora
+ */
+void InputStreamSetBufferSize(InputStream *stream, size_t buffer_size);
+
+/**
+ * Zwalnia przetworzony bufor i czeka na kolejny bufor wczytany
+ * przez wątek wczytujący z wyprzedzeniem
+ * @param[in,out] stream : wskaźnik na InputStream
+ */
+void InputStreamNextBuffer(InputStream *stream);
+
+/**
+ * Wczytuje kolejną porcję wejścia, jeśli wszystkie wczytane znaki
+ * zostały już zwrócone
+ *
+ * Plik odwzorowany w pamięć jest w całości dostępny od początku,
+ * więc jego koniec jest końcem wejścia.
+ * @param[in,out] stream : wskaźnik na InputStream
+ */
+static inline void FillBuffer(InputStream *stream)
+{
+    if (stream->remaining_buffer_size == 0 && stream->mapped_size == 0)
+    {
+        if (stream->read_ahead != NULL)
+        {
+            InputStreamNextBuffer(stream);
+        }
+        else {
+            stream->remaining_buffer_size = read(stream->file_descriptor,
+                                                 stream->buffer,
+                                                 stream->buffer_size);
+            stream->current_character_ptr = stream->buffer;
+        }
+    }
+}
+
+/**
+ * Sprawdza, czy kolejny znak wymaga wczytania nowej porcji wejścia
+ * (a więc być może czekania na dane)
+ * @param[in] stream : wskaźnik na InputStream
+ */
+static inline bool InputStreamNeedsFill(const InputStream *stream)
+{
+    return stream->remaining_buffer_size <= 0 && stream->mapped_size == 0;
+}
+
 /**
  * Zwraca znak z wejścia, nie przechodząc do następnego
  * @param[in,out] stream : wskaźnik na InputStream
@@ -55,13 +174,7 @@ static inline char PeekCharacter(InputStream *stream)
     assert(stream != NULL);
     stream->parse_error = false;
 
-    if (stream->remaining_buffer_size == 0)
-    {
-        stream->remaining_buffer_size = read(stream->file_descriptor,
-                                             stream->buffer,
-                                             INPUT_BUFFER_SIZE);
-        stream->current_character_ptr = stream->buffer;
-    }
+    FillBuffer(stream);
 
     if (stream->remaining_buffer_size > 0)
     {
@@ -96,6 +209,40 @@ static inline char ReadCharacter(InputStream *stream)
     return c;
 }
 
+/**
+ * Udostępnia wczytane, jeszcze nie zwrócone znaki wejścia
+ *
+ * W razie potrzeby wczytuje kolejną porcję danych. Dla pliku
+ * odwzorowanego w pamięć zwraca całą pozostałą część pliku, bez kopiowania.
+ * Wskaźnik jest ważny do następnej operacji na @p stream.
+ * @param[in,out] stream : wskaźnik na InputStream
+ * @param[out] length : liczba dostępnych znaków (0 na końcu wejścia)
+ * @return wskaźnik na pierwszy dostępny znak
+ */
+static inline const char* InputStreamData(InputStream *stream, size_t *length)
+{
+    assert(stream != NULL && length != NULL);
+    FillBuffer(stream);
+    *length = stream->remaining_buffer_size > 0 ?
+              (size_t)stream->remaining_buffer_size : 0;
+    return stream->current_character_ptr;
+}
+
+/**
+ * Przechodzi o @p count znaków udostępnionych przez InputStreamData
+ *
+ * Pomijane znaki nie mogą zawierać znaku nowej linii.
+ * @param[in,out] stream : wskaźnik na InputStream
+ * @param[in] count : liczba pomijanych znaków
+ */
+static inline void InputStreamAdvance(InputStream *stream, size_t count)
+{
+    assert(stream != NULL && (ssize_t)count <= stream->remaining_buffer_size);
+    stream->remaining_buffer_size -= count;
+    stream->current_character_ptr += count;
+    stream->column_number += count;
+}
+
 /**
  * Pomija obecną linię wejścia
  * @param[in,out] stream : wskaźnik na InputStream
@@ -103,21 +250,47 @@ static inline char ReadCharacter(InputStream *stream)
 static inline void SkipLine(InputStream *stream)
 {
     assert(stream != NULL);
-    char c = ReadCharacter(stream);
-    while (c != '\n' && c != EOF)
+    size_t length;
+    const char *data = InputStreamData(stream, &length);
+    while (length > 0)
     {
-        c = ReadCharacter(stream);
+        const char *end_of_line = memchr(data, '\n', length);
+        if (end_of_line != NULL)
+        {
+            InputStreamAdvance(stream, end_of_line - data);
+            break;
+        }
+        InputStreamAdvance(stream, length);
+        data = InputStreamData(stream, &length);
     }
+    ReadCharacter(stream);
 }
 
 /**
- * Usuwa InputStream z pamięci
+ * Pomija wiersz o znanej długości, przetworzony poza tym wejściem
+ *
+ * Wiersz musi zaczynać się na obecnej pozycji i w całości leżeć
+ * w udostępnionych danych (jak w pliku odwzorowanym w pamięć).
  * @param[in,out] stream : wskaźnik na InputStream
+ * @param[in] length : długość wiersza (ze znakiem nowej linii, jeśli go ma)
  */
-static inline void InputStreamDestroy(InputStream *stream)
+static inline void SkipLineOfLength(InputStream *stream, size_t length)
 {
-    assert(stream != NULL);
-    free(stream->buffer);
+    assert(stream != NULL && length > 0 &&
+           (ssize_t)length <= stream->remaining_buffer_size);
+    const bool has_newline = stream->current_character_ptr[length - 1] == '\n';
+    InputStreamAdvance(stream, length);
+    if (has_newline)
+    {
+        ++stream->line_number;
+        stream->column_number = 0;
+    }
 }
 
+/**
+ * Usuwa InputStream z pamięci
+ * @param[in,out] stream : wskaźnik na InputStream
+ */
+void InputStreamDestroy(InputStream *stream);
+
 #endif /* __INPUTSTREAM_H__ */
@@ -0,0 +1,183 @@
+/** @file
+   Implementacja buforowanego wypisywania
+
+   @date 2017-06-05
+*/
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "output.h"
+#include "utils.h"
+
+/// Bufor standardowego wyjścia
+static char standard_output_buffer[OUTPUT_BUFFER_SIZE];
+/// Bufor wyjścia błędów
+static char error_output_buffer[OUTPUT_BUFFER_SIZE];
+
+OutputWriter standard_output = {.buffer = standard_output_buffer,
+                                .length = 0,
+                                .capacity = OUTPUT_BUFFER_SIZE,
+                                .target = OUTPUT_STANDARD};
+
+_Thread_local OutputWriter error_output = {.buffer = error_output_buffer,
+                                           .length = 0,
+                                           .capacity = OUTPUT_BUFFER_SIZE,
+                                           .target = OUTPUT_ERROR};
+
+/// Zapisy dziesiętne liczb 0, 1, ..., 99 (po dwie cyfry)
+static const char digit_pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233"
+        "34353637383940414243444546474849505152535455565758596061626364656667"
+        "6869707172737475767778798081828384858687888990919293949596979899";
+
+void OutputFlush(OutputWriter *writer)
+{
+    if (writer->target == OUTPUT_STRING || writer->length == 0)
+    {
+        return;
+    }
+
+    // Przekazujemy bufor przez printf i fprintf (jedno wywołanie na cały
+    // bufor), żeby testy mogły przechwycić wyjście.
+    if (writer->target == OUTPUT_STANDARD)
+    {
+        printf("%.*s", (int)writer->length, writer->buffer);
+        fflush(stdout);
+    }
+    else {
+        fprintf(stderr, "%.*s", (int)writer->length, writer->buffer);
+    }
+    writer->length = 0;
+}
+
+void OutputMakeRoom(OutputWriter *writer, size_t length)
+{
+    if (writer->capacity - writer->length >= length)
+    {
+        return;
+    }
+
+    if (writer->target == OUTPUT_STRING)
+    {
+        while (writer->capacity - writer->length < length)
+        {
+            writer->capacity *= 2;
+        }
+        writer->buffer = realloc(writer->buffer, writer->capacity);
+        assert(writer->buffer != NULL);
+    }
+    else {
+        assert(length <= writer->capacity);
+        OutputFlush(writer);
+    }
+}
+
+void OutputWrite(OutputWriter *writer, const char *data, size_t length)
+{
+    // Długie ciągi wypisywane do pliku dzielimy na porcje wielkości bufora.
+    while (writer->capacity - writer->length < length &&
+           writer->target != OUTPUT_STRING)
+    {
+        const size_t part = writer->capacity - writer->length;
+        memcpy(writer->buffer + writer->length, data, part);
+        writer->length += part;
+        OutputFlush(writer);
+
+        data += part;
+        length -= part;
+    }
+
+    OutputMakeRoom(writer, length);
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+void OutputUnsigned(OutputWriter *writer, unsigned long value)
+{
+    OutputMakeRoom(writer, OUTPUT_NUMBER_LENGTH);
+
+    // Cyfry zapisujemy od końca, po dwie naraz, a potem przesuwamy na miejsce.
+    char digits[OUTPUT_NUMBER_LENGTH];
+    char *end = digits + OUTPUT_NUMBER_LENGTH;
+    char *start = end;
+    while (value >= 100)
+    {
+        const unsigned pair = value % 100;
+        value /= 100;
+        start -= 2;
+        memcpy(start, &digit_pairs[2 * pair], 2);
+    }
+    if (value >= 10)
+    {
+        start -= 2;
+        memcpy(start, &digit_pairs[2 * value], 2);
+    }
+    else {
+        *--start = (char)('0' + value);
+    }
+
+    memcpy(writer->buffer + writer->length, start, end - start);
+    writer->length += end - start;
+}
+
+void OutputLong(OutputWriter *writer, long value)
+{
+    unsigned long magnitude = value;
+    if (value < 0)
+    {
+        OutputChar(writer, '-');
+        magnitude = 0 - magnitude;
+    }
+    OutputUnsigned(writer, magnitude);
+}
+
+void OutputFormat(OutputWriter *writer, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(writer->buffer + writer->length,
+                           writer->capacity - writer->length, format, args);
+    va_end(args);
+
+    assert(length >= 0);
+    if ((size_t)length >= writer->capacity - writer->length)
+    {
+        OutputMakeRoom(writer, writer->target == OUTPUT_STRING ?
+                               (size_t)length + 1 : writer->capacity);
+
+        va_start(args, format);
+        length = vsnprintf(writer->buffer + writer->length,
+                           writer->capacity - writer->length, format, args);
+        va_end(args);
+
+        if ((size_t)length >= writer->capacity - writer->length)
+        {
+            length = writer->capacity - writer->length - 1;
+        }
+    }
+    writer->length += length;
+}
+
+OutputWriter OutputStringInit(size_t capacity)
+{
+    OutputWriter writer = {.buffer = malloc(capacity > 0 ? capacity : 1),
+                           .length = 0,
+                           .capacity = capacity > 0 ? capacity : 1,
+                           .target = OUTPUT_STRING};
+    assert(writer.buffer != NULL);
+    return writer;
+}
+
+char* OutputStringFinish(OutputWriter *writer)
+{
+    assert(writer->target == OUTPUT_STRING);
+    OutputChar(writer, '\0');
+
+    char *result = writer->buffer;
+    *writer = (OutputWriter) {.buffer = NULL, .length = 0, .capacity = 0,
+                              .target = OUTPUT_STRING};
+    return result;
+}
@@ -0,0 +1,131 @@
+/** @file
+   Interfejs buforowanego wypisywania
+
+   Wyjście kalkulatora zbierane jest w dużych buforach i przekazywane dalej
+   tylko w jawnych punktach (OutputFlush) lub po zapełnieniu bufora.
+   Liczby zamieniane są na tekst bez funkcji z rodziny printf.
+
+   @date 2017-06-05
+*/
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+///< Rozmiar buforów standardowego wyjścia i wyjścia błędów
+#define OUTPUT_NUMBER_LENGTH 20
+///< Maksymalna długość zapisu dziesiętnego liczby typu long
+
+/**
+ * Miejsce, do którego trafia zawartość bufora
+ */
+typedef enum OutputTarget
+{
+    OUTPUT_STANDARD, ///< Standardowe wyjście
+    OUTPUT_ERROR, ///< Wyjście błędów
+    OUTPUT_STRING ///< Napis w pamięci (bufor rośnie zamiast się opróżniać)
+} OutputTarget;
+
+/**
+ * Struktura przechowująca stan wypisywania
+ */
+typedef struct OutputWriter
+{
+    char *buffer; ///< Bufor
+    size_t length; ///< Liczba znaków w buforze
+    size_t capacity; ///< Rozmiar bufora
+    OutputTarget target; ///< Miejsce, do którego trafia zawartość bufora
+} OutputWriter;
+
+/// Buforowane standardowe wyjście
+extern OutputWriter standard_output;
+/**
+ * Buforowane wyjście błędów
+ *
+ * Każdy wątek ma własną kopię, początkowo wskazującą na wspólny bufor
+ * wyjścia błędów. Wątki pomocnicze, które mogą zgłaszać błędy, zastępują
+ * ją napisem w pamięci, a zebrane komunikaty przekazuje dalej wątek główny.
+ */
+extern _Thread_local OutputWriter error_output;
+
+/**
+ * Przekazuje zawartość bufora do miejsca docelowego
+ *
+ * Nie robi nic dla napisu w pamięci.
+ * @param[in,out] writer : wypisywanie
+ */
+void OutputFlush(OutputWriter *writer);
+
+/**
+ * Zapewnia miejsce w buforze na co najmniej @p length znaków
+ * (@p length nie większe niż rozmiar bufora wyjścia)
+ * @param[in,out] writer : wypisywanie
+ * @param[in] length : liczba znaków
+ */
+void OutputMakeRoom(OutputWriter *writer, size_t length);
+
+/**
+ * Wypisuje znak
+ * @param[in,out] writer : wypisywanie
+ * @param[in] c : znak
+ */
+static inline void OutputChar(OutputWriter *writer, char c)
+{
+    if (writer->length == writer->capacity)
+    {
+        OutputMakeRoom(writer, 1);
+    }
+    writer->buffer[writer->length++] = c;
+}
+
+/**
+ * Wypisuje ciąg znaków
+ * @param[in,out] writer : wypisywanie
+ * @param[in] data : znaki
+ * @param[in] length : liczba znaków
+ */
+void OutputWrite(OutputWriter *writer, const char *data, size_t length);
+
+/**
+ * Wypisuje liczbę dziesiętnie
+ * @param[in,out] writer : wypisywanie
+ * @param[in] value : liczba
+ */
+void OutputLong(OutputWriter *writer, long value);
+
+/**
+ * Wypisuje nieujemną liczbę dziesiętnie
+ * @param[in,out] writer : wypisywanie
+ * @param[in] value : liczba
+ */
+void OutputUnsigned(OutputWriter *writer, unsigned long value);
+
+/**
+ * Wypisuje tekst według formatu printf
+ *
+ * Przeznaczone dla rzadkich komunikatów (np. o błędach); komunikat dłuższy
+ * niż bufor wyjścia jest obcinany.
+ * @param[in,out] writer : wypisywanie
+ * @param[in] format : format
+ */
+void OutputFormat(OutputWriter *writer, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * Tworzy wypisywanie do napisu w pamięci
+ * @param[in] capacity : początkowy rozmiar bufora
+ * @return wypisywanie
+ */
+OutputWriter OutputStringInit(size_t capacity);
+
+/**
+ * Kończy wypisywanie do napisu w pamięci
+ * @param[in,out] writer : wypisywanie (po wywołaniu puste)
+ * @return zaalokowany napis zakończony zerem (zwalniany przez free)
+ */
+char* OutputStringFinish(OutputWriter *writer);
+
+#endif /* __OUTPUT_H__ */
@@ -7,6 +7,7 @@
 #ifndef __PARSE_H__
 #define __PARSE_H__
 
+#include <stdint.h>
 #include "input.h"
 #include "stack.h"
 #include "poly.h"
@@ -42,6 +43,45 @@
 ///< Nazwa polecenia zdejmującego wielomian ze stosu
 #define COMMAND_COMPOSE "COMPOSE"
 ///< Nazwa polecenia składającego wielomiany
+#define COMMAND_PRODUCT "PRODUCT"
+///< Nazwa polecenia mnożącego wiele wielomianów
+#define COMMAND_MUL_TRUNC "MUL_TRUNC"
+///< Nazwa polecenia mnożącego dwa wielomiany modulo potęga zmiennej
+#define COMMAND_RING "RING"
+///< Nazwa polecenia ustawiającego pierścień ilorazowy
+#define COMMAND_SCALE "SCALE"
+///< Nazwa polecenia mnożącego wielomian przez stałą
+#define COMMAND_SHIFT "SHIFT"
+///< Nazwa polecenia mnożącego wielomian przez potęgę zmiennej
+#define COMMAND_COEFF "COEFF"
+///< Nazwa polecenia wypisującego współczynnik wielomianu
+#define COMMAND_PERMUTE "PERMUTE"
+///< Nazwa polecenia przestawiającego zmienne wielomianu
+#define COMMAND_REORDER "REORDER"
+///< Nazwa polecenia włączającego zmianę kolejności zmiennych w PRODUCT
+#define COMMAND_SUBST "SUBST"
+///< Nazwa polecenia podstawiającego wielomian pod jedną zmienną
+#define COMMAND_SHIFT_VAR "SHIFT_VAR"
+///< Nazwa polecenia przesuwającego zmienną wielomianu o stałą
+#define COMMAND_POW_CACHE "POW_CACHE"
+///< Nazwa polecenia wypisującego liczniki pamięci podręcznej potęg
+#define COMMAND_SAVE "SAVE"
+///< Nazwa polecenia zapisującego wielomian do pliku
+#define COMMAND_SAVE_ALL "SAVE_ALL"
+///< Nazwa polecenia zapisującego cały stos do pliku
+#define COMMAND_LOAD "LOAD"
+///< Nazwa polecenia wczytującego wielomiany z pliku
+#define COMMAND_OPEN_STORE "OPEN_STORE"
+///< Nazwa polecenia otwierającego magazyn wielomianów
+#define COMMAND_STORE "STORE"
+///< Nazwa polecenia zapisującego wielomian w magazynie
+#define COMMAND_FETCH "FETCH"
+///< Nazwa polecenia pobierającego wielomian z magazynu
+
+#define POLY_FILE_MAGIC "POLY"
+///< Początek pliku z wielomianami (po nim bajt wersji formatu)
+#define POLY_FILE_HEADER_SIZE 5
+///< Rozmiar nagłówka pliku z wielomianami
 
 #define MAX_COMMAND_LENGTH 10
 ///< Maksymalna długość poprawnego polecenia
@@ -99,6 +139,28 @@ static inline bool IsValidCommandCharacter(const char c)
  */
 poly_coeff_t ReadAtCommandArgument(InputStream *stream);
 
+/**
+ * Wczytuje liczbę @p x będącą argumentem polecenia SCALE
+ *
+ * Wartość parametru polecenia SCALE uznajemy za niepoprawną,
+ * jeśli jest ona mniejsza od LONG_MIN lub większa od LONG_MAX.
+ * Ustawia stream->parse_error na true w przypadku błędu.
+ * @param[in,out] stream : wskaźnik na wykorzystywany InputStream
+ * @return x
+ */
+poly_coeff_t ReadScaleCommandArgument(InputStream *stream);
+
+/**
+ * Wczytuje liczbę @p x będącą przesunięciem w poleceniu SHIFT_VAR
+ *
+ * Wartość przesunięcia uznajemy za niepoprawną,
+ * jeśli jest ona mniejsza od LONG_MIN lub większa od LONG_MAX.
+ * Ustawia stream->parse_error na true w przypadku błędu.
+ * @param[in,out] stream : wskaźnik na wykorzystywany InputStream
+ * @return x
+ */
+poly_coeff_t ReadShiftVarCommandArgument(InputStream *stream);
+
 /**
  * Wczytuje liczbę @p x będącą współczynnikiem wielomianu
  *
@@ -143,6 +205,47 @@ unsigned ReadDegByCommandArgument(InputStream *stream);
  */
 unsigned ReadComposeCommandArgument(InputStream *stream);
 
+/**
+ * Wczytuje liczbę @p x będącą argumentem polecenia PRODUCT
+ *
+ * Wartość parametru polecenia PRODUCT uznajemy za niepoprawną,
+ * jeśli jest ona mniejsza od 0 lub większa od UINT_MAX.
+ * Ustawia stream->parse_error na true w przypadku błędu.
+ * @param[in,out] stream : wskaźnik na wykorzystywany InputStream
+ * @return x
+ */
+unsigned ReadProductCommandArgument(InputStream *stream);
+
+/**
+ * Wczytuje nieujemną liczbę @p x będącą argumentem polecenia
+ *
+ * Wartość argumentu uznajemy za niepoprawną, jeśli jest ona większa
+ * od @p max_value lub nie następuje po niej znak @p terminator.
+ * W przypadku błędu wypisuje `ERROR w WRONG error_name`, pomija resztę linii
+ * i ustawia stream->parse_error na true.
+ * Wczytuje również znak @p terminator.
+ * @param[in,out] stream : wskaźnik na wykorzystywany InputStream
+ * @param[in] max_value : maksymalna poprawna wartość
+ * @param[in] terminator : znak kończący argument
+ * @param[in] error_name : nazwa argumentu w komunikacie o błędzie
+ * @return x
+ */
+unsigned long ReadUnsignedCommandArgument(InputStream *stream,
+                                          unsigned long max_value,
+                                          char terminator,
+                                          const char *error_name);
+
+/**
+ * Wczytuje permutację będącą argumentem polecenia PERMUTE
+ *
+ * Oczekuje @p count liczb oddzielonych spacjami i zakończonych znakiem
+ * nowej linii. W przypadku błędu wypisuje `ERROR w WRONG PERMUTATION`
+ * i ustawia stream->parse_error na true.
+ * @param[in,out] stream : wskaźnik na wykorzystywany InputStream
+ * @param[in] count : długość permutacji (dodatnia)
+ * @return zaalokowana tablica z permutacją lub NULL w przypadku błędu
+ */
+unsigned *ReadPermutationCommandArgument(InputStream *stream, unsigned count);
 
 /**
  * Wczytuje wielomian @p p
@@ -153,6 +256,127 @@ unsigned ReadComposeCommandArgument(InputStream *stream);
  */
 Poly ReadPolynomial(InputStream *stream);
 
+/**
+ * Odpowiedź na pytanie o wielomian, znana bez jego wczytywania
+ */
+typedef enum LiteralFact
+{
+    LITERAL_FACT_UNKNOWN, ///< Trzeba wczytać wielomian
+    LITERAL_FACT_FALSE, ///< Nie
+    LITERAL_FACT_TRUE ///< Tak
+} LiteralFact;
+
+/**
+ * Struktura przechowująca niewczytany literał wielomianu
+ *
+ * Literał wskazuje na swój wiersz w wejściu odwzorowanym w pamięć
+ * albo na zapis PolySerialize w otwartym magazynie, więc wejście
+ * lub magazyn musi istnieć, dopóki literał nie zostanie usunięty
+ * lub wczytany. Poprawność literału sprawdzono przy odkładaniu go na stos.
+ */
+typedef struct PolyLiteral
+{
+    const char *start; ///< Początek wiersza lub zapisu
+    size_t length; ///< Długość wiersza (ze znakiem nowej linii, jeśli go ma)
+                   ///< lub zapisu
+    unsigned line_number; ///< Numer wiersza (liczony od 0)
+    bool is_serialized; ///< Czy literał jest zapisem z magazynu
+    LiteralFact is_coeff; ///< Czy wielomian jest współczynnikiem
+    LiteralFact is_zero; ///< Czy wielomian jest zerem
+} PolyLiteral;
+
+#define STACK_LITERAL_TAG ((uintptr_t)1)
+///< Znacznik wskaźnika na PolyLiteral wśród elementów stosu wielomianów
+
+/**
+ * Sprawdza, czy element stosu wielomianów jest niewczytanym literałem
+ *
+ * Elementy stosu to wskaźniki na Poly lub oznaczone STACK_LITERAL_TAG
+ * wskaźniki na PolyLiteral (obie struktury są wyrównane, więc najmłodszy
+ * bit ich adresu jest wolny).
+ * @param[in] entry : element stosu
+ */
+static inline bool StackEntryIsLiteral(const void *entry)
+{
+    return ((uintptr_t)entry & STACK_LITERAL_TAG) != 0;
+}
+
+/**
+ * Zwraca literał wskazywany przez element stosu wielomianów
+ * @param[in] entry : element stosu będący literałem
+ */
+static inline PolyLiteral* StackEntryLiteral(void *entry)
+{
+    assert(StackEntryIsLiteral(entry));
+    return (PolyLiteral *)((uintptr_t)entry & ~STACK_LITERAL_TAG);
+}
+
+/**
+ * Tworzy element stosu wielomianów wskazujący na literał
+ * @param[in] literal : literał
+ */
+static inline void* StackEntryFromLiteral(PolyLiteral *literal)
+{
+    assert(((uintptr_t)literal & STACK_LITERAL_TAG) == 0);
+    return (void *)((uintptr_t)literal | STACK_LITERAL_TAG);
+}
+
+/**
+ * Sprawdza składnię wielomianu, nie budując go
+ *
+ * Błędy zgłasza tak samo jak ReadPolynomial. Wymaga wejścia
+ * odwzorowanego w pamięć, ustawionego na początku wiersza. Nie zależy
+ * od stanu kalkulatora, więc może działać poza wątkiem głównym; fakty
+ * o literale zakładają brak pierścienia (poprawia je PolyStackPushLiteral).
+ * Ustawia stream->parse_error na true w przypadku błędu.
+ * @param[in,out] stream : wskaźnik na wykorzystywany InputStream
+ * @param[out] literal : literał wskazujący na sprawdzony wiersz
+ */
+void ReadPolynomialLiteral(InputStream *stream, PolyLiteral *literal);
+
+/**
+ * Wczytuje wielomian z literału
+ *
+ * Redukuje go modulo bieżący pierścień, jak wielomiany wczytywane
+ * od razu (pierścień nie mógł się zmienić od odłożenia literału).
+ * @param[in] literal : literał
+ * @return wielomian
+ */
+Poly PolyLiteralParse(const PolyLiteral *literal);
+
+/**
+ * Sprawdza, czy wielomian warto odłożyć jako niewczytany literał
+ *
+ * Decyzja zależy od tego, jak często polecenia musiały wczytywać
+ * ostatnio odkładane literały. Można ją podejmować w dowolnym wątku.
+ * @param[in] line_number : numer wiersza z wielomianem
+ * @return czy odłożyć literał
+ */
+bool PolyLiteralPreferred(unsigned line_number);
+
+/**
+ * Odkłada sprawdzony literał na stos wielomianów
+ *
+ * Zapomina fakty o literale, których redukcja modulo bieżący pierścień
+ * mogłaby nie zachować.
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] literal : literał z ReadPolynomialLiteral
+ */
+void PolyStackPushLiteral(Stack *poly_stack, PolyLiteral *literal);
+
+/**
+ * Zwraca liczniki literałów.
+ * @param[out] pushed : liczba literałów odłożonych na stos
+ * @param[out] parsed : liczba literałów wczytanych przez polecenia
+ */
+void PolyLiteralStats(unsigned long *pushed, unsigned long *parsed);
+
+/**
+ * Usuwa stos wielomianów razem z jego elementami (także literałami)
+ * @param[in,out] poly_stack : stos wielomianów
+ */
+void PolyStackDestroy(Stack *poly_stack);
+
 /**
  * Wczytuje i wykonuje polecenie
  *
@@ -162,4 +386,10 @@ Poly ReadPolynomial(InputStream *stream);
  */
 void ReadAndExecuteCommand(InputStream *stream, Stack *poly_stack);
 
+/**
+ * Zwalnia zasoby przechowywane między poleceniami (otwarty magazyn)
+ * i przywraca początkową ocenę opłacalności literałów
+ */
+void ReleaseCommandResources(void);
+
 #endif /* __PARSE_H__ */
@@ -6,18 +6,131 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include "parse.h"
+#include "poly_store.h"
 #include "utils.h"
 
+/**
+ * Sprawdza czy liczba elementów na stosie jest wystarczająca
+ *
+ * Nie wczytuje literałów, więc polecenie musi je obsłużyć samo.
+ * @param[in] n_requires_n_entries : minimalna liczba elementów
+ */
+#define REQUIRES_N_ENTRIES(n_requires_n_entries)\
+if (StackSize(poly_stack) < (n_requires_n_entries))\
+{\
+    OutputFormat(&error_output, "ERROR %u STACK UNDERFLOW\n",\
+                 stream->line_number);\
+    return;\
+}
+
 /**
  * Sprawdza czy liczba wielomianów na stosie jest wystarczająca
+ *
+ * Wczytuje literały spośród wymaganych wielomianów, więc wszystkie
+ * wymagane elementy stosu wskazują potem na Poly.
  * @param[in] n_requires_n_polys : minimalna liczba wielomianów
  */
 #define REQUIRES_N_POLYNOMIALS(n_requires_n_polys)\
-if (StackSize(poly_stack) < (n_requires_n_polys))\
-{\
-    fprintf(stderr, "ERROR %u STACK UNDERFLOW\n", stream->line_number);\
-    return;\
+REQUIRES_N_ENTRIES(n_requires_n_polys)\
+ParseStackLiterals(poly_stack, (n_requires_n_polys));
+
+/// Magazyn wielomianów otwarty poleceniem OPEN_STORE (lub NULL)
+static PolyStore *open_store = NULL;
+
+#define LITERAL_SCORE_MAX 64
+///< Górna granica oceny opłacalności literałów
+#define LITERAL_SCORE_FORCED 2
+///< Spadek oceny po wczytaniu literału (koszt zbędnego sprawdzania)
+#define LITERAL_SAMPLE_SHIFT 28
+///< Gdy literały się nie opłacają, odkładamy co `2^(32 - LITERAL_SAMPLE_SHIFT)`
+///< -ty wielomian (wybierany skrótem numeru wiersza)
+
+/**
+ * Ocena opłacalności literałów
+ *
+ * Sprawdzenie składni kosztuje niewiele mniej niż wczytanie wielomianu,
+ * więc literał opłaca się tylko, gdy rzadko trzeba go wczytać. Literał
+ * usunięty bez wczytania podnosi ocenę o 1, wczytany obniża ją
+ * o LITERAL_SCORE_FORCED. Zmienia ją tylko wątek główny, a odczytują
+ * także wątki wczytujące wielomiany potokowo. Zapisy z magazynu
+ * odkładamy zawsze jako literały, więc nie wpływają na ocenę.
+ */
+static atomic_uint literal_score = LITERAL_SCORE_MAX / 2;
+/// Liczba literałów odłożonych na stos
+static unsigned long literal_push_count = 0;
+/// Liczba literałów wczytanych przez polecenia
+static unsigned long literal_parse_count = 0;
+
+/**
+ * Usuwa element stosu wielomianów (wielomian lub literał)
+ * @param[in] entry : element stosu
+ */
+static void DestroyStackEntry(void *entry)
+{
+    if (StackEntryIsLiteral(entry))
+    {
+        PolyLiteral *literal = StackEntryLiteral(entry);
+        const bool is_serialized = literal->is_serialized;
+        free(literal);
+
+        const unsigned score = atomic_load_explicit(&literal_score,
+                                                    memory_order_relaxed);
+        if (!is_serialized && score < LITERAL_SCORE_MAX)
+        {
+            atomic_store_explicit(&literal_score, score + 1,
+                                  memory_order_relaxed);
+        }
+    }
+    else {
+        PolyDestroy(entry);
+        free(entry);
+    }
+}
+
+/**
+ * Zastępuje literał na stosie wczytanym z niego wielomianem
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] i : indeks elementu stosu będącego literałem
+ */
+static void ParseStackEntry(Stack *poly_stack, size_t i)
+{
+    PolyLiteral *literal = StackEntryLiteral(poly_stack->array[i]);
+    Poly *p = malloc(sizeof(Poly));
+    assert(p != NULL);
+    *p = PolyLiteralParse(literal);
+    poly_stack->array[i] = p;
+    ++literal_parse_count;
+
+    if (!literal->is_serialized)
+    {
+        const unsigned score = atomic_load_explicit(&literal_score,
+                                                    memory_order_relaxed);
+        atomic_store_explicit(&literal_score,
+                              score > LITERAL_SCORE_FORCED ?
+                              score - LITERAL_SCORE_FORCED : 0,
+                              memory_order_relaxed);
+    }
+    free(literal);
+}
+
+/**
+ * Wczytuje literały spośród @p count elementów z wierzchołka stosu
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] count : liczba elementów (nie większa niż rozmiar stosu)
+ */
+static void ParseStackLiterals(Stack *poly_stack, size_t count)
+{
+    for (size_t i = StackSize(poly_stack) - count; i < StackSize(poly_stack);
+         ++i)
+    {
+        if (StackEntryIsLiteral(poly_stack->array[i]))
+        {
+            ParseStackEntry(poly_stack, i);
+        }
+    }
 }
 
 /**
@@ -46,14 +159,26 @@ static inline void CommandZero(Stack *poly_stack)
  */
 static inline void CommandIsCoefficient(InputStream *stream, Stack *poly_stack)
 {
-    REQUIRES_N_POLYNOMIALS(1)
+    REQUIRES_N_ENTRIES(1)
+
+    LiteralFact is_coeff = LITERAL_FACT_UNKNOWN;
+    if (StackEntryIsLiteral(StackTop(poly_stack)))
+    {
+        is_coeff = StackEntryLiteral(StackTop(poly_stack))->is_coeff;
+    }
+    if (is_coeff == LITERAL_FACT_UNKNOWN)
+    {
+        ParseStackLiterals(poly_stack, 1);
+        is_coeff = PolyIsCoeff(StackTop(poly_stack)) ? LITERAL_FACT_TRUE :
+                                                        LITERAL_FACT_FALSE;
+    }
 
-    if (PolyIsCoeff(StackTop(poly_stack)))
+    if (is_coeff == LITERAL_FACT_TRUE)
     {
-        printf("1\n");
+        OutputWrite(&standard_output, "1\n", 2);
     }
     else {
-        printf("0\n");
+        OutputWrite(&standard_output, "0\n", 2);
     }
 }
 
@@ -68,20 +193,33 @@ static inline void CommandIsCoefficient(InputStream *stream, Stack *poly_stack)
  */
 static inline void CommandIsZero(InputStream *stream, Stack *poly_stack)
 {
-    REQUIRES_N_POLYNOMIALS(1)
+    REQUIRES_N_ENTRIES(1)
+
+    LiteralFact is_zero = LITERAL_FACT_UNKNOWN;
+    if (StackEntryIsLiteral(StackTop(poly_stack)))
+    {
+        is_zero = StackEntryLiteral(StackTop(poly_stack))->is_zero;
+    }
+    if (is_zero == LITERAL_FACT_UNKNOWN)
+    {
+        ParseStackLiterals(poly_stack, 1);
+        is_zero = PolyIsZero(StackTop(poly_stack)) ? LITERAL_FACT_TRUE :
+                                                      LITERAL_FACT_FALSE;
+    }
 
-    if (PolyIsZero(StackTop(poly_stack)))
+    if (is_zero == LITERAL_FACT_TRUE)
     {
-        printf("1\n");
+        OutputWrite(&standard_output, "1\n", 2);
     }
     else {
-        printf("0\n");
+        OutputWrite(&standard_output, "0\n", 2);
     }
 }
 
 /**
  * Robi głęboką kopię wielomianu na wierzchołku stosu
  * 
+ * Kopią niewczytanego literału jest ten sam literał.
  * Wymaga 1 wielomianu na stosie
  * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
  *                         wczytane
@@ -89,7 +227,16 @@ static inline void CommandIsZero(InputStream *stream, Stack *poly_stack)
  */
 static inline void CommandClone(InputStream *stream, Stack *poly_stack)
 {
-    REQUIRES_N_POLYNOMIALS(1)
+    REQUIRES_N_ENTRIES(1)
+
+    if (StackEntryIsLiteral(StackTop(poly_stack)))
+    {
+        PolyLiteral *literal = malloc(sizeof(PolyLiteral));
+        assert(literal != NULL);
+        *literal = *StackEntryLiteral(StackTop(poly_stack));
+        StackPush(poly_stack, StackEntryFromLiteral(literal));
+        return;
+    }
 
     Poly *result = malloc(sizeof(Poly));
     assert(result != NULL);
@@ -151,6 +298,61 @@ static inline void CommandMul(InputStream *stream, Stack *poly_stack)
     StackPush(poly_stack, result);
 }
 
+/**
+ * Zdejmuje dwa wielomiany z wierzchołka stosu, mnoży je ze sobą
+ * modulo `x_var^n` i dodaje wynik na wierzchołek stosu
+ *
+ * Wymaga 2 wielomianów na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] var : indeks zmiennej
+ * @param[in] n : ograniczenie wykładników zmiennej
+ */
+static inline void CommandMulTrunc(InputStream *stream, Stack *poly_stack,
+                                   unsigned var, poly_exp_t n)
+{
+    REQUIRES_N_POLYNOMIALS(2)
+
+    Poly *q = StackTop(poly_stack);
+    StackPop(poly_stack);
+
+    Poly *p = StackTop(poly_stack);
+    StackPop(poly_stack);
+
+    Poly *result = malloc(sizeof(Poly));
+    assert(result != NULL);
+    *result = PolyMulTrunc(p, q, var, n);
+
+    PolyDestroy(p);
+    PolyDestroy(q);
+    free(p);
+    free(q);
+
+    StackPush(poly_stack, result);
+}
+
+/**
+ * Ustawia pierścień ilorazowy modulo `x_var^n` (n = 0 usuwa ograniczenie
+ * zmiennej var) i redukuje wszystkie wielomiany na stosie
+ *
+ * Nie wymaga wielomianów na stosie
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] var : indeks zmiennej
+ * @param[in] n : ograniczenie wykładników zmiennej
+ */
+static inline void CommandRing(Stack *poly_stack, unsigned var, poly_exp_t n)
+{
+    // Literały wczytujemy w pierścieniu, w którym zostały odłożone.
+    ParseStackLiterals(poly_stack, StackSize(poly_stack));
+    PolyRingSet(var, n);
+
+    for (unsigned i = 0; i < StackSize(poly_stack); ++i)
+    {
+        PolyRingReduce(poly_stack->array[i]);
+    }
+}
+
 /**
  * Zdejmuje wielomian z wierzchołka stosu, dodaje wielomian przeciwny do
  * zdjętego na wierzchołek stosu
@@ -164,12 +366,135 @@ static inline void CommandNeg(InputStream *stream, Stack *poly_stack)
 {
     REQUIRES_N_POLYNOMIALS(1)
 
-    Poly *old_poly = StackTop(poly_stack);
-    Poly result = PolyNeg(old_poly);
+    PolyNegInPlace(StackTop(poly_stack));
+}
+
+/**
+ * Mnoży wielomian z wierzchołka stosu przez stałą @p value
+ *
+ * Wymaga 1 wielomianu na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] value : stała
+ */
+static inline void CommandScale(InputStream *stream,
+                                Stack *poly_stack,
+                                poly_coeff_t value)
+{
+    REQUIRES_N_POLYNOMIALS(1)
+
+    PolyScaleInPlace(StackTop(poly_stack), value);
+}
+
+/**
+ * Mnoży wielomian z wierzchołka stosu przez `x_var^k`
+ *
+ * Wymaga 1 wielomianu na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] var : indeks zmiennej
+ * @param[in] k : wykładnik
+ */
+static inline void CommandShift(InputStream *stream, Stack *poly_stack,
+                                unsigned var, poly_exp_t k)
+{
+    REQUIRES_N_POLYNOMIALS(1)
+
+    Poly *p = StackTop(poly_stack);
+    Poly result = PolyShiftVar(p, var, k);
+    PolyDestroy(p);
+    *p = result;
+}
+
+/**
+ * Podstawia `x_var + value` pod zmienną @p var wielomianu z wierzchołka stosu
+ *
+ * Wymaga 1 wielomianu na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] var : indeks zmiennej
+ * @param[in] value : przesunięcie
+ */
+static inline void CommandShiftVar(InputStream *stream, Stack *poly_stack,
+                                   unsigned var, poly_coeff_t value)
+{
+    REQUIRES_N_POLYNOMIALS(1)
+
+    Poly *p = StackTop(poly_stack);
+    Poly result = PolyShiftVarBy(p, var, value);
+    PolyDestroy(p);
+    *p = result;
+}
+
+/**
+ * Podstawia pod zmienną @p var wielomianu z wierzchołka stosu wielomian
+ * znajdujący się pod nim
+ *
+ * Wymaga 2 wielomianów na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] var : indeks zmiennej
+ */
+static inline void CommandSubst(InputStream *stream, Stack *poly_stack,
+                                unsigned var)
+{
+    REQUIRES_N_POLYNOMIALS(2)
+
+    Poly *p = StackTop(poly_stack);
+    StackPop(poly_stack);
+    Poly *q = StackTop(poly_stack);
+
+    Poly result = PolySubstitute(p, var, q);
+    PolyDestroy(p);
+    free(p);
+    PolyDestroy(q);
+    *q = result;
+}
+
+/**
+ * Przestawia zmienne wielomianu z wierzchołka stosu
+ *
+ * Wymaga 1 wielomianu na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] count : liczba przestawianych zmiennych
+ * @param[in] perm : nowe indeksy zmiennych
+ */
+static inline void CommandPermute(InputStream *stream, Stack *poly_stack,
+                                  unsigned count, const unsigned perm[])
+{
+    REQUIRES_N_POLYNOMIALS(1)
+
+    Poly *p = StackTop(poly_stack);
+    Poly result = PolyPermuteVars(p, count, perm);
+    PolyDestroy(p);
+    *p = result;
+    PolyRingReduce(p);
+}
 
-    PolyDestroy(old_poly);
+/**
+ * Wypisuje współczynnik wielomianu z wierzchołka stosu przy `x_0^exp`
+ *
+ * Wymaga 1 wielomianu na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in] poly_stack : stos wielomianów
+ * @param[in] exp : wykładnik
+ */
+static inline void CommandCoeff(InputStream *stream, Stack *poly_stack,
+                                poly_exp_t exp)
+{
+    REQUIRES_N_POLYNOMIALS(1)
 
-    *old_poly = result;
+    Poly coeff = PolyCoeff(StackTop(poly_stack), exp);
+    PolyPrint(&coeff);
+    OutputChar(&standard_output, '\n');
+    PolyDestroy(&coeff);
 }
 
 /**
@@ -187,21 +512,14 @@ static inline void CommandSub(InputStream *stream, Stack *poly_stack)
     REQUIRES_N_POLYNOMIALS(2)
 
     Poly *q = StackTop(poly_stack);
-    StackPop(poly_stack);
-
-    Poly *p = StackTop(poly_stack);
-    StackPop(poly_stack);
+    Poly *p = StackPeek(poly_stack);
 
-    Poly *result = malloc(sizeof(Poly));
-    assert(result != NULL);
-    *result = PolySub(q, p);
+    // Wynik (q - p) zapisujemy w miejscu p, negacja p zajmuje czas stały.
+    PolyNegInPlace(p);
+    PolyAddInPlace(p, q);
 
-    PolyDestroy(p);
-    PolyDestroy(q);
-    free(p);
+    StackPop(poly_stack);
     free(q);
-
-    StackPush(poly_stack, result);
 }
 
 /**
@@ -219,13 +537,28 @@ static inline void CommandIsEq(InputStream *stream, Stack *poly_stack)
 
     if (PolyIsEq(StackTop(poly_stack), StackPeek(poly_stack)))
     {
-        printf("1\n");
+        OutputWrite(&standard_output, "1\n", 2);
     }
     else {
-        printf("0\n");
+        OutputWrite(&standard_output, "0\n", 2);
     }
 }
 
+/**
+ * Wypisuje liczbę trafień i chybień pamięci podręcznej potęg
+ *
+ * Nie wymaga wielomianów na stosie
+ */
+static inline void CommandPowCache(void)
+{
+    unsigned long hits, misses;
+    PolyPowerCacheStats(&hits, &misses);
+    OutputUnsigned(&standard_output, hits);
+    OutputChar(&standard_output, ' ');
+    OutputUnsigned(&standard_output, misses);
+    OutputChar(&standard_output, '\n');
+}
+
 /**
  * Wypisuje stopień wielomianu z wierzchołka stosu
  * 
@@ -239,7 +572,8 @@ static inline void CommandDeg(InputStream *stream, Stack *poly_stack)
     REQUIRES_N_POLYNOMIALS(1)
 
     Poly *p = StackTop(poly_stack);
-    printf("%d\n", PolyDeg(p));
+    OutputLong(&standard_output, PolyDeg(p));
+    OutputChar(&standard_output, '\n');
 }
 
 /**
@@ -257,7 +591,8 @@ static inline void CommandDegBy(InputStream *stream,
 {
     REQUIRES_N_POLYNOMIALS(1)
 
-    printf("%d\n", PolyDegBy(StackTop(poly_stack), var));
+    OutputLong(&standard_output, PolyDegBy(StackTop(poly_stack), var));
+    OutputChar(&standard_output, '\n');
 }
 
 /**
@@ -305,6 +640,44 @@ static inline void CommandCompose(InputStream *stream,
     StackPush(poly_stack, result);
 }
 
+/**
+ * Zdejmuje @p count wielomianów z wierzchołka stosu, mnoży je
+ * i dodaje wynik na wierzchołek stosu
+ *
+ * Wymaga count wielomianów na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] count : liczba wielomianów do pomnożenia
+ */
+static inline void CommandProduct(InputStream *stream,
+                                  Stack *poly_stack,
+                                  unsigned count)
+{
+    REQUIRES_N_POLYNOMIALS(count)
+
+    Poly *tab = calloc(count, sizeof(Poly));
+    assert(tab != NULL);
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        tab[i] = *(Poly*)StackTop(poly_stack);
+        free(StackTop(poly_stack));
+        StackPop(poly_stack);
+    }
+    Poly *result = malloc(sizeof(Poly));
+    assert(result != NULL);
+    *result = PolyProductN(count, tab);
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        PolyDestroy(&tab[i]);
+    }
+    free(tab);
+
+    StackPush(poly_stack, result);
+}
+
 /**
  * Zdejmuje wielomian z wierzchołka stosu, liczy jego wartość w value i
  * dodaje wynik na wierzchołek stosu
@@ -325,6 +698,9 @@ static inline void CommandAt(InputStream *stream,
     Poly *result = malloc(sizeof(Poly));
     assert(result != NULL);
     *result = PolyAt(last_poly, value);
+    // Zmienne przesuwają się o jeden, więc ograniczenia pierścienia
+    // dotyczą teraz innych wykładników.
+    PolyRingReduce(result);
 
     PolyDestroy(last_poly);
     free(last_poly);
@@ -346,12 +722,13 @@ static inline void CommandPrint(InputStream *stream, Stack *poly_stack)
     REQUIRES_N_POLYNOMIALS(1)
 
     PolyPrint(StackTop(poly_stack));
-    printf("\n");
+    OutputChar(&standard_output, '\n');
 }
 
 /**
  * Zdejmuje wielomian z wierzchołka stosu
  * 
+ * Niewczytanego literału nie wczytuje.
  * Wymaga 1 wielomianu na stosie
  * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
  *                         wczytane
@@ -359,160 +736,987 @@ static inline void CommandPrint(InputStream *stream, Stack *poly_stack)
  */
 static inline void CommandPop(InputStream *stream, Stack *poly_stack)
 {
-    REQUIRES_N_POLYNOMIALS(1)
+    REQUIRES_N_ENTRIES(1)
 
-    PolyDestroy(StackTop(poly_stack));
-    free(StackTop(poly_stack));
+    DestroyStackEntry(StackTop(poly_stack));
     StackPop(poly_stack);
 }
 
 /**
- * Wczytuje i wykonuje polecenia
- * @param[in,out] stream : wskaźnik na InputStream do czytania poleceń
- * @param[in,out] poly_stack : stos wielomianów
+ * Wczytuje napis będący argumentem polecenia (np. nazwę pliku)
+ *
+ * Napisem jest reszta linii. W przypadku błędu (pusty napis, brak znaku
+ * nowej linii) wypisuje `ERROR w WRONG error_name`, pomija resztę linii
+ * i ustawia stream->parse_error na true.
+ * @param[in,out] stream : wskaźnik na wykorzystywany InputStream
+ * @param[in] error_name : nazwa argumentu w komunikacie o błędzie
+ * @param[out] length : długość napisu
+ * @return zaalokowany, zakończony zerem napis lub NULL w przypadku błędu
  */
-void ReadAndExecuteCommand(InputStream *stream, Stack *poly_stack)
+static char* ReadTextCommandArgument(InputStream *stream,
+                                     const char *error_name, size_t *length)
 {
-    char *command = calloc(MAX_COMMAND_LENGTH + 1, sizeof(char));
-    assert(command != NULL);
-
-    unsigned command_length = 0;
-    char c;
+    char *text = NULL;
+    *length = 0;
 
-    while (EOF != (c = ReadCharacter(stream)))
+    size_t available;
+    const char *data = InputStreamData(stream, &available);
+    while (available > 0)
     {
-        if (c == ' ' || c == '\n')
+        const char *end_of_line = memchr(data, '\n', available);
+        const size_t count = end_of_line == NULL ?
+                             available : (size_t)(end_of_line - data);
+
+        text = realloc(text, *length + count + 1);
+        assert(text != NULL);
+        memcpy(text + *length, data, count);
+        *length += count;
+        InputStreamAdvance(stream, count);
+
+        if (end_of_line != NULL)
         {
             break;
         }
+        data = InputStreamData(stream, &available);
+    }
 
-        if (command_length >= MAX_COMMAND_LENGTH ||
-            IsValidCommandCharacter(c) == false)
-        {
-            fprintf(stderr, "ERROR %u WRONG COMMAND\n",
-                    stream->line_number + 1);
-            SkipLine(stream);
+    if (*length == 0 || PeekCharacter(stream) != '\n' ||
+        memchr(text, '\0', *length) != NULL)
+    {
+        OutputFormat(&error_output, "ERROR %u WRONG %s\n",
+                     stream->line_number + 1, error_name);
+        SkipLine(stream);
+        stream->parse_error = true;
 
-            free(command);
-            return;
+        free(text);
+        return NULL;
+    }
+    ReadCharacter(stream);
+
+    text[*length] = '\0';
+    return text;
+}
+
+/**
+ * Zapisuje @p count wielomianów z wierzchołka stosu do pliku
+ *
+ * Plik zawiera nagłówek (POLY_FILE_MAGIC i bajt wersji formatu), a po nim
+ * zapisy PolySerialize kolejnych wielomianów, od najgłębiej położonego.
+ * Całość zapisujemy jednym wywołaniem fwrite.
+ * Wymaga count wielomianów na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in] poly_stack : stos wielomianów
+ * @param[in] path : ścieżka do pliku
+ * @param[in] count : liczba zapisywanych wielomianów
+ */
+static inline void CommandSave(InputStream *stream, Stack *poly_stack,
+                               const char *path, size_t count)
+{
+    REQUIRES_N_POLYNOMIALS(count)
+
+    const size_t first = StackSize(poly_stack) - count;
+    size_t size = POLY_FILE_HEADER_SIZE;
+    for (size_t i = first; i < StackSize(poly_stack); ++i)
+    {
+        size += PolySerializedSize(StackGet(poly_stack, i));
+    }
+
+    unsigned char *buffer = malloc(size);
+    assert(buffer != NULL);
+    memcpy(buffer, POLY_FILE_MAGIC, POLY_FILE_HEADER_SIZE - 1);
+    buffer[POLY_FILE_HEADER_SIZE - 1] = POLY_SERIAL_VERSION;
+
+    unsigned char *end = buffer + POLY_FILE_HEADER_SIZE;
+    for (size_t i = first; i < StackSize(poly_stack); ++i)
+    {
+        end = PolySerialize(StackGet(poly_stack, i), end);
+    }
+    assert(end == buffer + size);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        OutputFormat(&error_output, "ERROR %u CANNOT OPEN FILE\n",
+                     stream->line_number);
+    }
+    else {
+        bool written = fwrite(buffer, 1, size, file) == size;
+        written = fclose(file) == 0 && written;
+        if (!written)
+        {
+            OutputFormat(&error_output, "ERROR %u CANNOT WRITE FILE\n",
+                         stream->line_number);
+        }
+    }
+
+    free(buffer);
+}
+
+/**
+ * Wczytuje wielomiany zapisane przez CommandSave i dodaje je na stos
+ *
+ * Wielomiany trafiają na stos w kolejności zapisu. Jeśli plik jest
+ * niepoprawny, wypisuje `ERROR w WRONG FILE` i nie zmienia stosu.
+ * Nie wymaga wielomianów na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] path : ścieżka do pliku
+ */
+static inline void CommandLoad(InputStream *stream, Stack *poly_stack,
+                               const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        OutputFormat(&error_output, "ERROR %u CANNOT OPEN FILE\n",
+                     stream->line_number);
+        return;
+    }
+
+    unsigned char *buffer = NULL;
+    size_t size = 0;
+    size_t capacity = LARGE_INPUT_BUFFER_SIZE / 2;
+    do
+    {
+        capacity *= 2;
+        buffer = realloc(buffer, capacity);
+        assert(buffer != NULL);
+        size += fread(buffer + size, 1, capacity - size, file);
+    } while (size == capacity);
+
+    bool valid = !ferror(file);
+    fclose(file);
+
+    valid = valid && size >= POLY_FILE_HEADER_SIZE &&
+            memcmp(buffer, POLY_FILE_MAGIC, POLY_FILE_HEADER_SIZE - 1) == 0 &&
+            buffer[POLY_FILE_HEADER_SIZE - 1] == POLY_SERIAL_VERSION;
+
+    // Wielomiany odkładamy na bok, żeby niepoprawny plik nie zmienił stosu.
+    Stack loaded = StackInit();
+    const unsigned char *data = buffer + POLY_FILE_HEADER_SIZE;
+    const unsigned char * const end = buffer + size;
+    while (valid && data != end)
+    {
+        Poly *p = malloc(sizeof(Poly));
+        assert(p != NULL);
+        data = PolyDeserialize(data, end, p);
+        if (data == NULL)
+        {
+            free(p);
+            valid = false;
         }
         else {
-            command[command_length] = c;
-            ++command_length;
+            StackPush(&loaded, p);
         }
     }
+    free(buffer);
 
-    if (strcmp(command, COMMAND_ZERO) == 0 && c == '\n')
+    if (!valid)
     {
-        CommandZero(poly_stack);
+        OutputFormat(&error_output, "ERROR %u WRONG FILE\n",
+                     stream->line_number);
+        StackDestroy(&loaded, &PolyDestroy);
+        return;
     }
-    else if (strcmp(command, COMMAND_IS_COEFF) == 0 && c == '\n')
+
+    for (size_t i = 0; i < StackSize(&loaded); ++i)
     {
-        CommandIsCoefficient(stream, poly_stack);
+        Poly *p = StackGet(&loaded, i);
+        PolyRingReduce(p);
+        StackPush(poly_stack, p);
     }
-    else if (strcmp(command, COMMAND_IS_ZERO) == 0 && c == '\n')
+    StackDestroy(&loaded, NULL);
+}
+
+/**
+ * Otwiera magazyn wielomianów, zamykając poprzednio otwarty
+ *
+ * Literały wskazujące na zapisy w zamykanym magazynie zostają wczytane.
+ * Nie wymaga wielomianów na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] path : ścieżka do pliku magazynu
+ */
+static inline void CommandOpenStore(InputStream *stream, Stack *poly_stack,
+                                    const char *path)
+{
+    for (size_t i = 0; i < StackSize(poly_stack); ++i)
     {
-        CommandIsZero(stream, poly_stack);
+        if (StackEntryIsLiteral(poly_stack->array[i]) &&
+            StackEntryLiteral(poly_stack->array[i])->is_serialized)
+        {
+            ParseStackEntry(poly_stack, i);
+        }
     }
-    else if (strcmp(command, COMMAND_CLONE) == 0 && c == '\n')
+
+    PolyStoreClose(open_store);
+    open_store = PolyStoreOpen(path);
+    if (open_store == NULL)
     {
-        CommandClone(stream, poly_stack);
+        OutputFormat(&error_output, "ERROR %u CANNOT OPEN FILE\n",
+                     stream->line_number);
     }
-    else if (strcmp(command, COMMAND_ADD) == 0 && c == '\n')
+}
+
+/**
+ * Dodaje na wierzchołek stosu wielomian z otwartego magazynu
+ *
+ * Zapis wielomianu trafia na stos jako literał; odczytujemy go wprost
+ * z odwzorowanego pliku dopiero wtedy, gdy polecenie będzie potrzebowało
+ * wielomianu. Magazyn sprawdza zapis tylko przy pierwszym pobraniu,
+ * a to, czy wielomian jest współczynnikiem lub zerem, czytamy z nagłówka
+ * zapisu.
+ * Nie wymaga wielomianów na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] name : nazwa wielomianu
+ * @param[in] name_length : długość nazwy
+ */
+static inline void CommandFetch(InputStream *stream, Stack *poly_stack,
+                                const char *name, size_t name_length)
+{
+    const unsigned char *data;
+    size_t data_size;
+    bool is_coeff, is_zero;
+    if (open_store == NULL ||
+        !PolyStoreLookup(open_store, name, name_length, &data, &data_size))
     {
-        CommandAdd(stream, poly_stack);
+        OutputFormat(&error_output, "ERROR %u WRONG NAME\n",
+                     stream->line_number);
+        return;
     }
-    else if (strcmp(command, COMMAND_MUL) == 0 && c == '\n')
+    PolySerializedFacts(data, data + data_size, &is_coeff, &is_zero);
+
+    PolyLiteral *literal = malloc(sizeof(PolyLiteral));
+    assert(literal != NULL);
+    *literal = (PolyLiteral) {
+            .start = (const char *)data, .length = data_size,
+            .line_number = stream->line_number, .is_serialized = true,
+            .is_coeff = is_coeff ? LITERAL_FACT_TRUE : LITERAL_FACT_FALSE,
+            .is_zero = is_zero ? LITERAL_FACT_TRUE : LITERAL_FACT_FALSE};
+    PolyStackPushLiteral(poly_stack, literal);
+}
+
+/**
+ * Zapisuje wielomian z wierzchołka stosu w magazynie
+ *
+ * Argument ma postać `nazwa plik`; nazwa nie zawiera spacji.
+ * Wymaga 1 wielomianu na stosie
+ * @param[in,out] stream : wskaźnik na InputStream z którego polecenie zostało
+ *                         wczytane
+ * @param[in] poly_stack : stos wielomianów
+ * @param[in] argument : argument polecenia
+ * @param[in] length : długość argumentu
+ */
+static inline void CommandStore(InputStream *stream, Stack *poly_stack,
+                                const char *argument, size_t length)
+{
+    const char *separator = memchr(argument, ' ', length);
+    if (separator == NULL || separator == argument ||
+        separator + 1 == argument + length)
     {
-        CommandMul(stream, poly_stack);
+        OutputFormat(&error_output, "ERROR %u WRONG NAME\n",
+                     stream->line_number);
+        return;
     }
-    else if (strcmp(command, COMMAND_NEG) == 0 && c == '\n')
+
+    REQUIRES_N_POLYNOMIALS(1)
+
+    if (!PolyStoreAdd(separator + 1, argument, separator - argument,
+                      StackTop(poly_stack)))
     {
-        CommandNeg(stream, poly_stack);
+        OutputFormat(&error_output, "ERROR %u CANNOT WRITE FILE\n",
+                     stream->line_number);
     }
-    else if (strcmp(command, COMMAND_SUB) == 0 && c == '\n')
+}
+
+/**
+ * Identyfikator polecenia kalkulatora
+ */
+typedef enum CommandId
+{
+    COMMAND_ID_ZERO, ///< Polecenie ZERO
+    COMMAND_ID_IS_COEFF, ///< Polecenie IS_COEFF
+    COMMAND_ID_IS_ZERO, ///< Polecenie IS_ZERO
+    COMMAND_ID_CLONE, ///< Polecenie CLONE
+    COMMAND_ID_ADD, ///< Polecenie ADD
+    COMMAND_ID_MUL, ///< Polecenie MUL
+    COMMAND_ID_NEG, ///< Polecenie NEG
+    COMMAND_ID_SUB, ///< Polecenie SUB
+    COMMAND_ID_IS_EQ, ///< Polecenie IS_EQ
+    COMMAND_ID_DEG, ///< Polecenie DEG
+    COMMAND_ID_DEG_BY, ///< Polecenie DEG_BY
+    COMMAND_ID_AT, ///< Polecenie AT
+    COMMAND_ID_PRINT, ///< Polecenie PRINT
+    COMMAND_ID_POP, ///< Polecenie POP
+    COMMAND_ID_COMPOSE, ///< Polecenie COMPOSE
+    COMMAND_ID_PRODUCT, ///< Polecenie PRODUCT
+    COMMAND_ID_MUL_TRUNC, ///< Polecenie MUL_TRUNC
+    COMMAND_ID_RING, ///< Polecenie RING
+    COMMAND_ID_SCALE, ///< Polecenie SCALE
+    COMMAND_ID_SHIFT, ///< Polecenie SHIFT
+    COMMAND_ID_COEFF, ///< Polecenie COEFF
+    COMMAND_ID_PERMUTE, ///< Polecenie PERMUTE
+    COMMAND_ID_REORDER, ///< Polecenie REORDER
+    COMMAND_ID_SUBST, ///< Polecenie SUBST
+    COMMAND_ID_SHIFT_VAR, ///< Polecenie SHIFT_VAR
+    COMMAND_ID_POW_CACHE, ///< Polecenie POW_CACHE
+    COMMAND_ID_SAVE, ///< Polecenie SAVE
+    COMMAND_ID_SAVE_ALL, ///< Polecenie SAVE_ALL
+    COMMAND_ID_LOAD, ///< Polecenie LOAD
+    COMMAND_ID_OPEN_STORE, ///< Polecenie OPEN_STORE
+    COMMAND_ID_STORE, ///< Polecenie STORE
+    COMMAND_ID_FETCH, ///< Polecenie FETCH
+    COMMAND_ID_UNKNOWN ///< Niepoprawne polecenie
+} CommandId;
+
+/**
+ * Opis polecenia kalkulatora
+ */
+typedef struct CommandInfo
+{
+    const char *name; ///< Nazwa polecenia
+    bool has_arguments; ///< Czy po nazwie polecenia następują argumenty
+} CommandInfo;
+
+/// Opisy poleceń indeksowane identyfikatorami
+static const CommandInfo commands[COMMAND_ID_UNKNOWN] = {
+    [COMMAND_ID_ZERO] = {COMMAND_ZERO, false},
+    [COMMAND_ID_IS_COEFF] = {COMMAND_IS_COEFF, false},
+    [COMMAND_ID_IS_ZERO] = {COMMAND_IS_ZERO, false},
+    [COMMAND_ID_CLONE] = {COMMAND_CLONE, false},
+    [COMMAND_ID_ADD] = {COMMAND_ADD, false},
+    [COMMAND_ID_MUL] = {COMMAND_MUL, false},
+    [COMMAND_ID_NEG] = {COMMAND_NEG, false},
+    [COMMAND_ID_SUB] = {COMMAND_SUB, false},
+    [COMMAND_ID_IS_EQ] = {COMMAND_IS_EQ, false},
+    [COMMAND_ID_DEG] = {COMMAND_DEG, false},
+    [COMMAND_ID_DEG_BY] = {COMMAND_DEG_BY, true},
+    [COMMAND_ID_AT] = {COMMAND_AT, true},
+    [COMMAND_ID_PRINT] = {COMMAND_PRINT, false},
+    [COMMAND_ID_POP] = {COMMAND_POP, false},
+    [COMMAND_ID_COMPOSE] = {COMMAND_COMPOSE, true},
+    [COMMAND_ID_PRODUCT] = {COMMAND_PRODUCT, true},
+    [COMMAND_ID_MUL_TRUNC] = {COMMAND_MUL_TRUNC, true},
+    [COMMAND_ID_RING] = {COMMAND_RING, true},
+    [COMMAND_ID_SCALE] = {COMMAND_SCALE, true},
+    [COMMAND_ID_SHIFT] = {COMMAND_SHIFT, true},
+    [COMMAND_ID_COEFF] = {COMMAND_COEFF, true},
+    [COMMAND_ID_PERMUTE] = {COMMAND_PERMUTE, true},
+    [COMMAND_ID_REORDER] = {COMMAND_REORDER, true},
+    [COMMAND_ID_SUBST] = {COMMAND_SUBST, true},
+    [COMMAND_ID_SHIFT_VAR] = {COMMAND_SHIFT_VAR, true},
+    [COMMAND_ID_POW_CACHE] = {COMMAND_POW_CACHE, false},
+    [COMMAND_ID_SAVE] = {COMMAND_SAVE, true},
+    [COMMAND_ID_SAVE_ALL] = {COMMAND_SAVE_ALL, true},
+    [COMMAND_ID_LOAD] = {COMMAND_LOAD, true},
+    [COMMAND_ID_OPEN_STORE] = {COMMAND_OPEN_STORE, true},
+    [COMMAND_ID_STORE] = {COMMAND_STORE, true},
+    [COMMAND_ID_FETCH] = {COMMAND_FETCH, true},
+};
+
+/**
+ * Klucz nazwy polecenia: jej długość i dwa pierwsze znaki
+ *
+ * Klucze wszystkich poleceń są różne, więc wybierają kandydata bez
+ * porównywania napisów; jego pełną nazwę sprawdzamy jednym memcmp.
+ * @param[in] length : długość nazwy
+ * @param[in] first : pierwszy znak nazwy
+ * @param[in] second : drugi znak nazwy
+ */
+#define COMMAND_KEY(length, first, second)\
+(((unsigned)(length) << 16) | ((unsigned)(unsigned char)(first) << 8) |\
+ (unsigned)(unsigned char)(second))
+
+/**
+ * Znajduje polecenie o podanej nazwie
+ * @param[in] name : nazwa polecenia (niezakończona zerem)
+ * @param[in] length : długość nazwy
+ * @return identyfikator polecenia lub COMMAND_ID_UNKNOWN
+ */
+static CommandId LookupCommand(const char *name, unsigned length)
+{
+    if (length < 2)
     {
-        CommandSub(stream, poly_stack);
+        return COMMAND_ID_UNKNOWN;
     }
-    else if (strcmp(command, COMMAND_IS_EQ) == 0 && c == '\n')
+
+    CommandId id;
+    switch (COMMAND_KEY(length, name[0], name[1]))
     {
-        CommandIsEq(stream, poly_stack);
+        case COMMAND_KEY(2, 'A', 'T'):
+            id = COMMAND_ID_AT;
+            break;
+        case COMMAND_KEY(3, 'A', 'D'):
+            id = COMMAND_ID_ADD;
+            break;
+        case COMMAND_KEY(3, 'D', 'E'):
+            id = COMMAND_ID_DEG;
+            break;
+        case COMMAND_KEY(3, 'M', 'U'):
+            id = COMMAND_ID_MUL;
+            break;
+        case COMMAND_KEY(3, 'N', 'E'):
+            id = COMMAND_ID_NEG;
+            break;
+        case COMMAND_KEY(3, 'P', 'O'):
+            id = COMMAND_ID_POP;
+            break;
+        case COMMAND_KEY(3, 'S', 'U'):
+            id = COMMAND_ID_SUB;
+            break;
+        case COMMAND_KEY(4, 'L', 'O'):
+            id = COMMAND_ID_LOAD;
+            break;
+        case COMMAND_KEY(4, 'R', 'I'):
+            id = COMMAND_ID_RING;
+            break;
+        case COMMAND_KEY(4, 'S', 'A'):
+            id = COMMAND_ID_SAVE;
+            break;
+        case COMMAND_KEY(4, 'Z', 'E'):
+            id = COMMAND_ID_ZERO;
+            break;
+        case COMMAND_KEY(5, 'C', 'L'):
+            id = COMMAND_ID_CLONE;
+            break;
+        case COMMAND_KEY(5, 'C', 'O'):
+            id = COMMAND_ID_COEFF;
+            break;
+        case COMMAND_KEY(5, 'F', 'E'):
+            id = COMMAND_ID_FETCH;
+            break;
+        case COMMAND_KEY(5, 'I', 'S'):
+            id = COMMAND_ID_IS_EQ;
+            break;
+        case COMMAND_KEY(5, 'P', 'R'):
+            id = COMMAND_ID_PRINT;
+            break;
+        case COMMAND_KEY(5, 'S', 'C'):
+            id = COMMAND_ID_SCALE;
+            break;
+        case COMMAND_KEY(5, 'S', 'H'):
+            id = COMMAND_ID_SHIFT;
+            break;
+        case COMMAND_KEY(5, 'S', 'T'):
+            id = COMMAND_ID_STORE;
+            break;
+        case COMMAND_KEY(5, 'S', 'U'):
+            id = COMMAND_ID_SUBST;
+            break;
+        case COMMAND_KEY(6, 'D', 'E'):
+            id = COMMAND_ID_DEG_BY;
+            break;
+        case COMMAND_KEY(7, 'C', 'O'):
+            id = COMMAND_ID_COMPOSE;
+            break;
+        case COMMAND_KEY(7, 'I', 'S'):
+            id = COMMAND_ID_IS_ZERO;
+            break;
+        case COMMAND_KEY(7, 'P', 'E'):
+            id = COMMAND_ID_PERMUTE;
+            break;
+        case COMMAND_KEY(7, 'P', 'R'):
+            id = COMMAND_ID_PRODUCT;
+            break;
+        case COMMAND_KEY(7, 'R', 'E'):
+            id = COMMAND_ID_REORDER;
+            break;
+        case COMMAND_KEY(8, 'I', 'S'):
+            id = COMMAND_ID_IS_COEFF;
+            break;
+        case COMMAND_KEY(8, 'S', 'A'):
+            id = COMMAND_ID_SAVE_ALL;
+            break;
+        case COMMAND_KEY(9, 'M', 'U'):
+            id = COMMAND_ID_MUL_TRUNC;
+            break;
+        case COMMAND_KEY(9, 'P', 'O'):
+            id = COMMAND_ID_POW_CACHE;
+            break;
+        case COMMAND_KEY(9, 'S', 'H'):
+            id = COMMAND_ID_SHIFT_VAR;
+            break;
+        case COMMAND_KEY(10, 'O', 'P'):
+            id = COMMAND_ID_OPEN_STORE;
+            break;
+        default:
+            return COMMAND_ID_UNKNOWN;
     }
-    else if (strcmp(command, COMMAND_DEG) == 0 && c == '\n')
+
+    if (memcmp(name, commands[id].name, length) != 0)
     {
-        CommandDeg(stream, poly_stack);
+        return COMMAND_ID_UNKNOWN;
     }
-    else if (strcmp(command, COMMAND_DEG_BY) == 0)
+    return id;
+}
+
+/**
+ * Wczytuje i wykonuje polecenia
+ * @param[in,out] stream : wskaźnik na InputStream do czytania poleceń
+ * @param[in,out] poly_stack : stos wielomianów
+ */
+void ReadAndExecuteCommand(InputStream *stream, Stack *poly_stack)
+{
+    char command[MAX_COMMAND_LENGTH];
+
+    unsigned command_length = 0;
+    char c;
+
+    while (EOF != (c = ReadCharacter(stream)))
     {
-        if (c == ' ')
+        if (c == ' ' || c == '\n')
         {
-            unsigned var = ReadDegByCommandArgument(stream);
-            if (!stream->parse_error)
-            {
-                CommandDegBy(stream, poly_stack, var);
-            }
+            break;
+        }
+
+        if (command_length >= MAX_COMMAND_LENGTH ||
+            IsValidCommandCharacter(c) == false)
+        {
+            OutputFormat(&error_output, "ERROR %u WRONG COMMAND\n",
+                         stream->line_number + 1);
+            SkipLine(stream);
+            return;
         }
         else {
-            if (c != '\n')
-            {
-                SkipLine(stream);
-            }
-            fprintf(stderr, "ERROR %u WRONG VARIABLE\n", stream->line_number);
+            command[command_length] = c;
+            ++command_length;
         }
     }
-    else if (strcmp(command, COMMAND_COMPOSE) == 0)
+
+    CommandId id = LookupCommand(command, command_length);
+    if (id != COMMAND_ID_UNKNOWN && !commands[id].has_arguments && c != '\n')
     {
-        if (c == ' ')
-        {
-            unsigned var = ReadComposeCommandArgument(stream);
-            if (!stream->parse_error)
+        id = COMMAND_ID_UNKNOWN;
+    }
+
+    switch (id)
+    {
+        case COMMAND_ID_ZERO:
+            CommandZero(poly_stack);
+            break;
+        case COMMAND_ID_IS_COEFF:
+            CommandIsCoefficient(stream, poly_stack);
+            break;
+        case COMMAND_ID_IS_ZERO:
+            CommandIsZero(stream, poly_stack);
+            break;
+        case COMMAND_ID_CLONE:
+            CommandClone(stream, poly_stack);
+            break;
+        case COMMAND_ID_ADD:
+            CommandAdd(stream, poly_stack);
+            break;
+        case COMMAND_ID_MUL:
+            CommandMul(stream, poly_stack);
+            break;
+        case COMMAND_ID_NEG:
+            CommandNeg(stream, poly_stack);
+            break;
+        case COMMAND_ID_SUB:
+            CommandSub(stream, poly_stack);
+            break;
+        case COMMAND_ID_IS_EQ:
+            CommandIsEq(stream, poly_stack);
+            break;
+        case COMMAND_ID_DEG:
+            CommandDeg(stream, poly_stack);
+            break;
+        case COMMAND_ID_POW_CACHE:
+            CommandPowCache();
+            break;
+        case COMMAND_ID_DEG_BY:
+            if (c == ' ')
             {
-                CommandCompose(stream, poly_stack, var);
+                unsigned var = ReadDegByCommandArgument(stream);
+                if (!stream->parse_error)
+                {
+                    CommandDegBy(stream, poly_stack, var);
+                }
             }
-        }
-        else {
-            if (c != '\n')
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG VARIABLE\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_COMPOSE:
+            if (c == ' ')
             {
-                SkipLine(stream);
+                unsigned var = ReadComposeCommandArgument(stream);
+                if (!stream->parse_error)
+                {
+                    CommandCompose(stream, poly_stack, var);
+                }
             }
-            fprintf(stderr, "ERROR %u WRONG COUNT\n", stream->line_number);
-        }
-    }
-    else if (strcmp(command, COMMAND_AT) == 0)
-    {
-        if (c == ' ')
-        {
-            poly_coeff_t value = ReadAtCommandArgument(stream);
-            if (!stream->parse_error)
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG COUNT\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_PRODUCT:
+            if (c == ' ')
             {
-                ReadCharacter(stream);
-                CommandAt(stream, poly_stack, value);
+                unsigned count = ReadProductCommandArgument(stream);
+                if (!stream->parse_error)
+                {
+                    CommandProduct(stream, poly_stack, count);
+                }
             }
-        }
-        else {
-            if (c != '\n')
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG COUNT\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_MUL_TRUNC:
+        case COMMAND_ID_RING:
+            if (c == ' ')
+            {
+                unsigned var = ReadUnsignedCommandArgument(stream, UINT_MAX, ' ',
+                                                           "VARIABLE");
+                poly_exp_t n = 0;
+                if (!stream->parse_error)
+                {
+                    n = ReadUnsignedCommandArgument(stream, INT_MAX, '\n',
+                                                    "DEGREE");
+                }
+                if (!stream->parse_error)
+                {
+                    if (id == COMMAND_ID_RING)
+                    {
+                        CommandRing(poly_stack, var, n);
+                    }
+                    else {
+                        CommandMulTrunc(stream, poly_stack, var, n);
+                    }
+                }
+            }
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG VARIABLE\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_SHIFT:
+            if (c == ' ')
+            {
+                unsigned var = ReadUnsignedCommandArgument(stream, UINT_MAX, ' ',
+                                                           "VARIABLE");
+                poly_exp_t k = 0;
+                if (!stream->parse_error)
+                {
+                    k = ReadUnsignedCommandArgument(stream, INT_MAX, '\n',
+                                                    "EXPONENT");
+                }
+                if (!stream->parse_error)
+                {
+                    CommandShift(stream, poly_stack, var, k);
+                }
+            }
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG VARIABLE\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_COEFF:
+            if (c == ' ')
+            {
+                poly_exp_t exp = ReadUnsignedCommandArgument(stream, INT_MAX, '\n',
+                                                             "EXPONENT");
+                if (!stream->parse_error)
+                {
+                    CommandCoeff(stream, poly_stack, exp);
+                }
+            }
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG EXPONENT\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_SHIFT_VAR:
+            if (c == ' ')
+            {
+                unsigned var = ReadUnsignedCommandArgument(stream, UINT_MAX, ' ',
+                                                           "VARIABLE");
+                poly_coeff_t value = 0;
+                if (!stream->parse_error)
+                {
+                    value = ReadShiftVarCommandArgument(stream);
+                }
+                if (!stream->parse_error)
+                {
+                    ReadCharacter(stream);
+                    CommandShiftVar(stream, poly_stack, var, value);
+                }
+            }
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG VARIABLE\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_SUBST:
+            if (c == ' ')
+            {
+                unsigned var = ReadUnsignedCommandArgument(stream, UINT_MAX, '\n',
+                                                           "VARIABLE");
+                if (!stream->parse_error)
+                {
+                    CommandSubst(stream, poly_stack, var);
+                }
+            }
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG VARIABLE\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_PERMUTE:
+            if (c == ' ')
+            {
+                unsigned count = ReadUnsignedCommandArgument(stream, UINT_MAX, ' ',
+                                                             "COUNT");
+                unsigned *perm = NULL;
+                if (!stream->parse_error && count == 0)
+                {
+                    OutputFormat(&error_output, "ERROR %u WRONG COUNT\n",
+                                 stream->line_number + 1);
+                    SkipLine(stream);
+                    stream->parse_error = true;
+                }
+                if (!stream->parse_error)
+                {
+                    perm = ReadPermutationCommandArgument(stream, count);
+                }
+                if (!stream->parse_error)
+                {
+                    CommandPermute(stream, poly_stack, count, perm);
+                }
+                free(perm);
+            }
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG COUNT\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_REORDER:
+            if (c == ' ')
+            {
+                unsigned enabled = ReadUnsignedCommandArgument(stream, 1, '\n',
+                                                               "VALUE");
+                if (!stream->parse_error)
+                {
+                    PolyProductReorder(enabled == 1);
+                }
+            }
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG VALUE\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_AT:
+            if (c == ' ')
+            {
+                poly_coeff_t value = ReadAtCommandArgument(stream);
+                if (!stream->parse_error)
+                {
+                    ReadCharacter(stream);
+                    CommandAt(stream, poly_stack, value);
+                }
+            }
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                stream->parse_error = true;
+                OutputFormat(&error_output, "ERROR %u WRONG VALUE\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_SCALE:
+            if (c == ' ')
+            {
+                poly_coeff_t value = ReadScaleCommandArgument(stream);
+                if (!stream->parse_error)
+                {
+                    ReadCharacter(stream);
+                    CommandScale(stream, poly_stack, value);
+                }
+            }
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                stream->parse_error = true;
+                OutputFormat(&error_output, "ERROR %u WRONG VALUE\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_SAVE:
+        case COMMAND_ID_SAVE_ALL:
+        case COMMAND_ID_LOAD:
+        case COMMAND_ID_OPEN_STORE:
+            if (c == ' ')
+            {
+                size_t length;
+                char *path = ReadTextCommandArgument(stream, "FILE NAME",
+                                                     &length);
+                if (!stream->parse_error)
+                {
+                    if (id == COMMAND_ID_LOAD)
+                    {
+                        CommandLoad(stream, poly_stack, path);
+                    }
+                    else if (id == COMMAND_ID_OPEN_STORE)
+                    {
+                        CommandOpenStore(stream, poly_stack, path);
+                    }
+                    else {
+                        CommandSave(stream, poly_stack, path,
+                                    id == COMMAND_ID_SAVE ?
+                                    1 : StackSize(poly_stack));
+                    }
+                }
+                free(path);
+            }
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG FILE NAME\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_FETCH:
+        case COMMAND_ID_STORE:
+            if (c == ' ')
+            {
+                size_t length;
+                char *argument = ReadTextCommandArgument(stream, "NAME",
+                                                         &length);
+                if (!stream->parse_error)
+                {
+                    if (id == COMMAND_ID_FETCH)
+                    {
+                        CommandFetch(stream, poly_stack, argument, length);
+                    }
+                    else {
+                        CommandStore(stream, poly_stack, argument, length);
+                    }
+                }
+                free(argument);
+            }
+            else {
+                if (c != '\n')
+                {
+                    SkipLine(stream);
+                }
+                OutputFormat(&error_output, "ERROR %u WRONG NAME\n",
+                             stream->line_number);
+            }
+            break;
+        case COMMAND_ID_PRINT:
+            CommandPrint(stream, poly_stack);
+            break;
+        case COMMAND_ID_POP:
+            CommandPop(stream, poly_stack);
+            break;
+        default:
+            if(c != '\n')
             {
                 SkipLine(stream);
             }
-            stream->parse_error = true;
-            fprintf(stderr, "ERROR %u WRONG VALUE\n", stream->line_number);
-        }
+            OutputFormat(&error_output, "ERROR %u WRONG COMMAND\n",
+                         stream->line_number);
+            break;
     }
-    else if (strcmp(command, COMMAND_PRINT) == 0 && c == '\n')
+}
+
+bool PolyLiteralPreferred(unsigned line_number)
+{
+    // Nawet gdy literały się nie opłacają, co jakiś czas odkładamy literał,
+    // żeby zauważyć zmianę sposobu użycia wielomianów. Wiersze wybieramy
+    // skrótem numeru, żeby próbki nie omijały okresowo powtarzanych wierszy.
+    return atomic_load_explicit(&literal_score, memory_order_relaxed) >=
+           LITERAL_SCORE_MAX / 2 ||
+           (uint32_t)(line_number * 2654435761u) >> LITERAL_SAMPLE_SHIFT == 0;
+}
+
+void PolyStackPushLiteral(Stack *poly_stack, PolyLiteral *literal)
+{
+    // Redukcja modulo pierścień może wyzerować wyrazy, ale nie liczbę.
+    if (PolyRingIsSet() && literal->is_coeff != LITERAL_FACT_TRUE)
     {
-        CommandPrint(stream, poly_stack);
+        literal->is_coeff = LITERAL_FACT_UNKNOWN;
+        literal->is_zero = LITERAL_FACT_UNKNOWN;
     }
-    else if (strcmp(command, COMMAND_POP) == 0 && c == '\n')
+
+    StackPush(poly_stack, StackEntryFromLiteral(literal));
+    ++literal_push_count;
+}
+
+void PolyLiteralStats(unsigned long *pushed, unsigned long *parsed)
+{
+    *pushed = literal_push_count;
+    *parsed = literal_parse_count;
+}
+
+void PolyStackDestroy(Stack *poly_stack)
+{
+    for (size_t i = 0; i < StackSize(poly_stack); ++i)
     {
-        CommandPop(stream, poly_stack);
-    }
-    else {
-        if(c != '\n')
-        {
-            SkipLine(stream);
-        }
-        fprintf(stderr, "ERROR %u WRONG COMMAND\n", stream->line_number);
+        DestroyStackEntry(StackGet(poly_stack, i));
     }
+    StackDestroy(poly_stack, NULL);
+}
 
-    free(command);
+void ReleaseCommandResources(void)
+{
+    PolyStoreClose(open_store);
+    open_store = NULL;
+    atomic_store_explicit(&literal_score, LITERAL_SCORE_MAX / 2,
+                          memory_order_relaxed);
 }
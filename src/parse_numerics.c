@@ -7,28 +7,121 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <limits.h>
+#include <stdint.h>
+#include <string.h>
 #include "parse.h"
 #include "utils.h"
 
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/// Czy wczytujemy cyfry blokami po 8 znaków (SWAR)?
+#define PARSE_DIGITS_SWAR 1
+#endif
+
+#ifdef PARSE_DIGITS_SWAR
+
+/// Kolejne potęgi 10 (mnożniki dla bloków cyfr)
+static const unsigned long powers_of_ten[] = {
+    1ul, 10ul, 100ul, 1000ul, 10000ul, 100000ul, 1000000ul, 10000000ul,
+    100000000ul
+};
+
+/**
+ * Zlicza cyfry na początku bloku 8 znaków
+ *
+ * Znak jest cyfrą, gdy jego starsza połówka to 3, a dodanie 6 jej nie
+ * zmienia. Przeniesienie z bajtu nie-cyfry psuje co najwyżej dalsze
+ * bajty, więc pozycja pierwszej nie-cyfry jest zawsze poprawna.
+ * @param[in] chunk : 8 kolejnych znaków (pierwszy w najmłodszym bajcie)
+ * @return liczba cyfr przed pierwszą nie-cyfrą (0-8)
+ */
+static inline unsigned SwarDigitCount(uint64_t chunk)
+{
+    const uint64_t high_nibbles = 0xF0F0F0F0F0F0F0F0ull;
+    const uint64_t not_digits =
+            ((chunk & high_nibbles) |
+             (((chunk + 0x0606060606060606ull) & high_nibbles) >> 4)) ^
+            0x3333333333333333ull;
+
+    return not_digits == 0 ? 8 : __builtin_ctzll(not_digits) / 8;
+}
+
+/**
+ * Zamienia @p count początkowych cyfr bloku na liczbę
+ *
+ * Cyfry przesuwamy na starsze bajty, dopełniając zerami z przodu,
+ * i sumujemy je parami, czwórkami i ósemkami trzema mnożeniami.
+ * @param[in] chunk : 8 kolejnych znaków (pierwszy w najmłodszym bajcie)
+ * @param[in] count : liczba cyfr na początku bloku (1-8)
+ * @return wartość cyfr
+ */
+static inline unsigned long SwarDigitsValue(uint64_t chunk, unsigned count)
+{
+    uint64_t digits = (chunk - 0x3030303030303030ull) << (8 * (8 - count));
+    digits = digits * 10 + (digits >> 8);
+    return ((digits & 0x000000FF000000FFull) * (100 + (1000000ull << 32)) +
+            ((digits >> 16) & 0x000000FF000000FFull) *
+            (1 + (10000ull << 32))) >> 32;
+}
+
+#endif /* PARSE_DIGITS_SWAR */
+
 /**
- * Wczytuje liczby do tablicy
+ * Wczytuje co najwyżej @p max_length cyfr jako liczbę bez znaku
+ *
+ * Cyfry leżące w buforze wejścia zamieniamy blokami po 8 bez
+ * kopiowania, a resztę (np. na granicy buforów) znak po znaku.
  * @param[in,out] stream : wskaźnik na InputStream
- * @param[out] array : tablica
- * @param[in] max_length : długość tablicy
+ * @param[in] max_length : maksymalna liczba cyfr (co najwyżej 19, więc
+ * wartość mieści się w unsigned long)
+ * @param[out] value : wartość wczytanych cyfr
+ * @return liczba wczytanych cyfr
  */
-static inline size_t ReadDigitsIntoAnArray(InputStream *stream,
-                                           char *array,
-                                           size_t max_length){
+static size_t ReadDigits(InputStream *stream, size_t max_length,
+                         unsigned long *value)
+{
+    assert(max_length <= 19);
+    unsigned long result = 0;
     size_t length = 0;
-    while (IsValidDigit(PeekCharacter(stream)) && length < max_length)
+
+#ifdef PARSE_DIGITS_SWAR
+    size_t available;
+    const char *data = InputStreamData(stream, &available);
+    while (length < max_length && available >= 8)
     {
-        array[length] = ReadCharacter(stream);
+        uint64_t chunk;
+        memcpy(&chunk, data, sizeof(chunk));
+        unsigned count = SwarDigitCount(chunk);
+        if (count > max_length - length)
+        {
+            count = max_length - length;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+
+        result = result * powers_of_ten[count] + SwarDigitsValue(chunk, count);
+        InputStreamAdvance(stream, count);
+        data += count;
+        available -= count;
+        length += count;
+        if (count < 8)
+        {
+            break;
+        }
+    }
+#endif
+
+    while (length < max_length && IsValidDigit(PeekCharacter(stream)))
+    {
+        result = result * 10 + (ReadCharacter(stream) - '0');
         ++length;
     }
+
+    *value = result;
     return length;
 }
 
-
 /**
  * Wczytuje liczbę zgodnie z określonymi wymaganiami
  *
@@ -39,27 +132,24 @@ static inline size_t ReadDigitsIntoAnArray(InputStream *stream,
  */
 static poly_coeff_t ReadValueOrCoefficient(InputStream *stream, bool isValue)
 {
-    char *value = calloc(MAX_VALUE_AND_COEFF_LENGTH, sizeof(char));
-    assert(value != NULL);
-
     bool negative = false;
     if (PeekCharacter(stream) == '-')
     {
         negative = true;
         ReadCharacter(stream);
     }
-    size_t length = ReadDigitsIntoAnArray(stream, value,
-                                          MAX_VALUE_AND_COEFF_LENGTH);
+    unsigned long value;
+    size_t length = ReadDigits(stream, MAX_VALUE_AND_COEFF_LENGTH, &value);
 
     if (isValue)
     {
         if (PeekCharacter(stream) != '\n' || length == 0)
         {
-            fprintf(stderr, "ERROR %u WRONG VALUE\n", stream->line_number + 1);
+            OutputFormat(&error_output, "ERROR %u WRONG VALUE\n",
+                         stream->line_number + 1);
             SkipLine(stream);
             stream->parse_error = true;
 
-            free(value);
             return 0;
         }
     }
@@ -67,70 +157,36 @@ static poly_coeff_t ReadValueOrCoefficient(InputStream *stream, bool isValue)
         if ( (PeekCharacter(stream) != ',' && PeekCharacter(stream) != '\n') ||
              length == 0)
         {
-            fprintf(stderr, "ERROR %u %u\n",
-                    stream->line_number + 1, stream->column_number + 1);
+            OutputFormat(&error_output, "ERROR %u %u\n",
+                         stream->line_number + 1, stream->column_number + 1);
             SkipLine(stream);
             stream->parse_error = true;
 
-            free(value);
             return 0;
         }
     }
-    if (length == MAX_VALUE_AND_COEFF_LENGTH)
+
+    const unsigned long limit = negative ? (unsigned long)LONG_MAX + 1
+                                         : (unsigned long)LONG_MAX;
+    if (value > limit)
     {
-        poly_coeff_t reference;
-        if (negative)
+        if (isValue)
         {
-            reference = LONG_MIN;
+            OutputFormat(&error_output, "ERROR %u WRONG VALUE\n",
+                         stream->line_number + 1);
         }
         else {
-            reference = LONG_MAX;
+            OutputFormat(&error_output, "ERROR %u %u\n",
+                         stream->line_number + 1, stream->column_number);
         }
 
-        for (int i = length - 1; i >= 0; --i)
-        {
-            const poly_coeff_t c = value[i] - '0';
-            poly_coeff_t ref_c = reference % ((poly_coeff_t)10);
-            if (ref_c < 0)
-            {
-                ref_c *= (poly_coeff_t) -1;
-            }
-            reference /= (poly_coeff_t) 10;
-
-            if (c > ref_c)
-            {
-                if (isValue)
-                {
-                    fprintf(stderr, "ERROR %u WRONG VALUE\n",
-                            stream->line_number + 1);
-                }
-                else {
-                    fprintf(stderr, "ERROR %u %u\n", stream->line_number + 1,
-                            stream->column_number);
-                }
-
-                SkipLine(stream);
-                stream->parse_error = true;
-
-                free(value);
-                return 0;
-            }
-        }
-    }
+        SkipLine(stream);
+        stream->parse_error = true;
 
-    poly_coeff_t result = 0;
-    for (unsigned i = 0; i < length; ++i)
-    {
-        result *= (poly_coeff_t) 10;
-        result += (poly_coeff_t)(value[i] - '0');
-    }
-    if (negative)
-    {
-        result *= (poly_coeff_t)-1;
+        return 0;
     }
 
-    free(value);
-    return result;
+    return negative ? (poly_coeff_t)(0ul - value) : (poly_coeff_t)value;
 }
 
 inline poly_coeff_t ReadAtCommandArgument(InputStream *stream)
@@ -138,6 +194,16 @@ inline poly_coeff_t ReadAtCommandArgument(InputStream *stream)
     return ReadValueOrCoefficient(stream, true);
 }
 
+inline poly_coeff_t ReadScaleCommandArgument(InputStream *stream)
+{
+    return ReadValueOrCoefficient(stream, true);
+}
+
+inline poly_coeff_t ReadShiftVarCommandArgument(InputStream *stream)
+{
+    return ReadValueOrCoefficient(stream, true);
+}
+
 inline poly_coeff_t ReadPolyCoefficient(InputStream *stream)
 {
     return ReadValueOrCoefficient(stream, false);
@@ -153,62 +219,42 @@ inline poly_coeff_t ReadPolyCoefficient(InputStream *stream)
  */
 unsigned ReadDegByOrComposeCommandArgument(InputStream *stream, bool isDegBy)
 {
-    char *value = calloc(MAX_VARIABLE_LENGTH, sizeof(char));
-    assert(value != NULL);
-
-    size_t length = ReadDigitsIntoAnArray(stream, value, MAX_VARIABLE_LENGTH);
+    unsigned long value;
+    size_t length = ReadDigits(stream, MAX_VARIABLE_LENGTH, &value);
 
     if (length == 0 || ReadCharacter(stream) != '\n')
     {
         if (isDegBy)
         {
-            fprintf(stderr, "ERROR %u WRONG VARIABLE\n", stream->line_number + 1);
+            OutputFormat(&error_output, "ERROR %u WRONG VARIABLE\n",
+                         stream->line_number + 1);
         }
         else {
-            fprintf(stderr, "ERROR %u WRONG COUNT\n", stream->line_number + 1);
+            OutputFormat(&error_output, "ERROR %u WRONG COUNT\n",
+                         stream->line_number + 1);
         }
         SkipLine(stream);
         stream->parse_error = true;
 
-        free(value);
         return 0;
     }
-    if (length == MAX_VARIABLE_LENGTH)
+    if (value > UINT_MAX)
     {
-        unsigned reference = UINT_MAX;
-        for (int i = length - 1; i >= 0; --i)
+        if (isDegBy)
         {
-            const unsigned c = value[i] - '0';
-            const unsigned ref_c = reference % 10;
-            reference /= 10;
-            if (c > ref_c)
-            {
-                if (isDegBy)
-                {
-                    fprintf(stderr, "ERROR %u WRONG VARIABLE\n",
-                            stream->line_number);
-                }
-                else {
-                    fprintf(stderr, "ERROR %u WRONG COUNT\n",
-                            stream->line_number);
-                }
-                stream->parse_error = true;
-
-                free(value);
-                return 0;
-            }
+            OutputFormat(&error_output, "ERROR %u WRONG VARIABLE\n",
+                         stream->line_number);
         }
-    }
+        else {
+            OutputFormat(&error_output, "ERROR %u WRONG COUNT\n",
+                         stream->line_number);
+        }
+        stream->parse_error = true;
 
-    unsigned result = 0;
-    for (unsigned i = 0; i < length; ++i)
-    {
-        result *= 10;
-        result += value[i] - '0';
+        return 0;
     }
 
-    free(value);
-    return result;
+    return value;
 }
 
 unsigned ReadDegByCommandArgument(InputStream *stream){
@@ -219,11 +265,103 @@ unsigned ReadComposeCommandArgument(InputStream *stream){
     return ReadDegByOrComposeCommandArgument(stream, false);
 }
 
-poly_exp_t ReadExponent(InputStream *stream)
+unsigned ReadProductCommandArgument(InputStream *stream){
+    return ReadDegByOrComposeCommandArgument(stream, false);
+}
+
+unsigned long ReadUnsignedCommandArgument(InputStream *stream,
+                                          unsigned long max_value,
+                                          char terminator,
+                                          const char *error_name)
 {
-    char *value = calloc(MAX_EXPONENT_LENGTH, sizeof(char));
-    assert(value != NULL);
+    unsigned long result = 0;
+    size_t length = 0;
+    bool overflow = false;
+
+    while (IsValidDigit(PeekCharacter(stream)))
+    {
+        const unsigned long digit = ReadCharacter(stream) - '0';
+        if (digit > max_value || result > (max_value - digit) / 10)
+        {
+            overflow = true;
+        }
+        else {
+            result = result * 10 + digit;
+        }
+        ++length;
+    }
+
+    if (length == 0 || overflow || PeekCharacter(stream) != terminator)
+    {
+        OutputFormat(&error_output, "ERROR %u WRONG %s\n",
+                     stream->line_number + 1, error_name);
+        SkipLine(stream);
+        stream->parse_error = true;
+
+        return 0;
+    }
+    ReadCharacter(stream);
+
+    return result;
+}
+
+unsigned *ReadPermutationCommandArgument(InputStream *stream, unsigned count)
+{
+    unsigned *perm = NULL;
+    bool *used = NULL;
+    unsigned size = 0;
+    unsigned capacity = 0;
+
+    while (size < count && !stream->parse_error)
+    {
+        const char terminator = size + 1 < count ? ' ' : '\n';
+        const unsigned value = ReadUnsignedCommandArgument(stream, count - 1,
+                                                           terminator,
+                                                           "PERMUTATION");
+        if (stream->parse_error)
+        {
+            break;
+        }
+
+        // Tablice rosną razem z wczytanymi liczbami, nie z zadeklarowaną
+        // długością permutacji.
+        if (size == capacity)
+        {
+            capacity = capacity == 0 ? 8 : 2 * capacity;
+            perm = realloc(perm, capacity * sizeof(unsigned));
+            assert(perm != NULL);
+        }
+        perm[size++] = value;
+    }
 
+    if (!stream->parse_error)
+    {
+        used = calloc(count, sizeof(bool));
+        assert(used != NULL);
+        for (unsigned i = 0; i < count && !stream->parse_error; ++i)
+        {
+            if (used[perm[i]])
+            {
+                OutputFormat(&error_output, "ERROR %u WRONG PERMUTATION\n",
+                             stream->line_number);
+                stream->parse_error = true;
+            }
+            used[perm[i]] = true;
+        }
+        free(used);
+    }
+
+    if (stream->parse_error)
+    {
+        free(perm);
+        return NULL;
+    }
+
+    return perm;
+}
+
+poly_exp_t ReadExponent(InputStream *stream)
+{
     // https://moodle.mimuw.edu.pl/mod/forum/discuss.php?d=354#p1165
     bool negative_zero_expected = false;
     unsigned last_column = stream->column_number+2;
@@ -233,56 +371,36 @@ poly_exp_t ReadExponent(InputStream *stream)
         ReadCharacter(stream);
     }
 
-    size_t length = ReadDigitsIntoAnArray(stream, value, MAX_EXPONENT_LENGTH);
+    unsigned long value;
+    size_t length = ReadDigits(stream, MAX_EXPONENT_LENGTH, &value);
 
-    if (negative_zero_expected && (length != 1 || value[0] != '0')){
-        fprintf(stderr, "ERROR %u %u\n", stream->line_number + 1, last_column);
+    if (negative_zero_expected && (length != 1 || value != 0)){
+        OutputFormat(&error_output, "ERROR %u %u\n",
+                     stream->line_number + 1, last_column);
         SkipLine(stream);
         stream->parse_error = true;
 
-        free(value);
         return 0;
     }
 
     if (length == 0)
     {
-        fprintf(stderr, "ERROR %u %u\n", stream->line_number + 1,
-                stream->column_number + 1);
+        OutputFormat(&error_output, "ERROR %u %u\n",
+                     stream->line_number + 1, stream->column_number + 1);
         SkipLine(stream);
         stream->parse_error = true;
 
-        free(value);
         return 0;
     }
-    if (length == MAX_EXPONENT_LENGTH)
+    if (value > INT_MAX)
     {
-        unsigned reference = INT_MAX;
-        for (int i = length - 1; i >= 0; --i)
-        {
-            const unsigned c = value[i] - '0';
-            const unsigned ref_c = reference % 10;
-            reference /= 10;
-
-            if (c > ref_c)
-            {
-                fprintf(stderr, "ERROR %u %u\n", stream->line_number + 1,
-                        stream->column_number);
-                SkipLine(stream);
-                stream->parse_error = true;
-
-                free(value);
-                return 0;
-            }
-        }
-    }
+        OutputFormat(&error_output, "ERROR %u %u\n",
+                     stream->line_number + 1, stream->column_number);
+        SkipLine(stream);
+        stream->parse_error = true;
 
-    poly_exp_t result = 0;
-    for (unsigned i = 0; i < length; ++i)
-    {
-        result *= 10;
-        result += value[i] - '0';
+        return 0;
     }
 
-    free(value);
-    return result;
+    return value;
 }
@@ -5,111 +5,240 @@
 */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "parse.h"
 #include "utils.h"
 
+#define PARSE_LOCAL_FRAMES 32
+///< Liczba poziomów zagnieżdżenia mieszczących się w buforze ParseFrames
+
 /**
- * Wychodzi z funkcji wczytującej wielomian jeżeli
- * predykat jest spełniony.
- * 
- * Zwalnia zaalokowany stos
- * @param[in] condition_parse_poly_exit_if : predykat
+ * Struktura opisująca kształt poziomu sprawdzanego literału
+ *
+ * Wystarcza, żeby bez budowania wielomianu rozstrzygnąć część pytań
+ * (IS_COEFF, IS_ZERO): wyrazy o ściśle rosnących wykładnikach i na pewno
+ * niezerowych współczynnikach nie mogą się zredukować.
  */
-#define PARSE_POLY_EXIT_IF(condition_parse_poly_exit_if)\
-if (condition_parse_poly_exit_if)\
-{\
-    StackDestroy(&parse_stack, &StackOfMonosDestructor);\
-    return PolyZero();\
-}\
+typedef struct LiteralShape
+{
+    poly_coeff_t value; ///< Wartość poziomu, jeśli jest on liczbą
+    poly_exp_t last_exp; ///< Wykładnik ostatniego wyrazu
+    unsigned count; ///< Liczba wyrazów
+    bool is_number; ///< Czy poziom jest pojedynczą liczbą
+    bool exact; ///< Czy wyrazy nie mogą się zredukować
+} LiteralShape;
 
 /**
- * Wychodzi z funkcji wczytującej wielomian i wypisuje błąd
- * jeżeli predykat nie jest spełniony.
- * 
- * Zwalnia zaalokowany stos i ustawia flagę parse_error
- * @param[in] condition_parse_poly_expect : predykat
+ * Struktura przechowująca otwarty poziom wczytywanego wielomianu
  */
-#define PARSE_POLY_EXPECT(condition_parse_poly_expect) \
-if ((condition_parse_poly_expect) == false)\
-{\
-    fprintf(stderr, "ERROR %u %u\n", stream->line_number + 1,\
-            stream->column_number + 1);\
-    SkipLine(stream);\
-    stream->parse_error = true;\
-\
-    PARSE_POLY_EXIT_IF(true)\
-}\
+typedef struct ParseFrame
+{
+    PolyBuilder builder; ///< Budowany poziom (gdy budujemy wielomian)
+    LiteralShape shape; ///< Kształt poziomu (gdy tylko sprawdzamy składnię)
+} ParseFrame;
+
+/**
+ * Stos budowanych poziomów wczytywanego wielomianu
+ *
+ * Wszystkie otwarte poziomy zagnieżdżenia trzymamy w jednej tablicy,
+ * używanej ponownie przez kolejne poziomy. Płytkie wielomiany mieszczą
+ * się w buforze wewnątrz struktury, głębsze przenoszą tablicę na stertę.
+ * Przy sprawdzaniu składni zamiast wielomianów śledzimy tylko kształt
+ * poziomów. Struktury nie wolno kopiować (wskazuje na własny bufor).
+ */
+typedef struct ParseFrames
+{
+    ParseFrame *frames; ///< Tablica poziomów
+    unsigned size; ///< Liczba otwartych poziomów
+    unsigned capacity; ///< Rozmiar tablicy
+    bool building; ///< Czy budujemy wielomian (a nie tylko sprawdzamy)
+    ParseFrame local[PARSE_LOCAL_FRAMES]; ///< Bufor dla płytkich wielomianów
+} ParseFrames;
 
 /**
- * Alokuje i tworzy nowy stos.
- * @return wskażnik na wynik
+ * Inicjuje pusty stos poziomów
+ * @param[out] s : stos
+ * @param[in] building : czy budujemy wielomian
  */
-static inline Stack* NewStack()
+static inline void ParseFramesInit(ParseFrames *s, bool building)
 {
-    Stack *s = malloc(sizeof(Stack));
-    assert(s != NULL);
-    *s = StackInit();
-    return s;
+    s->frames = s->local;
+    s->size = 0;
+    s->capacity = PARSE_LOCAL_FRAMES;
+    s->building = building;
 }
 
 /**
- * Alokuje nowy jednomian i przypisuje mu wartość @p v
- * @param[in] v : wartość nowego jednomianu
- * @return wskaźnik na wynik
+ * Otwiera nowy poziom wielomianu
+ * @param[in,out] s : stos
  */
-static inline Mono* NewMono(Mono v)
+static inline void ParseFramesPush(ParseFrames *s)
 {
-    Mono *m = calloc(1, sizeof(Mono));
-    assert(m != NULL);
-    *m = v;
-    return m;
+    if (s->size == s->capacity)
+    {
+        ParseFrame *frames = malloc(2 * s->capacity * sizeof(ParseFrame));
+        assert(frames != NULL);
+        memcpy(frames, s->frames, s->size * sizeof(ParseFrame));
+        if (s->frames != s->local)
+        {
+            free(s->frames);
+        }
+        s->frames = frames;
+        s->capacity *= 2;
+    }
+    ParseFrame *frame = &s->frames[s->size++];
+    if (s->building)
+    {
+        frame->builder = PolyBuilderInit();
+    }
+    else {
+        frame->shape = (LiteralShape) {.count = 0, .exact = true};
+    }
+}
+
+/**
+ * Sprawdza, czy kształt poziomu gwarantuje niezerowy wielomian
+ * @param[in] shape : kształt poziomu
+ */
+static inline bool LiteralShapeIsNonzero(const LiteralShape *shape)
+{
+    return shape->count > 0 && shape->exact;
 }
 
 /**
- * Usuwa stos @p s jednomianów z pamięci
- * @param[in] s : stos
+ * Dopisuje wyraz do kształtu poziomu
+ * @param[in,out] shape : kształt poziomu
+ * @param[in] exp : wykładnik wyrazu
+ * @param[in] nonzero : czy współczynnik wyrazu na pewno jest niezerowy
  */
-static inline void StackOfMonosDestructor(Stack *s)
+static inline void LiteralShapeAppend(LiteralShape *shape, poly_exp_t exp,
+                                      bool nonzero)
 {
-    StackDestroy(s, &MonoDestroy);
+    shape->exact = shape->exact && nonzero &&
+                   (shape->count == 0 || exp > shape->last_exp);
+    shape->last_exp = exp;
+    shape->is_number = false;
+    ++shape->count;
 }
 
 /**
- * Zmienia stos jednomianów w wielomian będący ich sumą
- * @param[in] s : stos
- * @return wynikowy wielomian
+ * Dodaje współczynnik do najgłębszego otwartego poziomu
+ * @param[in,out] s : stos
+ * @param[in] coeff : współczynnik
  */
-static inline Poly CollapseMonoStackIntoAPoly(Stack *s)
+static inline void ParseFramesAppendCoeff(ParseFrames *s, poly_coeff_t coeff)
 {
-    unsigned mono_count = StackSize(s);
-    if (mono_count == 0)
+    assert(s->size > 0);
+    ParseFrame *frame = &s->frames[s->size - 1];
+    if (s->building)
     {
-        StackDestroy(s, &MonoDestroy);
-        return PolyZero();
+        Poly c = PolyFromCoeff(coeff);
+        PolyBuilderAppend(&frame->builder, &c, 0);
     }
+    else {
+        const bool first = frame->shape.count == 0;
+        LiteralShapeAppend(&frame->shape, 0, coeff != 0);
+        frame->shape.is_number = first;
+        frame->shape.value = coeff;
+    }
+}
 
-    Mono *arr = calloc(mono_count, sizeof(Mono));
-    assert(arr != NULL);
-
-    while (StackSize(s))
+/**
+ * Zamyka najgłębszy otwarty poziom i dodaje go jako jednomian
+ * do poziomu powyżej
+ * @param[in,out] s : stos
+ * @param[in] exp : wykładnik jednomianu
+ */
+static inline void ParseFramesCloseMono(ParseFrames *s, poly_exp_t exp)
+{
+    assert(s->size > 1);
+    ParseFrame *frame = &s->frames[--s->size];
+    ParseFrame *parent = &s->frames[s->size - 1];
+    if (s->building)
     {
-        arr[StackSize(s) - 1] = *(Mono *)StackTop(s);
-
-        free(StackTop(s));
-        StackPop(s);
+        Poly p = PolyBuilderFinish(&frame->builder);
+        PolyBuilderAppend(&parent->builder, &p, exp);
+    }
+    else {
+        LiteralShapeAppend(&parent->shape, exp,
+                           LiteralShapeIsNonzero(&frame->shape));
     }
-    StackDestroy(s, NULL);
+}
 
-    Poly temp = PolyAddMonos(mono_count, arr);
-    free(arr);
-    return temp;
+/**
+ * Zamyka najgłębszy otwarty poziom
+ * @param[in,out] s : stos (budujący wielomian)
+ * @return wielomian zbudowany na zamykanym poziomie
+ */
+static inline Poly ParseFramesPop(ParseFrames *s)
+{
+    assert(s->size > 0 && s->building);
+    return PolyBuilderFinish(&s->frames[--s->size].builder);
 }
 
-Poly ReadPolynomial(InputStream *stream)
+/**
+ * Usuwa stos razem z budowanymi wielomianami
+ * @param[in,out] s : stos
+ */
+static void ParseFramesDestroy(ParseFrames *s)
+{
+    while (s->building && s->size > 0)
+    {
+        Poly p = ParseFramesPop(s);
+        PolyDestroy(&p);
+    }
+    if (s->frames != s->local)
+    {
+        free(s->frames);
+    }
+}
+
+/**
+ * Wychodzi z funkcji wczytującej wielomian jeżeli
+ * predykat jest spełniony.
+ * 
+ * Zwalnia stos budowanych poziomów
+ * @param[in] condition_parse_poly_exit_if : predykat
+ */
+#define PARSE_POLY_EXIT_IF(condition_parse_poly_exit_if)\
+if (condition_parse_poly_exit_if)\
+{\
+    ParseFramesDestroy(parse_frames);\
+    return false;\
+}\
+
+/**
+ * Wychodzi z funkcji wczytującej wielomian i wypisuje błąd
+ * jeżeli predykat nie jest spełniony.
+ * 
+ * Zwalnia stos budowanych poziomów i ustawia flagę parse_error
+ * @param[in] condition_parse_poly_expect : predykat
+ */
+#define PARSE_POLY_EXPECT(condition_parse_poly_expect) \
+if ((condition_parse_poly_expect) == false)\
+{\
+    OutputFormat(&error_output, "ERROR %u %u\n",\
+                 stream->line_number + 1, stream->column_number + 1);\
+    SkipLine(stream);\
+    stream->parse_error = true;\
+\
+    PARSE_POLY_EXIT_IF(true)\
+}\
+
+/**
+ * Wczytuje wielomian na stos poziomów
+ *
+ * Po powodzeniu na stosie pozostaje jeden poziom z całym wielomianem.
+ * W przypadku błędu wypisuje komunikat, pomija resztę linii, ustawia
+ * stream->parse_error na true i usuwa stos.
+ * @param[in,out] stream : wskaźnik na wykorzystywany InputStream
+ * @param[in,out] parse_frames : pusty, zainicjowany stos poziomów
+ * @return czy wielomian jest poprawny
+ */
+static bool ParsePolynomial(InputStream *stream, ParseFrames *parse_frames)
 {
     bool expecting_mono = false;
-    Stack parse_stack = StackInit();
-    StackPush(&parse_stack, NewStack());
+    ParseFramesPush(parse_frames);
 
     PARSE_POLY_EXPECT(IsValidNumberCharacter(PeekCharacter(stream)) ||
                       PeekCharacter(stream) == '(')
@@ -119,7 +248,7 @@ Poly ReadPolynomial(InputStream *stream)
         {
             ReadCharacter(stream);
 
-            StackPush(&parse_stack, NewStack());
+            ParseFramesPush(parse_frames);
             expecting_mono = false;
             PARSE_POLY_EXPECT(IsValidNumberCharacter(PeekCharacter(stream)) ||
                               PeekCharacter(stream) == '(')
@@ -130,34 +259,18 @@ Poly ReadPolynomial(InputStream *stream)
             poly_coeff_t coeff = ReadPolyCoefficient(stream);
             PARSE_POLY_EXIT_IF(stream->parse_error)
 
-            if (coeff != 0)
-            {
-                Poly c = PolyFromCoeff(coeff);
-                Mono *m = NewMono(MonoFromPoly(&c, 0));
-                StackPush(StackTop(&parse_stack), m);
-            }
+            ParseFramesAppendCoeff(parse_frames, coeff);
         }
         else if (PeekCharacter(stream) == ',' && expecting_mono == false &&
-                 StackSize(&parse_stack) > 1)
+                 parse_frames->size > 1)
         {
 
             ReadCharacter(stream);
             poly_exp_t exponent = ReadExponent(stream);
             PARSE_POLY_EXIT_IF(stream->parse_error)
-            PARSE_POLY_EXPECT(StackSize(&parse_stack) > 1)
-
-            Poly p = CollapseMonoStackIntoAPoly(StackTop(&parse_stack));
-            free(StackTop(&parse_stack));
-            StackPop(&parse_stack);
+            PARSE_POLY_EXPECT(parse_frames->size > 1)
 
-            if (!PolyIsZero(&p))
-            {
-                Mono *m = NewMono(MonoFromPoly(&p, exponent));
-                StackPush(StackTop(&parse_stack), m);
-            }
-            else {
-                PolyDestroy(&p);
-            }
+            ParseFramesCloseMono(parse_frames, exponent);
 
             PARSE_POLY_EXPECT(PeekCharacter(stream)==')')
             ReadCharacter(stream);
@@ -176,12 +289,80 @@ Poly ReadPolynomial(InputStream *stream)
             PARSE_POLY_EXPECT(false)
         }
     }
-    PARSE_POLY_EXPECT(StackSize(&parse_stack) == 1 && expecting_mono == false)
+    PARSE_POLY_EXPECT(parse_frames->size == 1 && expecting_mono == false)
     ReadCharacter(stream);
 
-    Poly result = CollapseMonoStackIntoAPoly(StackTop(&parse_stack));
-    free(StackTop(&parse_stack));
-    StackDestroy(&parse_stack, NULL);
+    return true;
+}
+
+Poly ReadPolynomial(InputStream *stream)
+{
+    ParseFrames parse_frames;
+    ParseFramesInit(&parse_frames, true);
+    if (!ParsePolynomial(stream, &parse_frames))
+    {
+        return PolyZero();
+    }
+
+    Poly result = ParseFramesPop(&parse_frames);
+    ParseFramesDestroy(&parse_frames);
+
+    return result;
+}
+
+void ReadPolynomialLiteral(InputStream *stream, PolyLiteral *literal)
+{
+    assert(stream->mapped_size > 0 && stream->column_number == 0);
+    literal->start = stream->current_character_ptr;
+    literal->line_number = stream->line_number;
+    literal->is_serialized = false;
 
+    ParseFrames parse_frames;
+    ParseFramesInit(&parse_frames, false);
+    if (!ParsePolynomial(stream, &parse_frames))
+    {
+        return;
+    }
+    literal->length = stream->current_character_ptr - literal->start;
+
+    const LiteralShape *shape = &parse_frames.frames[0].shape;
+    literal->is_coeff = LITERAL_FACT_UNKNOWN;
+    literal->is_zero = LITERAL_FACT_UNKNOWN;
+    if (shape->is_number)
+    {
+        literal->is_coeff = LITERAL_FACT_TRUE;
+        literal->is_zero = shape->value == 0 ? LITERAL_FACT_TRUE :
+                                               LITERAL_FACT_FALSE;
+    }
+    else if (shape->exact)
+    {
+        literal->is_zero = LITERAL_FACT_FALSE;
+        if (shape->last_exp > 0)
+        {
+            literal->is_coeff = LITERAL_FACT_FALSE;
+        }
+    }
+    ParseFramesDestroy(&parse_frames);
+}
+
+Poly PolyLiteralParse(const PolyLiteral *literal)
+{
+    Poly result;
+    if (literal->is_serialized)
+    {
+        const unsigned char *data = (const unsigned char *)literal->start;
+        const unsigned char *end = PolyDeserialize(data, data + literal->length,
+                                                   &result);
+        assert(end == data + literal->length);
+        (void)end;
+    }
+    else {
+        InputStream stream = InputStreamFromMemory(literal->start,
+                                                   literal->length,
+                                                   literal->line_number);
+        result = ReadPolynomial(&stream);
+        assert(!stream.parse_error);
+    }
+    PolyRingReduce(&result);
     return result;
 }
@@ -0,0 +1,564 @@
+/** @file
+   Implementacja potokowego przetwarzania wejścia
+
+   @date 2017-06-05
+*/
+
+// sysconf wymaga rozszerzeń POSIX, niedostępnych przy -std=c11.
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "parse.h"
+#include "pipeline.h"
+#include "utils.h"
+
+/**
+ * Czy etapy potoku działają w osobnych wątkach?
+ *
+ * Alokacje w testach jednostkowych nie są bezpieczne wielowątkowo,
+ * dlatego tam wszystkie etapy wykonuje po kolei wątek główny.
+ */
+#ifdef UNIT_TESTING
+#define PIPELINE_THREADS false
+#else
+#define PIPELINE_THREADS true
+#endif
+
+#define PIPELINE_SPLIT_BATCH 64
+///< Liczba wierszy publikowanych przez wątek dzielący przed obudzeniem innych
+#define PIPELINE_CONSUMED_BATCH (PIPELINE_RING_SIZE / 2)
+///< Co tyle wykonanych wierszy budzimy wątek dzielący czekający na miejsce
+#define PIPELINE_ERROR_CAPACITY 64
+///< Początkowy rozmiar bufora komunikatów o błędach wczytywanego wiersza
+
+/**
+ * Struktura przechowująca wiersz wejścia w potoku
+ *
+ * Pola poza `ready` wypełnia wątek dzielący przed opublikowaniem wiersza;
+ * wyniki wczytywania wielomianu zapisuje wątek, który zajął wiersz,
+ * przed ustawieniem `ready`. Wiersze z poleceniami też są zajmowane
+ * i oznaczane jako gotowe przez ten wątek.
+ */
+typedef struct PipelineLine
+{
+    const char *start; ///< Początek wiersza
+    size_t length; ///< Długość wiersza (ze znakiem nowej linii, jeśli go ma)
+    unsigned line_number; ///< Numer wiersza (liczony od 0)
+    bool is_polynomial; ///< Czy wiersz zawiera wielomian (a nie polecenie)
+    /// Wczytany wielomian lub literał jako element stosu
+    /// (NULL w przypadku błędu)
+    void *entry;
+    char *errors; ///< Komunikaty o błędach wiersza (lub NULL)
+    atomic_bool ready; ///< Czy wiersz może zostać wykonany
+} PipelineLine;
+
+/**
+ * Struktura przechowująca sygnał zdarzenia potoku
+ *
+ * Każde zdarzenie zwiększa licznik `events`. Muteks potoku i zmienna
+ * warunkowa są potrzebne tylko wtedy, gdy ktoś czeka (`waiters`).
+ */
+typedef struct PipelineSignal
+{
+    _Alignas(64) atomic_ulong events; ///< Liczba dotychczasowych zdarzeń
+    atomic_uint waiters; ///< Liczba wątków śpiących na sygnale
+    pthread_cond_t changed; ///< Budzi śpiące wątki po zdarzeniu
+} PipelineSignal;
+
+/**
+ * Struktura przechowująca stan potoku
+ *
+ * Wiersze trafiają do cyklicznej tablicy `lines` w kolejności wejścia.
+ * Liczniki tylko rosną: `split` (wiersze opublikowane przez jedynego
+ * producenta, wątek dzielący), `claimed` (wiersze zajęte przez wątki
+ * wczytujące, zwiększany przez compare-and-swap) oraz `consumed` (wiersze
+ * wykonane przez jedynego konsumenta, wątek główny). Wiersz numer `i`
+ * zajmuje miejsce `i % PIPELINE_RING_SIZE`, zwalniane po jego wykonaniu.
+ *
+ * Etap, który nie może kontynuować, śpi na sygnale zdarzenia, na które
+ * czeka: opublikowania wierszy (`split_signal`), zwolnienia miejsc tablicy
+ * (`consumed_signal`) lub wczytania wiersza (`ready_signal`).
+ */
+typedef struct Pipeline
+{
+    PipelineLine lines[PIPELINE_RING_SIZE]; ///< Wiersze w potoku
+    const char *data; ///< Dzielone wejście
+    const char *end; ///< Koniec dzielonego wejścia
+    const char *position; ///< Początek kolejnego wiersza do podziału
+    unsigned line_number; ///< Numer kolejnego wiersza do podziału
+    _Alignas(64) atomic_ulong split; ///< Liczba opublikowanych wierszy
+    _Alignas(64) atomic_ulong claimed; ///< Liczba zajętych wierszy
+    _Alignas(64) atomic_ulong consumed; ///< Liczba wykonanych wierszy
+    atomic_bool finished; ///< Czy podzielono całe wejście
+    atomic_bool stop; ///< Czy wątki wczytujące mają zakończyć pracę
+    /// Opublikowano wiersze, podzielono całe wejście lub zatrzymano potok
+    PipelineSignal split_signal;
+    /// Zwolniono miejsca w tablicy wierszy
+    PipelineSignal consumed_signal;
+    /// Wczytano wiersz
+    PipelineSignal ready_signal;
+    pthread_mutex_t lock; ///< Chroni usypianie na sygnałach
+} Pipeline;
+
+/**
+ * Inicjuje sygnał zdarzenia potoku
+ * @param[out] signal : sygnał
+ */
+static void PipelineSignalInit(PipelineSignal *signal)
+{
+    atomic_init(&signal->events, 0);
+    atomic_init(&signal->waiters, 0);
+    pthread_cond_init(&signal->changed, NULL);
+}
+
+/**
+ * Zwraca licznik zdarzeń sygnału
+ *
+ * Czekający wątek odczytuje go przed sprawdzeniem, czy może kontynuować,
+ * i przekazuje do PipelineWait.
+ * @param[in,out] signal : sygnał
+ * @return liczba dotychczasowych zdarzeń
+ */
+static unsigned long PipelineEvents(PipelineSignal *signal)
+{
+    return atomic_load(&signal->events);
+}
+
+/**
+ * Zgłasza zdarzenie i budzi czekające na nie wątki
+ * @param[in,out] pipeline : potok
+ * @param[in,out] signal : sygnał zdarzenia
+ */
+static void PipelineNotify(Pipeline *pipeline, PipelineSignal *signal)
+{
+    atomic_fetch_add(&signal->events, 1);
+    if (atomic_load(&signal->waiters) > 0)
+    {
+        pthread_mutex_lock(&pipeline->lock);
+        pthread_cond_broadcast(&signal->changed);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+}
+
+/**
+ * Usypia wątek do kolejnego zdarzenia
+ *
+ * Jeśli zdarzenie nastąpiło od odczytania @p seen, wraca od razu.
+ * @param[in,out] pipeline : potok
+ * @param[in,out] signal : sygnał zdarzenia
+ * @param[in] seen : wynik PipelineEvents sprzed sprawdzenia stanu
+ */
+static void PipelineWait(Pipeline *pipeline, PipelineSignal *signal,
+                         unsigned long seen)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    atomic_fetch_add(&signal->waiters, 1);
+    while (atomic_load(&signal->events) == seen)
+    {
+        pthread_cond_wait(&signal->changed, &pipeline->lock);
+    }
+    atomic_fetch_sub(&signal->waiters, 1);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/**
+ * Publikuje kolejny wiersz wejścia
+ *
+ * Wolno wywoływać tylko z jednego wątku naraz. Nie budzi czekających
+ * na nowe wiersze, robi to wywołujący.
+ * @param[in,out] pipeline : potok
+ * @return czy opublikowano wiersz (false na końcu wejścia
+ * lub gdy tablica wierszy jest pełna)
+ */
+static bool PipelineSplitLine(Pipeline *pipeline)
+{
+    if (pipeline->position == pipeline->end)
+    {
+        atomic_store_explicit(&pipeline->finished, true, memory_order_release);
+        PipelineNotify(pipeline, &pipeline->split_signal);
+        return false;
+    }
+
+    const unsigned long index = atomic_load_explicit(&pipeline->split,
+                                                     memory_order_relaxed);
+    if (index - atomic_load_explicit(&pipeline->consumed,
+                                     memory_order_acquire) >=
+        PIPELINE_RING_SIZE)
+    {
+        return false;
+    }
+
+    const char *start = pipeline->position;
+    const char *end_of_line = memchr(start, '\n', pipeline->end - start);
+    PipelineLine *line = &pipeline->lines[index % PIPELINE_RING_SIZE];
+    line->start = start;
+    line->length = end_of_line != NULL ? (size_t)(end_of_line - start) + 1 :
+                                         (size_t)(pipeline->end - start);
+    line->line_number = pipeline->line_number++;
+    line->is_polynomial = !IsValidCommandCharacter(*start);
+    line->entry = NULL;
+    line->errors = NULL;
+    // Także polecenie oznacza jako gotowe dopiero wątek, który je zajął:
+    // do tego czasu miejsce w pierścieniu nie może zostać użyte ponownie.
+    atomic_store_explicit(&line->ready, false, memory_order_relaxed);
+    pipeline->position += line->length;
+
+    atomic_store_explicit(&pipeline->split, index + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * Wczytuje wielomian z wiersza
+ *
+ * Jeśli literały się opłacają, tylko sprawdza składnię wielomianu,
+ * jak przy przetwarzaniu wiersz po wierszu. Komunikaty o błędach zbiera
+ * w @p errors zamiast na wyjściu błędów, żeby wątek główny wypisał je
+ * w kolejności wierszy.
+ * @param[in,out] pipeline : potok
+ * @param[in,out] line : zajęty wiersz
+ * @param[in,out] errors : napis w pamięci na komunikaty o błędach
+ */
+static void PipelineParseLine(Pipeline *pipeline, PipelineLine *line,
+                              OutputWriter *errors)
+{
+    if (line->is_polynomial)
+    {
+        const OutputWriter saved_error_output = error_output;
+        error_output = *errors;
+
+        InputStream stream = InputStreamFromMemory(line->start, line->length,
+                                                   line->line_number);
+        if (PolyLiteralPreferred(line->line_number))
+        {
+            PolyLiteral *literal = malloc(sizeof(PolyLiteral));
+            assert(literal != NULL);
+            ReadPolynomialLiteral(&stream, literal);
+            if (stream.parse_error)
+            {
+                free(literal);
+            }
+            else {
+                line->entry = StackEntryFromLiteral(literal);
+            }
+        }
+        else {
+            Poly *p = malloc(sizeof(Poly));
+            assert(p != NULL);
+            *p = ReadPolynomial(&stream);
+            if (stream.parse_error)
+            {
+                PolyDestroy(p);
+                free(p);
+            }
+            else {
+                line->entry = p;
+            }
+        }
+
+        *errors = error_output;
+        error_output = saved_error_output;
+        if (errors->length > 0)
+        {
+            line->errors = OutputStringFinish(errors);
+            *errors = OutputStringInit(PIPELINE_ERROR_CAPACITY);
+        }
+    }
+
+    atomic_store_explicit(&line->ready, true, memory_order_release);
+    PipelineNotify(pipeline, &pipeline->ready_signal);
+}
+
+/**
+ * Zajmuje i wczytuje kolejny opublikowany wiersz
+ * @param[in,out] pipeline : potok
+ * @param[in] limit : zajmujemy tylko wiersze o numerach mniejszych
+ * @param[in,out] errors : napis w pamięci na komunikaty o błędach
+ * @return czy wczytano wiersz
+ */
+static bool PipelineParseNext(Pipeline *pipeline, unsigned long limit,
+                              OutputWriter *errors)
+{
+    unsigned long index = atomic_load_explicit(&pipeline->claimed,
+                                               memory_order_relaxed);
+    while (index < limit &&
+           index < atomic_load_explicit(&pipeline->split,
+                                        memory_order_acquire))
+    {
+        if (atomic_compare_exchange_weak_explicit(&pipeline->claimed, &index,
+                                                  index + 1,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+        {
+            PipelineParseLine(pipeline,
+                              &pipeline->lines[index % PIPELINE_RING_SIZE],
+                              errors);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Funkcja wątku dzielącego wejście na wiersze
+ * @param[in,out] arg : potok
+ * @return NULL
+ */
+static void* PipelineSplitter(void *arg)
+{
+    Pipeline *pipeline = arg;
+    while (pipeline->position != pipeline->end)
+    {
+        const unsigned long seen = PipelineEvents(&pipeline->consumed_signal);
+        unsigned count = 0;
+        while (count < PIPELINE_SPLIT_BATCH && PipelineSplitLine(pipeline))
+        {
+            ++count;
+        }
+
+        if (count > 0)
+        {
+            PipelineNotify(pipeline, &pipeline->split_signal);
+        }
+        else {
+            PipelineWait(pipeline, &pipeline->consumed_signal, seen);
+        }
+    }
+    atomic_store_explicit(&pipeline->finished, true, memory_order_release);
+    PipelineNotify(pipeline, &pipeline->split_signal);
+    return NULL;
+}
+
+/**
+ * Funkcja wątku wczytującego wielomiany
+ * @param[in,out] arg : potok
+ * @return NULL
+ */
+static void* PipelineWorker(void *arg)
+{
+    Pipeline *pipeline = arg;
+    OutputWriter errors = OutputStringInit(PIPELINE_ERROR_CAPACITY);
+    while (!atomic_load_explicit(&pipeline->stop, memory_order_relaxed))
+    {
+        const unsigned long seen = PipelineEvents(&pipeline->split_signal);
+        if (PipelineParseNext(pipeline, ULONG_MAX, &errors))
+        {
+            continue;
+        }
+        if (atomic_load_explicit(&pipeline->finished,
+                                      memory_order_acquire) &&
+                 atomic_load_explicit(&pipeline->claimed,
+                                      memory_order_relaxed) ==
+                 atomic_load_explicit(&pipeline->split, memory_order_relaxed))
+        {
+            break;
+        }
+        PipelineWait(pipeline, &pipeline->split_signal, seen);
+    }
+    free(OutputStringFinish(&errors));
+    return NULL;
+}
+
+/**
+ * Czeka, aż wiersz o podanym numerze będzie gotowy do wykonania
+ *
+ * Bez wątku dzielącego sami publikujemy wiersze, a wiersz, którego
+ * nie zajął jeszcze żaden wątek wczytujący, wczytujemy sami.
+ * @param[in,out] pipeline : potok
+ * @param[in] index : numer wiersza
+ * @param[in] has_splitter : czy działa wątek dzielący
+ * @param[in,out] errors : napis w pamięci na komunikaty o błędach
+ * @return wiersz lub NULL na końcu wejścia
+ */
+static PipelineLine* PipelineNextLine(Pipeline *pipeline, unsigned long index,
+                                      bool has_splitter, OutputWriter *errors)
+{
+    unsigned long seen = PipelineEvents(&pipeline->split_signal);
+    while (index >= atomic_load_explicit(&pipeline->split,
+                                         memory_order_acquire))
+    {
+        if (!has_splitter)
+        {
+            if (!PipelineSplitLine(pipeline))
+            {
+                return NULL;
+            }
+            PipelineNotify(pipeline, &pipeline->split_signal);
+        }
+        else if (atomic_load_explicit(&pipeline->finished,
+                                      memory_order_acquire) &&
+                 index >= atomic_load_explicit(&pipeline->split,
+                                               memory_order_acquire))
+        {
+            return NULL;
+        }
+        else {
+            PipelineWait(pipeline, &pipeline->split_signal, seen);
+        }
+        seen = PipelineEvents(&pipeline->split_signal);
+    }
+
+    PipelineLine *line = &pipeline->lines[index % PIPELINE_RING_SIZE];
+    seen = PipelineEvents(&pipeline->ready_signal);
+    while (!atomic_load_explicit(&line->ready, memory_order_acquire))
+    {
+        if (!PipelineParseNext(pipeline, index + 1, errors))
+        {
+            PipelineWait(pipeline, &pipeline->ready_signal, seen);
+        }
+        seen = PipelineEvents(&pipeline->ready_signal);
+    }
+    return line;
+}
+
+/**
+ * Wykonuje wiersze potoku w kolejności wejścia
+ * @param[in,out] pipeline : potok
+ * @param[in] has_splitter : czy działa wątek dzielący
+ * @param[in,out] stream : wejście, na którego obecnej pozycji zaczyna się
+ * pierwszy wiersz potoku
+ * @param[in,out] poly_stack : stos wielomianów
+ */
+static void PipelineExecute(Pipeline *pipeline, bool has_splitter,
+                            InputStream *stream, Stack *poly_stack)
+{
+    OutputWriter errors = OutputStringInit(PIPELINE_ERROR_CAPACITY);
+    PipelineLine *line;
+    for (unsigned long index = 0;
+         (line = PipelineNextLine(pipeline, index, has_splitter,
+                                  &errors)) != NULL;
+         ++index)
+    {
+        assert(stream->current_character_ptr == line->start);
+        if (line->is_polynomial)
+        {
+            if (line->errors != NULL)
+            {
+                OutputWrite(&error_output, line->errors, strlen(line->errors));
+                free(line->errors);
+            }
+            if (line->entry != NULL && StackEntryIsLiteral(line->entry))
+            {
+                PolyStackPushLiteral(poly_stack,
+                                     StackEntryLiteral(line->entry));
+            }
+            else if (line->entry != NULL)
+            {
+                PolyRingReduce(line->entry);
+                StackPush(poly_stack, line->entry);
+            }
+            SkipLineOfLength(stream, line->length);
+        }
+        else {
+            // Polecenie wczytuje swój wiersz z wejścia, razem z końcem wiersza.
+            ReadAndExecuteCommand(stream, poly_stack);
+        }
+
+        atomic_store_explicit(&line->ready, false, memory_order_relaxed);
+        atomic_store_explicit(&pipeline->consumed, index + 1,
+                              memory_order_release);
+        if ((index + 1) % PIPELINE_CONSUMED_BATCH == 0)
+        {
+            PipelineNotify(pipeline, &pipeline->consumed_signal);
+        }
+    }
+    free(OutputStringFinish(&errors));
+}
+
+/**
+ * Usuwa potok z pamięci
+ * @param[in] pipeline : potok, którego wątki już się zakończyły
+ */
+static void PipelineDestroy(Pipeline *pipeline)
+{
+    pthread_cond_destroy(&pipeline->split_signal.changed);
+    pthread_cond_destroy(&pipeline->consumed_signal.changed);
+    pthread_cond_destroy(&pipeline->ready_signal.changed);
+    pthread_mutex_destroy(&pipeline->lock);
+    free(pipeline);
+}
+
+unsigned PipelineDefaultWorkerCount(void)
+{
+    const long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_count <= 1)
+    {
+        return 0;
+    }
+    return cpu_count - 1 < PIPELINE_DEFAULT_MAX_WORKERS ?
+           (unsigned)cpu_count - 1 : PIPELINE_DEFAULT_MAX_WORKERS;
+}
+
+bool PipelineRun(InputStream *stream, Stack *poly_stack, unsigned worker_count)
+{
+    assert(stream != NULL && poly_stack != NULL);
+    assert(worker_count > 0 && worker_count <= PIPELINE_MAX_WORKERS);
+    if (stream->mapped_size == 0 || stream->column_number != 0)
+    {
+        return false;
+    }
+
+    Pipeline *pipeline = malloc(sizeof(Pipeline));
+    assert(pipeline != NULL);
+    pipeline->data = stream->current_character_ptr;
+    pipeline->end = pipeline->data + stream->remaining_buffer_size;
+    pipeline->position = pipeline->data;
+    pipeline->line_number = stream->line_number;
+    atomic_init(&pipeline->split, 0);
+    atomic_init(&pipeline->claimed, 0);
+    atomic_init(&pipeline->consumed, 0);
+    atomic_init(&pipeline->finished, false);
+    atomic_init(&pipeline->stop, false);
+    PipelineSignalInit(&pipeline->split_signal);
+    PipelineSignalInit(&pipeline->consumed_signal);
+    PipelineSignalInit(&pipeline->ready_signal);
+    pthread_mutex_init(&pipeline->lock, NULL);
+    for (unsigned i = 0; i < PIPELINE_RING_SIZE; ++i)
+    {
+        atomic_init(&pipeline->lines[i].ready, false);
+    }
+
+    pthread_t workers[PIPELINE_MAX_WORKERS];
+    pthread_t splitter;
+    unsigned started = 0;
+    bool has_splitter = false;
+    if (PIPELINE_THREADS)
+    {
+        while (started < worker_count &&
+               pthread_create(&workers[started], NULL, &PipelineWorker,
+                              pipeline) == 0)
+        {
+            ++started;
+        }
+        has_splitter = started > 0 &&
+                       pthread_create(&splitter, NULL, &PipelineSplitter,
+                                      pipeline) == 0;
+        if (!has_splitter)
+        {
+            atomic_store_explicit(&pipeline->stop, true, memory_order_relaxed);
+            PipelineNotify(pipeline, &pipeline->split_signal);
+            for (unsigned i = 0; i < started; ++i)
+            {
+                pthread_join(workers[i], NULL);
+            }
+            PipelineDestroy(pipeline);
+            return false;
+        }
+    }
+
+    PipelineExecute(pipeline, has_splitter, stream, poly_stack);
+
+    atomic_store_explicit(&pipeline->stop, true, memory_order_relaxed);
+    PipelineNotify(pipeline, &pipeline->split_signal);
+    if (has_splitter)
+    {
+        pthread_join(splitter, NULL);
+    }
+    for (unsigned i = 0; i < started; ++i)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    PipelineDestroy(pipeline);
+    return true;
+}
@@ -0,0 +1,53 @@
+/** @file
+   Interfejs potokowego przetwarzania wejścia
+
+   Wiersze z wielomianami nie zależą od stanu stosu, więc można je wczytywać
+   równolegle z wykonywaniem poleceń. Potok ma trzy etapy: wątek dzielący
+   wejście na wiersze, pulę wątków wczytujących wielomiany i wątek główny,
+   który wykonuje polecenia i odkłada wielomiany na stos w kolejności
+   wierszy. Jeśli literały się opłacają, wątki wczytujące tylko sprawdzają
+   składnię wielomianów, a na stos trafiają niewczytane literały. Etapy
+   przekazują sobie wiersze przez cykliczną tablicę bez blokad, a na postęp
+   innych etapów czekają uśpione na zmiennej warunkowej.
+
+   @date 2017-06-05
+*/
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <stdbool.h>
+#include "input.h"
+#include "stack.h"
+
+#define PIPELINE_MAX_WORKERS 64
+///< Maksymalna liczba wątków wczytujących wielomiany
+#define PIPELINE_DEFAULT_MAX_WORKERS 8
+///< Maksymalna liczba wątków wczytujących dobierana automatycznie
+#define PIPELINE_RING_SIZE 1024
+///< Liczba wierszy, które mogą być jednocześnie w potoku
+
+/**
+ * Zwraca domyślną liczbę wątków wczytujących wielomiany
+ *
+ * Jeden procesor zostawiamy wątkowi głównemu; na jednym procesorze
+ * potok nie ma z czym się przeplatać, więc zwracamy 0.
+ * @return liczba wątków (0 oznacza wczytywanie bez potoku)
+ */
+unsigned PipelineDefaultWorkerCount(void);
+
+/**
+ * Przetwarza całe wejście potokowo
+ *
+ * Wymaga wejścia w całości dostępnego w pamięci (pliku odwzorowanego
+ * w pamięć). Komunikaty o błędach i ich numery wierszy i kolumn są takie
+ * same jak przy przetwarzaniu wiersz po wierszu.
+ * @param[in,out] stream : wskaźnik na InputStream
+ * @param[in,out] poly_stack : stos wielomianów
+ * @param[in] worker_count : liczba wątków wczytujących (dodatnia)
+ * @return czy przetworzono wejście (false, jeśli wejście nie jest w pamięci
+ * lub nie udało się utworzyć wątków; wejście pozostaje wtedy nieruszone)
+ */
+bool PipelineRun(InputStream *stream, Stack *poly_stack, unsigned worker_count);
+
+#endif /* __PIPELINE_H__ */
@@ -7,326 +7,4453 @@
 #include "poly.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "coeff_kernels.h"
 #include "stack.h"
 #include "utils.h"
 
+/**
+ * Maksymalna liczba wątków mnożących pary czynników w PolyProductN
+ *
+ * Alokacje w testach jednostkowych nie są bezpieczne wielowątkowo,
+ * dlatego tam mnożymy wszystko w wątku głównym.
+ */
+#ifdef UNIT_TESTING
+#define PRODUCT_MAX_THREADS 1
+#else
+#define PRODUCT_MAX_THREADS 16
+#endif
+
+#define PRODUCT_PARALLEL_THRESHOLD 4096
+///< Minimalny iloczyn rozmiarów pary czynników, dla którego opłaca się wątek
+
+/**
+ * Struktura przechowująca czynnik iloczynu liczonego przez PolyProductN
+ */
+typedef struct ProductFactor
+{
+    Poly poly; ///< Czynnik
+    size_t size; ///< Liczba jednomianów czynnika (łącznie z zagnieżdżonymi)
+    bool owned; ///< Czy czynnik jest wynikiem pośrednim do zwolnienia
+} ProductFactor;
+
+/**
+ * Struktura opisująca pracę jednego wątku mnożącego pary czynników
+ */
+typedef struct ProductTask
+{
+    const ProductFactor *factors; ///< Czynniki posortowane wg. rozmiaru
+    Poly *results; ///< Tablica wyników mnożenia kolejnych par
+    unsigned pair_count; ///< Liczba par w rundzie
+    unsigned first_pair; ///< Pierwsza para przetwarzana przez wątek
+    unsigned stride; ///< Odstęp między parami przetwarzanymi przez wątek
+} ProductTask;
+
+#define UNBOUNDED -1
+///< Wartość ograniczenia oznaczająca brak obcięcia wykładników
+
+/**
+ * Struktura przechowująca ograniczenie wykładników jednej zmiennej
+ *
+ * Jednomiany, w których zmienna o indeksie var_idx ma wykładnik
+ * większy lub równy limit, są pomijane (liczymy modulo `x_var_idx^limit`).
+ */
+typedef struct PolyBound
+{
+    unsigned var_idx; ///< Indeks ograniczanej zmiennej
+    poly_exp_t limit; ///< Wykładniki zmiennej muszą być mniejsze od limit
+} PolyBound;
+
+/**
+ * Struktura opisująca podstawienie `a * x + b` pod jedną zmienną
+ */
+typedef struct AffineMap
+{
+    poly_coeff_t a; ///< Współczynnik przy zmiennej
+    poly_coeff_t b; ///< Wyraz wolny
+} AffineMap;
+
+/**
+ * Struktura przechowująca wykładnik jednej zmiennej jednomianu
+ */
+typedef struct TermExp
+{
+    unsigned var_idx; ///< Indeks zmiennej
+    poly_exp_t exp; ///< Dodatni wykładnik zmiennej
+} TermExp;
+
+#define DENSE_MIN_LENGTH 16
+///< Minimalna liczba pozycji poziomu, który przetwarzamy w postaci gęstej
+#define DENSE_MAX_GAP 2
+///< Poziom jest gęsty, gdy zajęta jest średnio co DENSE_MAX_GAP-ta pozycja
+#define DENSE_SPARSE_GAP 4
+///< Przechowywany gęsto poziom wraca na listę, gdy zajęta jest rzadziej
+///< niż co DENSE_SPARSE_GAP-ta pozycja
+
+/**
+ * Struktura przechowująca gęsty poziom wielomianu o stałych współczynnikach
+ *
+ * Poziom, którego wszystkie współczynniki są stałymi, a zajęta jest co
+ * najmniej co DENSE_MAX_GAP-ta pozycja, trzymamy zamiast listy w tablicy
+ * indeksowanej wykładnikiem: współczynnik przy `x^(i * stride)` leży na
+ * pozycji i. Pozycja 0 jest zawsze zerem (stała poziomu leży w polu
+ * constant wielomianu), a ostatnia pozycja nie jest zerem. Poziom wraca
+ * na listę dopiero, gdy zrobi się DENSE_SPARSE_GAP razy rzadszy, więc
+ * kolejne działania nie przełączają go w tę i z powrotem.
+ */
+struct DenseCoeffs
+{
+    poly_exp_t stride; ///< Odstęp między wykładnikami kolejnych pozycji
+    poly_exp_t length; ///< Liczba pozycji
+    unsigned count; ///< Liczba niezerowych pozycji
+    poly_coeff_t coeffs[]; ///< Współczynniki (bez mnożnika wielomianu)
+};
+
+/**
+ * Struktura przechowująca gęstą postać poziomu wielomianu
+ *
+ * Współczynnik przy `x^(i * stride)` leży na pozycji i tablic. Poziomy
+ * o wielomianowych współczynnikach przechowujemy jako listy, a gęstą
+ * postać budujemy tylko na czas działań, w których tablica indeksowana
+ * wykładnikiem zastępuje sortowanie i scalanie list.
+ */
+typedef struct DenseLevel
+{
+    poly_exp_t stride; ///< Odstęp między wykładnikami kolejnych pozycji
+    poly_exp_t length; ///< Liczba pozycji
+    /// Współczynniki jednomianów (NULL dla brakujących wykładników)
+    const Poly **polys;
+    /// Stałe współczynniki wraz ze stałą poziomu na pozycji 0
+    /// (NULL, gdy któryś jednomian ma współczynnik wielomianowy)
+    poly_coeff_t *coeffs;
+    /// Współczynniki wskazywane przez polys, jeśli poziom jest
+    /// przechowywany gęsto (NULL dla listy)
+    Poly *coeff_polys;
+} DenseLevel;
+
+/// Liczba iloczynów poziomów policzonych w postaci gęstej w bieżącym wątku
+static _Thread_local unsigned long dense_mul_count = 0;
+/// Liczba wartości poziomów policzonych w postaci gęstej w bieżącym wątku
+static _Thread_local unsigned long dense_at_count = 0;
+
+#define MONO_BLOCK_CAPACITY 5
+///< Liczba jednomianów w jednym bloku listy (blok zajmuje 256 bajtów)
+
+/**
+ * Struktura przechowująca blok listy jednomianów
+ *
+ * Lista jednomianów wielomianu jest listą bloków, z których każdy trzyma
+ * w tablicy kilka kolejnych jednomianów. Przeglądanie listy czyta więc
+ * jednomiany leżące obok siebie w pamięci, a wstawienie jednomianu
+ * przesuwa co najwyżej kilka jednomianów jednego bloku (pełny blok
+ * dzielimy na dwa). Bloki listy nie są puste, a wykładniki rosną wzdłuż
+ * całej listy.
+ */
+struct MonoBlock
+{
+    MonoBlock *next_block; ///< Następny blok listy
+    unsigned count; ///< Liczba jednomianów bloku
+    Mono monos[MONO_BLOCK_CAPACITY]; ///< Jednomiany bloku
+};
+
+/**
+ * Struktura wskazująca jednomian na liście jednomianów
+ *
+ * Dla poziomu przechowywanego gęsto wskaźnik przechodzi po niezerowych
+ * pozycjach tablicy, a jednomian pozycji odtwarza w polu dense_mono.
+ * Wskazywany jednomian jest wtedy ważny tylko do następnego MonoNext.
+ */
+typedef struct MonoCursor
+{
+    MonoBlock *block; ///< Blok zawierający jednomian (NULL za końcem listy)
+    Mono *mono; ///< Jednomian (NULL za końcem listy)
+    const DenseCoeffs *dense; ///< Tablica poziomu gęstego (NULL dla listy)
+    poly_exp_t position; ///< Pozycja jednomianu w tablicy dense
+    Mono dense_mono; ///< Jednomian odtworzony z tablicy dense
+} MonoCursor;
+
+/**
+ * Przesuwa wskaźnik na poziomie gęstym na pierwszą niezerową pozycję,
+ * nie mniejszą od bieżącej
+ * @param[in,out] cursor : wskaźnik na poziomie gęstym
+ */
+static inline void MonoDenseSeek(MonoCursor *cursor)
+{
+    const DenseCoeffs * const dense = cursor->dense;
+    while (cursor->position < dense->length &&
+           dense->coeffs[cursor->position] == 0)
+    {
+        ++cursor->position;
+    }
+
+    if (cursor->position == dense->length)
+    {
+        cursor->mono = NULL;
+        return;
+    }
+
+    cursor->dense_mono = (Mono) {
+        .p = PolyFromCoeff(dense->coeffs[cursor->position]),
+        .exp = cursor->position * dense->stride};
+    cursor->mono = &cursor->dense_mono;
+}
+
+/**
+ * Ustawia wskaźnik na pierwszy jednomian wielomianu
+ * @param[out] cursor : wskaźnik (za końcem listy, jeśli @p p jest
+ * współczynnikiem)
+ * @param[in] p : wielomian
+ */
+static inline void MonoBegin(MonoCursor *cursor, const Poly *p)
+{
+    if (p->is_dense)
+    {
+        cursor->block = NULL;
+        cursor->dense = p->dense;
+        cursor->position = 0;
+        MonoDenseSeek(cursor);
+        return;
+    }
+
+    MonoBlock * const block = p->first_block;
+    cursor->block = block;
+    cursor->mono = block == NULL ? NULL : block->monos;
+    cursor->dense = NULL;
+}
+
+/**
+ * Przesuwa wskaźnik na następny jednomian listy
+ * @param[in,out] cursor : wskaźnik na jednomian (nie za końcem listy)
+ */
+static inline void MonoNext(MonoCursor *cursor)
+{
+    if (cursor->dense != NULL)
+    {
+        ++cursor->position;
+        MonoDenseSeek(cursor);
+    }
+    else if (++cursor->mono == cursor->block->monos + cursor->block->count)
+    {
+        cursor->block = cursor->block->next_block;
+        cursor->mono = cursor->block == NULL ? NULL : cursor->block->monos;
+    }
+}
+
+/**
+ * Zwraca pierwszy jednomian wielomianu
+ * @param[in] p : wielomian przechowywany jako lista
+ * @return jednomian o najmniejszym wykładniku (NULL dla współczynnika)
+ */
+static inline Mono* FirstMono(const Poly *p)
+{
+    assert(!p->is_dense);
+    return p->first_block == NULL ? NULL : p->first_block->monos;
+}
+
+/**
+ * Zwraca ostatni jednomian wielomianu
+ * @param[in] p : wielomian przechowywany jako lista, który nie jest
+ * współczynnikiem
+ * @return jednomian o największym wykładniku
+ */
+static inline Mono* LastMono(const Poly *p)
+{
+    assert(!p->is_dense);
+    MonoBlock *block = p->first_block;
+    while (block->next_block != NULL)
+    {
+        block = block->next_block;
+    }
+
+    return &block->monos[block->count - 1];
+}
+
+/**
+ * Sprawdza, czy wielomian ma dokładnie jeden jednomian
+ * @param[in] p : wielomian
+ * @return Czy lista jednomianów @p p ma jeden element?
+ */
+static inline bool HasSingleMono(const Poly *p)
+{
+    return !p->is_dense && p->first_block != NULL &&
+           p->first_block->count == 1 &&
+           p->first_block->next_block == NULL;
+}
+
+#define MONO_INDEX_THRESHOLD 1024
+///< Minimalna liczba jednomianów listy, dla której budujemy indeks
+#define MONO_INDEX_STRIDE 32
+///< Odstęp (w jednomianach) między kolejnymi wskaźnikami indeksu
+
+/**
+ * Struktura przechowująca indeks listy jednomianów
+ *
+ * Indeks to posortowana tablica wskaźników na bloki listy, rozmieszczone
+ * co około MONO_INDEX_STRIDE jednomianów. Wyszukiwanie binarne w tablicy
+ * (wg. pierwszych wykładników bloków), a potem przejście krótkiego
+ * fragmentu listy, znajduje jednomian o danym wykładniku w czasie
+ * `O(log n)`. Wskaźniki mogą się powtarzać po usunięciu bloków, ale
+ * pierwsze wykładniki ich bloków są zawsze niemalejące.
+ */
+struct MonoIndex
+{
+    MonoBlock **fences; ///< Wskaźniki na bloki listy
+    unsigned fence_count; ///< Liczba wskaźników
+    unsigned mono_count; ///< Liczba jednomianów listy
+};
+
+/// Ograniczenia pierścienia sesji, posortowane rosnąco wg. var_idx
+static PolyBound *ring_bounds = NULL;
+/// Liczba ograniczeń pierścienia sesji
+static unsigned ring_bound_count = 0;
+
+#define REORDER_MAX_VARS 8
+///< Liczba pierwszych zmiennych, których kolejność może zmienić PolyProductN
+
+/// Czy PolyProductN ma mnożyć przy kolejności zmiennych wybranej heurystyką
+static bool product_reorder = false;
+
+/**
+ * Domyślny limit rozmiaru pamięci podręcznej potęg (w jednomianach)
+ *
+ * Pamięć podręczna przeżywa pojedyncze testy jednostkowe i psułaby
+ * sprawdzanie wycieków, dlatego tam jest domyślnie wyłączona.
+ */
+#ifdef UNIT_TESTING
+#define POWER_CACHE_DEFAULT_BUDGET 0
+#else
+#define POWER_CACHE_DEFAULT_BUDGET (1 << 20)
+#endif
+
+#define POWER_CACHE_MAX_ENTRIES 256
+///< Maksymalna liczba potęg w pamięci podręcznej
+
+/**
+ * Struktura przechowująca potęgę wielomianu w pamięci podręcznej
+ */
+typedef struct PowerCacheEntry
+{
+    unsigned long long hash; ///< Skrót struktury podstawy
+    Poly base; ///< Podstawa potęgi
+    poly_exp_t exp; ///< Wykładnik potęgi
+    Poly power; ///< Potęga
+    size_t size; ///< Liczba jednomianów podstawy i potęgi
+    struct PowerCacheEntry *prev; ///< Wcześniej użyta potęga
+    struct PowerCacheEntry *next; ///< Później użyta potęga
+} PowerCacheEntry;
+
+/// Ostatnio użyta potęga w pamięci podręcznej
+static PowerCacheEntry *power_cache_head = NULL;
+/// Najdawniej użyta potęga w pamięci podręcznej
+static PowerCacheEntry *power_cache_tail = NULL;
+/// Liczba potęg w pamięci podręcznej
+static unsigned power_cache_count = 0;
+/// Łączny rozmiar potęg w pamięci podręcznej (w jednomianach)
+static size_t power_cache_size = 0;
+/// Limit rozmiaru pamięci podręcznej (w jednomianach)
+static size_t power_cache_budget = POWER_CACHE_DEFAULT_BUDGET;
+/// Liczba potęg znalezionych w pamięci podręcznej
+static unsigned long power_cache_hits = 0;
+/// Liczba potęg, których nie było w pamięci podręcznej
+static unsigned long power_cache_misses = 0;
+
+/**
+ * Struktura przechowująca wyraz wielomianu o przestawionych zmiennych
+ */
+typedef struct PermutedTerm
+{
+    const poly_exp_t *exps; ///< Wykładniki przestawianych zmiennych
+    unsigned count; ///< Liczba przestawianych zmiennych
+    Poly tail; ///< Współczynnik (wielomian pozostałych zmiennych)
+} PermutedTerm;
+
+/**
+ * Struktura przechowująca wyrazy zbierane przez PolyPermuteVars
+ */
+typedef struct PermutedTermList
+{
+    PermutedTerm *terms; ///< Tablica wyrazów
+    poly_exp_t *exps; ///< Wykładniki wyrazów, po count na wyraz
+    size_t size; ///< Liczba wyrazów
+    size_t capacity; ///< Rozmiar zaalokowanych tablic (w wyrazach)
+} PermutedTermList;
+
 /**
  * Struktura przechowująca stan składania wielomianów
  */
-typedef struct ComposeState
+typedef struct ComposeState
+{
+    Poly result; ///< Dotychczasowy wynik
+    MonoCursor mono; ///< Przetwarzany jednomian
+    poly_coeff_t factor; ///< Odłożony mnożnik przetwarzanego wielomianu
+    unsigned var_idx; ///< Indeks zmiennej głównej przetwarzanego wielomianu
+} ComposeState;
+
+/**
+ * Czy bloki list jednomianów przydzielamy z własnego alokatora?
+ *
+ * Testy jednostkowe sprawdzają wycieki przy każdym malloc i free,
+ * dlatego tam bloki przydzielamy pojedynczo.
+ */
+#ifdef UNIT_TESTING
+#define MONO_POOL 0
+#else
+#define MONO_POOL 1
+#endif
+
+#define MONO_SLAB_SIZE 64
+///< Liczba bloków jednomianów w jednym kawałku pamięci alokatora
+#define MONO_POOL_BATCH 64
+///< Liczba bloków przenoszonych naraz między pulą wątku a pulą wspólną
+
+/**
+ * Struktura przechowująca kawałek pamięci alokatora bloków jednomianów
+ *
+ * Alokator przydziela bloki z list wolnych bloków, które uzupełnia,
+ * dzieląc nowe kawałki pamięci. Kolejno przydzielane bloki leżą więc
+ * zwykle obok siebie.
+ */
+typedef struct MonoSlab
+{
+    struct MonoSlab *next; ///< Wcześniej przydzielony kawałek
+    MonoBlock blocks[MONO_SLAB_SIZE]; ///< Bloki kawałka
+} MonoSlab;
+
+/// Wszystkie kawałki pamięci alokatora (zwalnia je PolyReleaseMemory)
+static MonoSlab *mono_slabs = NULL;
+/// Wolne bloki oddane przez wątki, połączone polem next_block
+static MonoBlock *mono_shared_free = NULL;
+/// Chroni kawałki pamięci i wspólną listę wolnych bloków
+static pthread_mutex_t mono_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+/// Klucz, którego destruktor oddaje wolne bloki kończącego się wątku
+static pthread_key_t mono_pool_key;
+/// Gwarantuje jednokrotne utworzenie mono_pool_key
+static pthread_once_t mono_pool_key_once = PTHREAD_ONCE_INIT;
+/// Wolne bloki wątku, połączone polem next_block
+static _Thread_local MonoBlock *mono_free_list = NULL;
+/// Liczba wolnych bloków wątku
+static _Thread_local unsigned mono_free_count = 0;
+
+/**
+ * Oddaje do puli wspólnej @p count pierwszych wolnych bloków wątku
+ * @param[in] count : liczba bloków (nie większa niż mono_free_count)
+ */
+static void MonoPoolSpill(unsigned count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    MonoBlock *first = mono_free_list;
+    MonoBlock *last = first;
+    for (unsigned i = 1; i < count; ++i)
+    {
+        last = last->next_block;
+    }
+    mono_free_list = last->next_block;
+    mono_free_count -= count;
+
+    pthread_mutex_lock(&mono_pool_lock);
+    last->next_block = mono_shared_free;
+    mono_shared_free = first;
+    pthread_mutex_unlock(&mono_pool_lock);
+}
+
+/**
+ * Oddaje do puli wspólnej wszystkie wolne bloki kończącego się wątku
+ * @param[in] unused : wartość klucza mono_pool_key
+ */
+static void MonoPoolThreadExit(void *unused)
+{
+    (void)unused;
+    MonoPoolSpill(mono_free_count);
+}
+
+/**
+ * Tworzy klucz mono_pool_key
+ */
+static void MonoPoolCreateKey(void)
+{
+    pthread_key_create(&mono_pool_key, MonoPoolThreadExit);
+}
+
+/**
+ * Uzupełnia wolne bloki wątku z puli wspólnej lub z nowego kawałka pamięci
+ */
+static void MonoPoolRefill(void)
+{
+    pthread_once(&mono_pool_key_once, MonoPoolCreateKey);
+    pthread_setspecific(mono_pool_key, &mono_free_list);
+
+    pthread_mutex_lock(&mono_pool_lock);
+    if (mono_shared_free != NULL)
+    {
+        MonoBlock *last = mono_shared_free;
+        unsigned count = 1;
+        while (count < MONO_POOL_BATCH && last->next_block != NULL)
+        {
+            last = last->next_block;
+            ++count;
+        }
+
+        mono_free_list = mono_shared_free;
+        mono_shared_free = last->next_block;
+        last->next_block = NULL;
+        mono_free_count = count;
+    }
+    else {
+        MonoSlab *slab = malloc(sizeof(MonoSlab));
+        assert(slab != NULL);
+        slab->next = mono_slabs;
+        mono_slabs = slab;
+
+        // Kolejne przydziały dostaną kolejne bloki kawałka.
+        for (unsigned i = 0; i + 1 < MONO_SLAB_SIZE; ++i)
+        {
+            slab->blocks[i].next_block = &slab->blocks[i + 1];
+        }
+        slab->blocks[MONO_SLAB_SIZE - 1].next_block = NULL;
+        mono_free_list = &slab->blocks[0];
+        mono_free_count = MONO_SLAB_SIZE;
+    }
+    pthread_mutex_unlock(&mono_pool_lock);
+}
+
+/**
+ * Przydziela pusty blok listy jednomianów
+ * @return blok bez jednomianów i bez następnika
+ */
+static inline MonoBlock* MonoBlockAlloc(void)
+{
+    MonoBlock *block;
+    if (!MONO_POOL)
+    {
+        block = malloc(sizeof(MonoBlock));
+        assert(block != NULL);
+    }
+    else {
+        if (mono_free_list == NULL)
+        {
+            MonoPoolRefill();
+        }
+
+        block = mono_free_list;
+        mono_free_list = block->next_block;
+        --mono_free_count;
+    }
+
+    block->next_block = NULL;
+    block->count = 0;
+    return block;
+}
+
+/**
+ * Zwalnia blok przydzielony przez MonoBlockAlloc
+ *
+ * Nie zwalnia współczynników jednomianów bloku.
+ * @param[in] block : blok
+ */
+static inline void MonoBlockFree(MonoBlock *block)
+{
+    if (!MONO_POOL)
+    {
+        free(block);
+        return;
+    }
+
+    block->next_block = mono_free_list;
+    mono_free_list = block;
+    if (++mono_free_count > 2 * MONO_POOL_BATCH)
+    {
+        MonoPoolSpill(MONO_POOL_BATCH);
+    }
+}
+
+/**
+ * Zwalnia wszystkie bloki listy, nie zwalniając współczynników jednomianów
+ * @param[in] block : pierwszy blok listy lub NULL
+ */
+static void MonoBlockListFree(MonoBlock *block)
+{
+    while (block != NULL)
+    {
+        MonoBlock * const next_block = block->next_block;
+        MonoBlockFree(block);
+        block = next_block;
+    }
+}
+
+/**
+ * Struktura przechowująca koniec budowanej listy jednomianów
+ */
+typedef struct MonoTail
+{
+    MonoBlock **link; ///< Pole, do którego trafi kolejny nowy blok
+    MonoBlock *block; ///< Ostatni blok listy (NULL dla pustej listy)
+} MonoTail;
+
+/**
+ * Zaczyna budowanie listy jednomianów wielomianu
+ * @param[in,out] p : wielomian bez jednomianów
+ * @return koniec pustej listy @p p
+ */
+static inline MonoTail MonoTailInit(Poly *p)
+{
+    assert(p->first_block == NULL);
+    return (MonoTail) {.link = &p->first_block, .block = NULL};
+}
+
+/**
+ * Dołącza miejsce na jednomian na koniec budowanej listy
+ * @param[in,out] tail : koniec listy
+ * @return miejsce na jednomian (o wykładniku większym niż poprzednie)
+ */
+static inline Mono* MonoTailPush(MonoTail *tail)
+{
+    if (tail->block == NULL || tail->block->count == MONO_BLOCK_CAPACITY)
+    {
+        MonoBlock * const block = MonoBlockAlloc();
+        *tail->link = block;
+        tail->link = &block->next_block;
+        tail->block = block;
+    }
+
+    return &tail->block->monos[tail->block->count++];
+}
+
+/**
+ * Wstawia jednomian do bloku listy, przed jednomian na pozycji @p *pos
+ *
+ * Pełny blok dzielimy na dwa, chyba że jednomian trafia na jego koniec;
+ * wtedy dostaje nowy blok tuż za nim.
+ * @param[in,out] block : blok (przesuwany na blok wstawionego jednomianu)
+ * @param[in,out] pos : pozycja w bloku, nie większa niż liczba jego
+ * jednomianów (przesuwana na pozycję wstawionego jednomianu)
+ * @param[in] mono : wstawiany jednomian
+ */
+static void MonoBlockInsert(MonoBlock **block, unsigned *pos, const Mono *mono)
+{
+    MonoBlock *current = *block;
+    if (current->count == MONO_BLOCK_CAPACITY)
+    {
+        MonoBlock * const next = MonoBlockAlloc();
+        next->next_block = current->next_block;
+        current->next_block = next;
+
+        if (*pos == MONO_BLOCK_CAPACITY)
+        {
+            current = next;
+            *pos = 0;
+        }
+        else {
+            const unsigned half = MONO_BLOCK_CAPACITY / 2;
+            next->count = MONO_BLOCK_CAPACITY - half;
+            memcpy(next->monos, &current->monos[half],
+                   next->count * sizeof(Mono));
+            current->count = half;
+            if (*pos > half)
+            {
+                current = next;
+                *pos -= half;
+            }
+        }
+    }
+
+    memmove(&current->monos[*pos + 1], &current->monos[*pos],
+            (current->count - *pos) * sizeof(Mono));
+    current->monos[*pos] = *mono;
+    ++current->count;
+    *block = current;
+}
+
+/**
+ * Usuwa pierwszy jednomian z listy wielomianu bez indeksu
+ *
+ * Nie zwalnia współczynnika jednomianu.
+ * @param[in,out] p : wielomian, który nie jest współczynnikiem
+ */
+static void RemoveFirstMono(Poly *p)
+{
+    MonoBlock * const block = p->first_block;
+    if (--block->count == 0)
+    {
+        p->first_block = block->next_block;
+        MonoBlockFree(block);
+    }
+    else {
+        memmove(block->monos, block->monos + 1, block->count * sizeof(Mono));
+    }
+}
+
+/**
+ * Zwraca odłożony mnożnik wielomianu
+ * @param[in] p : wielomian
+ * @return mnożnik (1 jeśli wielomian go nie ma)
+ */
+static inline poly_coeff_t PolyFactor(const Poly *p)
+{
+    return p->factor == 0 ? 1 : p->factor;
+}
+
+/**
+ * Ustawia odłożony mnożnik wielomianu
+ *
+ * Wielomiany będące współczynnikami nie mają odłożonego mnożnika,
+ * mnożymy wtedy od razu ich stałą (nie pomijają też zmiennych).
+ * @param[in,out] p : wielomian
+ * @param[in] factor : nieparzysty mnożnik
+ */
+static inline void PolySetFactor(Poly *p, poly_coeff_t factor)
+{
+    if (PolyIsCoeff(p))
+    {
+        p->constant *= factor;
+        p->factor = 0;
+        p->var_skip = 0;
+    }
+    else {
+        p->factor = factor == 1 ? 0 : factor;
+    }
+}
+
+/**
+ * Przenosi odłożony mnożnik wielomianu o jeden poziom w dół
+ *
+ * Mnoży stałą wielomianu, a mnożnik przekazuje współczynnikom jednomianów.
+ * Koszt jest liniowy względem liczby jednomianów tylko tego poziomu.
+ * @param[in,out] p : wielomian
+ */
+static void PolyPushFactorDown(Poly *p)
+{
+    if (p->factor == 0)
+    {
+        return;
+    }
+
+    const poly_coeff_t factor = p->factor;
+    p->factor = 0;
+    p->constant *= factor;
+
+    if (p->is_dense)
+    {
+        CoeffScaleArray(p->dense->coeffs, factor, p->dense->length);
+        return;
+    }
+
+    for (MonoBlock *block = p->first_block; block != NULL;
+         block = block->next_block)
+    {
+        for (unsigned i = 0; i < block->count; ++i)
+        {
+            Poly * const coeff = &block->monos[i].p;
+            PolySetFactor(coeff, PolyFactor(coeff) * factor);
+        }
+    }
+}
+
+/**
+ * Przenosi stałą współczynnika jednomianu o wykładniku 0
+ * do wielomianu nadrzędnego
+ * @param[in,out] parent : wielomian nadrzędny (bez uwzględnienia jego mnożnika)
+ * @param[in,out] mono : jednomian o wykładniku 0 z listy @p parent
+ */
+static inline void HoistConstant(Poly *parent, Mono *mono)
+{
+    parent->constant += PolyFactor(&mono->p) * mono->p.constant;
+    mono->p.constant = 0;
+}
+
+/**
+ * Zwraca odwrotność liczby nieparzystej modulo 2^64
+ *
+ * Używa metody Newtona, każdy krok podwaja liczbę poprawnych bitów.
+ * @param[in] a : liczba nieparzysta
+ * @return `x` takie, że `a * x = 1`
+ */
+static inline poly_coeff_t CoeffInverse(poly_coeff_t a)
+{
+    if (a == 1)
+    {
+        return 1;
+    }
+
+    const unsigned long u = a;
+    unsigned long x = u;
+    for (int i = 0; i < 5; ++i)
+    {
+        x *= 2 - u * x;
+    }
+
+    return (poly_coeff_t)x;
+}
+
+/**
+ * Usuwa indeks listy jednomianów wielomianu
+ *
+ * Wywoływana przed każdą zmianą listy, która nie aktualizuje indeksu.
+ * @param[in,out] p : wielomian
+ */
+static inline void PolyDropIndex(Poly *p)
+{
+    if (p->index != NULL)
+    {
+        free(p->index->fences);
+        free(p->index);
+        p->index = NULL;
+    }
+}
+
+/**
+ * Buduje od nowa indeks listy jednomianów, jeśli lista jest dość długa
+ *
+ * Poziomy przechowywane gęsto nie potrzebują indeksu.
+ * @param[in,out] p : wielomian
+ */
+static void PolyBuildIndex(Poly *p)
+{
+    PolyDropIndex(p);
+    if (p->is_dense)
+    {
+        return;
+    }
+
+    unsigned mono_count = 0;
+    for (MonoBlock *block = p->first_block; block != NULL;
+         block = block->next_block)
+    {
+        mono_count += block->count;
+    }
+
+    if (mono_count < MONO_INDEX_THRESHOLD)
+    {
+        return;
+    }
+
+    MonoIndex *index = malloc(sizeof(MonoIndex));
+    assert(index != NULL);
+    index->mono_count = mono_count;
+    index->fences = calloc((mono_count + MONO_INDEX_STRIDE - 1) /
+                           MONO_INDEX_STRIDE, sizeof(MonoBlock*));
+    assert(index->fences != NULL);
+
+    // Kolejne wskaźniki dzieli co najmniej MONO_INDEX_STRIDE jednomianów.
+    unsigned fence_count = 0;
+    unsigned i = 0, next_fence = 0;
+    for (MonoBlock *block = p->first_block; block != NULL;
+         block = block->next_block)
+    {
+        if (i >= next_fence)
+        {
+            index->fences[fence_count++] = block;
+            next_fence = i + MONO_INDEX_STRIDE;
+        }
+        i += block->count;
+    }
+    index->fence_count = fence_count;
+
+    p->index = index;
+}
+
+/**
+ * Wyszukuje binarnie pierwszy wskaźnik indeksu na blok, którego pierwszy
+ * jednomian ma wykładnik co najmniej @p exp
+ * @param[in] index : indeks
+ * @param[in] exp : wykładnik
+ * @return pozycja wskaźnika (fence_count, jeśli takiego nie ma)
+ */
+static unsigned IndexLowerBound(const MonoIndex *index, poly_exp_t exp)
+{
+    unsigned low = 0, high = index->fence_count;
+    while (low < high)
+    {
+        const unsigned mid = low + (high - low) / 2;
+        if (index->fences[mid]->monos[0].exp < exp)
+        {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * Znajduje miejsce jednomianu o wykładniku @p exp na liście
+ * @param[in] p : wielomian przechowywany jako lista, który nie jest
+ * współczynnikiem
+ * @param[in] exp : wykładnik
+ * @param[out] pos : pozycja w bloku pierwszego jednomianu o wykładniku
+ * co najmniej @p exp (liczba jednomianów bloku, jeśli blok takich nie ma)
+ * @return ostatni blok, którego pierwszy jednomian ma wykładnik nie większy
+ * niż @p exp (pierwszy blok, jeśli takiego nie ma)
+ */
+static MonoBlock* FindMonoBlock(const Poly *p, poly_exp_t exp, unsigned *pos)
+{
+    MonoBlock *block = p->first_block;
+
+    if (p->index != NULL)
+    {
+        const unsigned i = IndexLowerBound(p->index, exp);
+        if (i > 0)
+        {
+            block = p->index->fences[i - 1];
+        }
+    }
+
+    while (block->next_block != NULL && block->next_block->monos[0].exp <= exp)
+    {
+        block = block->next_block;
+    }
+
+    unsigned i = 0;
+    while (i < block->count && block->monos[i].exp < exp)
+    {
+        ++i;
+    }
+    *pos = i;
+
+    return block;
+}
+
+/**
+ * Zastępuje w indeksie wskaźniki na blok, który zostanie usunięty z listy
+ * @param[in,out] index : indeks
+ * @param[in] block : usuwany blok
+ * @param[in] exp : wykładnik pierwszego jednomianu @p block
+ * @param[in] replacement : blok wskazywany zamiast @p block
+ */
+static void IndexReplaceBlock(MonoIndex *index, const MonoBlock *block,
+                              poly_exp_t exp, MonoBlock *replacement)
+{
+    unsigned i = IndexLowerBound(index, exp);
+    while (i < index->fence_count && index->fences[i] == block)
+    {
+        index->fences[i++] = replacement;
+    }
+}
+
+/**
+ * Usuwa jednomian z listy wielomianu z indeksem
+ *
+ * Nie zwalnia współczynnika jednomianu. Pusty blok zajmuje miejsce
+ * następnego bloku (albo, na końcu listy, znika), a wskaźniki indeksu
+ * przechodzą na blok, który zachowuje kolejność wykładników.
+ * @param[in,out] p : wielomian z indeksem
+ * @param[in,out] block : blok jednomianu
+ * @param[in] pos : pozycja jednomianu w bloku
+ */
+static void IndexedRemoveMono(Poly *p, MonoBlock *block, unsigned pos)
+{
+    MonoIndex * const index = p->index;
+    --index->mono_count;
+    if (block->count > 1)
+    {
+        --block->count;
+        memmove(&block->monos[pos], &block->monos[pos + 1],
+                (block->count - pos) * sizeof(Mono));
+        return;
+    }
+
+    const poly_exp_t exp = block->monos[0].exp;
+    MonoBlock * const next = block->next_block;
+    if (next != NULL)
+    {
+        IndexReplaceBlock(index, next, next->monos[0].exp, block);
+        *block = *next;
+        MonoBlockFree(next);
+        return;
+    }
+
+    // Ostatni blok listy: szukamy poprzednika, zaczynając od wskaźnika
+    // indeksu na wcześniejszy blok.
+    const unsigned i = IndexLowerBound(index, exp);
+    MonoBlock *prev = NULL;
+    MonoBlock *current = i > 0 ? index->fences[i - 1] : p->first_block;
+    while (current != block)
+    {
+        prev = current;
+        current = current->next_block;
+    }
+
+    IndexReplaceBlock(index, block, exp, prev);
+    if (prev == NULL)
+    {
+        p->first_block = NULL;
+    }
+    else {
+        prev->next_block = NULL;
+    }
+    MonoBlockFree(block);
+}
+
+/**
+ * Zwraca widok wielomianu, w którym jawny jest poziom zmiennej
+ * pomijanej przez @p p
+ *
+ * Widok współdzieli listę jednomianów z @p p i nie może być zwalniany.
+ * Zmienna główna widoku to zmienna o @p skip dalsza niż pierwsza, od której
+ * może zależeć @p p, a jedynym jednomianem widoku jest `q * x^0`, gdzie `q`
+ * to @p p bez stałej.
+ * @param[in] p : wielomian, który nie jest współczynnikiem
+ * @param[in] skip : liczba zmiennych pomijanych przez widok (< p->var_skip)
+ * @param[out] storage : miejsce na jedyny blok widoku
+ * @return widok
+ */
+static Poly PolyExpandedView(const Poly *p, unsigned skip, MonoBlock *storage)
+{
+    assert(!PolyIsCoeff(p) && skip < p->var_skip);
+
+    Poly child = *p;
+    child.constant = 0;
+    child.factor = 0;
+    child.var_skip = p->var_skip - skip - 1;
+
+    storage->next_block = NULL;
+    storage->count = 1;
+    storage->monos[0] = (Mono) {.p = child, .exp = 0};
+
+    return (Poly) {.first_block = storage, .constant = p->constant,
+                   .factor = p->factor, .index = NULL, .var_skip = skip};
+}
+
+/**
+ * Rozwija wielomian tak, by pomijał tylko @p skip zmiennych
+ * @param[in,out] p : wielomian, który nie jest współczynnikiem
+ * @param[in] skip : docelowa liczba pomijanych zmiennych (< p->var_skip)
+ */
+static void PolyExpandTo(Poly *p, unsigned skip)
+{
+    MonoBlock storage;
+    Poly view = PolyExpandedView(p, skip, &storage);
+
+    view.first_block = MonoBlockAlloc();
+    view.first_block->count = 1;
+    view.first_block->monos[0] = storage.monos[0];
+
+    *p = view;
+}
+
+/**
+ * Sprowadza poziom wielomianu do postaci kanonicznej
+ *
+ * Współczynnik nie pomija zmiennych, a wielomian, którego jedynym
+ * jednomianem jest `q * x^0`, zastępujemy wielomianem `q` pomijającym
+ * o jedną zmienną więcej. Zakłada, że jednomiany @p p nie są zerami,
+ * a współczynniki jednomianów są w postaci kanonicznej.
+ * @param[in,out] p : wielomian
+ */
+static void PolyNormalize(Poly *p)
+{
+    if (PolyIsCoeff(p))
+    {
+        PolySetFactor(p, PolyFactor(p));
+        return;
+    }
+
+    if (!HasSingleMono(p) || p->first_block->monos[0].exp != 0)
+    {
+        return;
+    }
+
+    Poly child = p->first_block->monos[0].p;
+    MonoBlockFree(p->first_block);
+    PolyDropIndex(p);
+
+    const poly_coeff_t child_factor = PolyFactor(&child);
+    child.constant += p->constant * CoeffInverse(child_factor);
+    child.factor = 0;
+    PolySetFactor(&child, PolyFactor(p) * child_factor);
+    child.var_skip += p->var_skip + 1;
+
+    *p = child;
+}
+
+/**
+ * Zwiększa liczbę zmiennych pomijanych przez wielomian
+ * @param[in,out] p : wielomian w postaci kanonicznej
+ * @param[in] skip : liczba dodatkowo pomijanych zmiennych
+ */
+static inline void PolyAddSkip(Poly *p, unsigned skip)
+{
+    if (!PolyIsCoeff(p))
+    {
+        p->var_skip += skip;
+    }
+}
+
+/**
+ * Zlicza jednomiany wielomianu, przerywając po @p limit
+ * @param[in] p : wielomian
+ * @param[in] limit : ograniczenie liczby przeglądanych jednomianów
+ * @return min(liczba jednomianów @p p, @p limit)
+ */
+static unsigned MonoCountUpTo(const Poly *p, unsigned limit)
+{
+    if (p->is_dense)
+    {
+        return p->dense->count < limit ? p->dense->count : limit;
+    }
+
+    unsigned count = 0;
+    for (MonoBlock *block = p->first_block; block != NULL && count < limit;
+         block = block->next_block)
+    {
+        count += block->count;
+    }
+
+    return count < limit ? count : limit;
+}
+
+/**
+ * Zmienia mnożnik wielomianu na @p factor, nie zmieniając jego wartości
+ *
+ * Po wywołaniu współczynniki @p p są wyrażone w jednostkach @p factor,
+ * a samo pole factor jest wyzerowane, tak by dało się je dodać do
+ * współczynników wielomianu o mnożniku @p factor.
+ * Koszt jest liniowy względem liczby jednomianów tylko tego poziomu.
+ * @param[in,out] p : wielomian
+ * @param[in] factor : nieparzysty mnożnik
+ */
+static void PolyAlignFactor(Poly *p, poly_coeff_t factor)
+{
+    const poly_coeff_t relative = PolyFactor(p) * CoeffInverse(factor);
+    p->factor = relative == 1 ? 0 : relative;
+    PolyPushFactorDown(p);
+}
+
+/**
+ * Dodaje mały wielomian do wielomianu z indeksem
+ *
+ * Każdy jednomian @p q wstawiany jest w miejsce znalezione przez indeks,
+ * więc dodawanie zajmuje czas `O(k log n)` dla k jednomianów @p q.
+ * Przejmuje na własność zawartość @p q.
+ * @param[in,out] p : wielomian z indeksem i mnożnikiem równym mnożnikowi q
+ * @param[in,out] q : wielomian
+ */
+static void PolyAddIndexed(Poly *p, Poly *q)
+{
+    p->constant += q->constant;
+
+    MonoCursor q_mono;
+    for (MonoBegin(&q_mono, q); q_mono.mono != NULL;
+         MonoNext(&q_mono))
+    {
+        unsigned pos;
+        MonoBlock *block = FindMonoBlock(p, q_mono.mono->exp, &pos);
+
+        if (pos < block->count && block->monos[pos].exp == q_mono.mono->exp)
+        {
+            Mono * const p_mono = &block->monos[pos];
+            PolyAddInPlace(&p_mono->p, &q_mono.mono->p);
+
+            if (p_mono->exp == 0)
+            {
+                HoistConstant(p, p_mono);
+            }
+
+            if (PolyIsZero(&p_mono->p))
+            {
+                IndexedRemoveMono(p, block, pos);
+            }
+        }
+        else {
+            MonoBlockInsert(&block, &pos, q_mono.mono);
+            ++p->index->mono_count;
+        }
+    }
+
+    MonoBlockListFree(q->first_block);
+    q->first_block = NULL;
+    PolyDropIndex(q);
+
+    // Po wielu wstawieniach odstępy między wskaźnikami rosną,
+    // a po wielu usunięciach indeks przestaje się opłacać.
+    const MonoIndex * const index = p->index;
+    if (index->mono_count > 2 * MONO_INDEX_STRIDE * index->fence_count ||
+        index->mono_count < MONO_INDEX_THRESHOLD / 2)
+    {
+        PolyBuildIndex(p);
+    }
+
+    PolyNormalize(p);
+}
+
+/**
+ * Funkcja tworząca nowy obiekt przechowywujący informacje o składaniu
+ *
+ * @param[in] p : składany wielomian
+ * @param[in] depth : indeks pierwszej zmiennej, od której może zależeć @p p
+ */
+ComposeState* NewComposeState(const Poly *p, unsigned depth){
+    ComposeState *new_state = malloc(sizeof(ComposeState));
+    assert(new_state != NULL);
+    new_state->result = PolyFromCoeff(p->constant);
+    MonoBegin(&new_state->mono, p);
+    new_state->factor = PolyFactor(p);
+    new_state->var_idx = depth + p->var_skip;
+    return new_state;
+}
+
+/**
+ * Właściwa funkcja odpowiedzialna za wypisywanie wielomianu
+ * @param[in] p : wielomian
+ * @param[in] constant : stała wielomianu nadrzędnego
+ * @param[in] factor : iloczyn mnożników wielomianów nadrzędnych
+ * @param[in,out] writer : wypisywanie
+ */
+static void PolyWriteWithConstant(const Poly *p, poly_coeff_t constant,
+                                  poly_coeff_t factor, OutputWriter *writer)
+{
+    factor *= PolyFactor(p);
+    constant += factor * p->constant;
+
+    if (PolyIsCoeff(p))
+    {
+        OutputLong(writer, constant);
+        return;
+    }
+
+    // Pominięte zmienne wypisujemy jako jednomiany o wykładniku 0.
+    for (unsigned i = 0; i < p->var_skip; ++i)
+    {
+        OutputChar(writer, '(');
+    }
+
+    // Poziom gęsty nie ma jednomianu o wykładniku 0.
+    if (constant != 0 && (p->is_dense || FirstMono(p)->exp != 0))
+    {
+        OutputChar(writer, '(');
+        OutputLong(writer, constant);
+        OutputWrite(writer, ",0)+", 4);
+    }
+
+    if (p->is_dense)
+    {
+        // Współczynniki wypisujemy wprost z tablicy.
+        const DenseCoeffs * const dense = p->dense;
+        bool first = true;
+        for (poly_exp_t i = 1; i < dense->length; ++i)
+        {
+            if (dense->coeffs[i] == 0)
+            {
+                continue;
+            }
+
+            if (!first)
+            {
+                OutputChar(writer, '+');
+            }
+            first = false;
+
+            OutputChar(writer, '(');
+            OutputLong(writer, factor * dense->coeffs[i]);
+            OutputChar(writer, ',');
+            OutputUnsigned(writer, i * dense->stride);
+            OutputChar(writer, ')');
+        }
+    }
+    else {
+        MonoCursor cursor;
+        for (MonoBegin(&cursor, p); cursor.mono != NULL;
+             MonoNext(&cursor))
+        {
+            const Mono * const current_mono = cursor.mono;
+            if (current_mono != FirstMono(p))
+            {
+                OutputChar(writer, '+');
+            }
+
+            OutputChar(writer, '(');
+            if (current_mono->exp == 0)
+            {
+                PolyWriteWithConstant(&current_mono->p, constant, factor,
+                                      writer);
+            }
+            else {
+                PolyWriteWithConstant(&current_mono->p, 0, factor, writer);
+            }
+            OutputChar(writer, ',');
+            OutputUnsigned(writer, current_mono->exp);
+            OutputChar(writer, ')');
+        }
+    }
+
+    for (unsigned i = 0; i < p->var_skip; ++i)
+    {
+        OutputWrite(writer, ",0)", 3);
+    }
+}
+
+/**
+ * Szacuje z góry długość zapisu wielomianu
+ *
+ * Każdy współczynnik i stała zajmują co najwyżej OUTPUT_NUMBER_LENGTH
+ * znaków, wykładnik co najwyżej 10, a pozostałe znaki wynikają wprost
+ * z liczby jednomianów i pominiętych zmiennych.
+ * @param[in] p : wielomian
+ * @return ograniczenie górne liczby znaków wypisywanych przez PolyWrite
+ */
+static size_t PolyWrittenLengthBound(const Poly *p)
+{
+    if (PolyIsCoeff(p))
+    {
+        return OUTPUT_NUMBER_LENGTH;
+    }
+
+    // `(` i `,0)` dla pominiętych zmiennych oraz `(stała,0)+`.
+    size_t length = 4 * (size_t)p->var_skip + OUTPUT_NUMBER_LENGTH + 4;
+    MonoCursor m;
+    for (MonoBegin(&m, p); m.mono != NULL; MonoNext(&m))
+    {
+        // `(`, `,wykładnik)` i `+`.
+        length += 14 + PolyWrittenLengthBound(&m.mono->p);
+    }
+
+    return length;
+}
+
+void PolyWrite(const Poly *p, OutputWriter *writer)
+{
+    PolyWriteWithConstant(p, 0, 1, writer);
+}
+
+void PolyPrint(const Poly *p)
+{
+    PolyWrite(p, &standard_output);
+}
+
+char* PolyToString(const Poly *p)
+{
+    OutputWriter writer = OutputStringInit(PolyWrittenLengthBound(p) + 1);
+    PolyWrite(p, &writer);
+    return OutputStringFinish(&writer);
+}
+
+/**
+ * Zwraca większy z dwóch wykładników
+ * @param[in] a : wykładnik jednomianu
+ * @param[in] b : wykładnik jednomianu
+ * @return większy z wykładników a i b
+ */
+static inline poly_exp_t Max(poly_exp_t a, poly_exp_t b)
+{
+    return (a > b) ? a : b;
+}
+
+/**
+ * Szybkie potęgowanie współczynnika
+ *
+ * Implementuje algorytm szybkiego potęgowania w wersji iteracyjnej
+ * @param[in] x : liczbowy współczynnik wielomianu
+ * @param[in] n : potęga do której współczynnik ma być podniesiony
+ * @return `x^n`
+ */
+static inline poly_coeff_t FastCoeffPow(poly_coeff_t x, poly_exp_t n)
+{
+    poly_coeff_t result = 1;
+    while (n != 0)
+    {
+        if (n % 2 == 1)
+        {
+	        result *= x;
+		}
+        n /= 2;
+        x *= x;
+    }
+
+    return result;
+}
+
+/**
+ * Liczy największy wspólny dzielnik dwóch wykładników
+ * @param[in] a : wykładnik
+ * @param[in] b : wykładnik
+ * @return NWD @p a i @p b (0, gdy oba są zerami)
+ */
+static inline poly_exp_t ExpGcd(poly_exp_t a, poly_exp_t b)
+{
+    while (b != 0)
+    {
+        const poly_exp_t rest = a % b;
+        a = b;
+        b = rest;
+    }
+
+    return a;
+}
+
+/**
+ * Liczy największy wspólny dzielnik wykładników jednomianów poziomu
+ *
+ * Wielomian o NWD `k > 1` zależy od zmiennej głównej tylko przez `x^k`,
+ * więc można go traktować jak `k` razy rzadszy wielomian zmiennej `x^k`.
+ * @param[in] p : wielomian
+ * @return NWD wykładników jednomianów @p p (0, gdy nie ma jednomianów)
+ */
+static poly_exp_t PolyExpGcd(const Poly *p)
+{
+    poly_exp_t gcd = 0;
+    MonoCursor m;
+    for (MonoBegin(&m, p); m.mono != NULL && gcd != 1;
+         MonoNext(&m))
+    {
+        gcd = ExpGcd(gcd, m.mono->exp);
+    }
+
+    return gcd;
+}
+
+/**
+ * Sprawdza, czy poziom opłaca się przechowywać w postaci gęstej
+ * @param[in] count : liczba jednomianów poziomu
+ * @param[in] length : liczba pozycji gęstej postaci poziomu
+ * @param[in] gap : dopuszczalny średni odstęp między zajętymi pozycjami
+ * @return Czy poziom ma co najmniej DENSE_MIN_LENGTH pozycji, z których
+ * zajęta jest średnio co @p gap-ta?
+ */
+static inline bool DenseShapePays(long long count, long long length,
+                                  long long gap)
+{
+    return length >= DENSE_MIN_LENGTH && (count + 1) * gap >= length;
+}
+
+/**
+ * Przydziela wyzerowaną tablicę poziomu gęstego
+ * @param[in] stride : odstęp między wykładnikami kolejnych pozycji
+ * @param[in] length : liczba pozycji
+ * @return tablica bez niezerowych pozycji
+ */
+static DenseCoeffs* DenseAlloc(poly_exp_t stride, poly_exp_t length)
+{
+    DenseCoeffs *dense = calloc(1, sizeof(DenseCoeffs) +
+                                   (size_t)length * sizeof(poly_coeff_t));
+    assert(dense != NULL);
+    dense->stride = stride;
+    dense->length = length;
+
+    return dense;
+}
+
+/**
+ * Sprawdza, czy wszystkie współczynniki poziomu są stałymi,
+ * i wyznacza kształt jego postaci gęstej
+ * @param[in] p : wielomian, który nie jest współczynnikiem
+ * @param[out] count : liczba jednomianów
+ * @param[out] stride : wspólny dzielnik wykładników (0 dla samego `x^0`)
+ * @param[out] degree : największy wykładnik
+ * @return Czy wszystkie współczynniki @p p są stałymi? (tylko wtedy
+ * wyniki są wyznaczone)
+ */
+static bool LevelConstantShape(const Poly *p, unsigned *count,
+                               poly_exp_t *stride, poly_exp_t *degree)
+{
+    if (p->is_dense)
+    {
+        *count = p->dense->count;
+        *stride = p->dense->stride;
+        *degree = (p->dense->length - 1) * p->dense->stride;
+        return true;
+    }
+
+    *count = 0;
+    *stride = 0;
+    *degree = 0;
+    MonoCursor cursor;
+    for (MonoBegin(&cursor, p); cursor.mono != NULL; MonoNext(&cursor))
+    {
+        const Mono * const m = cursor.mono;
+        if (!PolyIsCoeff(&m->p))
+        {
+            return false;
+        }
+
+        ++*count;
+        *stride = ExpGcd(*stride, m->exp);
+        *degree = m->exp;
+    }
+
+    return true;
+}
+
+/**
+ * Zamienia listę jednomianów o stałych współczynnikach na tablicę
+ * @param[in,out] p : wielomian przechowywany jako lista
+ * @param[in] stride : dodatni wspólny dzielnik wykładników @p p
+ * @param[in] length : liczba pozycji (największy wykładnik / stride + 1)
+ */
+static void PolyMakeDense(Poly *p, poly_exp_t stride, poly_exp_t length)
+{
+    PolyDropIndex(p);
+
+    DenseCoeffs * const dense = DenseAlloc(stride, length);
+    for (MonoBlock *block = p->first_block; block != NULL;
+         block = block->next_block)
+    {
+        for (unsigned i = 0; i < block->count; ++i)
+        {
+            const Mono * const m = &block->monos[i];
+            if (m->exp == 0)
+            {
+                p->constant += m->p.constant;
+            }
+            else {
+                dense->coeffs[m->exp / stride] = m->p.constant;
+                ++dense->count;
+            }
+        }
+    }
+    MonoBlockListFree(p->first_block);
+
+    p->dense = dense;
+    p->is_dense = true;
+}
+
+/**
+ * Zamienia tablicę poziomu gęstego z powrotem na listę jednomianów
+ *
+ * Nie buduje indeksu listy.
+ * @param[in,out] p : wielomian przechowywany gęsto
+ */
+static void PolyMakeSparse(Poly *p)
+{
+    DenseCoeffs * const dense = p->dense;
+    p->first_block = NULL;
+    p->is_dense = false;
+
+    MonoTail tail = MonoTailInit(p);
+    for (poly_exp_t i = 1; i < dense->length; ++i)
+    {
+        if (dense->coeffs[i] != 0)
+        {
+            *MonoTailPush(&tail) = (Mono) {
+                .p = PolyFromCoeff(dense->coeffs[i]),
+                .exp = i * dense->stride};
+        }
+    }
+    free(dense);
+}
+
+/**
+ * Sprowadza poziom gęsty do postaci kanonicznej po zmianie jego tablicy
+ *
+ * Przenosi pozycję 0 do stałej, obcina zera z końca tablicy, a poziom,
+ * w którym zajęta jest rzadziej niż co DENSE_SPARSE_GAP-ta pozycja,
+ * zamienia z powrotem na listę.
+ * @param[in,out] p : wielomian przechowywany gęsto
+ */
+static void DenseSettle(Poly *p)
+{
+    DenseCoeffs * const dense = p->dense;
+    p->constant += dense->coeffs[0];
+    dense->coeffs[0] = 0;
+
+    unsigned count = 0;
+    poly_exp_t length = 0;
+    for (poly_exp_t i = 1; i < dense->length; ++i)
+    {
+        if (dense->coeffs[i] != 0)
+        {
+            ++count;
+            length = i + 1;
+        }
+    }
+    dense->count = count;
+    dense->length = length;
+
+    if (!DenseShapePays(count, length, DENSE_SPARSE_GAP))
+    {
+        PolyMakeSparse(p);
+        PolyBuildIndex(p);
+    }
+    PolyNormalize(p);
+}
+
+/**
+ * Wybiera sposób przechowywania zbudowanego poziomu wielomianu
+ *
+ * Poziom o stałych współczynnikach, w którym zajęta jest średnio co
+ * najmniej co DENSE_MAX_GAP-ta pozycja, zamienia na tablicę, a dla
+ * długiej listy buduje indeks. Na koniec sprowadza poziom do postaci
+ * kanonicznej.
+ * @param[in,out] p : wielomian przechowywany jako lista bez indeksu
+ */
+static void PolyFinishList(Poly *p)
+{
+    unsigned count;
+    poly_exp_t stride, degree;
+    if (!PolyIsCoeff(p) &&
+        LevelConstantShape(p, &count, &stride, &degree) && stride > 0 &&
+        DenseShapePays(count, degree / stride + 1, DENSE_MAX_GAP))
+    {
+        PolyMakeDense(p, stride, degree / stride + 1);
+    }
+    else {
+        PolyBuildIndex(p);
+    }
+
+    PolyNormalize(p);
+}
+
+/**
+ * Zmienia odstęp i liczbę pozycji tablicy poziomu gęstego
+ * @param[in,out] p : wielomian przechowywany gęsto
+ * @param[in] stride : dzielnik dotychczasowego odstępu
+ * @param[in] length : liczba pozycji, nie mniejsza niż potrzebna
+ * dotychczasowym współczynnikom
+ * @return nowa tablica @p p
+ */
+static DenseCoeffs* DenseResize(Poly *p, poly_exp_t stride,
+                                poly_exp_t length)
+{
+    const DenseCoeffs * const old = p->dense;
+    DenseCoeffs * const dense = DenseAlloc(stride, length);
+    const poly_exp_t step = old->stride / stride;
+    for (poly_exp_t i = 1; i < old->length; ++i)
+    {
+        dense->coeffs[i * step] = old->coeffs[i];
+    }
+    dense->count = old->count;
+
+    free(p->dense);
+    p->dense = dense;
+    return dense;
+}
+
+/**
+ * Dodaje wielomian do poziomu przechowywanego gęsto
+ *
+ * Współczynniki @p q, przeliczone na jednostki mnożnika @p p, trafiają
+ * wprost na swoje pozycje tablicy; tablice o równych odstępach dodajemy
+ * w całości. Przejmuje na własność zawartość @p q, jeśli się udało.
+ * @param[in,out] p : wielomian przechowywany gęsto
+ * @param[in,out] q : wielomian pomijający tyle samo zmiennych co @p p
+ * @return Czy @p q ma stałe współczynniki, a suma mieści się w dość gęstej
+ * tablicy? (w przeciwnym razie @p p i @p q się nie zmieniają)
+ */
+static bool PolyAddDense(Poly *p, Poly *q)
+{
+    unsigned count;
+    poly_exp_t stride, degree;
+    if (!LevelConstantShape(q, &count, &stride, &degree) || stride == 0)
+    {
+        return false;
+    }
+
+    DenseCoeffs *dense = p->dense;
+    stride = ExpGcd(stride, dense->stride);
+    const poly_exp_t length =
+        Max(degree, (dense->length - 1) * dense->stride) / stride + 1;
+    if (!DenseShapePays((long long)dense->count + count, length,
+                        DENSE_SPARSE_GAP))
+    {
+        return false;
+    }
+    if (stride != dense->stride || length > dense->length)
+    {
+        dense = DenseResize(p, stride, length);
+    }
+
+    const poly_coeff_t relative = PolyFactor(q) * CoeffInverse(PolyFactor(p));
+    p->constant += relative * q->constant;
+    if (q->is_dense && q->dense->stride == stride)
+    {
+        CoeffMulAddArray(dense->coeffs, q->dense->coeffs, relative,
+                         q->dense->length);
+    }
+    else {
+        MonoCursor cursor;
+        for (MonoBegin(&cursor, q); cursor.mono != NULL; MonoNext(&cursor))
+        {
+            const Mono * const m = cursor.mono;
+            dense->coeffs[m->exp / stride] += relative * m->p.constant;
+        }
+    }
+
+    PolyDestroy(q);
+    DenseSettle(p);
+    return true;
+}
+
+/**
+ * Komparator dla typu Mono
+ *
+ * Porównuje wykładaniki dwóch jednomianów
+ * @param[in] left_v : Jednomian
+ * @param[in] right_v : Jednomian
+ * @return 0 dla left_v.exp = right_v.exp, 1 dla left_v.exp > right_v.exp,
+ * -1 dla left_v.exp < right_v.exp
+ */
+static int MonoCompare(const void *left_v, const void *right_v)
+{
+    const Mono *left  = (const Mono *)left_v;
+    const Mono *right = (const Mono *)right_v;
+
+    if (left->exp > right->exp)
+    {
+        return 1;
+    }
+
+    if (left->exp < right->exp)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Sprawdza czy tablica jednomianów jest posortowana
+ * @param[in] count : liczba elementów tablicy @p monos
+ * @param[in] monos : tablica jednomianów
+ * @return True dla posortowanej tablicy, False w przeciwnym wypadku
+ */
+static bool MonosAreSorted(unsigned count, const Mono monos[])
+{
+    for (unsigned i = 1; i < count; ++i)
+    {
+        if (MonoCompare(&monos[i-1], &monos[i]) > 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Zlicza liczbę jednomianów w wielomianie
+ * @param[in] p : Wielomian
+ * @return Liczba jednomianów z których składa się wielomian
+ * (bez jednomianu stałego)
+ */
+static unsigned MonoCount(const Poly *p)
+{
+    if (p->is_dense)
+    {
+        return p->dense->count;
+    }
+
+    unsigned count = 0;
+
+    for (MonoBlock *block = p->first_block; block != NULL;
+         block = block->next_block)
+    {
+        count += block->count;
+    }
+
+    return count;
+}
+
+/**
+ * Zwraca głęboką kopię listy jednomianów
+ * @param[in] block : pierwszy blok listy jednomianów
+ * @return Pierwszy blok głębokiej kopii listy jednomianów
+ */
+static MonoBlock* MonoListClone(const MonoBlock *block)
+{
+    MonoBlock *result = NULL;
+    MonoBlock **last_block_ptr = &result;
+
+    while (block != NULL)
+    {
+        MonoBlock * const copy = MonoBlockAlloc();
+        copy->count = block->count;
+        for (unsigned i = 0; i < block->count; ++i)
+        {
+            copy->monos[i] = MonoClone(&block->monos[i]);
+        }
+
+        *last_block_ptr = copy;
+        last_block_ptr = &copy->next_block;
+        block = block->next_block;
+    }
+
+    return result;
+}
+
+/**
+ * Zwraca ograniczenie wykładników zmiennej o indeksie @p depth
+ *
+ * Jeśli takie ograniczenie istnieje, przesuwa @p bounds za nie,
+ * tak by wskazywały ograniczenia głębszych zmiennych. Pomija też
+ * ograniczenia zmiennych o mniejszych indeksach.
+ * @param[in,out] bounds : ograniczenia posortowane wg. indeksu zmiennej
+ * @param[in,out] bound_count : liczba ograniczeń
+ * @param[in] depth : indeks zmiennej bieżącego poziomu
+ * @return ograniczenie lub UNBOUNDED
+ */
+static inline poly_exp_t TakeBound(const PolyBound **bounds,
+                                   unsigned *bound_count, unsigned depth)
+{
+    // Ograniczenia zmiennych pominiętych przez wielomian nic nie obcinają.
+    while (*bound_count > 0 && (*bounds)->var_idx < depth)
+    {
+        ++*bounds;
+        --*bound_count;
+    }
+
+    if (*bound_count == 0 || (*bounds)->var_idx != depth)
+    {
+        return UNBOUNDED;
+    }
+
+    const poly_exp_t limit = (*bounds)->limit;
+    ++*bounds;
+    --*bound_count;
+    return limit;
+}
+
+/**
+ * Sprawdza czy wykładnik mieści się w ograniczeniu
+ * @param[in] exp : wykładnik (suma wykładników może nie mieścić się w int)
+ * @param[in] limit : ograniczenie lub UNBOUNDED
+ * @return Czy exp < limit?
+ */
+static inline bool ExpWithinBound(long long exp, poly_exp_t limit)
+{
+    return limit == UNBOUNDED || exp < limit;
+}
+
+static Poly PolyMulBounded(const Poly *p, const Poly *q,
+                           const PolyBound *bounds, unsigned bound_count,
+                           unsigned depth);
+
+/**
+ * Zwraca głęboką kopię listy jednomianów, pomnożoną przez stałą
+ *
+ * Pomija jednomiany (i ich części) wykraczające poza ograniczenia.
+ * @param[in] p : Wielomian, którego lista jest kopiowana
+ * @param[in] constant : Stała przez którą lista ma być pomnożona
+ * @param[in] limit : ograniczenie wykładników bieżącego poziomu
+ * @param[in] bounds : ograniczenia głębszych zmiennych
+ * @param[in] bound_count : liczba ograniczeń głębszych zmiennych
+ * @param[in] depth : indeks zmiennej bieżącego poziomu
+ * @param[out] array : Wskaźnik na pierwszy element tablicy w której
+ * znajdzie się kopia
+ * @return liczba jednomianów zapisanych w @p array
+ */
+static unsigned CloneMonosMultipliedByAConstant(
+             const Poly *p, poly_coeff_t constant, poly_exp_t limit,
+             const PolyBound *bounds, unsigned bound_count, unsigned depth,
+             Mono *array)
+{
+    const Poly const_poly = PolyFromCoeff(constant);
+
+    unsigned i = 0;
+    MonoCursor current;
+    for (MonoBegin(&current, p);
+         current.mono != NULL && ExpWithinBound(current.mono->exp, limit);
+         MonoNext(&current))
+    {
+        array[i].p   = PolyMulBounded(&current.mono->p, &const_poly,
+                                      bounds, bound_count, depth + 1);
+        array[i].exp = current.mono->exp;
+
+        ++i;
+    }
+
+    return i;
+}
+
+/**
+ * Usuwa jednomiany tożsamościowo równe zeru z listy
+ * jednomianów wielomianu @p p
+ *
+ * Bloki, które po usunięciu zer zmieszczą się w poprzednim bloku, są z nim
+ * scalane. Na koniec wybiera sposób przechowywania poziomu (PolyFinishList).
+ * @param[in,out] p : Wielomian przechowywany jako lista
+ */
+static void RemoveEmptyMonosFromPoly(Poly * const p)
+{
+    assert(!p->is_dense);
+    PolyDropIndex(p);
+
+    MonoBlock *prev_block = NULL;
+    MonoBlock **block_ptr = &p->first_block;
+    while (*block_ptr != NULL)
+    {
+        MonoBlock * const block = *block_ptr;
+
+        unsigned count = 0;
+        for (unsigned i = 0; i < block->count; ++i)
+        {
+            if (PolyIsZero(&block->monos[i].p) == false)
+            {
+                block->monos[count++] = block->monos[i];
+            }
+        }
+        block->count = count;
+
+        if (prev_block != NULL &&
+            prev_block->count + count <= MONO_BLOCK_CAPACITY)
+        {
+            memcpy(&prev_block->monos[prev_block->count], block->monos,
+                   count * sizeof(Mono));
+            prev_block->count += count;
+            *block_ptr = block->next_block;
+            MonoBlockFree(block);
+        }
+        else if (count == 0)
+        {
+            *block_ptr = block->next_block;
+            MonoBlockFree(block);
+        }
+        else {
+            prev_block = block;
+            block_ptr = &block->next_block;
+        }
+    }
+
+    PolyFinishList(p);
+}
+
+/**
+ * "Szybkie" potęgowanie wielomianów
+ *
+ * Implementuje algorytm szybkiego potęgowania w wersji iteracyjnej
+ * @param[in] p : wielomian
+ * @param[in] n : potęga do której wielomian ma być podniesiony
+ * @return `p^n`
+ */
+static inline Poly FastPolyPow(const Poly *p, poly_exp_t n)
+{
+    if (PolyIsCoeff(p))
+    {
+        return PolyFromCoeff(FastCoeffPow(p->constant, n));
+    }
+
+    Poly result = PolyFromCoeff(1);
+    Poly x = PolyClone(p);
+    while (n != 0)
+    {
+        if (n % 2 == 1)
+        {
+            Poly new_result = PolyMul(&result, &x);
+            PolyDestroy(&result);
+            result = new_result;
+        }
+        n /= 2;
+        if (n == 0)
+        {
+            break;
+        }
+        Poly new_x = PolyMul(&x, &x);
+        PolyDestroy(&x);
+        x = new_x;
+    }
+    PolyDestroy(&x);
+    return result;
+}
+
+void PolyAddInPlace(Poly *p, Poly *q)
+{
+    assert(p != NULL && q != NULL);
+
+    // Wynik budujemy w wielomianie, który ma indeks, lub w dłuższym.
+    if (PolyIsCoeff(p) || (p->index == NULL && q->index != NULL))
+    {
+        const Poly tmp = *p;
+        *p = *q;
+        *q = tmp;
+    }
+
+    // Dodanie współczynnika zmienia tylko stałą, bez przemnażania listy.
+    if (PolyIsCoeff(q))
+    {
+        p->constant += q->constant * CoeffInverse(PolyFactor(p));
+        return;
+    }
+
+    // Wielomian pomijający więcej zmiennych rozwijamy do poziomu drugiego.
+    if (p->var_skip > q->var_skip)
+    {
+        PolyExpandTo(p, q->var_skip);
+    }
+    else if (q->var_skip > p->var_skip)
+    {
+        PolyExpandTo(q, p->var_skip);
+    }
+
+    // Do poziomu gęstego dodajemy wprost w tablicy, a gdy się nie da,
+    // poziom wraca na listę.
+    if (p->is_dense || q->is_dense)
+    {
+        if (!p->is_dense)
+        {
+            const Poly tmp = *p;
+            *p = *q;
+            *q = tmp;
+        }
+
+        if (PolyAddDense(p, q))
+        {
+            return;
+        }
+        PolyMakeSparse(p);
+        if (q->is_dense)
+        {
+            PolyMakeSparse(q);
+        }
+    }
+
+    if (p->index != NULL &&
+        MonoCountUpTo(q, p->index->fence_count) < p->index->fence_count)
+    {
+        PolyAlignFactor(q, PolyFactor(p));
+        PolyAddIndexed(p, q);
+        return;
+    }
+
+    PolyDropIndex(p);
+    PolyDropIndex(q);
+
+    // Przy równych mnożnikach dodajemy współczynniki bez przemnażania.
+    if (PolyFactor(p) != PolyFactor(q))
+    {
+        PolyPushFactorDown(p);
+        PolyPushFactorDown(q);
+    }
+
+    p->constant += q->constant;
+
+    // Jednomiany q wstawiamy do bloków p, idąc po obu listach naraz.
+    MonoBlock *block = p->first_block;
+    unsigned pos = 0;
+    MonoCursor q_mono;
+    for (MonoBegin(&q_mono, q); q_mono.mono != NULL;
+         MonoNext(&q_mono))
+    {
+        const poly_exp_t exp = q_mono.mono->exp;
+        while (pos < block->count ? block->monos[pos].exp < exp
+                                  : block->next_block != NULL)
+        {
+            if (++pos > block->count)
+            {
+                block = block->next_block;
+                pos = 0;
+            }
+        }
+
+        if (pos < block->count && block->monos[pos].exp == exp)
+        {
+            PolyAddInPlace(&block->monos[pos].p, &q_mono.mono->p);
+        }
+        else {
+            MonoBlockInsert(&block, &pos, q_mono.mono);
+        }
+        ++pos;
+    }
+
+    MonoBlockListFree(q->first_block);
+    q->first_block = NULL;
+
+    if (FirstMono(p)->exp == 0)
+    {
+        HoistConstant(p, FirstMono(p));
+    }
+
+    RemoveEmptyMonosFromPoly(p);
+}
+
+void PolyDestroy(Poly *p)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+
+    MonoBlock *block = p->is_dense ? NULL : p->first_block;
+    while (block != NULL)
+    {
+        MonoBlock * const next_block = block->next_block;
+
+        for (unsigned i = 0; i < block->count; ++i)
+        {
+            MonoDestroy(&block->monos[i]);
+        }
+        MonoBlockFree(block);
+
+        block = next_block;
+    }
+
+    if (p->is_dense)
+    {
+        free(p->dense);
+        p->is_dense = false;
+    }
+    p->first_block = NULL;
+    p->constant = 0;
+    p->factor = 0;
+    p->var_skip = 0;
+    PolyDropIndex(p);
+}
+
+
+Poly PolyClone(const Poly *p)
+{
+    Poly new_poly;
+    new_poly.constant   = p->constant;
+    new_poly.factor     = p->factor;
+    new_poly.index      = NULL;
+    new_poly.var_skip   = p->var_skip;
+    new_poly.is_dense   = p->is_dense;
+    if (p->is_dense)
+    {
+        const size_t size = sizeof(DenseCoeffs) +
+                            (size_t)p->dense->length * sizeof(poly_coeff_t);
+        new_poly.dense = malloc(size);
+        assert(new_poly.dense != NULL);
+        memcpy(new_poly.dense, p->dense, size);
+    }
+    else {
+        new_poly.first_block = MonoListClone(p->first_block);
+    }
+    if (p->index != NULL)
+    {
+        PolyBuildIndex(&new_poly);
+    }
+
+    return new_poly;
+}
+
+Poly PolyAdd(const Poly *p, const Poly *q)
+{
+    Poly result  = PolyClone(p);
+    Poly q_clone = PolyClone(q);
+
+    PolyAddInPlace(&result, &q_clone);
+
+    return result;
+}
+
+Poly PolyAddMonos(unsigned count, const Mono monos[])
+{
+
+    if (count == 0)
+    {
+        return PolyZero();
+    }
+
+    if (MonosAreSorted(count, monos) == false)
+    {
+        // https://moodle.mimuw.edu.pl/mod/forum/discuss.php?d=244#p755
+        // " Ja bym w takich przypadkach pozwalał na haki, np. pozbywanie
+        //   się const za pomocą odpowiednich rzutowań lub innych trików  "
+        //
+        // Funkcja PolyAddMonos nie tworzy kopii tablicy monos ponieważ
+        // wpływałoby to negatywnie na szybkość działania i ilość kodu
+        qsort((Mono*)monos, count, sizeof(Mono), MonoCompare);
+    }
+
+    Poly result = PolyZero();
+    MonoTail tail = MonoTailInit(&result);
+
+    Mono *last_mono = MonoTailPush(&tail);
+    *last_mono = monos[0];
+
+    if (last_mono->exp == 0)
+    {
+        HoistConstant(&result, last_mono);
+    }
+
+    poly_exp_t last_mono_exp = last_mono->exp;
+    for (unsigned i = 1; i < count; ++i)
+    {
+        if (last_mono_exp == monos[i].exp)
+        {
+            PolyAddInPlace(&last_mono->p, (Poly*)&monos[i].p);
+        }
+        else {
+            last_mono  = MonoTailPush(&tail);
+            *last_mono = monos[i];
+
+            last_mono_exp = last_mono->exp;
+        }
+
+        if (last_mono->exp == 0)
+        {
+            HoistConstant(&result, last_mono);
+        }
+    }
+
+    RemoveEmptyMonosFromPoly(&result);
+
+    return result;
+}
+
+void PolyBuilderAppend(PolyBuilder *builder, Poly *p, poly_exp_t exp)
+{
+    if (PolyIsZero(p))
+    {
+        return;
+    }
+
+    MonoBlock *block = builder->last_block;
+    if (block == NULL)
+    {
+        block = builder->first_block = MonoBlockAlloc();
+    }
+    else {
+        builder->sorted = builder->sorted &&
+                          block->monos[block->count - 1].exp < exp;
+        if (block->count == MONO_BLOCK_CAPACITY)
+        {
+            block = block->next_block = MonoBlockAlloc();
+        }
+    }
+    builder->last_block = block;
+
+    block->monos[block->count++] = MonoFromPoly(p, exp);
+    ++builder->mono_count;
+}
+
+Poly PolyBuilderFinish(PolyBuilder *builder)
+{
+    Poly result = PolyZero();
+
+    if (!builder->sorted)
+    {
+        Mono *monos = malloc(builder->mono_count * sizeof(Mono));
+        assert(monos != NULL);
+
+        unsigned count = 0;
+        for (MonoBlock *block = builder->first_block; block != NULL;
+             block = block->next_block)
+        {
+            memcpy(&monos[count], block->monos, block->count * sizeof(Mono));
+            count += block->count;
+        }
+        MonoBlockListFree(builder->first_block);
+
+        result = PolyAddMonos(count, monos);
+        free(monos);
+    }
+    else if (builder->first_block != NULL)
+    {
+        // Jednomiany są niezerowe i posortowane, więc wystarczy przenieść
+        // stałą jednomianu o wykładniku 0 i sprowadzić poziom do postaci
+        // kanonicznej.
+        result.first_block = builder->first_block;
+        Mono * const first_mono = FirstMono(&result);
+        if (first_mono->exp == 0)
+        {
+            HoistConstant(&result, first_mono);
+            if (PolyIsZero(&first_mono->p))
+            {
+                RemoveFirstMono(&result);
+            }
+        }
+
+        PolyFinishList(&result);
+    }
+
+    *builder = PolyBuilderInit();
+    return result;
+}
+
+/**
+ * Zwraca wykładnik jednomianu przy zmiennej o indeksie @p depth
+ *
+ * Jeśli zmienna występuje w jednomianie, przesuwa @p exps za nią.
+ * @param[in,out] exps : wykładniki posortowane wg. indeksu zmiennej
+ * @param[in,out] exp_count : liczba wykładników
+ * @param[in] depth : indeks zmiennej bieżącego poziomu
+ * @return wykładnik zmiennej (0 jeśli jej nie ma)
+ */
+static inline poly_exp_t TakeTermExp(const TermExp **exps,
+                                     unsigned *exp_count, unsigned depth)
+{
+    if (*exp_count == 0 || (*exps)->var_idx != depth)
+    {
+        return 0;
+    }
+
+    const poly_exp_t exp = (*exps)->exp;
+    ++*exps;
+    --*exp_count;
+    return exp;
+}
+
+/**
+ * Dołącza jednomian na koniec budowanej listy, o ile nie jest zerem
+ * @param[in,out] tail : koniec budowanej listy
+ * @param[in] p : współczynnik jednomianu (przejmowany na własność)
+ * @param[in] exp : wykładnik jednomianu
+ */
+static inline void AppendMono(MonoTail *tail, Poly *p, poly_exp_t exp)
+{
+    if (PolyIsZero(p))
+    {
+        return;
+    }
+
+    *MonoTailPush(tail) = MonoFromPoly(p, exp);
+}
+
+/**
+ * Sprowadza zbudowany poziom zmiennej @p level do postaci kanonicznej
+ *
+ * Ustawia liczbę pomijanych zmiennych i przenosi stałą jednomianu
+ * o wykładniku 0 do @p p.
+ * @param[in,out] p : wielomian bez stałej i mnożnika, którego lista
+ * jednomianów jest posortowana
+ * @param[in] level : indeks zmiennej poziomu
+ */
+static void FinishLevel(Poly *p, unsigned level)
+{
+    Mono * const first_mono = FirstMono(p);
+    if (first_mono != NULL && first_mono->exp == 0)
+    {
+        HoistConstant(p, first_mono);
+        if (PolyIsZero(&first_mono->p))
+        {
+            RemoveFirstMono(p);
+        }
+    }
+    p->var_skip = PolyIsCoeff(p) ? 0 : level;
+
+    PolyFinishList(p);
+}
+
+/**
+ * Mnoży wielomian przez jednomian w jednym przejściu
+ *
+ * Liczy `(c * p + extra) * x^exps`. Mnożenie przez jednomian nie zmienia
+ * kolejności jednomianów, więc wynik powstaje bez sortowania i scalania;
+ * współczynniki wyzerowane przez przepełnienie są od razu pomijane.
+ * @param[in] p : wielomian
+ * @param[in] c : mnożnik wielomianu
+ * @param[in] extra : stała dodawana do `c * p` przed przesunięciem
+ * @param[in] exps : wykładniki jednomianu posortowane wg. indeksu zmiennej
+ * @param[in] exp_count : liczba wykładników
+ * @param[in] bounds : ograniczenia posortowane wg. indeksu zmiennej
+ * @param[in] bound_count : liczba ograniczeń
+ * @param[in] depth : indeks zmiennej głównej @p p
+ * @return `(c * p + extra) * x^exps` z pominięciem jednomianów
+ * przekraczających ograniczenia
+ */
+static Poly PolyMulTermBounded(const Poly *p, poly_coeff_t c,
+                               poly_coeff_t extra,
+                               const TermExp *exps, unsigned exp_count,
+                               const PolyBound *bounds, unsigned bound_count,
+                               unsigned depth)
+{
+    const poly_coeff_t factor = c * PolyFactor(p);
+    const poly_coeff_t constant = factor * p->constant + extra;
+
+    // Przeskakujemy zmienne, od których nie zależy ani p, ani jednomian.
+    unsigned skip = PolyIsCoeff(p) ? UINT_MAX : p->var_skip;
+    if (exp_count > 0 && exps->var_idx - depth < skip)
+    {
+        skip = exps->var_idx - depth;
+    }
+    if (skip == UINT_MAX)
+    {
+        skip = 0;
+    }
+
+    MonoBlock view_storage;
+    Poly view;
+    if (!PolyIsCoeff(p) && skip < p->var_skip)
+    {
+        view = PolyExpandedView(p, skip, &view_storage);
+        p = &view;
+    }
+    depth += skip;
+
+    const poly_exp_t limit = TakeBound(&bounds, &bound_count, depth);
+    const poly_exp_t exp = TakeTermExp(&exps, &exp_count, depth);
+
+    Poly result = PolyZero();
+    MonoTail tail = MonoTailInit(&result);
+    MonoCursor current;
+    MonoBegin(&current, p);
+
+    if (exp == 0 && exp_count == 0)
+    {
+        result.constant = constant;
+    }
+    else if (ExpWithinBound(exp, limit))
+    {
+        // Stała trafia do jednomianu o wykładniku exp, razem ze
+        // współczynnikiem jednomianu o wykładniku 0.
+        Poly zero = PolyZero();
+        const Poly *shifted_constant = &zero;
+        if (current.mono != NULL && current.mono->exp == 0)
+        {
+            shifted_constant = &current.mono->p;
+            MonoNext(&current);
+        }
+
+        Poly shifted = PolyMulTermBounded(shifted_constant, factor, constant,
+                                          exps, exp_count, bounds,
+                                          bound_count, depth + 1);
+        AppendMono(&tail, &shifted, exp);
+    }
+
+    while (current.mono != NULL &&
+           ExpWithinBound((long long)current.mono->exp + exp, limit))
+    {
+        const Mono * const current_mono = current.mono;
+        Poly shifted = PolyMulTermBounded(&current_mono->p, factor, 0, exps,
+                                          exp_count, bounds, bound_count,
+                                          depth + 1);
+        AppendMono(&tail, &shifted, current_mono->exp + exp);
+
+        MonoNext(&current);
+    }
+
+    PolyFinishList(&result);
+    PolyAddSkip(&result, skip);
+
+    return result;
+}
+
+/**
+ * Sprawdza czy wielomian jest jednomianem `c * x^exps`
+ * @param[in] p : wielomian
+ * @param[out] exp_count : liczba zmiennych o dodatnim wykładniku
+ * @return Czy @p p jest jednomianem (lub współczynnikiem)?
+ */
+static bool PolyIsTerm(const Poly *p, unsigned *exp_count)
+{
+    *exp_count = 0;
+    while (!PolyIsCoeff(p))
+    {
+        if (p->constant != 0 || !HasSingleMono(p))
+        {
+            return false;
+        }
+
+        if (FirstMono(p)->exp != 0)
+        {
+            ++*exp_count;
+        }
+        p = &FirstMono(p)->p;
+    }
+
+    return true;
+}
+
+/**
+ * Mnoży wielomian przez jednomian
+ * @param[in] p : wielomian
+ * @param[in] term : jednomian (PolyIsTerm(term) musi być prawdą)
+ * @param[in] exp_count : liczba zmiennych o dodatnim wykładniku w @p term
+ * @param[in] bounds : ograniczenia posortowane wg. indeksu zmiennej
+ * @param[in] bound_count : liczba ograniczeń
+ * @param[in] depth : indeks zmiennej głównej @p p i @p term
+ * @return `p * term` z pominięciem jednomianów przekraczających ograniczenia
+ */
+static Poly PolyMulByTerm(const Poly *p, const Poly *term, unsigned exp_count,
+                          const PolyBound *bounds, unsigned bound_count,
+                          unsigned depth)
+{
+    TermExp *exps = NULL;
+    if (exp_count > 0)
+    {
+        exps = calloc(exp_count, sizeof(TermExp));
+        assert(exps != NULL);
+    }
+
+    poly_coeff_t c = 1;
+    unsigned i = 0;
+    for (unsigned var_idx = depth; !PolyIsCoeff(term); ++var_idx)
+    {
+        var_idx += term->var_skip;
+        c *= PolyFactor(term);
+        const Mono * const mono = FirstMono(term);
+        if (mono->exp != 0)
+        {
+            exps[i++] = (TermExp) {.var_idx = var_idx, .exp = mono->exp};
+        }
+        term = &mono->p;
+    }
+    c *= term->constant;
+
+    Poly result = c == 0 ? PolyZero()
+                         : PolyMulTermBounded(p, c, 0, exps, exp_count,
+                                              bounds, bound_count, depth);
+    free(exps);
+
+    return result;
+}
+
+/**
+ * Sprawdza, czy poziom wielomianu opłaca się przetwarzać w postaci gęstej
+ * @param[in] p : wielomian
+ * @param[in] stride : dzielnik wykładników @p p
+ * @return Czy poziom ma co najmniej DENSE_MIN_LENGTH pozycji, z których
+ * zajęta jest średnio co DENSE_MAX_GAP-ta?
+ */
+static bool LevelIsDense(const Poly *p, poly_exp_t stride)
+{
+    if (stride == 0)
+    {
+        return false;
+    }
+
+    if (p->is_dense)
+    {
+        const long long degree =
+            (long long)(p->dense->length - 1) * p->dense->stride;
+        return DenseShapePays(p->dense->count, degree / stride + 1,
+                              DENSE_MAX_GAP);
+    }
+
+    long long count = 0;
+    poly_exp_t degree = 0;
+    MonoCursor cursor;
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
+    {
+        const Mono * const m = cursor.mono;
+        ++count;
+        degree = m->exp;
+    }
+
+    return DenseShapePays(count, degree / stride + 1, DENSE_MAX_GAP);
+}
+
+/**
+ * Tworzy gęstą postać poziomu przechowywanego gęsto
+ * @param[in] p : wielomian przechowywany gęsto
+ * @param[in] stride : dodatni dzielnik wykładników @p p
+ * @return gęsta postać poziomu
+ */
+static DenseLevel DenseFromStored(const Poly *p, poly_exp_t stride)
+{
+    const DenseCoeffs * const dense = p->dense;
+    DenseLevel level = {.stride = stride,
+                        .length = (dense->length - 1) * dense->stride /
+                                  stride + 1,
+                        .polys = NULL, .coeffs = NULL, .coeff_polys = NULL};
+    level.polys = calloc(level.length, sizeof(const Poly*));
+    level.coeffs = calloc(level.length, sizeof(poly_coeff_t));
+    level.coeff_polys = calloc(level.length, sizeof(Poly));
+    assert(level.polys != NULL && level.coeffs != NULL &&
+           level.coeff_polys != NULL);
+
+    level.coeffs[0] = p->constant;
+    for (poly_exp_t i = 1; i < dense->length; ++i)
+    {
+        if (dense->coeffs[i] != 0)
+        {
+            const poly_exp_t j = i * dense->stride / stride;
+            level.coeffs[j] = dense->coeffs[i];
+            level.coeff_polys[j] = PolyFromCoeff(dense->coeffs[i]);
+            level.polys[j] = &level.coeff_polys[j];
+        }
+    }
+
+    return level;
+}
+
+/**
+ * Tworzy gęstą postać poziomu wielomianu
+ *
+ * Dla listy nie kopiuje współczynników: wskaźniki prowadzą do jednomianów
+ * @p p. Stałe współczynniki i stała poziomu nie uwzględniają mnożnika @p p.
+ * @param[in] p : wielomian
+ * @param[in] stride : dodatni dzielnik wykładników @p p
+ * @return gęsta postać poziomu
+ */
+static DenseLevel DenseFromLevel(const Poly *p, poly_exp_t stride)
+{
+    if (p->is_dense)
+    {
+        return DenseFromStored(p, stride);
+    }
+
+    poly_exp_t degree = 0;
+    bool constants = true;
+    MonoCursor cursor;
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
+    {
+        const Mono * const m = cursor.mono;
+        degree = m->exp;
+        constants = constants && PolyIsCoeff(&m->p);
+    }
+
+    DenseLevel level = {.stride = stride, .length = degree / stride + 1,
+                        .polys = NULL, .coeffs = NULL, .coeff_polys = NULL};
+    level.polys = calloc(level.length, sizeof(const Poly*));
+    assert(level.polys != NULL);
+    if (constants)
+    {
+        level.coeffs = calloc(level.length, sizeof(poly_coeff_t));
+        assert(level.coeffs != NULL);
+        level.coeffs[0] = p->constant;
+    }
+
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
+    {
+        const Mono * const m = cursor.mono;
+        level.polys[m->exp / stride] = &m->p;
+        if (constants)
+        {
+            level.coeffs[m->exp / stride] += m->p.constant;
+        }
+    }
+
+    return level;
+}
+
+void PolyDenseStats(unsigned long *muls, unsigned long *evals)
+{
+    *muls = dense_mul_count;
+    *evals = dense_at_count;
+}
+
+/**
+ * Zwalnia tablice gęstej postaci poziomu
+ * @param[in,out] level : gęsta postać poziomu
+ */
+static void DenseDestroy(DenseLevel *level)
+{
+    free(level->polys);
+    free(level->coeffs);
+    free(level->coeff_polys);
+}
+
+/**
+ * Dodaje iloczyn wielomianu i stałej do wielomianu
+ * @param[in,out] sum : wielomian
+ * @param[in] p : wielomian
+ * @param[in] c : stała
+ * @param[in] bounds : ograniczenia posortowane wg. indeksu zmiennej
+ * @param[in] bound_count : liczba ograniczeń
+ * @param[in] depth : indeks zmiennej głównej @p p
+ */
+static void AddScaledBounded(Poly *sum, const Poly *p, poly_coeff_t c,
+                             const PolyBound *bounds, unsigned bound_count,
+                             unsigned depth)
+{
+    if (c == 0)
+    {
+        return;
+    }
+
+    const Poly const_poly = PolyFromCoeff(c);
+    Poly product = PolyMulBounded(p, &const_poly, bounds, bound_count, depth);
+    PolyAddInPlace(sum, &product);
+}
+
+/**
+ * Mnoży dwa gęste poziomy wielomianów
+ *
+ * Iloczyn współczynników trafia wprost na pozycję o sumie indeksów,
+ * więc zamiast sortować wszystkie iloczyny jednomianów wystarczy jedna
+ * tablica wyników. Poziomy o stałych współczynnikach mnożymy jako
+ * tablice liczb, a tablica wyników zostaje tablicą iloczynu, o ile jest
+ * dość gęsta (DenseSettle). Pozostałe wyniki zamieniamy na listę
+ * jednomianów, pomijając wyzerowane pozycje.
+ * @param[in] p : wielomian, który nie jest współczynnikiem
+ * @param[in] q : wielomian pomijający tyle samo zmiennych co @p p
+ * @param[in] stride : dodatni wspólny dzielnik wykładników @p p i @p q
+ * @param[in] limit : ograniczenie wykładników bieżącego poziomu
+ * @param[in] bounds : ograniczenia głębszych zmiennych
+ * @param[in] bound_count : liczba ograniczeń głębszych zmiennych
+ * @param[in] depth : indeks zmiennej bieżącego poziomu
+ * @return iloczyn bez mnożników @p p i @p q, niepomijający zmiennych
+ */
+static Poly PolyMulDense(const Poly *p, const Poly *q, poly_exp_t stride,
+                         poly_exp_t limit, const PolyBound *bounds,
+                         unsigned bound_count, unsigned depth)
+{
+    ++dense_mul_count;
+    DenseLevel a = DenseFromLevel(p, stride);
+    DenseLevel b = DenseFromLevel(q, stride);
+
+    long long length = (long long)a.length + b.length - 1;
+    if (limit != UNBOUNDED && length > ((long long)limit + stride - 1) / stride)
+    {
+        length = ((long long)limit + stride - 1) / stride;
+    }
+
+    const bool constants = a.coeffs != NULL && b.coeffs != NULL;
+    Poly result = PolyZero();
+    if (constants)
+    {
+        DenseCoeffs * const sums = DenseAlloc(stride, length);
+        for (long long i = 0; i < a.length && i < length; ++i)
+        {
+            const poly_coeff_t c = a.coeffs[i];
+            const long long count = b.length < length - i ? b.length
+                                                          : length - i;
+            if (c != 0)
+            {
+                CoeffMulAddArray(&sums->coeffs[i], b.coeffs, c, count);
+            }
+        }
+
+        result.dense = sums;
+        result.is_dense = true;
+    }
+    else {
+        MonoTail tail = MonoTailInit(&result);
+        Poly *sums = calloc(length + 1, sizeof(Poly));
+        assert(sums != NULL);
+        for (long long i = 0; i < a.length && i < length; ++i)
+        {
+            if (a.polys[i] == NULL)
+            {
+                continue;
+            }
+
+            const long long count = b.length < length - i ? b.length
+                                                          : length - i;
+            for (long long j = 0; j < count; ++j)
+            {
+                if (b.polys[j] != NULL)
+                {
+                    Poly product = PolyMulBounded(a.polys[i], b.polys[j],
+                                                  bounds, bound_count,
+                                                  depth + 1);
+                    PolyAddInPlace(&sums[i + j], &product);
+                }
+            }
+            AddScaledBounded(&sums[i], a.polys[i], q->constant,
+                             bounds, bound_count, depth + 1);
+        }
+        for (long long j = 0; j < b.length && j < length; ++j)
+        {
+            if (b.polys[j] != NULL)
+            {
+                AddScaledBounded(&sums[j], b.polys[j], p->constant,
+                                 bounds, bound_count, depth + 1);
+            }
+        }
+
+        for (long long i = 0; i < length; ++i)
+        {
+            AppendMono(&tail, &sums[i], i * stride);
+        }
+        free(sums);
+    }
+
+    DenseDestroy(&a);
+    DenseDestroy(&b);
+
+    if (constants)
+    {
+        DenseSettle(&result);
+    }
+    else {
+        FinishLevel(&result, 0);
+        result.constant += p->constant * q->constant *
+                           CoeffInverse(PolyFactor(&result));
+    }
+    return result;
+}
+
+/**
+ * Mnoży dwa wielomiany, pomijając jednomiany wykraczające poza ograniczenia
+ *
+ * Jednomiany iloczynu przekraczające ograniczenie nie są w ogóle liczone.
+ * Wszystkie ograniczenia muszą być dodatnie.
+ * @param[in] p : wielomian
+ * @param[in] q : wielomian
+ * @param[in] bounds : ograniczenia posortowane wg. indeksu zmiennej
+ * @param[in] bound_count : liczba ograniczeń
+ * @param[in] depth : indeks zmiennej głównej @p p i @p q
+ * @return `p * q` z pominięciem jednomianów przekraczających ograniczenia
+ */
+static Poly PolyMulBounded(const Poly *p, const Poly *q,
+                           const PolyBound *bounds, unsigned bound_count,
+                           unsigned depth)
+{
+    unsigned exp_count;
+    if (PolyIsTerm(q, &exp_count))
+    {
+        return PolyMulByTerm(p, q, exp_count, bounds, bound_count, depth);
+    }
+    if (PolyIsTerm(p, &exp_count))
+    {
+        return PolyMulByTerm(q, p, exp_count, bounds, bound_count, depth);
+    }
+
+    // Zmienne pomijane przez oba czynniki pomija też iloczyn.
+    MonoBlock view_storage;
+    Poly view;
+    if (p->var_skip > q->var_skip)
+    {
+        view = PolyExpandedView(p, q->var_skip, &view_storage);
+        p = &view;
+    }
+    else if (q->var_skip > p->var_skip)
+    {
+        view = PolyExpandedView(q, p->var_skip, &view_storage);
+        q = &view;
+    }
+    const unsigned skip = p->var_skip;
+    depth += skip;
+
+    const poly_exp_t limit = TakeBound(&bounds, &bound_count, depth);
+
+    const poly_exp_t stride = ExpGcd(PolyExpGcd(p), PolyExpGcd(q));
+    if (LevelIsDense(p, stride) && LevelIsDense(q, stride))
+    {
+        Poly result = PolyMulDense(p, q, stride, limit, bounds, bound_count,
+                                   depth);
+        PolySetFactor(&result, PolyFactor(&result) * PolyFactor(p) *
+                               PolyFactor(q));
+        PolyAddSkip(&result, skip);
+        return result;
+    }
+
+    unsigned all_mono_count = MonoCount(p) + MonoCount(q);
+    MonoCursor p_cursor;
+    for (MonoBegin(&p_cursor, p); p_cursor.mono != NULL;
+         MonoNext(&p_cursor))
+    {
+        MonoCursor q_cursor;
+        for (MonoBegin(&q_cursor, q);
+             q_cursor.mono != NULL &&
+             ExpWithinBound((long long)p_cursor.mono->exp +
+                            q_cursor.mono->exp, limit);
+             MonoNext(&q_cursor))
+        {
+            ++all_mono_count;
+        }
+    }
+
+    Mono *monos = calloc(all_mono_count, sizeof(Mono));
+    assert(monos != NULL);
+
+    unsigned mono_count = 0;
+    for (MonoBegin(&p_cursor, p); p_cursor.mono != NULL;
+         MonoNext(&p_cursor))
+    {
+        const Mono * const current_mono_p = p_cursor.mono;
+        MonoCursor q_cursor;
+        for (MonoBegin(&q_cursor, q);
+             q_cursor.mono != NULL &&
+             ExpWithinBound((long long)current_mono_p->exp +
+                            q_cursor.mono->exp, limit);
+             MonoNext(&q_cursor))
+        {
+            const Mono * const current_mono_q = q_cursor.mono;
+            monos[mono_count].p   = PolyMulBounded(&current_mono_p->p,
+                                                   &current_mono_q->p,
+                                                   bounds, bound_count,
+                                                   depth + 1);
+            monos[mono_count].exp = current_mono_p->exp +
+                                    current_mono_q->exp;
+
+            ++mono_count;
+        }
+    }
+
+    mono_count += CloneMonosMultipliedByAConstant(p, q->constant,
+                                                  limit, bounds, bound_count,
+                                                  depth, &monos[mono_count]);
+    mono_count += CloneMonosMultipliedByAConstant(q, p->constant,
+                                                  limit, bounds, bound_count,
+                                                  depth, &monos[mono_count]);
+
+    // Wynik mógł zostać sprowadzony do poziomu z własnym mnożnikiem.
+    Poly result = PolyAddMonos(mono_count, monos);
+    result.constant += p->constant * q->constant *
+                       CoeffInverse(PolyFactor(&result));
+    PolySetFactor(&result, PolyFactor(&result) * PolyFactor(p) *
+                           PolyFactor(q));
+    PolyAddSkip(&result, skip);
+
+    free(monos);
+
+    return result;
+}
+
+Poly PolyMul(const Poly *p, const Poly *q)
+{
+    return PolyMulBounded(p, q, ring_bounds, ring_bound_count, 0);
+}
+
+/**
+ * Znajduje miejsce ograniczenia zmiennej @p var_idx w tablicy ograniczeń
+ * @param[in] bounds : ograniczenia posortowane wg. indeksu zmiennej
+ * @param[in] bound_count : liczba ograniczeń
+ * @param[in] var_idx : indeks zmiennej
+ * @return indeks pierwszego ograniczenia zmiennej o indeksie >= var_idx
+ */
+static unsigned FindBound(const PolyBound bounds[], unsigned bound_count,
+                          unsigned var_idx)
+{
+    unsigned i = 0;
+    while (i < bound_count && bounds[i].var_idx < var_idx)
+    {
+        ++i;
+    }
+
+    return i;
+}
+
+Poly PolyMulTrunc(const Poly *p, const Poly *q, unsigned var_idx,
+                  poly_exp_t n)
+{
+    if (n == 0)
+    {
+        return PolyZero();
+    }
+
+    PolyBound *bounds = calloc(ring_bound_count + 1, sizeof(PolyBound));
+    assert(bounds != NULL);
+    unsigned bound_count = ring_bound_count;
+    for (unsigned i = 0; i < bound_count; ++i)
+    {
+        bounds[i] = ring_bounds[i];
+    }
+
+    const unsigned i = FindBound(bounds, bound_count, var_idx);
+    if (i < bound_count && bounds[i].var_idx == var_idx)
+    {
+        if (n < bounds[i].limit)
+        {
+            bounds[i].limit = n;
+        }
+    }
+    else {
+        memmove(&bounds[i + 1], &bounds[i],
+                (bound_count - i) * sizeof(PolyBound));
+        bounds[i] = (PolyBound) {.var_idx = var_idx, .limit = n};
+        ++bound_count;
+    }
+
+    Poly result = PolyMulBounded(p, q, bounds, bound_count, 0);
+    free(bounds);
+
+    return result;
+}
+
+/**
+ * Usuwa z wielomianu jednomiany wykraczające poza ograniczenia
+ * @param[in,out] p : wielomian
+ * @param[in] bounds : ograniczenia posortowane wg. indeksu zmiennej
+ * @param[in] bound_count : liczba ograniczeń
+ * @param[in] depth : indeks zmiennej głównej @p p
+ */
+static void PolyTruncateInPlace(Poly *p, const PolyBound *bounds,
+                                unsigned bound_count, unsigned depth)
+{
+    if (bound_count == 0)
+    {
+        return;
+    }
+
+    depth += p->var_skip;
+    const poly_exp_t limit = TakeBound(&bounds, &bound_count, depth);
+
+    if (p->is_dense)
+    {
+        // Stałe współczynniki obcina tylko ograniczenie tego poziomu.
+        DenseCoeffs * const dense = p->dense;
+        if (limit != UNBOUNDED &&
+            dense->length > ((long long)limit + dense->stride - 1) /
+                            dense->stride)
+        {
+            dense->length = ((long long)limit + dense->stride - 1) /
+                            dense->stride;
+            DenseSettle(p);
+        }
+        return;
+    }
+
+    PolyDropIndex(p);
+    for (MonoBlock *block = p->first_block; block != NULL;
+         block = block->next_block)
+    {
+        for (unsigned i = 0; i < block->count; ++i)
+        {
+            if (!ExpWithinBound(block->monos[i].exp, limit))
+            {
+                // Lista jest posortowana, więc usuwamy całą resztę listy.
+                for (unsigned j = i; j < block->count; ++j)
+                {
+                    MonoDestroy(&block->monos[j]);
+                }
+                block->count = i;
+
+                Poly rest = {.first_block = block->next_block,
+                             .constant = 0};
+                PolyDestroy(&rest);
+                block->next_block = NULL;
+                break;
+            }
+
+            PolyTruncateInPlace(&block->monos[i].p, bounds, bound_count,
+                                depth + 1);
+        }
+    }
+
+    RemoveEmptyMonosFromPoly(p);
+}
+
+void PolyRingSet(unsigned var_idx, poly_exp_t n)
+{
+    const unsigned i = FindBound(ring_bounds, ring_bound_count, var_idx);
+    const bool present = i < ring_bound_count &&
+                         ring_bounds[i].var_idx == var_idx;
+
+    if (n == 0)
+    {
+        if (present)
+        {
+            memmove(&ring_bounds[i], &ring_bounds[i + 1],
+                    (ring_bound_count - i - 1) * sizeof(PolyBound));
+            --ring_bound_count;
+        }
+        if (ring_bound_count == 0)
+        {
+            PolyRingReset();
+        }
+        return;
+    }
+
+    if (!present)
+    {
+        ring_bounds = realloc(ring_bounds,
+                              (ring_bound_count + 1) * sizeof(PolyBound));
+        assert(ring_bounds != NULL);
+        memmove(&ring_bounds[i + 1], &ring_bounds[i],
+                (ring_bound_count - i) * sizeof(PolyBound));
+        ++ring_bound_count;
+    }
+
+    ring_bounds[i] = (PolyBound) {.var_idx = var_idx, .limit = n};
+
+    // Zapamiętane potęgi były obcinane według poprzednich ograniczeń.
+    PolyPowerCacheClear();
+}
+
+void PolyRingReset(void)
+{
+    free(ring_bounds);
+    ring_bounds = NULL;
+    ring_bound_count = 0;
+
+    PolyPowerCacheClear();
+}
+
+void PolyReleaseMemory(void)
+{
+    PolyRingReset();
+
+    if (!MONO_POOL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&mono_pool_lock);
+    while (mono_slabs != NULL)
+    {
+        MonoSlab *next = mono_slabs->next;
+        free(mono_slabs);
+        mono_slabs = next;
+    }
+    mono_shared_free = NULL;
+    pthread_mutex_unlock(&mono_pool_lock);
+
+    mono_free_list = NULL;
+    mono_free_count = 0;
+}
+
+bool PolyRingIsSet(void)
+{
+    return ring_bound_count > 0;
+}
+
+void PolyRingReduce(Poly *p)
+{
+    PolyTruncateInPlace(p, ring_bounds, ring_bound_count, 0);
+}
+
+/**
+ * Dodaje wyraz do listy wyrazów wielomianu o przestawionych zmiennych
+ * @param[in,out] list : lista wyrazów
+ * @param[in] path : wykładniki przestawianych zmiennych (w nowej kolejności)
+ * @param[in] count : liczba przestawianych zmiennych
+ * @param[in] tail : współczynnik wyrazu (przejmowany na własność)
+ */
+static void AppendPermutedTerm(PermutedTermList *list, const poly_exp_t path[],
+                               unsigned count, Poly *tail)
+{
+    if (PolyIsZero(tail))
+    {
+        return;
+    }
+
+    if (list->size == list->capacity)
+    {
+        list->capacity = list->capacity == 0 ? 16 : 2 * list->capacity;
+        list->terms = realloc(list->terms,
+                              list->capacity * sizeof(PermutedTerm));
+        list->exps = realloc(list->exps,
+                             list->capacity * count * sizeof(poly_exp_t));
+        assert(list->terms != NULL && list->exps != NULL);
+    }
+
+    memcpy(&list->exps[list->size * count], path, count * sizeof(poly_exp_t));
+    list->terms[list->size].count = count;
+    list->terms[list->size].tail = *tail;
+    ++list->size;
+}
+
+/**
+ * Rozkłada wielomian na wyrazy `x^path * tail`, gdzie tail nie zależy
+ * od przestawianych zmiennych
+ *
+ * Stałe z łańcucha jednomianów o wykładniku 0 przenosimy w dół, tak jak
+ * przy wypisywaniu, więc żadne dwa wyrazy nie mają tych samych wykładników.
+ * @param[in] p : wielomian
+ * @param[in] factor : iloczyn mnożników wielomianów nadrzędnych
+ * @param[in] constant : stała przeniesiona z wielomianów nadrzędnych
+ * @param[in] depth : indeks pierwszej zmiennej, od której może zależeć @p p
+ * @param[in] count : liczba przestawianych zmiennych
+ * @param[in] perm : nowe indeksy przestawianych zmiennych
+ * @param[in,out] path : wykładniki przestawianych zmiennych na ścieżce
+ * @param[in,out] list : lista wyrazów
+ */
+static void CollectPermutedTerms(const Poly *p, poly_coeff_t factor,
+                                 poly_coeff_t constant, unsigned depth,
+                                 unsigned count, const unsigned perm[],
+                                 poly_exp_t path[], PermutedTermList *list)
+{
+    if (PolyIsCoeff(p) || depth + p->var_skip >= count)
+    {
+        // Reszta wielomianu nie zależy od przestawianych zmiennych.
+        Poly tail = PolyScale(p, factor);
+        if (!PolyIsCoeff(&tail))
+        {
+            tail.var_skip -= count - depth;
+        }
+        Poly tail_constant = PolyFromCoeff(constant);
+        PolyAddInPlace(&tail, &tail_constant);
+
+        AppendPermutedTerm(list, path, count, &tail);
+        return;
+    }
+
+    const unsigned var_idx = depth + p->var_skip;
+    factor *= PolyFactor(p);
+    constant += factor * p->constant;
+
+    bool constant_used = false;
+    MonoCursor cursor;
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
+    {
+        const Mono * const current_mono = cursor.mono;
+        path[perm[var_idx]] = current_mono->exp;
+        if (current_mono->exp == 0)
+        {
+            constant_used = true;
+            CollectPermutedTerms(&current_mono->p, factor, constant,
+                                 var_idx + 1, count, perm, path, list);
+        }
+        else {
+            CollectPermutedTerms(&current_mono->p, factor, 0,
+                                 var_idx + 1, count, perm, path, list);
+        }
+    }
+    path[perm[var_idx]] = 0;
+
+    if (!constant_used)
+    {
+        Poly tail = PolyFromCoeff(constant);
+        AppendPermutedTerm(list, path, count, &tail);
+    }
+}
+
+/**
+ * Komparator dla typu PermutedTerm
+ *
+ * Porównuje leksykograficznie wykładniki dwóch wyrazów
+ * @param[in] left_v : wyraz
+ * @param[in] right_v : wyraz
+ * @return 0 dla równych wykładników, 1 gdy left_v jest większy,
+ * -1 gdy left_v jest mniejszy
+ */
+static int PermutedTermCompare(const void *left_v, const void *right_v)
+{
+    const PermutedTerm *left  = (const PermutedTerm *)left_v;
+    const PermutedTerm *right = (const PermutedTerm *)right_v;
+
+    for (unsigned i = 0; i < left->count; ++i)
+    {
+        if (left->exps[i] != right->exps[i])
+        {
+            return left->exps[i] > right->exps[i] ? 1 : -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Buduje wielomian z posortowanych wyrazów
+ *
+ * Przejmuje na własność współczynniki wyrazów.
+ * @param[in,out] terms : wyrazy posortowane wg. wykładników
+ * @param[in] term_count : liczba wyrazów (dodatnia)
+ * @param[in] var_idx : indeks zmiennej budowanego poziomu
+ * @return suma wyrazów
+ */
+static Poly BuildFromPermutedTerms(PermutedTerm terms[], size_t term_count,
+                                   unsigned var_idx)
+{
+    if (var_idx == terms[0].count)
+    {
+        Poly result = terms[0].tail;
+        for (size_t i = 1; i < term_count; ++i)
+        {
+            PolyAddInPlace(&result, &terms[i].tail);
+        }
+
+        return result;
+    }
+
+    Poly result = PolyZero();
+    MonoTail tail = MonoTailInit(&result);
+
+    size_t group_start = 0;
+    while (group_start < term_count)
+    {
+        const poly_exp_t exp = terms[group_start].exps[var_idx];
+        size_t group_end = group_start + 1;
+        while (group_end < term_count && terms[group_end].exps[var_idx] == exp)
+        {
+            ++group_end;
+        }
+
+        Poly child = BuildFromPermutedTerms(&terms[group_start],
+                                            group_end - group_start,
+                                            var_idx + 1);
+        AppendMono(&tail, &child, exp);
+
+        group_start = group_end;
+    }
+
+    Mono * const first_mono = FirstMono(&result);
+    if (first_mono != NULL && first_mono->exp == 0)
+    {
+        HoistConstant(&result, first_mono);
+        if (PolyIsZero(&first_mono->p))
+        {
+            RemoveFirstMono(&result);
+        }
+    }
+
+    PolyFinishList(&result);
+
+    return result;
+}
+
+Poly PolyPermuteVars(const Poly *p, unsigned count, const unsigned perm[])
+{
+    if (count == 0 || PolyIsCoeff(p))
+    {
+        return PolyClone(p);
+    }
+
+    poly_exp_t *path = calloc(count, sizeof(poly_exp_t));
+    assert(path != NULL);
+
+    PermutedTermList list = {.terms = NULL, .exps = NULL,
+                             .size = 0, .capacity = 0};
+    CollectPermutedTerms(p, 1, 0, 0, count, perm, path, &list);
+    free(path);
+
+    for (size_t i = 0; i < list.size; ++i)
+    {
+        list.terms[i].exps = &list.exps[i * count];
+    }
+    qsort(list.terms, list.size, sizeof(PermutedTerm), PermutedTermCompare);
+
+    Poly result = list.size == 0 ? PolyZero()
+                                 : BuildFromPermutedTerms(list.terms,
+                                                          list.size, 0);
+
+    free(list.terms);
+    free(list.exps);
+
+    return result;
+}
+
+void PolyProductReorder(bool enabled)
+{
+    product_reorder = enabled;
+}
+
+/**
+ * Wybiera kolejność pierwszych zmiennych do mnożenia czynników
+ *
+ * Rekurencyjna reprezentacja iloczynu ma najmniej węzłów, gdy zmienne
+ * o najmniejszym stopniu są najbardziej zewnętrzne, dlatego sortujemy
+ * zmienne rosnąco wg. sumy ich stopni w czynnikach.
+ * @param[in] count : liczba czynników
+ * @param[in] factors : czynniki
+ * @param[out] perm : nowe indeksy zmiennych 0..REORDER_MAX_VARS-1
+ * @return Czy wybrana kolejność różni się od obecnej?
+ */
+static bool ChooseVarOrder(unsigned count, const Poly factors[],
+                           unsigned perm[])
+{
+    long degrees[REORDER_MAX_VARS] = {0};
+    unsigned order[REORDER_MAX_VARS];
+    for (unsigned v = 0; v < REORDER_MAX_VARS; ++v)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            degrees[v] += Max(PolyDegBy(&factors[i], v), 0);
+        }
+
+        // Sortowanie przez wstawianie, stabilne dla równych stopni.
+        unsigned j = v;
+        while (j > 0 && degrees[order[j - 1]] > degrees[v])
+        {
+            order[j] = order[j - 1];
+            --j;
+        }
+        order[j] = v;
+    }
+
+    bool changed = false;
+    for (unsigned i = 0; i < REORDER_MAX_VARS; ++i)
+    {
+        perm[order[i]] = i;
+        changed |= order[i] != i;
+    }
+
+    return changed;
+}
+
+/**
+ * Zlicza jednomiany wielomianu, łącznie z jednomianami współczynników
+ * @param[in] p : wielomian
+ * @return liczba jednomianów
+ */
+static size_t PolyTermCount(const Poly *p)
+{
+    size_t count = 0;
+
+    MonoCursor cursor;
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
+    {
+        count += 1 + PolyTermCount(&cursor.mono->p);
+    }
+
+    return count;
+}
+
+/**
+ * Miesza wartość do skrótu
+ * @param[in] hash : skrót
+ * @param[in] value : wartość
+ * @return nowy skrót
+ */
+static inline unsigned long long HashMix(unsigned long long hash,
+                                         unsigned long long value)
+{
+    hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    return hash * 0xff51afd7ed558ccdULL;
+}
+
+/**
+ * Liczy skrót struktury wielomianu
+ *
+ * Skrót zależy od wartości współczynników, a nie od odłożonych mnożników,
+ * więc równe wielomiany mają równe skróty.
+ * @param[in] p : wielomian
+ * @param[in] factor : iloczyn mnożników wielomianów nadrzędnych
+ * @return skrót
+ */
+static unsigned long long PolyHash(const Poly *p, poly_coeff_t factor)
+{
+    factor *= PolyFactor(p);
+
+    unsigned long long hash = HashMix(p->var_skip, factor * p->constant);
+    MonoCursor cursor;
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
+    {
+        const Mono * const m = cursor.mono;
+        hash = HashMix(hash, m->exp);
+        hash = HashMix(hash, PolyHash(&m->p, factor));
+    }
+
+    return hash;
+}
+
+/**
+ * Usuwa potęgę z listy pamięci podręcznej
+ * @param[in,out] entry : potęga
+ */
+static void PowerCacheUnlink(PowerCacheEntry *entry)
+{
+    if (entry->prev != NULL)
+    {
+        entry->prev->next = entry->next;
+    }
+    else {
+        power_cache_head = entry->next;
+    }
+    if (entry->next != NULL)
+    {
+        entry->next->prev = entry->prev;
+    }
+    else {
+        power_cache_tail = entry->prev;
+    }
+}
+
+/**
+ * Wstawia potęgę na początek listy pamięci podręcznej
+ * @param[in,out] entry : potęga
+ */
+static void PowerCachePushFront(PowerCacheEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = power_cache_head;
+    if (power_cache_head != NULL)
+    {
+        power_cache_head->prev = entry;
+    }
+    else {
+        power_cache_tail = entry;
+    }
+    power_cache_head = entry;
+}
+
+/**
+ * Usuwa najdawniej użytą potęgę z pamięci podręcznej
+ */
+static void PowerCacheEvict(void)
+{
+    PowerCacheEntry * const entry = power_cache_tail;
+    PowerCacheUnlink(entry);
+
+    power_cache_size -= entry->size;
+    --power_cache_count;
+    PolyDestroy(&entry->base);
+    PolyDestroy(&entry->power);
+    free(entry);
+}
+
+void PolyPowerCacheClear(void)
+{
+    while (power_cache_tail != NULL)
+    {
+        PowerCacheEvict();
+    }
+}
+
+void PolyPowerCacheSetBudget(size_t budget)
+{
+    power_cache_budget = budget;
+    while (power_cache_size > power_cache_budget)
+    {
+        PowerCacheEvict();
+    }
+}
+
+void PolyPowerCacheStats(unsigned long *hits, unsigned long *misses)
+{
+    *hits = power_cache_hits;
+    *misses = power_cache_misses;
+}
+
+/**
+ * Potęguje wielomian, korzystając z pamięci podręcznej potęg
+ *
+ * Gdy potęgi nie ma w pamięci podręcznej, zaczynamy od największej
+ * zapamiętanej potęgi tej samej podstawy o mniejszym wykładniku.
+ * Potęgi współczynników liczymy zawsze od nowa.
+ * @param[in] p : wielomian
+ * @param[in] n : wykładnik
+ * @return `p^n`
+ */
+static Poly CachedPolyPow(const Poly *p, poly_exp_t n)
+{
+    if (PolyIsCoeff(p) || power_cache_budget == 0 || n < 2)
+    {
+        return FastPolyPow(p, n);
+    }
+
+    const unsigned long long hash = PolyHash(p, 1);
+    PowerCacheEntry *best = NULL;
+    for (PowerCacheEntry *entry = power_cache_head; entry != NULL;
+         entry = entry->next)
+    {
+        if (entry->hash != hash || entry->exp > n ||
+            (best != NULL && entry->exp <= best->exp) ||
+            !PolyIsEq(&entry->base, p))
+        {
+            continue;
+        }
+
+        best = entry;
+        if (entry->exp == n)
+        {
+            break;
+        }
+    }
+
+    if (best != NULL)
+    {
+        PowerCacheUnlink(best);
+        PowerCachePushFront(best);
+        if (best->exp == n)
+        {
+            ++power_cache_hits;
+            return PolyClone(&best->power);
+        }
+    }
+    ++power_cache_misses;
+
+    Poly result;
+    if (best != NULL)
+    {
+        Poly rest = FastPolyPow(p, n - best->exp);
+        result = PolyMul(&best->power, &rest);
+        PolyDestroy(&rest);
+    }
+    else {
+        result = FastPolyPow(p, n);
+    }
+
+    const size_t size = PolyTermCount(p) + PolyTermCount(&result);
+    if (size <= power_cache_budget)
+    {
+        while (power_cache_size + size > power_cache_budget ||
+               power_cache_count >= POWER_CACHE_MAX_ENTRIES)
+        {
+            PowerCacheEvict();
+        }
+
+        PowerCacheEntry *entry = malloc(sizeof(PowerCacheEntry));
+        assert(entry != NULL);
+        *entry = (PowerCacheEntry) {.hash = hash, .base = PolyClone(p),
+                                    .exp = n, .power = PolyClone(&result),
+                                    .size = size};
+        PowerCachePushFront(entry);
+        power_cache_size += size;
+        ++power_cache_count;
+    }
+
+    return result;
+}
+
+/**
+ * Komparator dla typu ProductFactor
+ *
+ * Porównuje rozmiary dwóch czynników
+ * @param[in] left_v : czynnik
+ * @param[in] right_v : czynnik
+ * @return 0 dla równych rozmiarów, 1 gdy left_v jest większy,
+ * -1 gdy left_v jest mniejszy
+ */
+static int ProductFactorCompare(const void *left_v, const void *right_v)
+{
+    const ProductFactor *left  = (const ProductFactor *)left_v;
+    const ProductFactor *right = (const ProductFactor *)right_v;
+
+    if (left->size > right->size)
+    {
+        return 1;
+    }
+
+    if (left->size < right->size)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Mnoży pary czynników przydzielone do jednego wątku
+ * @param[in,out] task_v : wskaźnik na ProductTask
+ * @return NULL
+ */
+static void* ProductWorker(void *task_v)
+{
+    ProductTask *task = task_v;
+
+    for (unsigned i = task->first_pair; i < task->pair_count; i += task->stride)
+    {
+        task->results[i] = PolyMul(&task->factors[2 * i].poly,
+                                   &task->factors[2 * i + 1].poly);
+    }
+
+    return NULL;
+}
+
+/**
+ * Zwraca liczbę wątków, na których warto mnożyć pary jednej rundy
+ * @param[in] factors : czynniki posortowane rosnąco wg. rozmiaru
+ * @param[in] pair_count : liczba par w rundzie
+ * @return liczba wątków (co najmniej 1)
+ */
+static unsigned ProductThreadCount(const ProductFactor factors[],
+                                   unsigned pair_count)
+{
+    const size_t largest_pair_cost = factors[2 * pair_count - 2].size *
+                                     factors[2 * pair_count - 1].size;
+    if (pair_count < 2 || largest_pair_cost < PRODUCT_PARALLEL_THRESHOLD)
+    {
+        return 1;
+    }
+
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_count > PRODUCT_MAX_THREADS)
+    {
+        cpu_count = PRODUCT_MAX_THREADS;
+    }
+    if (cpu_count < 1)
+    {
+        cpu_count = 1;
+    }
+
+    return pair_count < cpu_count ? pair_count : (unsigned)cpu_count;
+}
+
+/**
+ * Mnoży pary sąsiednich czynników, rozdzielając pracę między wątki
+ * @param[in] factors : czynniki posortowane rosnąco wg. rozmiaru
+ * @param[in] pair_count : liczba par
+ * @param[out] results : tablica na @p pair_count wyników
+ */
+static void MultiplyFactorPairs(const ProductFactor factors[],
+                                unsigned pair_count, Poly results[])
+{
+    const unsigned thread_count = ProductThreadCount(factors, pair_count);
+
+    ProductTask *tasks = calloc(thread_count, sizeof(ProductTask));
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+    bool *started = calloc(thread_count, sizeof(bool));
+    assert(tasks != NULL && threads != NULL && started != NULL);
+
+    for (unsigned i = 0; i < thread_count; ++i)
+    {
+        tasks[i] = (ProductTask) {.factors = factors, .results = results,
+                                  .pair_count = pair_count, .first_pair = i,
+                                  .stride = thread_count};
+    }
+
+    // Wątek główny przetwarza pary zadania 0.
+    // Jeśli nie uda się utworzyć wątku, jego zadanie też wykonujemy sami.
+    for (unsigned i = 1; i < thread_count; ++i)
+    {
+        started[i] = pthread_create(&threads[i], NULL,
+                                    &ProductWorker, &tasks[i]) == 0;
+    }
+    for (unsigned i = 0; i < thread_count; ++i)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+        else {
+            ProductWorker(&tasks[i]);
+        }
+    }
+
+    free(tasks);
+    free(threads);
+    free(started);
+}
+
+/**
+ * Mnoży @p count wielomianów w zrównoważonym drzewie mnożeń
+ * @param[in] count : liczba wielomianów
+ * @param[in] factors : tablica wielomianów
+ * @return iloczyn wielomianów
+ */
+static Poly PolyProductBalanced(unsigned count, const Poly factors[])
+{
+    if (count == 0)
+    {
+        return PolyFromCoeff(1);
+    }
+
+    ProductFactor *current = calloc(count, sizeof(ProductFactor));
+    Poly *results = calloc(count / 2 + 1, sizeof(Poly));
+    assert(current != NULL && results != NULL);
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        current[i].poly  = factors[i];
+        current[i].size  = PolyTermCount(&factors[i]);
+        current[i].owned = false;
+    }
+
+    // W każdej rundzie mnożymy najmniejszy czynnik z drugim najmniejszym,
+    // trzeci z czwartym itd. Daje to zrównoważone drzewo mnożeń
+    // o głębokości log(count), a pary jednej rundy są od siebie niezależne.
+    while (count > 1)
+    {
+        qsort(current, count, sizeof(ProductFactor), ProductFactorCompare);
+
+        const unsigned pair_count = count / 2;
+        MultiplyFactorPairs(current, pair_count, results);
+
+        for (unsigned i = 0; i < pair_count; ++i)
+        {
+            for (unsigned j = 2 * i; j <= 2 * i + 1; ++j)
+            {
+                if (current[j].owned)
+                {
+                    PolyDestroy(&current[j].poly);
+                }
+            }
+
+            current[i].poly  = results[i];
+            current[i].size  = PolyTermCount(&results[i]);
+            current[i].owned = true;
+        }
+
+        if (count % 2 == 1)
+        {
+            current[pair_count] = current[count - 1];
+        }
+        count = pair_count + count % 2;
+    }
+
+    Poly result = current[0].owned ? current[0].poly
+                                   : PolyClone(&current[0].poly);
+
+    free(current);
+    free(results);
+
+    return result;
+}
+
+Poly PolyProductN(unsigned count, const Poly factors[])
+{
+    unsigned perm[REORDER_MAX_VARS];
+
+    // Ograniczenia pierścienia dotyczą zmiennych w oryginalnej kolejności.
+    if (!product_reorder || ring_bound_count > 0 || count < 2 ||
+        !ChooseVarOrder(count, factors, perm))
+    {
+        return PolyProductBalanced(count, factors);
+    }
+
+    unsigned inverse[REORDER_MAX_VARS];
+    for (unsigned v = 0; v < REORDER_MAX_VARS; ++v)
+    {
+        inverse[perm[v]] = v;
+    }
+
+    Poly *permuted = calloc(count, sizeof(Poly));
+    assert(permuted != NULL);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        permuted[i] = PolyPermuteVars(&factors[i], REORDER_MAX_VARS, perm);
+    }
+
+    Poly permuted_result = PolyProductBalanced(count, permuted);
+    Poly result = PolyPermuteVars(&permuted_result, REORDER_MAX_VARS, inverse);
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        PolyDestroy(&permuted[i]);
+    }
+    free(permuted);
+    PolyDestroy(&permuted_result);
+
+    return result;
+}
+
+Poly PolyNeg(const Poly *p)
+{
+    Poly result = PolyClone(p);
+    PolyNegInPlace(&result);
+
+    return result;
+}
+
+/**
+ * Mnoży w miejscu wszystkie współczynniki wielomianu przez stałą
+ *
+ * Usuwa przy tym jednomiany, których współczynniki wyzerowało przepełnienie.
+ * Wynik nie ma odłożonych mnożników.
+ * @param[in,out] p : wielomian
+ * @param[in] c : stała
+ */
+static void PolyScaleEagerInPlace(Poly *p, poly_coeff_t c)
+{
+    c *= PolyFactor(p);
+    p->factor = 0;
+    p->constant *= c;
+    PolyDropIndex(p);
+
+    if (p->is_dense)
+    {
+        CoeffScaleArray(p->dense->coeffs, c, p->dense->length);
+        DenseSettle(p);
+        return;
+    }
+
+    for (MonoBlock *block = p->first_block; block != NULL;
+         block = block->next_block)
+    {
+        for (unsigned i = 0; i < block->count; ++i)
+        {
+            PolyScaleEagerInPlace(&block->monos[i].p, c);
+        }
+    }
+
+    RemoveEmptyMonosFromPoly(p);
+}
+
+void PolyScaleInPlace(Poly *p, poly_coeff_t c)
+{
+    if (c == 0)
+    {
+        PolyDestroy(p);
+    }
+    else if (c % 2 != 0)
+    {
+        // Nieparzyste liczby są odwracalne modulo 2^64, więc mnożenie
+        // przez nie nie zeruje żadnego współczynnika i może być odłożone.
+        PolySetFactor(p, PolyFactor(p) * c);
+    }
+    else {
+        PolyScaleEagerInPlace(p, c);
+    }
+}
+
+Poly PolyScale(const Poly *p, poly_coeff_t c)
+{
+    if (c % 2 != 0)
+    {
+        Poly result = PolyClone(p);
+        PolySetFactor(&result, PolyFactor(p) * c);
+
+        return result;
+    }
+
+    return PolyMulTermBounded(p, c, 0, NULL, 0, NULL, 0, 0);
+}
+
+Poly PolyShiftVar(const Poly *p, unsigned var_idx, poly_exp_t k)
+{
+    if (k == 0)
+    {
+        return PolyClone(p);
+    }
+
+    const TermExp exp = {.var_idx = var_idx, .exp = k};
+
+    return PolyMulTermBounded(p, 1, 0, &exp, 1, ring_bounds,
+                              ring_bound_count, 0);
+}
+
+/**
+ * Dołącza jednomian na koniec budowanej listy poziomu zmiennej @p level
+ * @param[in,out] tail : koniec budowanej listy
+ * @param[in] coeff : współczynnik jednomianu o zmiennych indeksowanych od 0,
+ * niezależny od zmiennych o indeksach do @p level (przejmowany na własność)
+ * @param[in] exp : wykładnik jednomianu
+ * @param[in] level : indeks zmiennej poziomu
+ */
+static inline void AppendLevelMono(MonoTail *tail, Poly *coeff,
+                                   poly_exp_t exp, unsigned level)
 {
-    Poly result; ///< Dotychczasowy wynik
-    Mono *mono; ///< Przetwarzany jednomian
-} ComposeState;
+    if (!PolyIsCoeff(coeff))
+    {
+        coeff->var_skip -= level + 1;
+    }
+    AppendMono(tail, coeff, exp);
+}
 
 /**
- * Funkcja tworząca nowy obiekt przechowywujący informacje o składaniu
- *
- * @param[in] mono : jednomian
- * @param[in] constant : stała
+ * Mnoży wielomian przez potęgę wielomianu, w miejscu
+ * @param[in,out] p : wielomian
+ * @param[in] q : wielomian
+ * @param[in] n : wykładnik (dodatni)
  */
-ComposeState* NewComposeState(Mono *mono, poly_coeff_t constant){
-    ComposeState *new_state = malloc(sizeof(ComposeState));
-    assert(new_state != NULL);
-    new_state->result = PolyFromCoeff(constant);
-    new_state->mono = mono;
-    return new_state;
+static void PolyMulByPowInPlace(Poly *p, const Poly *q, poly_exp_t n)
+{
+    Poly result;
+    if (n == 1)
+    {
+        result = PolyMul(p, q);
+    }
+    else {
+        Poly power = CachedPolyPow(q, n);
+        result = PolyMul(p, &power);
+        PolyDestroy(&power);
+    }
+
+    PolyDestroy(p);
+    *p = result;
 }
 
 /**
- * Właściwa funkcja odpowiedzialna za wypisywanie wielomianu
+ * Właściwa funkcja podstawiająca wielomian pod zmienną
+ *
+ * Poziomy zmiennych o indeksach większych niż @p var_idx są tylko
+ * kopiowane, a poziom zmiennej @p var_idx zwijany jest schematem Hornera.
+ * Poziomy mniejszych zmiennych przebudowujemy bez mnożenia, o ile @p q
+ * nie zależy od ich zmiennej.
  * @param[in] p : wielomian
- * @param[in] constant : stała wielomianu nadrzędnego
+ * @param[in] depth : indeks pierwszej zmiennej, od której może zależeć @p p
+ * @param[in] var_idx : indeks zmiennej
+ * @param[in] q : podstawiany wielomian
+ * @return wynik podstawienia (zmienne indeksowane od 0, a nie od @p depth)
  */
-static void PolyPrintWithConstant(const Poly *p, poly_coeff_t constant)
+static Poly PolySubstituteAt(const Poly *p, unsigned depth, unsigned var_idx,
+                             const Poly *q)
 {
-    constant += p->constant;
-
-    if (PolyIsCoeff(p))
+    if (PolyIsCoeff(p) || depth + p->var_skip > var_idx)
     {
-        printf("%ld", constant);
-        return;
+        Poly result = PolyClone(p);
+        PolyAddSkip(&result, depth);
+
+        return result;
     }
 
-    if (constant != 0 && p->first_mono->exp != 0)
+    const unsigned level = depth + p->var_skip;
+    Poly result = PolyZero();
+    if (level == var_idx)
     {
-        printf("(%ld,0)+", constant);
-    }
+        // Jednomiany poziomu gęstego istnieją tylko w trakcie przeglądania,
+        // więc zapamiętujemy ich kopie (bez kopiowania współczynników).
+        const unsigned mono_count = MonoCount(p);
+        Mono *monos = calloc(mono_count, sizeof(Mono));
+        assert(monos != NULL);
+        unsigned i = 0;
+        MonoCursor cursor;
+        for (MonoBegin(&cursor, p); cursor.mono != NULL;
+             MonoNext(&cursor))
+        {
+            monos[i++] = *cursor.mono;
+        }
+
+        // Współczynniki nie zależą od x_var_idx, więc tylko je kopiujemy.
+        for (i = mono_count; i-- > 0;)
+        {
+            Poly coeff = PolySubstituteAt(&monos[i].p, level + 1, var_idx, q);
+            PolyAddInPlace(&result, &coeff);
+
+            const poly_exp_t next_exp = i > 0 ? monos[i - 1].exp : 0;
+            if (monos[i].exp > next_exp)
+            {
+                PolyMulByPowInPlace(&result, q, monos[i].exp - next_exp);
+            }
+        }
 
-    Mono *current_mono = p->first_mono;
-    while (current_mono != NULL)
+        free(monos);
+    }
+    else if (PolyIsCoeff(q) || q->var_skip > level)
     {
-        printf("(");
-        if (current_mono->exp == 0)
+        // Wynik wciąż ma zmienną główną level i te same wykładniki.
+        MonoTail tail = MonoTailInit(&result);
+        MonoCursor cursor;
+        for (MonoBegin(&cursor, p); cursor.mono != NULL;
+             MonoNext(&cursor))
         {
-            PolyPrintWithConstant(&current_mono->p, constant);
+            const Mono * const m = cursor.mono;
+            Poly coeff = PolySubstituteAt(&m->p, level + 1, var_idx, q);
+            AppendLevelMono(&tail, &coeff, m->exp, level);
         }
-        else {
-            PolyPrintWithConstant(&current_mono->p, 0);
+        FinishLevel(&result, level);
+    }
+    else {
+        MonoCursor cursor;
+        for (MonoBegin(&cursor, p); cursor.mono != NULL;
+             MonoNext(&cursor))
+        {
+            const Mono * const m = cursor.mono;
+            Poly coeff = PolySubstituteAt(&m->p, level + 1, var_idx, q);
+            Poly term = PolyShiftVar(&coeff, level, m->exp);
+            PolyAddInPlace(&result, &term);
+            PolyDestroy(&coeff);
         }
-        printf(",%u)", current_mono->exp);
+    }
 
-        if (current_mono->next_mono != NULL)
-            printf("+");
+    Poly constant = PolyFromCoeff(p->constant);
+    PolyAddInPlace(&result, &constant);
+    PolyScaleInPlace(&result, PolyFactor(p));
 
-        current_mono = current_mono->next_mono;
-    }
+    return result;
 }
 
-void PolyPrint(const Poly *p)
+Poly PolySubstitute(const Poly *p, unsigned var_idx, const Poly *q)
 {
-    PolyPrintWithConstant(p, 0);
+    return PolySubstituteAt(p, 0, var_idx, q);
 }
 
 /**
- * Zwraca większy z dwóch wykładników
- * @param[in] a : wykładnik jednomianu
- * @param[in] b : wykładnik jednomianu
- * @return większy z wykładników a i b
+ * Przesuwa wielomian jednej zmiennej o współczynnikach wielomianowych
+ *
+ * Zamienia `c[0] + c[1] x + ... + c[n] x^n` na ten sam wielomian
+ * w punkcie `x + b` prostym schematem addytywnym: n rund Hornera,
+ * każda to tylko mnożenie przez stałą i dodawanie, bez mnożenia
+ * wielomianów.
+ * @param[in,out] coeffs : współczynniki c[0], ..., c[n]
+ * @param[in] n : stopień
+ * @param[in] b : przesunięcie
  */
-static inline poly_exp_t Max(poly_exp_t a, poly_exp_t b)
+static void TaylorShift(Poly coeffs[], poly_exp_t n, poly_coeff_t b)
 {
-    return (a > b) ? a : b;
+    for (poly_exp_t i = 0; i < n; ++i)
+    {
+        for (poly_exp_t j = n - 1; j >= i; --j)
+        {
+            if (PolyIsZero(&coeffs[j + 1]))
+            {
+                continue;
+            }
+
+            Poly term = PolyScale(&coeffs[j + 1], b);
+            PolyAddInPlace(&coeffs[j], &term);
+        }
+    }
 }
 
 /**
- * Szybkie potęgowanie współczynnika
+ * Podstawia `a x + b` pod zmienną wielomianu o stałych współczynnikach
  *
- * Implementuje algorytm szybkiego potęgowania w wersji iteracyjnej
- * @param[in] x : liczbowy współczynnik wielomianu
- * @param[in] n : potęga do której współczynnik ma być podniesiony
- * @return `x^n`
+ * Sumuje `c[j] (a x + b)^j`, a kolejne potęgi liczy z poprzednich:
+ * `(a x + b)^j = b (a x + b)^(j-1) + a x (a x + b)^(j-1)`. Każdy krok to
+ * kilka przebiegów po tablicach liczb, wykonywanych wektorowo, zamiast
+ * działań na wielomianach-współczynnikach w TaylorShift.
+ * @param[in,out] coeffs : współczynniki c[0], ..., c[n], zastępowane
+ * współczynnikami wyniku
+ * @param[in] n : stopień
+ * @param[in] map : podstawienie
  */
-static inline poly_coeff_t FastCoeffPow(poly_coeff_t x, poly_exp_t n)
+static void AffineMapConstants(poly_coeff_t coeffs[], poly_exp_t n,
+                               AffineMap map)
 {
-    poly_coeff_t result = 1;
-    while (n != 0)
+    poly_coeff_t *result = calloc((size_t)n + 1, sizeof(poly_coeff_t));
+    poly_coeff_t *power = calloc((size_t)n + 1, sizeof(poly_coeff_t));
+    poly_coeff_t *next = calloc((size_t)n + 1, sizeof(poly_coeff_t));
+    assert(result != NULL && power != NULL && next != NULL);
+
+    result[0] = coeffs[0];
+    power[0] = 1;
+    for (poly_exp_t j = 1; j <= n; ++j)
     {
-        if (n % 2 == 1)
+        memcpy(next, power, j * sizeof(poly_coeff_t));
+        CoeffScaleArray(next, map.b, j);
+        next[j] = 0;
+        CoeffMulAddArray(&next[1], power, map.a, j);
+
+        poly_coeff_t * const swap = power;
+        power = next;
+        next = swap;
+
+        if (coeffs[j] != 0)
         {
-	        result *= x;
-		}
-        n /= 2;
-        x *= x;
+            CoeffMulAddArray(result, power, coeffs[j], (size_t)j + 1);
+        }
     }
 
-    return result;
+    memcpy(coeffs, result, ((size_t)n + 1) * sizeof(poly_coeff_t));
+    free(result);
+    free(power);
+    free(next);
 }
 
 /**
- * Komparator dla typu Mono
+ * Właściwa funkcja podstawiająca wielomiany liniowe pod zmienne
  *
- * Porównuje wykładaniki dwóch jednomianów
- * @param[in] left_v : Jednomian
- * @param[in] right_v : Jednomian
- * @return 0 dla left_v.exp = right_v.exp, 1 dla left_v.exp > right_v.exp,
- * -1 dla left_v.exp < right_v.exp
+ * Pod zmienną x_i, dla i < @p count, podstawia `a_i x_i + b_i`, a pod
+ * pozostałe zmienne 0 (gdy @p zero_rest) lub nic nie podstawia.
+ * Wykładniki nie rosną, więc wynik nie wymaga redukcji w pierścieniu.
+ * @param[in] p : wielomian
+ * @param[in] depth : indeks pierwszej zmiennej, od której może zależeć @p p
+ * @param[in] count : liczba podstawianych zmiennych
+ * @param[in] maps : współczynniki podstawianych wielomianów
+ * @param[in] zero_rest : czy pod zmienne o indeksach >= @p count
+ * podstawiamy 0
+ * @return wynik podstawienia (zmienne indeksowane od 0, a nie od @p depth)
  */
-static int MonoCompare(const void *left_v, const void *right_v)
+static Poly PolyAffineAt(const Poly *p, unsigned depth, unsigned count,
+                         const AffineMap maps[], bool zero_rest)
 {
-    const Mono *left  = (const Mono *)left_v;
-    const Mono *right = (const Mono *)right_v;
-
-    if (left->exp > right->exp)
+    const unsigned level = depth + p->var_skip;
+    if (PolyIsCoeff(p) || (level >= count && !zero_rest))
     {
-        return 1;
+        Poly result = PolyClone(p);
+        PolyAddSkip(&result, depth);
+
+        return result;
     }
 
-    if (left->exp < right->exp)
+    Poly result = PolyZero();
+    if (level >= count)
     {
-        return -1;
+        // Zostaje tylko wyraz wolny względem wszystkich dalszych zmiennych.
+        // Poziom gęsty nie ma jednomianu o wykładniku 0.
+        const Mono * const first_mono = p->is_dense ? NULL : FirstMono(p);
+        if (first_mono != NULL && first_mono->exp == 0)
+        {
+            result = PolyAffineAt(&first_mono->p, level + 1, count, maps,
+                                  zero_rest);
+        }
+    }
+    else if (maps[level].a == 0)
+    {
+        MonoCursor cursor;
+        for (MonoBegin(&cursor, p); cursor.mono != NULL;
+             MonoNext(&cursor))
+        {
+            const Mono * const m = cursor.mono;
+            Poly coeff = PolyAffineAt(&m->p, level + 1, count, maps,
+                                      zero_rest);
+            PolyScaleInPlace(&coeff, FastCoeffPow(maps[level].b, m->exp));
+            PolyAddInPlace(&result, &coeff);
+        }
+    }
+    else if (maps[level].b == 0)
+    {
+        MonoTail tail = MonoTailInit(&result);
+        MonoCursor cursor;
+        for (MonoBegin(&cursor, p); cursor.mono != NULL;
+             MonoNext(&cursor))
+        {
+            const Mono * const m = cursor.mono;
+            Poly coeff = PolyAffineAt(&m->p, level + 1, count, maps,
+                                      zero_rest);
+            PolyScaleInPlace(&coeff, FastCoeffPow(maps[level].a, m->exp));
+            AppendLevelMono(&tail, &coeff, m->exp, level);
+        }
+        FinishLevel(&result, level);
     }
+    else {
+        poly_exp_t n = 0;
+        MonoCursor cursor;
+        for (MonoBegin(&cursor, p); cursor.mono != NULL;
+             MonoNext(&cursor))
+        {
+            const Mono * const m = cursor.mono;
+            n = m->exp;
+        }
 
-    return 0;
-}
+        Poly *coeffs = calloc((size_t)n + 1, sizeof(Poly));
+        assert(coeffs != NULL);
+        for (MonoBegin(&cursor, p); cursor.mono != NULL;
+             MonoNext(&cursor))
+        {
+            const Mono * const m = cursor.mono;
+            coeffs[m->exp] = PolyAffineAt(&m->p, level + 1, count, maps,
+                                          zero_rest);
+        }
 
-/**
- * Sprawdza czy tablica jednomianów jest posortowana
- * @param[in] count : liczba elementów tablicy @p monos
- * @param[in] monos : tablica jednomianów
- * @return True dla posortowanej tablicy, False w przeciwnym wypadku
- */
-static bool MonosAreSorted(unsigned count, const Mono monos[])
-{
-    for (unsigned i = 1; i < count; ++i)
-    {
-        if (MonoCompare(&monos[i-1], &monos[i]) > 0)
+        bool constants = true;
+        for (poly_exp_t i = 0; i <= n && constants; ++i)
         {
-            return false;
+            constants = PolyIsCoeff(&coeffs[i]);
+        }
+
+        if (constants)
+        {
+            poly_coeff_t *values = calloc((size_t)n + 1, sizeof(poly_coeff_t));
+            assert(values != NULL);
+            for (poly_exp_t i = 0; i <= n; ++i)
+            {
+                values[i] = coeffs[i].constant;
+            }
+            AffineMapConstants(values, n, maps[level]);
+            for (poly_exp_t i = 0; i <= n; ++i)
+            {
+                coeffs[i] = PolyFromCoeff(values[i]);
+            }
+            free(values);
+        }
+        else {
+            // Najpierw x -> x + b, dopiero potem x -> a * x.
+            TaylorShift(coeffs, n, maps[level].b);
+
+            poly_coeff_t a_power = 1;
+            for (poly_exp_t i = 0; i <= n; ++i)
+            {
+                PolyScaleInPlace(&coeffs[i], a_power);
+                a_power *= maps[level].a;
+            }
+        }
+
+        MonoTail tail = MonoTailInit(&result);
+        for (poly_exp_t i = 0; i <= n; ++i)
+        {
+            AppendLevelMono(&tail, &coeffs[i], i, level);
         }
+        free(coeffs);
+        FinishLevel(&result, level);
     }
 
-    return true;
+    Poly constant = PolyFromCoeff(p->constant);
+    PolyAddInPlace(&result, &constant);
+    PolyScaleInPlace(&result, PolyFactor(p));
+
+    return result;
 }
 
 /**
- * Zlicza liczbę jednomianów w wielomianie
- * @param[in] p : Wielomian
- * @return Liczba jednomianów z których składa się wielomian
- * (bez jednomianu stałego)
+ * Sprawdza, czy wielomian jest postaci `a x_var_idx + b`
+ * @param[in] p : wielomian
+ * @param[in] var_idx : indeks zmiennej
+ * @param[out] map : współczynniki a i b
+ * @return Czy @p p jest wielomianem liniowym zmiennej @p var_idx?
  */
-static unsigned MonoCount(const Poly *p)
+static bool PolyIsAffineIn(const Poly *p, unsigned var_idx, AffineMap *map)
 {
-    unsigned count = 0;
+    if (PolyIsCoeff(p))
+    {
+        *map = (AffineMap) {.a = 0, .b = p->constant};
+        return true;
+    }
 
-    Mono *current_mono = p->first_mono;
-    while (current_mono != NULL)
+    if (p->var_skip != var_idx || !HasSingleMono(p))
     {
-        ++count;
-        current_mono = current_mono->next_mono;
+        return false;
     }
 
-    return count;
+    const Mono * const mono = FirstMono(p);
+    if (mono->exp != 1 || !PolyIsCoeff(&mono->p))
+    {
+        return false;
+    }
+
+    *map = (AffineMap) {.a = PolyFactor(p) * mono->p.constant,
+                        .b = PolyFactor(p) * p->constant};
+    return true;
 }
 
-/**
- * Zwraca głęboką kopię listy jednomianów
- * @param[in] m : lista jednomianów
- * @return Głęboka kopia listy jednomianów
- */
-static Mono* MonoListClone(Mono *m)
+Poly PolyShiftVarBy(const Poly *p, unsigned var_idx, poly_coeff_t c)
 {
-    if (m == NULL)
+    if (c == 0 || var_idx == UINT_MAX)
     {
-        return NULL;
+        return PolyClone(p);
     }
 
-    Mono *result = malloc(sizeof(Mono));
-    assert(result != NULL);
-    *result = MonoClone(m);
-
-    Mono *last_copied_mono = result;
-    Mono *current_mono = m->next_mono;
-    while (current_mono != NULL)
+    AffineMap *maps = calloc((size_t)var_idx + 1, sizeof(AffineMap));
+    assert(maps != NULL);
+    for (unsigned i = 0; i < var_idx; ++i)
     {
-        last_copied_mono->next_mono = malloc(sizeof(Mono));
-        assert(last_copied_mono->next_mono != NULL);
-        *(last_copied_mono->next_mono) = MonoClone(current_mono);
-
-        current_mono = current_mono->next_mono;
-        last_copied_mono = last_copied_mono->next_mono;
+        maps[i] = (AffineMap) {.a = 1, .b = 0};
     }
+    maps[var_idx] = (AffineMap) {.a = 1, .b = c};
+
+    Poly result = PolyAffineAt(p, 0, var_idx + 1, maps, false);
+    free(maps);
 
     return result;
 }
 
 /**
- * Zwraca głęboką kopię listy jednomianów, pomnożoną przez stałą
- * @param[in] first_mono : Wskaźnik na pierwszy element listy
- * @param[in] constant : Stała przez którą lista ma być pomnożona
- * @param[out] array : Wskaźnik na pierwszy element tablicy w której
- * znajdzie się kopia
+ * Dobiera długość bloku metody Patersona–Stockmeyera
+ *
+ * Krok liczymy względem x, a nie x^gcd: iloczyny rosną ze stopniem,
+ * więc dłuższy skok Hornera tylko przesuwa koszt na większe mnożenia.
+ * @param[in] degree : stopień wielomianu zmiennej `x^gcd`
+ * @param[in] gcd : wspólny dzielnik wykładników
+ * @return największy krok `k >= 1`, dla którego `k^2 gcd <= degree + 1`
  */
-static void CloneMonosMultipliedByAConstant(
-             Mono *first_mono, poly_coeff_t constant, Mono *array)
+static poly_exp_t ComposeBlockStep(poly_exp_t degree, poly_exp_t gcd)
 {
-    Poly *const_poly = malloc(sizeof(Poly));
-    assert(const_poly != NULL);
-    *const_poly = PolyFromCoeff(constant);
-
-    unsigned i = 0;
-    Mono *current_mono = first_mono;
-    while (current_mono != NULL)
+    poly_exp_t step = 1;
+    while ((long long)(step + 1) * (step + 1) * gcd <= (long long)degree + 1)
     {
-        array[i].p   = PolyMul(&current_mono->p, const_poly);
-        array[i].exp = current_mono->exp;
-
-        ++i;
-        current_mono = current_mono->next_mono;
+        ++step;
     }
 
-    PolyDestroy(const_poly);
-    free(const_poly);
+    return step;
 }
 
 /**
- * Usuwa jednomiany tożsamościowo równe zeru z listy
- * jednomianów wielomianu @p p
- * @param[in,out] p : Wielomian
+ * Podstawia wielomian pod zmienną wielomianu o stałych współczynnikach
+ *
+ * Używa metody Patersona–Stockmeyera: dla `k` bliskiego pierwiastkowi
+ * ze stopnia liczy potęgi `q, ..., q^k`, sumuje z nich bloki
+ * `k` kolejnych jednomianów (mnożąc tylko przez stałe) i łączy bloki
+ * schematem Hornera względem `q^k`. Potrzeba około `2 sqrt(n)` mnożeń
+ * wielomianów zamiast osobnej potęgi dla każdego jednomianu.
+ * Gdy wykładniki @p p są wielokrotnościami @p gcd, liczymy raz `q^gcd`
+ * i składamy z nim wielomian o wykładnikach podzielonych przez @p gcd.
+ * @param[in] p : wielomian, którego jednomiany mają stałe współczynniki
+ * @param[in] q : podstawiany wielomian
+ * @param[in] gcd : wspólny dzielnik wykładników @p p (PolyExpGcd)
+ * @return suma jednomianów @p p z @p q podstawionym pod zmienną
+ * (bez stałej i mnożnika @p p)
  */
-static void RemoveEmptyMonosFromPoly(Poly * const p)
+static Poly PolyComposeByBlocks(const Poly *p, const Poly *q, poly_exp_t gcd)
 {
-    Mono *first_nonempty_mono = p->first_mono;
-    while (first_nonempty_mono != NULL &&
-          PolyIsZero(&(first_nonempty_mono->p)) == true)
+    poly_exp_t degree = 0;
+    MonoCursor cursor;
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
     {
-        Mono * const next_mono = first_nonempty_mono->next_mono;
-        free(first_nonempty_mono);
-        first_nonempty_mono = next_mono;
+        const Mono * const m = cursor.mono;
+        degree = m->exp / gcd;
     }
 
-    p->first_mono = first_nonempty_mono;
+    const poly_exp_t step = ComposeBlockStep(degree, gcd);
+    const poly_exp_t block_count = degree / step + 1;
 
-    if (first_nonempty_mono != NULL)
+    Poly *powers = calloc(step + 1, sizeof(Poly));
+    Poly *blocks = calloc(block_count, sizeof(Poly));
+    assert(powers != NULL && blocks != NULL);
+    powers[0] = PolyFromCoeff(1);
+    powers[1] = (gcd > 1) ? CachedPolyPow(q, gcd) : PolyClone(q);
+    for (poly_exp_t i = 2; i <= step; ++i)
     {
-        Mono *last_nonempty_mono = first_nonempty_mono;
-        Mono *current_mono       = p->first_mono->next_mono;
-        while (current_mono != NULL)
-        {
-            Mono* const next_mono = current_mono->next_mono;
+        powers[i] = PolyMul(&powers[i - 1], &powers[1]);
+    }
 
-            if (PolyIsZero(&current_mono->p) == false)
-            {
-                last_nonempty_mono->next_mono = current_mono;
-                last_nonempty_mono = current_mono;
-            }
-            else {
-                last_nonempty_mono->next_mono = NULL;
-                free(current_mono);
-            }
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
+    {
+        const Mono * const m = cursor.mono;
+        const poly_exp_t exp = m->exp / gcd;
+        Poly term = PolyScale(&powers[exp % step],
+                              PolyFactor(&m->p) * m->p.constant);
+        PolyAddInPlace(&blocks[exp / step], &term);
+    }
 
-            current_mono = next_mono;
-        }
+    Poly result = blocks[block_count - 1];
+    for (poly_exp_t j = block_count - 1; j-- > 0;)
+    {
+        Poly shifted = PolyMul(&result, &powers[step]);
+        PolyDestroy(&result);
+        result = shifted;
+        PolyAddInPlace(&result, &blocks[j]);
     }
+
+    for (poly_exp_t i = 0; i <= step; ++i)
+    {
+        PolyDestroy(&powers[i]);
+    }
+    free(powers);
+    free(blocks);
+
+    return result;
 }
 
 /**
- * "Szybkie" potęgowanie wielomianów
+ * Sprawdza, czy poziom składanego wielomianu opłaca się liczyć
+ * metodą PolyComposeByBlocks
  *
- * Implementuje algorytm szybkiego potęgowania w wersji iteracyjnej
+ * Porównuje liczbę mnożeń wielomianów obu metod: szybkie potęgowanie
+ * dla każdego jednomianu z osobna oraz potęgi i kroki Hornera metody
+ * blokowej, do których dochodzi potęgowanie `q^gcd`.
  * @param[in] p : wielomian
- * @param[in] n : potęga do której wielomian ma być podniesiony
- * @return `p^n`
+ * @param[in] q : wielomian podstawiany pod zmienną główną @p p
+ * @param[in] gcd : wspólny dzielnik wykładników @p p (PolyExpGcd)
+ * @return Czy liczyć poziom blokami?
  */
-static inline Poly FastPolyPow(const Poly *p, poly_exp_t n)
+static bool ComposeByBlocksPays(const Poly *p, const Poly *q, poly_exp_t gcd)
 {
-    if (PolyIsCoeff(p))
+    if (PolyIsCoeff(p) || PolyIsCoeff(q))
     {
-        return PolyFromCoeff(FastCoeffPow(p->constant, n));
+        return false;
     }
 
-    Poly result = PolyFromCoeff(1);
-    Poly x = PolyClone(p);
-    while (n != 0)
+    unsigned long long power_cost = 0;
+    poly_exp_t degree = 0;
+    MonoCursor cursor;
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
     {
-        if (n % 2 == 1)
+        const Mono * const m = cursor.mono;
+        if (!PolyIsCoeff(&m->p))
         {
-            Poly new_result = PolyMul(&result, &x);
-            PolyDestroy(&result);
-            result = new_result;
+            return false;
         }
-        n /= 2;
-        Poly new_x = PolyMul(&x, &x);
-        PolyDestroy(&x);
-        x = new_x;
+
+        for (poly_exp_t e = m->exp; e > 1; e /= 2)
+        {
+            power_cost += 1 + e % 2;
+        }
+        ++power_cost;
+        degree = m->exp / gcd;
     }
-    PolyDestroy(&x);
-    return result;
+
+    const poly_exp_t step = ComposeBlockStep(degree, gcd);
+    unsigned long long block_cost = step + degree / step;
+    for (poly_exp_t e = gcd; e > 1; e /= 2)
+    {
+        ++block_cost;
+    }
+
+    return block_cost < power_cost;
+}
+
+/**
+ * Dodaje na stos stan składania wielomianu
+ *
+ * Poziom o stałych współczynnikach, dla którego metoda blokowa jest
+ * tańsza, od razu liczymy w całości.
+ * @param[in,out] calc_stack : stos stanów
+ * @param[in] p : składany wielomian
+ * @param[in] depth : indeks pierwszej zmiennej, od której może zależeć @p p
+ * @param[in] count : liczba wielomianów
+ * @param[in] x : tablica wielomianów
+ */
+static void PushComposeState(Stack *calc_stack, const Poly *p, unsigned depth,
+                             unsigned count, const Poly x[])
+{
+    ComposeState *state = NewComposeState(p, depth);
+    const poly_exp_t gcd = PolyExpGcd(p);
+    if (state->var_idx < count &&
+        ComposeByBlocksPays(p, &x[state->var_idx], gcd))
+    {
+        Poly sum = PolyComposeByBlocks(p, &x[state->var_idx], gcd);
+        PolyAddInPlace(&state->result, &sum);
+        state->mono.mono = NULL;
+    }
+
+    StackPush(calc_stack, state);
 }
 
 Poly PolyCompose(const Poly *p, unsigned count, const Poly x[]) {
+    AffineMap *maps = calloc(count, sizeof(AffineMap));
+    assert(count == 0 || maps != NULL);
+    unsigned affine_count = 0;
+    while (affine_count < count &&
+           PolyIsAffineIn(&x[affine_count], affine_count, &maps[affine_count]))
+    {
+        ++affine_count;
+    }
+
+    if (affine_count == count)
+    {
+        // Każda zmienna przechodzi na wielomian liniowy tej samej zmiennej,
+        // więc zamiast potęgować wystarczy przesunąć współczynniki.
+        Poly result = PolyAffineAt(p, 0, count, maps, true);
+        free(maps);
+        return result;
+    }
+    free(maps);
+
     Stack calc_stack = StackInit();
-    StackPush(&calc_stack, NewComposeState(p->first_mono, p->constant));
+    PushComposeState(&calc_stack, p, 0, count, x);
     while (StackSize(&calc_stack) > 1 ||
-           ((ComposeState*)StackTop(&calc_stack))->mono != NULL)
+           ((ComposeState*)StackTop(&calc_stack))->mono.mono != NULL)
     {
         assert(StackSize(&calc_stack) != 0);
         ComposeState *current_state = StackTop(&calc_stack);
 
-        if (current_state->mono == NULL || StackSize(&calc_stack) > count)
+        if (current_state->mono.mono == NULL || current_state->var_idx >= count)
         {
             Poly lower_result = current_state->result;
+            PolyScaleInPlace(&lower_result, current_state->factor);
             free(current_state);
             StackPop(&calc_stack);
             if (StackSize(&calc_stack) == 0)
@@ -335,385 +4462,570 @@ Poly PolyCompose(const Poly *p, unsigned count, const Poly x[]) {
                 return lower_result;
             }
 
-            ComposeState *next_state = StackTop(&calc_stack);
-            Poly poly_power = FastPolyPow(&x[StackSize(&calc_stack) - 1],
-                                          next_state->mono->exp);
-            Poly result = PolyMul(&lower_result, &poly_power);
-            PolyDestroy(&poly_power);
-            PolyDestroy(&lower_result);
-
-            PolyAddInPlace(&next_state->result, &result);
-            next_state->mono = next_state->mono->next_mono;
+            ComposeState *next_state = StackTop(&calc_stack);
+            if (!PolyIsZero(&lower_result))
+            {
+                Poly poly_power = CachedPolyPow(&x[next_state->var_idx],
+                                                next_state->mono.mono->exp);
+                Poly result = PolyMul(&lower_result, &poly_power);
+                PolyDestroy(&poly_power);
+                PolyDestroy(&lower_result);
+
+                PolyAddInPlace(&next_state->result, &result);
+            }
+            MonoNext(&next_state->mono);
             continue;
         }
 
-        StackPush(&calc_stack,
-                  NewComposeState(current_state->mono->p.first_mono,
-                                  current_state->mono->p.constant));
+        PushComposeState(&calc_stack, &current_state->mono.mono->p,
+                         current_state->var_idx + 1, count, x);
     }
     assert(StackSize(&calc_stack) == 1);
 
-    Poly result = *(Poly*)StackTop(&calc_stack);
-    free(StackTop(&calc_stack));
+    ComposeState *last_state = StackTop(&calc_stack);
+    Poly result = last_state->result;
+    PolyScaleInPlace(&result, last_state->factor);
+    free(last_state);
     StackDestroy(&calc_stack, NULL);
     return result;
 }
 
-void PolyAddInPlace(Poly *p, Poly *q)
+Poly PolySub(const Poly *p, const Poly *q)
 {
-    assert(p != NULL && q != NULL);
-
-    p->constant += q->constant;
+    Poly result = PolyClone(p);
+    Poly neg_q  = PolyNeg(q);
+    PolyAddInPlace(&result, &neg_q);
 
-    if (q->first_mono == NULL)
-    {
-        return;
-    }
+    return result;
+}
 
-    if (p->first_mono == NULL)
+poly_exp_t PolyDegBy(const Poly *p, unsigned var_idx)
+{
+    if (PolyIsZero(p))
     {
-        p->first_mono = q->first_mono;
-
-        return;
+        return -1;
     }
 
-    if (p->first_mono->exp > q->first_mono->exp)
+    if (var_idx < p->var_skip)
     {
-        Mono * const old_first_mono = p->first_mono;
-        p->first_mono = q->first_mono;
-        q->first_mono = q->first_mono->next_mono;
-        p->first_mono->next_mono = old_first_mono;
+        return 0;
     }
+    var_idx -= p->var_skip;
 
-    Mono *p_mono = p->first_mono;
-    Mono *q_mono = q->first_mono;
-    Mono *prev_p_mono = p->first_mono;
-
-    while (p_mono != NULL && q_mono != NULL)
+    poly_exp_t result = 0;
+    if (var_idx == 0)
     {
-        if (p_mono->exp < q_mono->exp)
+        MonoCursor cursor;
+        for (MonoBegin(&cursor, p); cursor.mono != NULL;
+             MonoNext(&cursor))
         {
-            prev_p_mono = p_mono;
-            p_mono = p_mono->next_mono;
+            result = Max(result, cursor.mono->exp);
         }
-        else if (p_mono->exp > q_mono->exp)
+    }
+    else {
+        MonoCursor cursor;
+        for (MonoBegin(&cursor, p); cursor.mono != NULL;
+             MonoNext(&cursor))
         {
-            Mono * const next_mono = q_mono->next_mono;
-            prev_p_mono->next_mono = q_mono;
-            q_mono->next_mono = p_mono;
-            prev_p_mono = q_mono;
-            q_mono = next_mono;
-        }
-        else {
-            PolyAddInPlace(&p_mono->p, &q_mono->p);
-
-            Mono * const next_mono = q_mono->next_mono;
-            free(q_mono);
-            q_mono = next_mono;
+            result = Max(result, PolyDegBy(&(cursor.mono->p), var_idx-1));
         }
     }
 
-    if (q_mono != NULL)
+    return result;
+}
+
+
+poly_exp_t PolyDeg(const Poly *p)
+{
+    poly_exp_t result = -1;
+    if (p->constant != 0)
     {
-        prev_p_mono->next_mono = q_mono;
+        result = 0;
     }
 
-    if(p->first_mono != NULL && p->first_mono->exp == 0){
-        p->constant += p->first_mono->p.constant;
-        p->first_mono->p.constant = 0;
+    MonoCursor cursor;
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
+    {
+        const Mono * const current_mono = cursor.mono;
+        result = Max(result, PolyDeg(&current_mono->p) + current_mono->exp);
     }
 
-    RemoveEmptyMonosFromPoly(p);
+    return result;
 }
 
-void PolyDestroy(Poly *p)
+
+/**
+ * Sprawdza równość dwóch wielomianów przemnożonych przez stałe
+ * @param[in] p : wielomian
+ * @param[in] p_factor : iloczyn mnożników wielomianów nadrzędnych @p p
+ * @param[in] q : wielomian
+ * @param[in] q_factor : iloczyn mnożników wielomianów nadrzędnych @p q
+ * @return `p_factor * p = q_factor * q`
+ */
+static bool PolyIsEqScaled(const Poly *p, poly_coeff_t p_factor,
+                           const Poly *q, poly_coeff_t q_factor)
 {
-    if (p == NULL)
+    p_factor *= PolyFactor(p);
+    q_factor *= PolyFactor(q);
+
+    if (p_factor * p->constant != q_factor * q->constant ||
+        p->var_skip != q->var_skip)
     {
-        return;
+        return false;
     }
 
-    Mono *current_mono = p->first_mono;
-    while (current_mono != NULL)
+    MonoCursor p_mono, q_mono;
+    MonoBegin(&p_mono, p);
+    MonoBegin(&q_mono, q);
+    while (p_mono.mono != NULL && q_mono.mono != NULL)
     {
-        Mono * const next_mono = current_mono->next_mono;
+        if (p_mono.mono->exp != q_mono.mono->exp ||
+           PolyIsEqScaled(&p_mono.mono->p, p_factor,
+                          &q_mono.mono->p, q_factor) == false)
+        {
+            return false;
+        }
 
-        MonoDestroy(current_mono);
-        free(current_mono);
+        MonoNext(&p_mono);
+        MonoNext(&q_mono);
+    }
 
-        current_mono = next_mono;
+    if (p_mono.mono != NULL || q_mono.mono != NULL)
+    {
+        return false;
     }
 
-    p->first_mono = NULL;
-    p->constant = 0;
+    return true;
 }
 
-
-Poly PolyClone(const Poly *p)
+bool PolyIsEq(const Poly *p, const Poly *q)
 {
-    Poly new_poly;
-    new_poly.constant   = p->constant;
-    new_poly.first_mono = MonoListClone(p->first_mono);
-
-    return new_poly;
+    return PolyIsEqScaled(p, 1, q, 1);
 }
 
-Poly PolyAdd(const Poly *p, const Poly *q)
+Poly PolyAt(const Poly *p, poly_coeff_t x)
 {
-    Poly result  = PolyClone(p);
-    Poly q_clone = PolyClone(q);
-
-    PolyAddInPlace(&result, &q_clone);
-
-    return result;
-}
+    if (p->var_skip > 0)
+    {
+        // Wielomian nie zależy od x_0, zmniejszamy tylko indeksy zmiennych.
+        Poly result = PolyClone(p);
+        --result.var_skip;
 
-Poly PolyAddMonos(unsigned count, const Mono monos[])
-{
+        return result;
+    }
 
-    if (count == 0)
+    if (p->is_dense)
     {
-        return PolyZero();
+        ++dense_at_count;
+        // Schemat Hornera wprost na przechowywanej tablicy.
+        const DenseCoeffs * const dense = p->dense;
+        const poly_coeff_t base = FastCoeffPow(x, dense->stride);
+        poly_coeff_t value = 0;
+        for (poly_exp_t i = dense->length; i-- > 1;)
+        {
+            value = value * base + dense->coeffs[i];
+        }
+        value = value * base + p->constant;
+
+        return PolyFromCoeff(PolyFactor(p) * value);
     }
 
-    if (MonosAreSorted(count, monos) == false)
+    // Wielomian zmiennej x^gcd wystarczy policzyć w punkcie x^gcd.
+    const poly_exp_t gcd = PolyExpGcd(p);
+    const poly_coeff_t base = FastCoeffPow(x, gcd);
+    if (LevelIsDense(p, gcd))
     {
-        // https://moodle.mimuw.edu.pl/mod/forum/discuss.php?d=244#p755
-        // " Ja bym w takich przypadkach pozwalał na haki, np. pozbywanie
-        //   się const za pomocą odpowiednich rzutowań lub innych trików  "
-        //
-        // Funkcja PolyAddMonos nie tworzy kopii tablicy monos ponieważ
-        // wpływałoby to negatywnie na szybkość działania i ilość kodu
-        qsort((Mono*)monos, count, sizeof(Mono), MonoCompare);
+        DenseLevel level = DenseFromLevel(p, gcd);
+        if (level.coeffs != NULL)
+        {
+            ++dense_at_count;
+            // Schemat Hornera na tablicy współczynników.
+            poly_coeff_t value = 0;
+            for (poly_exp_t i = level.length; i-- > 0;)
+            {
+                value = value * base + level.coeffs[i];
+            }
+            DenseDestroy(&level);
+
+            return PolyFromCoeff(PolyFactor(p) * value);
+        }
+        DenseDestroy(&level);
     }
 
     Poly result = PolyZero();
 
-    Mono *last_mono = malloc(sizeof(Mono));
-    assert(last_mono != NULL);
-    *last_mono = monos[0];
-
-    if (last_mono->exp == 0)
-    {
-        result.constant += last_mono->p.constant;
-        last_mono->p.constant = 0;
-    }
-
-    result.first_mono = last_mono;
+    Poly *temp_coeff_poly = malloc(sizeof(Poly));
+    Poly *temp_mult_poly = malloc(sizeof(Poly));
+    assert(temp_coeff_poly != NULL && temp_mult_poly != NULL);
 
-    poly_exp_t last_mono_exp = last_mono->exp;
-    for (unsigned i = 1; i < count; ++i)
+    MonoCursor cursor;
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
     {
-        if (last_mono_exp == monos[i].exp)
-        {
-            PolyAddInPlace(&last_mono->p, (Poly*)&monos[i].p);
-        }
-        else {
-            last_mono->next_mono = malloc(sizeof(Mono));
-            assert(last_mono->next_mono != NULL);
-            *last_mono->next_mono = monos[i];
+        const Mono * const current_mono = cursor.mono;
+        *temp_coeff_poly = PolyFromCoeff(FastCoeffPow(base,
+                                                      current_mono->exp / gcd));
+        *temp_mult_poly  = PolyMul(temp_coeff_poly, &current_mono->p);
 
-            last_mono     = last_mono->next_mono;
-            last_mono_exp = last_mono->exp;
-        }
+        PolyAddInPlace(&result, temp_mult_poly);
 
-        if (last_mono->exp == 0)
-        {
-            result.constant += last_mono->p.constant;
-            last_mono->p.constant = 0;
-        }
+        PolyDestroy(temp_coeff_poly);
     }
 
-    RemoveEmptyMonosFromPoly(&result);
+    free(temp_coeff_poly);
+    free(temp_mult_poly);
 
+    Poly constant = PolyFromCoeff(p->constant);
+    PolyAddInPlace(&result, &constant);
+    PolyScaleInPlace(&result, PolyFactor(p));
     return result;
 }
 
-Poly PolyMul(const Poly *p, const Poly *q)
+Poly PolyCoeff(const Poly *p, poly_exp_t exp)
 {
-    const unsigned p_mono_count = MonoCount(p);
-    const unsigned q_mono_count = MonoCount(q);
-    unsigned all_mono_count;
-    all_mono_count = p_mono_count * q_mono_count + p_mono_count + q_mono_count;
-
-    Mono *monos = calloc(all_mono_count, sizeof(Mono));
-    assert(monos != NULL);
+    if (p->var_skip > 0)
+    {
+        // Wielomian nie zależy od x_0.
+        return exp == 0 ? PolyAt(p, 0) : PolyZero();
+    }
 
-    unsigned p_id = 0;
-    Mono *current_mono_p = p->first_mono;
-    while (current_mono_p != NULL)
+    if (p->is_dense)
     {
-        unsigned q_id = 0;
-        Mono *current_mono_q = q->first_mono;
-        while (current_mono_q != NULL)
+        const DenseCoeffs * const dense = p->dense;
+        poly_coeff_t value = exp == 0 ? p->constant : 0;
+        if (exp >= 0 && exp % dense->stride == 0 &&
+            exp / dense->stride < dense->length)
         {
-            const unsigned current_id = q_mono_count * p_id + q_id;
-            monos[current_id].p   = PolyMul(&current_mono_p->p,
-                                            &current_mono_q->p);
-            monos[current_id].exp = current_mono_p->exp + current_mono_q->exp;
-
-            ++q_id;
-            current_mono_q = current_mono_q->next_mono;
+            value += dense->coeffs[exp / dense->stride];
         }
 
-        ++p_id;
-        current_mono_p = current_mono_p->next_mono;
+        return PolyFromCoeff(PolyFactor(p) * value);
     }
 
-    Mono *first_p_mono = &monos[p_mono_count * q_mono_count];
-    Mono *first_q_mono = &monos[p_mono_count * q_mono_count + p_mono_count];
-    CloneMonosMultipliedByAConstant(p->first_mono, q->constant, first_p_mono);
-    CloneMonosMultipliedByAConstant(q->first_mono, p->constant, first_q_mono);
+    const Mono *mono = NULL;
+    if (!PolyIsCoeff(p))
+    {
+        unsigned pos;
+        const MonoBlock * const block = FindMonoBlock(p, exp, &pos);
+        mono = pos < block->count ? &block->monos[pos] : NULL;
+    }
 
-    Poly result = PolyAddMonos(all_mono_count, monos);
-    result.constant = p->constant * q->constant;
+    Poly result = PolyZero();
+    if (mono != NULL && mono->exp == exp)
+    {
+        result = PolyClone(&mono->p);
+        PolyScaleInPlace(&result, PolyFactor(p));
+    }
 
-    free(monos);
+    if (exp == 0)
+    {
+        Poly constant = PolyFromCoeff(PolyFactor(p) * p->constant);
+        PolyAddInPlace(&result, &constant);
+    }
 
     return result;
 }
 
-Poly PolyNeg(const Poly *p)
+/**
+ * Zapisuje liczbę kodem o zmiennej długości (po 7 bitów na bajt,
+ * najstarszy bit oznacza kolejny bajt)
+ * @param[out] out : miejsce zapisu (NULL, jeśli tylko liczymy bajty)
+ * @param[in] value : liczba
+ * @return liczba bajtów zapisu
+ */
+static inline size_t PutVarint(unsigned char *out, unsigned long value)
 {
-    Poly new_poly = PolyZero();
-    new_poly.constant = -1 * p->constant;
-
-    if (p->first_mono != NULL)
+    size_t length = 0;
+    while (value >= 0x80)
     {
-        new_poly.first_mono = malloc(sizeof(Mono));
-        assert(new_poly.first_mono != NULL);
-        *new_poly.first_mono = MonoNeg(p->first_mono);
-
-        Mono *current_mono   = new_poly.first_mono;
-        Mono *current_p_mono = p->first_mono->next_mono;
-        while (current_p_mono != NULL)
+        if (out != NULL)
         {
-            current_mono->next_mono = malloc(sizeof(Mono));
-            assert(current_mono->next_mono != NULL);
-            *(current_mono->next_mono) = MonoNeg(current_p_mono);
+            out[length] = (unsigned char)(value | 0x80);
+        }
+        ++length;
+        value >>= 7;
+    }
+    if (out != NULL)
+    {
+        out[length] = (unsigned char)value;
+    }
 
-            current_mono = current_mono->next_mono;
-            current_p_mono = current_p_mono->next_mono;
+    return length + 1;
+}
+
+/**
+ * Odczytuje liczbę zapisaną przez PutVarint
+ * @param[in] data : początek zapisu
+ * @param[in] end : koniec dostępnych danych
+ * @param[out] value : odczytana liczba
+ * @return wskaźnik za zapisem lub NULL, jeśli zapis jest niepoprawny
+ */
+static inline const unsigned char* GetVarint(const unsigned char *data,
+                                             const unsigned char *end,
+                                             unsigned long *value)
+{
+    unsigned long result = 0;
+    for (unsigned shift = 0; shift < 64 && data != end; shift += 7)
+    {
+        const unsigned char byte = *data++;
+        result |= (unsigned long)(byte & 0x7f) << shift;
+        if (byte < 0x80)
+        {
+            // Ostatni bajt dziesięciobajtowego zapisu niesie jeden bit.
+            if (shift == 63 && byte > 1)
+            {
+                return NULL;
+            }
+            *value = result;
+            return data;
         }
     }
 
-    return new_poly;
+    return NULL;
 }
 
-Poly PolySub(const Poly *p, const Poly *q)
+/**
+ * Przekształca współczynnik tak, by małe co do modułu liczby miały
+ * krótki zapis (0, -1, 1, -2, ... przechodzą na 0, 1, 2, 3, ...)
+ * @param[in] c : współczynnik
+ * @return przekształcony współczynnik
+ */
+static inline unsigned long ZigZagEncode(poly_coeff_t c)
 {
-    Poly result = PolyClone(p);
-    Poly neg_q  = PolyNeg(q);
-    PolyAddInPlace(&result, &neg_q);
+    const unsigned long value = c;
+    return (value << 1) ^ (0 - (value >> 63));
+}
 
-    return result;
+/**
+ * Odwraca przekształcenie ZigZagEncode
+ * @param[in] value : przekształcony współczynnik
+ * @return współczynnik
+ */
+static inline poly_coeff_t ZigZagDecode(unsigned long value)
+{
+    return (poly_coeff_t)((value >> 1) ^ (0 - (value & 1)));
 }
 
-poly_exp_t PolyDegBy(const Poly *p, unsigned var_idx)
+/**
+ * Zapisuje wielomian w formacie PolySerialize
+ * @param[in] p : wielomian
+ * @param[in] factor : iloczyn mnożników wielomianów nadrzędnych
+ * @param[out] out : miejsce zapisu (NULL, jeśli tylko liczymy bajty)
+ * @return liczba bajtów zapisu
+ */
+static size_t SerializeLevel(const Poly *p, poly_coeff_t factor,
+                             unsigned char *out)
 {
-    if (PolyIsZero(p))
-    {
-        return -1;
-    }
+    factor *= PolyFactor(p);
 
-    poly_exp_t result = 0;
-    if (var_idx == 0)
-    {
-        Mono *current_mono = p->first_mono;
-        while (current_mono != NULL)
-        {
-            result = Max(result, current_mono->exp);
+    size_t length = 0;
+    const unsigned long mono_count = MonoCount(p);
 
-            current_mono = current_mono->next_mono;
-        }
+    length += PutVarint(out, mono_count);
+    if (mono_count > 0)
+    {
+        length += PutVarint(out == NULL ? NULL : out + length, p->var_skip);
     }
-    else {
-        Mono *current_mono = p->first_mono;
-        while (current_mono != NULL)
-        {
-            result = Max(result, PolyDegBy(&(current_mono->p), var_idx-1));
+    length += PutVarint(out == NULL ? NULL : out + length,
+                        ZigZagEncode(factor * p->constant));
 
-            current_mono = current_mono->next_mono;
-        }
+    poly_exp_t next_exp = 0;
+    MonoCursor cursor;
+    for (MonoBegin(&cursor, p); cursor.mono != NULL;
+         MonoNext(&cursor))
+    {
+        const Mono * const m = cursor.mono;
+        length += PutVarint(out == NULL ? NULL : out + length,
+                            m->exp - next_exp);
+        length += SerializeLevel(&m->p, factor,
+                                 out == NULL ? NULL : out + length);
+        next_exp = m->exp + 1;
     }
 
-    return result;
+    return length;
 }
 
-
-poly_exp_t PolyDeg(const Poly *p)
+/**
+ * Odczytuje wielomian zapisany przez SerializeLevel
+ *
+ * Sprawdza, czy zapis opisuje wielomian w postaci kanonicznej.
+ * @param[in] data : początek zapisu
+ * @param[in] end : koniec dostępnych danych
+ * @param[out] p : odczytany wielomian (zero w przypadku błędu)
+ * @return wskaźnik za zapisem lub NULL, jeśli zapis jest niepoprawny
+ */
+static const unsigned char* DeserializeLevel(const unsigned char *data,
+                                             const unsigned char *end,
+                                             Poly *p)
 {
-    poly_exp_t result = -1;
-    if (p->constant != 0)
+    *p = PolyZero();
+
+    unsigned long mono_count;
+    unsigned long var_skip = 0;
+    unsigned long constant;
+    data = GetVarint(data, end, &mono_count);
+    if (data != NULL && mono_count > 0)
     {
-        result = 0;
+        data = GetVarint(data, end, &var_skip);
+    }
+    if (data != NULL)
+    {
+        data = GetVarint(data, end, &constant);
+    }
+    if (data == NULL || var_skip > UINT_MAX)
+    {
+        return NULL;
     }
+    p->constant = ZigZagDecode(constant);
+    p->var_skip = var_skip;
 
-    Mono *current_mono = p->first_mono;
-    while (current_mono != NULL)
+    MonoTail tail = MonoTailInit(p);
+    long long next_exp = 0;
+    for (unsigned long i = 0; i < mono_count; ++i)
     {
-        result = Max(result, PolyDeg(&current_mono->p) + current_mono->exp);
+        unsigned long exp_delta;
+        data = GetVarint(data, end, &exp_delta);
+        if (data == NULL || exp_delta > (unsigned long)INT_MAX ||
+            (long long)exp_delta > INT_MAX - next_exp)
+        {
+            data = NULL;
+            break;
+        }
+
+        Mono * const mono = MonoTailPush(&tail);
+        *mono = (Mono) {.p = PolyZero(), .exp = next_exp + exp_delta};
+        next_exp = mono->exp + 1LL;
+
+        // Współczynniki nie są zerami, a współczynnik przy x^0 nie ma stałej
+        // (jest ona stałą poziomu).
+        data = DeserializeLevel(data, end, &mono->p);
+        if (data == NULL || PolyIsZero(&mono->p) ||
+            (mono->exp == 0 && (PolyIsCoeff(&mono->p) ||
+                                mono->p.constant != 0)))
+        {
+            data = NULL;
+            break;
+        }
+    }
 
-        current_mono = current_mono->next_mono;
+    // Poziom z jedynym jednomianem `q * x^0` zapisujemy jako `q`.
+    if (data == NULL ||
+        (mono_count == 1 && FirstMono(p)->exp == 0))
+    {
+        PolyDestroy(p);
+        return NULL;
     }
 
-    return result;
-}
+    PolyFinishList(p);
 
+    return data;
+}
 
-bool PolyIsEq(const Poly *p, const Poly *q)
+/**
+ * Sprawdza zapis poziomu wielomianu, nie budując go
+ *
+ * Stosuje te same warunki poprawności co DeserializeLevel.
+ * @param[in] data : początek zapisu
+ * @param[in] end : koniec dostępnych danych
+ * @param[out] mono_count : liczba jednomianów poziomu
+ * @param[out] constant : stała poziomu (bez mnożników)
+ * @return wskaźnik za zapisem lub NULL, jeśli zapis jest niepoprawny
+ */
+static const unsigned char* CheckSerializedLevel(const unsigned char *data,
+                                                 const unsigned char *end,
+                                                 unsigned long *mono_count,
+                                                 poly_coeff_t *constant)
 {
-    if (p->constant != q->constant)
+    unsigned long var_skip = 0;
+    unsigned long value;
+    data = GetVarint(data, end, mono_count);
+    if (data != NULL && *mono_count > 0)
     {
-        return false;
+        data = GetVarint(data, end, &var_skip);
+    }
+    if (data != NULL)
+    {
+        data = GetVarint(data, end, &value);
+    }
+    if (data == NULL || var_skip > UINT_MAX)
+    {
+        return NULL;
     }
+    *constant = ZigZagDecode(value);
 
-    Mono *p_mono = p->first_mono;
-    Mono *q_mono = q->first_mono;
-    while (p_mono != NULL && q_mono != NULL)
+    long long next_exp = 0;
+    for (unsigned long i = 0; i < *mono_count; ++i)
     {
-        if (p_mono->exp != q_mono->exp ||
-           PolyIsEq(&p_mono->p, &q_mono->p) == false)
+        unsigned long exp_delta;
+        data = GetVarint(data, end, &exp_delta);
+        if (data == NULL || exp_delta > (unsigned long)INT_MAX ||
+            (long long)exp_delta > INT_MAX - next_exp)
         {
-            return false;
+            return NULL;
         }
+        const long long exp = next_exp + exp_delta;
+        next_exp = exp + 1;
 
-        p_mono = p_mono->next_mono;
-        q_mono = q_mono->next_mono;
-    }
-
-    if (p_mono != NULL || q_mono != NULL)
-    {
-        return false;
+        unsigned long coeff_mono_count;
+        poly_coeff_t coeff_constant;
+        data = CheckSerializedLevel(data, end, &coeff_mono_count,
+                                    &coeff_constant);
+        if (data == NULL || (coeff_mono_count == 0 && coeff_constant == 0) ||
+            (exp == 0 && (coeff_mono_count == 0 || coeff_constant != 0 ||
+                          *mono_count == 1)))
+        {
+            return NULL;
+        }
     }
 
-    return true;
+    return data;
 }
 
-Poly PolyAt(const Poly *p, poly_coeff_t x)
+size_t PolySerializedSize(const Poly *p)
 {
-    Poly result = PolyZero();
-
-    Poly *temp_coeff_poly = malloc(sizeof(Poly));
-    Poly *temp_mult_poly = malloc(sizeof(Poly));
-    assert(temp_coeff_poly != NULL && temp_mult_poly != NULL);
+    return SerializeLevel(p, 1, NULL);
+}
 
-    Mono *current_mono = p->first_mono;
-    while (current_mono != NULL)
-    {
-        *temp_coeff_poly = PolyFromCoeff(FastCoeffPow(x, current_mono->exp));
-        *temp_mult_poly  = PolyMul(temp_coeff_poly, &current_mono->p);
+unsigned char* PolySerialize(const Poly *p, unsigned char *buffer)
+{
+    return buffer + SerializeLevel(p, 1, buffer);
+}
 
-        PolyAddInPlace(&result, temp_mult_poly);
+const unsigned char* PolyDeserialize(const unsigned char *data,
+                                     const unsigned char *end, Poly *p)
+{
+    return DeserializeLevel(data, end, p);
+}
 
-        PolyDestroy(temp_coeff_poly);
+const unsigned char* PolySerializedCheck(const unsigned char *data,
+                                         const unsigned char *end,
+                                         bool *is_coeff, bool *is_zero)
+{
+    unsigned long mono_count = 0;
+    poly_coeff_t constant = 0;
+    data = CheckSerializedLevel(data, end, &mono_count, &constant);
+    *is_coeff = mono_count == 0;
+    *is_zero = mono_count == 0 && constant == 0;
+    return data;
+}
 
-        current_mono = current_mono->next_mono;
+void PolySerializedFacts(const unsigned char *data, const unsigned char *end,
+                         bool *is_coeff, bool *is_zero)
+{
+    // Wielomian z jednomianami w postaci kanonicznej nie jest zerem,
+    // więc stałą czytamy tylko dla współczynnika.
+    unsigned long mono_count = 0;
+    unsigned long constant = 0;
+    data = GetVarint(data, end, &mono_count);
+    assert(data != NULL);
+    if (mono_count == 0)
+    {
+        data = GetVarint(data, end, &constant);
+        assert(data != NULL);
     }
+    (void)data;
 
-    free(temp_coeff_poly);
-    free(temp_mult_poly);
-
-    result.constant += p->constant;
-    return result;
+    *is_coeff = mono_count == 0;
+    *is_zero = mono_count == 0 && constant == 0;
 }
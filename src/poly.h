@@ -12,6 +12,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include "output.h"
 
 /** Typ współczynników wielomianu */
 typedef long poly_coeff_t;
@@ -21,13 +22,35 @@ typedef int poly_exp_t;
 
 typedef struct Mono Mono;
 
+/** Blok listy jednomianów (szczegóły w poly.c) */
+typedef struct MonoBlock MonoBlock;
+
+/** Indeks listy jednomianów dużego wielomianu (szczegóły w poly.c) */
+typedef struct MonoIndex MonoIndex;
+
+/** Gęsta tablica stałych współczynników poziomu (szczegóły w poly.c) */
+typedef struct DenseCoeffs DenseCoeffs;
+
 /**
  * Struktura przechowująca wielomian
  */
 typedef struct Poly
 {
-    Mono *first_mono; ///< Wskaźnik na listę jednomianów
+    union
+    {
+        /// Pierwszy blok listy jednomianów (NULL dla współczynnika)
+        MonoBlock *first_block;
+        DenseCoeffs *dense; ///< Współczynniki poziomu, gdy is_dense
+    };
     poly_coeff_t constant; ///< Stała część wielomianu
+    /// Odłożony, nieparzysty mnożnik całego wielomianu (0 oznacza brak)
+    poly_coeff_t factor;
+    MonoIndex *index; ///< Indeks listy jednomianów (NULL dla małych list)
+    /// Liczba kolejnych zmiennych, od których wielomian nie zależy;
+    /// jednomiany są wielomianem zmiennej o indeksie większym o var_skip
+    unsigned var_skip;
+    /// Czy jednomiany są przechowywane w tablicy dense zamiast listy?
+    bool is_dense;
 } Poly;
 
 /**
@@ -35,11 +58,13 @@ typedef struct Poly
   * Jednomian ma postać `p * x^e`.
   * Współczynnik `p` może też być wielomianem.
   * Będzie on traktowany jako wielomian nad kolejną zmienną (nie nad x).
+  * Zmienne, od których współczynnik nie zależy, nie tworzą osobnych
+  * poziomów zagnieżdżenia, tylko są pomijane (pole var_skip).
+  * Jednomiany wielomianu leżą po kilka w kolejnych blokach listy.
   */
 typedef struct Mono
 {
     Poly p; ///< Współczynnik
-    Mono *next_mono; ///< Wskaźnik na następny element listy
     poly_exp_t exp; ///< Wykładnik
 } Mono;
 
@@ -50,7 +75,7 @@ typedef struct Mono
  */
 static inline Poly PolyFromCoeff(poly_coeff_t c)
 {
-    return (Poly) {.first_mono = NULL, .constant = c};
+    return (Poly) {.first_block = NULL, .constant = c};
 }
 
 /**
@@ -59,7 +84,7 @@ static inline Poly PolyFromCoeff(poly_coeff_t c)
  */
 static inline Poly PolyZero()
 {
-    return (Poly) {.first_mono = NULL, .constant = 0};
+    return (Poly) {.first_block = NULL, .constant = 0};
 }
 
 /**
@@ -71,7 +96,7 @@ static inline Poly PolyZero()
  */
 static inline Mono MonoFromPoly(const Poly *p, poly_exp_t e)
 {
-    return (Mono) {.p = *p, .exp = e, .next_mono = NULL};
+    return (Mono) {.p = *p, .exp = e};
 }
 
 /**
@@ -81,7 +106,7 @@ static inline Mono MonoFromPoly(const Poly *p, poly_exp_t e)
  */
 static inline bool PolyIsCoeff(const Poly *p)
 {
-    return p->first_mono == NULL;
+    return p->first_block == NULL;
 }
 
 /**
@@ -91,7 +116,7 @@ static inline bool PolyIsCoeff(const Poly *p)
  */
 static inline bool PolyIsZero(const Poly *p)
 {
-    return p->first_mono == NULL && p->constant == 0;
+    return p->first_block == NULL && p->constant == 0;
 }
 
 /**
@@ -123,7 +148,7 @@ Poly PolyClone(const Poly *p);
  */
 static inline Mono MonoClone(const Mono *m)
 {
-    return (Mono) {.p = PolyClone(&m->p), .exp = m->exp, .next_mono = NULL};
+    return (Mono) {.p = PolyClone(&m->p), .exp = m->exp};
 }
 
 /**
@@ -152,6 +177,51 @@ void PolyAddInPlace(Poly *p, Poly *q);
  */
 Poly PolyAddMonos(unsigned count, const Mono monos[]);
 
+/**
+ * Struktura przechowująca stan budowania wielomianu z kolejnych jednomianów
+ *
+ * Jednomiany dołączane w kolejności rosnących wykładników trafiają od razu
+ * na docelową listę, bez sortowania i scalania.
+ */
+typedef struct PolyBuilder
+{
+    MonoBlock *first_block; ///< Początek budowanej listy jednomianów
+    MonoBlock *last_block; ///< Ostatni blok listy (NULL dla pustej listy)
+    unsigned mono_count; ///< Liczba jednomianów na liście
+    bool sorted; ///< Czy wykładniki listy są ściśle rosnące
+} PolyBuilder;
+
+/**
+ * Tworzy pusty PolyBuilder
+ * @return PolyBuilder bez jednomianów
+ */
+static inline PolyBuilder PolyBuilderInit()
+{
+    return (PolyBuilder) {.first_block = NULL, .last_block = NULL,
+                          .mono_count = 0, .sorted = true};
+}
+
+/**
+ * Dołącza jednomian `p * x^exp` do budowanego wielomianu
+ *
+ * Przejmuje na własność zawartość @p p. Zerowe współczynniki są pomijane.
+ * @param[in,out] builder : budowany wielomian
+ * @param[in] p : współczynnik jednomianu w postaci kanonicznej
+ * @param[in] exp : wykładnik
+ */
+void PolyBuilderAppend(PolyBuilder *builder, Poly *p, poly_exp_t exp);
+
+/**
+ * Kończy budowanie wielomianu
+ *
+ * Jeśli jednomiany dołączano w kolejności rosnących wykładników,
+ * wynik powstaje w jednym przejściu; w przeciwnym razie jednomiany są
+ * sortowane i scalane jak w PolyAddMonos.
+ * @param[in,out] builder : budowany wielomian (po wywołaniu pusty)
+ * @return wielomian będący sumą dołączonych jednomianów
+ */
+Poly PolyBuilderFinish(PolyBuilder *builder);
+
 /**
  * Mnoży dwa wielomiany.
  * @param[in] p : wielomian
@@ -160,6 +230,120 @@ Poly PolyAddMonos(unsigned count, const Mono monos[]);
  */
 Poly PolyMul(const Poly *p, const Poly *q);
 
+/**
+ * Mnoży dwa wielomiany modulo `x_var_idx^n`.
+ * Jednomiany iloczynu, w których zmienna o indeksie @p var_idx ma wykładnik
+ * co najmniej @p n, nie są w ogóle liczone.
+ * Uwzględnia również ograniczenia pierścienia ustawione przez PolyRingSet.
+ * @param[in] p : wielomian
+ * @param[in] q : wielomian
+ * @param[in] var_idx : indeks zmiennej
+ * @param[in] n : ograniczenie wykładników zmiennej
+ * @return `p * q mod x_var_idx^n`
+ */
+Poly PolyMulTrunc(const Poly *p, const Poly *q, unsigned var_idx,
+                  poly_exp_t n);
+
+/**
+ * Ustawia tryb pierścienia ilorazowego.
+ * Od tej chwili wyniki mnożenia (a więc także składania, potęgowania
+ * i iloczynów wielu wielomianów) liczone są modulo `x_var_idx^n`.
+ * Ograniczenia kolejnych zmiennych sumują się, @p n równe 0 usuwa
+ * ograniczenie zmiennej o indeksie @p var_idx.
+ * @param[in] var_idx : indeks zmiennej
+ * @param[in] n : ograniczenie wykładników zmiennej
+ */
+void PolyRingSet(unsigned var_idx, poly_exp_t n);
+
+/**
+ * Wyłącza tryb pierścienia ilorazowego, usuwając wszystkie ograniczenia.
+ */
+void PolyRingReset(void);
+
+/**
+ * Zwalnia pamięć pomocniczą modułu: ograniczenia pierścienia, pamięć
+ * podręczną potęg i pamięć alokatora bloków jednomianów.
+ * Wolno ją wywołać tylko wtedy, gdy wszystkie wielomiany zostały usunięte,
+ * a inne wątki korzystające z wielomianów zakończyły działanie.
+ */
+void PolyReleaseMemory(void);
+
+/**
+ * Sprawdza, czy włączony jest tryb pierścienia ilorazowego.
+ * @return Czy ustawiono ograniczenie wykładników którejś zmiennej?
+ */
+bool PolyRingIsSet(void);
+
+/**
+ * Redukuje wielomian modulo ograniczenia bieżącego pierścienia, w miejscu.
+ * @param[in,out] p : wielomian
+ */
+void PolyRingReduce(Poly *p);
+
+/**
+ * Mnoży @p count wielomianów.
+ * Czynniki mnożone są parami, od najmniejszych, w zrównoważonym drzewie.
+ * Niezależne pary jednej rundy mnożone są równolegle.
+ * Nie przejmuje żadnego z parametrów na własność.
+ * @param[in] count : liczba wielomianów
+ * @param[in] factors : tablica wielomianów
+ * @return `factors[0] * factors[1] * ... * factors[count - 1]`
+ */
+Poly PolyProductN(unsigned count, const Poly factors[]);
+
+/**
+ * Włącza lub wyłącza zmianę kolejności zmiennych w PolyProductN.
+ * Gdy jest włączona, a pierścień nie ma ograniczeń, czynniki mnożone są
+ * przy kolejności pierwszych zmiennych rosnącej wg. ich łącznego stopnia,
+ * a iloczyn przed zwróceniem przekształcany jest z powrotem.
+ * @param[in] enabled : czy zmieniać kolejność zmiennych
+ */
+void PolyProductReorder(bool enabled);
+
+/**
+ * Usuwa wszystkie potęgi z pamięci podręcznej potęg.
+ * Pamięć podręczną wykorzystują PolyCompose i PolySubstitute; potęgi są
+ * rozpoznawane po skrócie struktury podstawy i wykładniku. Zmiana
+ * pierścienia czyści ją automatycznie.
+ */
+void PolyPowerCacheClear(void);
+
+/**
+ * Ustawia limit rozmiaru pamięci podręcznej potęg.
+ * Po przekroczeniu limitu usuwane są najdawniej użyte potęgi.
+ * @param[in] budget : limit łącznej liczby jednomianów zapamiętanych
+ * podstaw i potęg (0 wyłącza pamięć podręczną)
+ */
+void PolyPowerCacheSetBudget(size_t budget);
+
+/**
+ * Zwraca liczniki trafień i chybień pamięci podręcznej potęg.
+ * @param[out] hits : liczba potęg znalezionych w pamięci podręcznej
+ * @param[out] misses : liczba potęg policzonych od nowa
+ */
+void PolyPowerCacheStats(unsigned long *hits, unsigned long *misses);
+
+/**
+ * Zwraca liczniki działań policzonych w postaci gęstej w bieżącym wątku.
+ * Poziomy o stałych współczynnikach, w których zajęta jest dość duża część
+ * wykładników, są przechowywane w postaci gęstej; pozostałe poziomy
+ * zamieniamy na nią tylko na czas jednego mnożenia lub wyliczenia wartości.
+ * @param[out] muls : liczba iloczynów poziomów policzonych w postaci gęstej
+ * @param[out] evals : liczba wartości poziomów policzonych schematem Hornera
+ */
+void PolyDenseStats(unsigned long *muls, unsigned long *evals);
+
+/**
+ * Przestawia zmienne wielomianu.
+ * Pod zmienną x_i, dla i < @p count, podstawia zmienną x_perm[i];
+ * pozostałe zmienne nie zmieniają indeksów.
+ * @param[in] p : wielomian
+ * @param[in] count : liczba przestawianych zmiennych
+ * @param[in] perm : permutacja liczb 0, 1, ..., count - 1
+ * @return p(x_perm[0], x_perm[1], ..., x_perm[count - 1], x_count, ...)
+ */
+Poly PolyPermuteVars(const Poly *p, unsigned count, const unsigned perm[]);
+
 /**
  * Zwraca przeciwny wielomian.
  * @param[in] p : wielomian
@@ -167,6 +351,55 @@ Poly PolyMul(const Poly *p, const Poly *q);
  */
 Poly PolyNeg(const Poly *p);
 
+/**
+ * Mnoży wielomian przez stałą, w miejscu.
+ * Mnożenie przez liczbę nieparzystą jest odkładane i zajmuje czas stały,
+ * współczynniki przemnażane są dopiero gdy jest to potrzebne.
+ * @param[in,out] p : wielomian
+ * @param[in] c : stała
+ */
+void PolyScaleInPlace(Poly *p, poly_coeff_t c);
+
+/**
+ * Zamienia wielomian na przeciwny, w miejscu i w czasie stałym.
+ * @param[in,out] p : wielomian
+ */
+static inline void PolyNegInPlace(Poly *p)
+{
+    PolyScaleInPlace(p, -1);
+}
+
+/**
+ * Mnoży wielomian przez stałą.
+ * Współczynniki przepisywane są w jednym przejściu, bez sortowania.
+ * @param[in] p : wielomian
+ * @param[in] c : stała
+ * @return `c * p`
+ */
+Poly PolyScale(const Poly *p, poly_coeff_t c);
+
+/**
+ * Mnoży wielomian przez potęgę zmiennej.
+ * Wykładniki przepisywane są w jednym przejściu, bez sortowania.
+ * Uwzględnia ograniczenia pierścienia ustawione przez PolyRingSet.
+ * @param[in] p : wielomian
+ * @param[in] var_idx : indeks zmiennej
+ * @param[in] k : wykładnik
+ * @return `p * x_var_idx^k`
+ */
+Poly PolyShiftVar(const Poly *p, unsigned var_idx, poly_exp_t k);
+
+/**
+ * Przesuwa zmienną wielomianu o stałą.
+ * Współczynniki przeliczane są schematem addytywnym, bez potęgowania
+ * i mnożenia wielomianów.
+ * @param[in] p : wielomian
+ * @param[in] var_idx : indeks zmiennej
+ * @param[in] c : przesunięcie
+ * @return p(x_0, ..., x_{var_idx - 1}, x_var_idx + c, x_{var_idx + 1}, ...)
+ */
+Poly PolyShiftVarBy(const Poly *p, unsigned var_idx, poly_coeff_t c);
+
 /**
  * Zwraca przeciwny jednomian
  * @param[in] m : jednomian
@@ -174,7 +407,7 @@ Poly PolyNeg(const Poly *p);
  */
 static inline Mono MonoNeg(const Mono *m)
 {
-    return (Mono) {.p = PolyNeg(&m->p), .exp = m->exp, .next_mono = NULL};
+    return (Mono) {.p = PolyNeg(&m->p), .exp = m->exp};
 }
 
 /**
@@ -206,12 +439,99 @@ poly_exp_t PolyDegBy(const Poly *p, unsigned var_idx);
 poly_exp_t PolyDeg(const Poly *p);
 
 /**
- * Wypisuje wielomian na standardowe wyjście
+ * Wypisuje wielomian w formacie akceptowanym przez kalkulator
+ * @param[in] p : wielomian
+ * @param[in,out] writer : wypisywanie
+ */
+void PolyWrite(const Poly *p, OutputWriter *writer);
+
+/**
+ * Wypisuje wielomian na (buforowane) standardowe wyjście
  * w formacie akceptowanym przez kalkulator
  * @param[in] p : wielomian
  */
 void PolyPrint(const Poly *p);
 
+/**
+ * Zapisuje wielomian w formacie akceptowanym przez kalkulator
+ *
+ * Bufor napisu ma od razu rozmiar oszacowany z liczby jednomianów,
+ * więc nie jest powiększany w trakcie wypisywania.
+ * @param[in] p : wielomian
+ * @return zaalokowany napis zakończony zerem (zwalniany przez free)
+ */
+char* PolyToString(const Poly *p);
+
+#define POLY_SERIAL_VERSION 1
+///< Wersja binarnego formatu zapisu wielomianów (PolySerialize)
+
+/**
+ * Zwraca rozmiar binarnego zapisu wielomianu
+ * @param[in] p : wielomian
+ * @return liczba bajtów zapisywanych przez PolySerialize
+ */
+size_t PolySerializedSize(const Poly *p);
+
+/**
+ * Zapisuje wielomian w zwartym formacie binarnym
+ *
+ * Poziomy wielomianu zapisywane są w porządku prefiksowym: liczba
+ * jednomianów, liczba pominiętych zmiennych (tylko gdy poziom ma
+ * jednomiany), stała, a po nich kolejne jednomiany jako różnica wykładnika
+ * i następnego wykładnika poprzedniego jednomianu oraz zapis współczynnika.
+ * Liczby mają zapis o zmiennej długości (7 bitów na bajt), stałe są
+ * wcześniej przekształcane tak, by małe co do modułu wartości zajmowały
+ * jeden bajt. Odłożone mnożniki są wymnażane w trakcie zapisu.
+ * @param[in] p : wielomian
+ * @param[out] buffer : bufor na co najmniej PolySerializedSize(p) bajtów
+ * @return wskaźnik za ostatnim zapisanym bajtem
+ */
+unsigned char* PolySerialize(const Poly *p, unsigned char *buffer);
+
+/**
+ * Odczytuje wielomian zapisany przez PolySerialize
+ *
+ * Zapis, który nie opisuje wielomianu w postaci kanonicznej, uznajemy
+ * za niepoprawny.
+ * @param[in] data : początek zapisu
+ * @param[in] end : koniec dostępnych danych
+ * @param[out] p : odczytany wielomian (zero w przypadku błędu)
+ * @return wskaźnik za odczytanym zapisem lub NULL, jeśli zapis
+ * jest niepoprawny
+ */
+const unsigned char* PolyDeserialize(const unsigned char *data,
+                                     const unsigned char *end, Poly *p);
+
+/**
+ * Sprawdza zapis PolySerialize bez tworzenia wielomianu
+ *
+ * Zapis jest poprawny wtedy i tylko wtedy, gdy PolyDeserialize by go
+ * odczytał, ale sprawdzenie nie przydziela pamięci.
+ * @param[in] data : początek zapisu
+ * @param[in] end : koniec dostępnych danych
+ * @param[out] is_coeff : czy zapisany wielomian jest współczynnikiem
+ * @param[out] is_zero : czy zapisany wielomian jest zerem
+ * @return wskaźnik za sprawdzonym zapisem lub NULL, jeśli zapis
+ * jest niepoprawny (wartości @p is_coeff i @p is_zero są wtedy dowolne)
+ */
+const unsigned char* PolySerializedCheck(const unsigned char *data,
+                                         const unsigned char *end,
+                                         bool *is_coeff, bool *is_zero);
+
+/**
+ * Odczytuje z nagłówka zapisu PolySerialize, czy wielomian jest
+ * współczynnikiem i czy jest zerem
+ *
+ * Czyta tylko pierwsze bajty zapisu, który musi być poprawny
+ * (np. sprawdzony wcześniej funkcją PolySerializedCheck).
+ * @param[in] data : początek zapisu
+ * @param[in] end : koniec zapisu
+ * @param[out] is_coeff : czy zapisany wielomian jest współczynnikiem
+ * @param[out] is_zero : czy zapisany wielomian jest zerem
+ */
+void PolySerializedFacts(const unsigned char *data, const unsigned char *end,
+                         bool *is_coeff, bool *is_zero);
+
 /**
  * Implementuje składanie wielomianów.
  * Funkcja PolyCompose zwraca wielomian @p p, w którym pod zmienną x_i
@@ -219,6 +539,8 @@ void PolyPrint(const Poly *p);
  * p(x[0], x[1], ..., x[count - 1], 0, 0, ...).
  * Brakujące wartości zmiennych wypełniamy zerami. 
  * Nadmiarowe wielomiany w x[] ignorujemy.
+ * Gdy każdy x[i] ma postać `a * x_i + b`, wynik liczony jest przesuwaniem
+ * współczynników, bez potęgowania wielomianów.
  * Nie przejmuje żadnego z parametrów na własność.
  * @param[in] p : wielomian do którego podstawiamy
  * @param[in] count : liczba wielomianów
@@ -227,6 +549,18 @@ void PolyPrint(const Poly *p);
  */
 Poly PolyCompose(const Poly *p, unsigned count, const Poly x[]);
 
+/**
+ * Podstawia wielomian pod jedną zmienną.
+ * Przebudowywane są tylko poziomy zmiennych o indeksach nie większych
+ * niż @p var_idx, pozostała część wielomianu jest kopiowana.
+ * Nie przejmuje żadnego z parametrów na własność.
+ * @param[in] p : wielomian do którego podstawiamy
+ * @param[in] var_idx : indeks zmiennej
+ * @param[in] q : podstawiany wielomian
+ * @return p(x_0, ..., x_{var_idx - 1}, q, x_{var_idx + 1}, ...)
+ */
+Poly PolySubstitute(const Poly *p, unsigned var_idx, const Poly *q);
+
 
 /**
  * Sprawdza równość dwóch wielomianów.
@@ -249,4 +583,16 @@ bool PolyIsEq(const Poly *p, const Poly *q);
  */
 Poly PolyAt(const Poly *p, poly_coeff_t x);
 
+/**
+ * Zwraca współczynnik wielomianu przy @f$x_0^{exp}@f$.
+ * Współczynnik jest wielomianem zmiennych @f$x_1, x_2, \ldots@f$
+ * (w wyniku ich indeksy są zmniejszone o jeden, tak jak w PolyAt).
+ * Duże wielomiany mają indeks listy jednomianów, wtedy wyszukanie
+ * współczynnika zajmuje czas logarytmiczny względem ich długości.
+ * @param[in] p : wielomian
+ * @param[in] exp : wykładnik
+ * @return współczynnik przy @f$x_0^{exp}@f$
+ */
+Poly PolyCoeff(const Poly *p, poly_exp_t exp);
+
 #endif /* __POLY_H__ */
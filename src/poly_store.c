@@ -0,0 +1,428 @@
+/** @file
+   Implementacja magazynu nazwanych wielomianów
+
+   @date 2017-06-05
+*/
+
+// mmap wymaga rozszerzeń POSIX, niedostępnych przy -std=c11.
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "poly_store.h"
+
+#define POLY_STORE_HEADER_SIZE 16
+///< Rozmiar nagłówka: znacznik, wersja, 3 bajty wyrównania, liczba wpisów
+#define POLY_STORE_ENTRY_SIZE 32
+///< Rozmiar opisu wpisu: położenie i długość nazwy oraz zapisu wielomianu
+
+/**
+ * Wynik sprawdzenia zapisu wpisu magazynu
+ */
+typedef enum EntryCheck
+{
+    ENTRY_CHECK_UNKNOWN, ///< Zapisu jeszcze nie sprawdzono
+    ENTRY_CHECK_VALID, ///< Zapis jest poprawny
+    ENTRY_CHECK_INVALID ///< Zapis jest niepoprawny
+} EntryCheck;
+
+/**
+ * Struktura przechowująca otwarty magazyn
+ */
+struct PolyStore
+{
+    const unsigned char *data; ///< Odwzorowany plik
+    size_t size; ///< Rozmiar pliku
+    size_t entry_count; ///< Liczba wpisów
+    /// Wyniki sprawdzenia zapisów wpisów (NULL przed pierwszym wyszukaniem)
+    unsigned char *entry_checks;
+};
+
+/**
+ * Struktura opisująca wpis magazynu
+ */
+typedef struct StoreEntry
+{
+    const char *name; ///< Nazwa wielomianu (niezakończona zerem)
+    size_t name_length; ///< Długość nazwy
+    const unsigned char *data; ///< Zapis PolySerialize wielomianu
+    size_t data_size; ///< Długość zapisu
+} StoreEntry;
+
+/**
+ * Odczytuje 64-bitową liczbę zapisaną od najmłodszego bajtu
+ * @param[in] bytes : zapis liczby
+ * @return liczba
+ */
+static inline uint64_t Load64(const unsigned char *bytes)
+{
+    uint64_t value = 0;
+    for (unsigned i = 8; i-- > 0;)
+    {
+        value = (value << 8) | bytes[i];
+    }
+
+    return value;
+}
+
+/**
+ * Zapisuje 64-bitową liczbę od najmłodszego bajtu
+ * @param[out] bytes : miejsce zapisu
+ * @param[in] value : liczba
+ */
+static inline void Store64(unsigned char *bytes, uint64_t value)
+{
+    for (unsigned i = 0; i < 8; ++i)
+    {
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+/**
+ * Porównuje nazwy wielomianów
+ * @param[in] a : nazwa
+ * @param[in] a_length : długość nazwy @p a
+ * @param[in] b : nazwa
+ * @param[in] b_length : długość nazwy @p b
+ * @return liczba ujemna, zero lub dodatnia, gdy @p a jest odpowiednio
+ * mniejsza, równa lub większa od @p b
+ */
+static int CompareNames(const char *a, size_t a_length,
+                        const char *b, size_t b_length)
+{
+    const int result = memcmp(a, b, a_length < b_length ? a_length : b_length);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+/**
+ * Odczytuje opis wpisu magazynu
+ * @param[in] store : magazyn
+ * @param[in] i : numer wpisu
+ * @param[out] entry : wpis
+ * @return czy nazwa i zapis wpisu mieszczą się w pliku
+ */
+static bool StoreGetEntry(const PolyStore *store, size_t i, StoreEntry *entry)
+{
+    assert(i < store->entry_count);
+    const unsigned char *record = store->data + POLY_STORE_HEADER_SIZE +
+                                  i * POLY_STORE_ENTRY_SIZE;
+    const uint64_t name_offset = Load64(record);
+    const uint64_t name_length = Load64(record + 8);
+    const uint64_t data_offset = Load64(record + 16);
+    const uint64_t data_size = Load64(record + 24);
+
+    if (name_offset > store->size || name_length > store->size - name_offset ||
+        data_offset > store->size || data_size > store->size - data_offset)
+    {
+        return false;
+    }
+
+    *entry = (StoreEntry) {
+            .name = (const char *)store->data + name_offset,
+            .name_length = name_length,
+            .data = store->data + data_offset,
+            .data_size = data_size};
+    return true;
+}
+
+/**
+ * Wyszukuje binarnie pierwszy wpis o nazwie nie mniejszej niż podana
+ * @param[in] store : magazyn
+ * @param[in] name : nazwa
+ * @param[in] name_length : długość nazwy
+ * @param[out] position : numer wpisu (liczba wpisów, jeśli nie ma takiego)
+ * @return czy przeglądane wpisy były poprawne
+ */
+static bool StoreLowerBound(const PolyStore *store, const char *name,
+                            size_t name_length, size_t *position)
+{
+    size_t low = 0;
+    size_t high = store->entry_count;
+    while (low < high)
+    {
+        const size_t middle = low + (high - low) / 2;
+        StoreEntry entry;
+        if (!StoreGetEntry(store, middle, &entry))
+        {
+            return false;
+        }
+
+        if (CompareNames(entry.name, entry.name_length, name, name_length) < 0)
+        {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    *position = low;
+    return true;
+}
+
+PolyStore* PolyStoreOpen(const char *path)
+{
+    assert(path != NULL);
+    const int file_descriptor = open(path, O_RDONLY);
+    if (file_descriptor < 0)
+    {
+        return NULL;
+    }
+
+    struct stat info;
+    void *data = MAP_FAILED;
+    if (fstat(file_descriptor, &info) == 0 && S_ISREG(info.st_mode) &&
+        info.st_size >= POLY_STORE_HEADER_SIZE)
+    {
+        data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE,
+                    file_descriptor, 0);
+    }
+    close(file_descriptor);
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    const unsigned char *bytes = data;
+    const size_t size = info.st_size;
+    const uint64_t entry_count = Load64(bytes + 8);
+    if (memcmp(bytes, POLY_STORE_MAGIC, 4) != 0 ||
+        bytes[4] != POLY_STORE_VERSION ||
+        entry_count > (size - POLY_STORE_HEADER_SIZE) / POLY_STORE_ENTRY_SIZE)
+    {
+        munmap(data, size);
+        return NULL;
+    }
+
+    PolyStore *store = malloc(sizeof(PolyStore));
+    assert(store != NULL);
+    *store = (PolyStore) {.data = bytes, .size = size,
+                          .entry_count = entry_count, .entry_checks = NULL};
+    return store;
+}
+
+void PolyStoreClose(PolyStore *store)
+{
+    if (store == NULL)
+    {
+        return;
+    }
+
+    munmap((void *)store->data, store->size);
+    free(store->entry_checks);
+    free(store);
+}
+
+bool PolyStoreLookup(PolyStore *store, const char *name,
+                     size_t name_length, const unsigned char **data,
+                     size_t *data_size)
+{
+    assert(store != NULL && data != NULL && data_size != NULL);
+
+    size_t position;
+    StoreEntry entry;
+    if (!StoreLowerBound(store, name, name_length, &position) ||
+        position == store->entry_count ||
+        !StoreGetEntry(store, position, &entry) ||
+        CompareNames(entry.name, entry.name_length, name, name_length) != 0)
+    {
+        return false;
+    }
+
+    // Zapis sprawdzamy przy pierwszym wyszukaniu, kolejne korzystają
+    // z zapamiętanego wyniku.
+    if (store->entry_checks == NULL)
+    {
+        store->entry_checks = calloc(store->entry_count, 1);
+        assert(store->entry_checks != NULL);
+    }
+    if (store->entry_checks[position] == ENTRY_CHECK_UNKNOWN)
+    {
+        bool is_coeff, is_zero;
+        const unsigned char *end = entry.data + entry.data_size;
+        store->entry_checks[position] =
+            PolySerializedCheck(entry.data, end, &is_coeff, &is_zero) == end ?
+            ENTRY_CHECK_VALID : ENTRY_CHECK_INVALID;
+    }
+    if (store->entry_checks[position] != ENTRY_CHECK_VALID)
+    {
+        return false;
+    }
+
+    *data = entry.data;
+    *data_size = entry.data_size;
+    return true;
+}
+
+bool PolyStoreFetch(PolyStore *store, const char *name,
+                    size_t name_length, Poly *p)
+{
+    assert(store != NULL && p != NULL);
+    *p = PolyZero();
+
+    const unsigned char *data;
+    size_t data_size;
+    if (!PolyStoreLookup(store, name, name_length, &data, &data_size))
+    {
+        return false;
+    }
+
+    const unsigned char *end = data + data_size;
+    if (PolyDeserialize(data, end, p) != end)
+    {
+        PolyDestroy(p);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Zapisuje plik magazynu z podanymi wpisami
+ * @param[in] path : ścieżka do pliku
+ * @param[in] entries : wpisy posortowane wg. nazw
+ * @param[in] count : liczba wpisów
+ * @return czy udało się zapisać
+ */
+static bool StoreWriteFile(const char *path, const StoreEntry entries[],
+                           size_t count)
+{
+    const size_t table_size = POLY_STORE_HEADER_SIZE +
+                              count * POLY_STORE_ENTRY_SIZE;
+    unsigned char *table = calloc(table_size, 1);
+    assert(table != NULL);
+    memcpy(table, POLY_STORE_MAGIC, 4);
+    table[4] = POLY_STORE_VERSION;
+    Store64(table + 8, count);
+
+    // Nazwy leżą zaraz za tablicą opisów, zapisy wielomianów za nazwami.
+    uint64_t offset = table_size;
+    for (size_t i = 0; i < count; ++i)
+    {
+        unsigned char *record = table + POLY_STORE_HEADER_SIZE +
+                                i * POLY_STORE_ENTRY_SIZE;
+        Store64(record, offset);
+        Store64(record + 8, entries[i].name_length);
+        offset += entries[i].name_length;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        unsigned char *record = table + POLY_STORE_HEADER_SIZE +
+                                i * POLY_STORE_ENTRY_SIZE;
+        Store64(record + 16, offset);
+        Store64(record + 24, entries[i].data_size);
+        offset += entries[i].data_size;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        free(table);
+        return false;
+    }
+
+    bool written = fwrite(table, 1, table_size, file) == table_size;
+    for (size_t i = 0; i < count && written; ++i)
+    {
+        written = fwrite(entries[i].name, 1, entries[i].name_length, file) ==
+                  entries[i].name_length;
+    }
+    for (size_t i = 0; i < count && written; ++i)
+    {
+        written = fwrite(entries[i].data, 1, entries[i].data_size, file) ==
+                  entries[i].data_size;
+    }
+    written = fclose(file) == 0 && written;
+
+    free(table);
+    return written;
+}
+
+bool PolyStoreAdd(const char *path, const char *name, size_t name_length,
+                  const Poly *p)
+{
+    assert(path != NULL && name != NULL && p != NULL);
+    PolyStore *store = PolyStoreOpen(path);
+    if (store == NULL)
+    {
+        // Istniejącego pliku, który nie jest magazynem, nie nadpisujemy.
+        FILE *existing = fopen(path, "rb");
+        if (existing != NULL)
+        {
+            fclose(existing);
+            return false;
+        }
+    }
+    const PolyStore empty = {.data = NULL, .size = 0, .entry_count = 0,
+                             .entry_checks = NULL};
+    const PolyStore *old = store != NULL ? store : &empty;
+
+    size_t position = 0;
+    bool valid = StoreLowerBound(old, name, name_length, &position);
+
+    const size_t data_size = PolySerializedSize(p);
+    unsigned char *data = malloc(data_size);
+    assert(data != NULL);
+    PolySerialize(p, data);
+
+    StoreEntry *entries = malloc((old->entry_count + 1) * sizeof(StoreEntry));
+    assert(entries != NULL);
+    size_t count = 0;
+    for (size_t i = 0; i < old->entry_count && valid; ++i)
+    {
+        if (i == position)
+        {
+            entries[count++] = (StoreEntry) {
+                    .name = name, .name_length = name_length,
+                    .data = data, .data_size = data_size};
+        }
+
+        valid = StoreGetEntry(old, i, &entries[count]);
+        // Wpis o tej samej nazwie zastępujemy nowym.
+        if (valid && (i != position ||
+                      CompareNames(entries[count].name,
+                                   entries[count].name_length,
+                                   name, name_length) != 0))
+        {
+            ++count;
+        }
+    }
+    if (position == old->entry_count)
+    {
+        entries[count++] = (StoreEntry) {
+                .name = name, .name_length = name_length,
+                .data = data, .data_size = data_size};
+    }
+
+    if (valid)
+    {
+        char *temporary_path = malloc(strlen(path) + sizeof(".tmp"));
+        assert(temporary_path != NULL);
+        sprintf(temporary_path, "%s.tmp", path);
+
+        valid = StoreWriteFile(temporary_path, entries, count) &&
+                rename(temporary_path, path) == 0;
+        if (!valid)
+        {
+            remove(temporary_path);
+        }
+        free(temporary_path);
+    }
+
+    free(entries);
+    free(data);
+    PolyStoreClose(store);
+    return valid;
+}
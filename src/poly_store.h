@@ -0,0 +1,90 @@
+/** @file
+   Interfejs magazynu nazwanych wielomianów
+
+   Magazyn jest plikiem bez wskaźników: po nagłówku następuje posortowana
+   wg. nazw tablica opisów wielomianów (położenie i długość nazwy oraz
+   zapisu), a dalej nazwy i zapisy PolySerialize. Otwarty magazyn jest
+   odwzorowany w pamięć tylko do odczytu, więc otwarcie nie zależy od jego
+   rozmiaru, a pobranie wielomianu czyta tylko strony z jego zapisem.
+
+   @date 2017-06-05
+*/
+
+#ifndef __POLY_STORE_H__
+#define __POLY_STORE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "poly.h"
+
+#define POLY_STORE_MAGIC "PSTO"
+///< Początek pliku magazynu (po nim bajt wersji formatu)
+#define POLY_STORE_VERSION 1
+///< Wersja formatu pliku magazynu
+
+/** Otwarty magazyn wielomianów (szczegóły w poly_store.c) */
+typedef struct PolyStore PolyStore;
+
+/**
+ * Otwiera magazyn zapisany w pliku
+ * @param[in] path : ścieżka do pliku
+ * @return magazyn lub NULL, jeśli pliku nie da się otworzyć
+ * lub nie jest on magazynem
+ */
+PolyStore* PolyStoreOpen(const char *path);
+
+/**
+ * Zamyka magazyn
+ * @param[in] store : magazyn (może być NULL)
+ */
+void PolyStoreClose(PolyStore *store);
+
+/**
+ * Wyszukuje poprawny zapis wielomianu o podanej nazwie, nie odczytując go
+ *
+ * Zapis pozostaje ważny do zamknięcia magazynu. Poprawność zapisu
+ * sprawdzamy tylko przy pierwszym wyszukaniu wpisu, a magazyn pamięta
+ * wynik; kolejne wyszukania tego wpisu to tylko wyszukiwanie binarne.
+ * @param[in,out] store : magazyn
+ * @param[in] name : nazwa (niezakończona zerem)
+ * @param[in] name_length : długość nazwy
+ * @param[out] data : początek zapisu PolySerialize w odwzorowanym pliku
+ * @param[out] data_size : długość zapisu
+ * @return czy magazyn zawiera wpis o tej nazwie z poprawnym zapisem
+ */
+bool PolyStoreLookup(PolyStore *store, const char *name,
+                     size_t name_length, const unsigned char **data,
+                     size_t *data_size);
+
+/**
+ * Tworzy wielomian zapisany w magazynie pod podaną nazwą
+ *
+ * Wielomian odczytywany jest wprost z odwzorowanego pliku.
+ * @param[in,out] store : magazyn
+ * @param[in] name : nazwa (niezakończona zerem)
+ * @param[in] name_length : długość nazwy
+ * @param[out] p : wielomian
+ * @return czy magazyn zawiera poprawny wielomian o tej nazwie
+ */
+bool PolyStoreFetch(PolyStore *store, const char *name,
+                    size_t name_length, Poly *p);
+
+/**
+ * Zapisuje wielomian w magazynie pod podaną nazwą
+ *
+ * Tworzy plik magazynu, jeśli nie istnieje, i zastępuje wielomian
+ * o tej samej nazwie. Nowa zawartość powstaje w pliku tymczasowym
+ * zamienianym na docelowy dopiero po zapisaniu całości; zapisy pozostałych
+ * wielomianów są przepisywane bez odczytywania. Magazyny otwarte wcześniej
+ * nie widzą zmiany.
+ * @param[in] path : ścieżka do pliku magazynu
+ * @param[in] name : nazwa (niezakończona zerem)
+ * @param[in] name_length : długość nazwy
+ * @param[in] p : wielomian
+ * @return czy udało się zapisać (niepoprawny plik magazynu nie jest
+ * nadpisywany)
+ */
+bool PolyStoreAdd(const char *path, const char *name, size_t name_length,
+                  const Poly *p);
+
+#endif /* __POLY_STORE_H__ */
@@ -58,6 +58,17 @@ static inline void* StackPeek(Stack *s)
     return s->array[s->size - 2];
 }
 
+/**
+ * Zwraca element stosu o podanej pozycji, licząc od dna
+ * @param[in] s : stos
+ * @param[in] i : pozycja elementu (mniejsza od rozmiaru stosu)
+ */
+static inline void* StackGet(Stack *s, size_t i)
+{
+    assert(s != NULL && i < s->size);
+    return s->array[i];
+}
+
 /**
  * Usuwa element z wierzchołka stosu
  * @param[in] s : stos
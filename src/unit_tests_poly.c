@@ -21,12 +21,22 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+// pipe, nanosleep i ioctl wymagają rozszerzeń POSIX, niedostępnych przy -std=c11.
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
 #include <setjmp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 #include "cmocka.h"
 #include "poly.h"
+#include "poly_store.h"
+#include "coeff_kernels.h"
 
 /// Makro zwracające długość tablicy 
 #define array_length(x) (sizeof(x) / sizeof((x)[0]))
@@ -40,6 +50,9 @@ static int exit_status;
 /// Oryginalna funkcja main kalkulatora
 extern int calc_main(int argc, char *argv[]); 
 
+/// Liczniki literałów odłożonych na stos i wczytanych przez polecenia
+extern void PolyLiteralStats(unsigned long *pushed, unsigned long *parsed);
+
 /**
  * Atrapa funkcji main
 */
@@ -68,6 +81,8 @@ static char printf_buffer[256];
 static int fprintf_position = 0;
 /// Pozycja zapisu w buforze atrapy printf, wskazuje bajt o wartości 0.
 static int printf_position = 0;
+/// Funkcja wołana przez atrapę printf po każdym wypisaniu (lub NULL)
+static void (*printf_hook)(void) = NULL;
 
 /**
  * Atrapa funkcji fprintf sprawdzająca poprawność wypisywania na stderr.
@@ -114,6 +129,8 @@ int mock_printf(const char *format, ...) {
 
     printf_position += return_value;
     assert_true((size_t)printf_position < sizeof(printf_buffer));
+    if (printf_hook != NULL)
+        printf_hook();
     return return_value;
 }
 
@@ -125,6 +142,8 @@ static int input_stream_position = 0;
 static int input_stream_end = 0;
 /// Ilość przeczytanych znaków
 int read_char_count;
+/// Potok, z którego czytają atrapy zamiast z bufora (lub -1)
+static int input_pipe = -1;
 
 /**
  * Atrapa funkcji scanf używana do przechwycenia czytania z stdin.
@@ -178,6 +197,8 @@ int mock_ungetc(int c, FILE *stream) {
  */
 int mock_read(int fd, void *buf, size_t count) {
     assert_true(fd == 0);
+    if (input_pipe >= 0)
+        return read(input_pipe, buf, count);
     unsigned i = 0;
     for (; i < count; ++i)
     {
@@ -188,6 +209,22 @@ int mock_read(int fd, void *buf, size_t count) {
     return i;
 }
 
+/**
+ * Atrapa funkcji poll.
+ * Obsługiwane jest tylko standardowe wejście; dane z bufora są zawsze gotowe.
+ */
+int mock_poll(struct pollfd *fds, unsigned long count, int timeout) {
+    assert_true(count == 1 && fds[0].fd == 0);
+    if (input_pipe >= 0) {
+        struct pollfd pipe_fd = { .fd = input_pipe, .events = fds[0].events };
+        int ret = poll(&pipe_fd, 1, timeout);
+        fds[0].revents = pipe_fd.revents;
+        return ret;
+    }
+    fds[0].revents = POLLIN;
+    return 1;
+}
+
 /**
  * Funkcja wołana przed każdym testem.
  */
@@ -198,6 +235,7 @@ static int test_setup(void **state) {
     memset(printf_buffer, 0, sizeof(printf_buffer));
     printf_position = 0;
     fprintf_position = 0;
+    printf_hook = NULL;
 
     /* Zwrócenie zera oznacza sukces. */
     return 0;
@@ -339,6 +377,108 @@ static void test_x0_poly_one_count_x0(void **state) {
     PolyDestroy(&expected_result);
 }
 
+/**
+ * Test PolyCompose dla gęstego wielomianu jednej zmiennej wysokiego stopnia
+ */
+static void test_dense_poly_one_count_nonlinear(void **state) {
+    (void)state;
+
+    const poly_exp_t degree = 40;
+    Mono *monos = calloc(degree, sizeof(Mono));
+    assert_true(monos != NULL);
+    for (poly_exp_t e = 1; e <= degree; ++e)
+    {
+        Poly c = PolyFromCoeff(e);
+        monos[e - 1] = MonoFromPoly(&c, e);
+    }
+    Poly p = PolyAddMonos(degree, monos);
+    free(monos);
+
+    Poly one = PolyFromCoeff(1);
+    Poly q = PolyShiftVar(&one, 0, 2);           // x_0^2 + x_1 + 1
+    Poly x1 = PolyShiftVar(&one, 1, 1);
+    PolyAddInPlace(&q, &x1);
+    PolyAddInPlace(&q, &one);
+
+    // Schemat Hornera: (((40 q + 39) q + ...) q + 1) q
+    Poly expected_result = PolyZero();
+    for (poly_exp_t e = degree; e >= 1; --e)
+    {
+        Poly c = PolyFromCoeff(e);
+        PolyAddInPlace(&expected_result, &c);
+        Poly next = PolyMul(&expected_result, &q);
+        PolyDestroy(&expected_result);
+        expected_result = next;
+    }
+
+    Poly result = PolyCompose(&p, 1, &q);
+    assert_true(PolyIsEq(&result, &expected_result));
+    PolyDestroy(&p);
+    PolyDestroy(&q);
+    PolyDestroy(&result);
+    PolyDestroy(&expected_result);
+}
+
+/**
+ * Test złożenia i wartości wielomianu zależnego tylko od x_0^3
+ */
+static void test_deflated_poly(void **state) {
+    (void)state;
+
+    const poly_exp_t degree = 20;
+    Mono *monos = calloc(degree, sizeof(Mono));
+    assert_true(monos != NULL);
+    for (poly_exp_t e = 1; e <= degree; ++e)
+    {
+        Poly c = PolyFromCoeff(e);
+        monos[e - 1] = MonoFromPoly(&c, 3 * e);
+    }
+    Poly p = PolyAddMonos(degree, monos);
+    free(monos);
+
+    Poly one = PolyFromCoeff(1);
+    Poly q = PolyShiftVar(&one, 0, 2);           // x_0^2 + x_1
+    Poly x1 = PolyShiftVar(&one, 1, 1);
+    PolyAddInPlace(&q, &x1);
+
+    Poly q_cubed = PolyMul(&q, &q);
+    Poly temp = PolyMul(&q_cubed, &q);
+    PolyDestroy(&q_cubed);
+    q_cubed = temp;
+
+    Poly expected_result = PolyZero();
+    for (poly_exp_t e = degree; e >= 1; --e)
+    {
+        Poly c = PolyFromCoeff(e);
+        PolyAddInPlace(&expected_result, &c);
+        Poly next = PolyMul(&expected_result, &q_cubed);
+        PolyDestroy(&expected_result);
+        expected_result = next;
+    }
+
+    Poly result = PolyCompose(&p, 1, &q);
+    assert_true(PolyIsEq(&result, &expected_result));
+
+    // p(2) = sum e * 8^e (modulo 2^64)
+    unsigned long long expected_value = 0;
+    unsigned long long power = 1;
+    for (poly_exp_t e = 1; e <= degree; ++e)
+    {
+        power *= 8;
+        expected_value += e * power;
+    }
+    Poly value = PolyAt(&p, 2);
+    assert_true(PolyIsCoeff(&value));
+    assert_int_equal((unsigned long long)value.constant, expected_value);
+
+    PolyDestroy(&p);
+    PolyDestroy(&q);
+    PolyDestroy(&q_cubed);
+    PolyDestroy(&result);
+    PolyDestroy(&expected_result);
+    PolyDestroy(&value);
+}
+
 /**
  * Test czytania wejścia - COMPOSE - brak parametru
  */
@@ -454,6 +594,1243 @@ static void test_compose_letters_numbers_param(void **state) {
     assert_string_equal(fprintf_buffer, "ERROR 1 WRONG COUNT\n");
 }
 
+/**
+ * Test PolyProductN - count równe 0
+ */
+static void test_product_zero_count(void **state) {
+    (void)state;
+
+    Poly result = PolyProductN(0, NULL);
+    Poly expected_result = PolyFromCoeff(1);
+    assert_true(PolyIsEq(&result, &expected_result));
+    PolyDestroy(&result);
+    PolyDestroy(&expected_result);
+}
+
+/**
+ * Test PolyProductN - wynik zgodny z kolejnymi wywołaniami PolyMul
+ */
+static void test_product_matches_mul(void **state) {
+    (void)state;
+
+    Poly factors[3];
+    for (unsigned i = 0; i < array_length(factors); ++i)
+    {
+        Poly c = PolyFromCoeff(i + 2);
+        Mono m = MonoFromPoly(&c, i + 1);
+        factors[i] = PolyAddMonos(1, &m);
+        factors[i].constant = -1;
+    }
+
+    Poly partial = PolyMul(&factors[0], &factors[1]);
+    Poly expected_result = PolyMul(&partial, &factors[2]);
+    Poly result = PolyProductN(array_length(factors), factors);
+    assert_true(PolyIsEq(&result, &expected_result));
+
+    for (unsigned i = 0; i < array_length(factors); ++i)
+    {
+        PolyDestroy(&factors[i]);
+    }
+    PolyDestroy(&partial);
+    PolyDestroy(&result);
+    PolyDestroy(&expected_result);
+}
+
+/**
+ * Test czytania wejścia - PRODUCT - mnożenie dwóch wielomianów
+ */
+static void test_product_two_polys(void **state) {
+    (void)state;
+
+    init_input_stream("(1,1)\n(2,1)+(1,0)\nPRODUCT 2\nPRINT\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "(1,1)+(2,2)\n");
+    assert_string_equal(fprintf_buffer, "");
+}
+
+/**
+ * Test czytania wejścia - PRODUCT - brak parametru
+ */
+static void test_product_no_param(void **state) {
+    (void)state;
+
+    init_input_stream("PRODUCT\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "");
+    assert_string_equal(fprintf_buffer, "ERROR 1 WRONG COUNT\n");
+}
+
+/**
+ * Test PolyMulTrunc - (x0 + 1)^2 modulo x0^2
+ */
+static void test_mul_trunc_square(void **state) {
+    (void)state;
+
+    Poly c = PolyFromCoeff(1);
+    Mono m = MonoFromPoly(&c, 1);
+    Poly p = PolyAddMonos(1, &m);
+    p.constant = 1;
+
+    Poly result = PolyMulTrunc(&p, &p, 0, 2);
+    Poly two = PolyFromCoeff(2);
+    Mono expected_mono = MonoFromPoly(&two, 1);
+    Poly expected_result = PolyAddMonos(1, &expected_mono);
+    expected_result.constant = 1;
+    assert_true(PolyIsEq(&result, &expected_result));
+    PolyDestroy(&p);
+    PolyDestroy(&result);
+    PolyDestroy(&expected_result);
+}
+
+/**
+ * Test czytania wejścia - RING - redukcja wielomianów na stosie i iloczynów
+ */
+static void test_ring_reduces_stack(void **state) {
+    (void)state;
+
+    init_input_stream("(1,0)+(1,3)\nRING 0 3\nPRINT\n(1,1)+(1,2)\nCLONE\n"
+                      "MUL\nPRINT\nRING 0 0\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "1\n(1,2)\n");
+    assert_string_equal(fprintf_buffer, "");
+}
+
+/**
+ * Test czytania wejścia - MUL_TRUNC - brak drugiego parametru
+ */
+static void test_mul_trunc_no_degree(void **state) {
+    (void)state;
+
+    init_input_stream("MUL_TRUNC 1 \n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "");
+    assert_string_equal(fprintf_buffer, "ERROR 1 WRONG DEGREE\n");
+}
+
+/**
+ * Test PolyScaleInPlace - odłożony mnożnik i dodawanie wielomianów
+ */
+static void test_scale_lazy_factor_add(void **state) {
+    (void)state;
+
+    Poly c = PolyFromCoeff(2);
+    Mono m = MonoFromPoly(&c, 1);
+    Poly p = PolyAddMonos(1, &m);
+    p.constant = 1;
+    Poly q = PolyClone(&p);
+
+    PolyScaleInPlace(&p, 3);
+    PolyNegInPlace(&q);
+    PolyAddInPlace(&p, &q);
+
+    Poly four = PolyFromCoeff(4);
+    Mono expected_mono = MonoFromPoly(&four, 1);
+    Poly expected_result = PolyAddMonos(1, &expected_mono);
+    expected_result.constant = 2;
+    assert_true(PolyIsEq(&p, &expected_result));
+    PolyDestroy(&p);
+    PolyDestroy(&expected_result);
+}
+
+/**
+ * Test czytania wejścia - SCALE, NEG i SUB
+ */
+static void test_scale_neg_sub(void **state) {
+    (void)state;
+
+    init_input_stream("(1,0)+(2,1)\nSCALE -3\nPRINT\nCLONE\nNEG\nSUB\n"
+                      "PRINT\nSCALE 2\nIS_ZERO\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer,
+                        "(-3,0)+(-6,1)\n(6,0)+(12,1)\n0\n");
+    assert_string_equal(fprintf_buffer, "");
+}
+
+/**
+ * Test czytania wejścia - SCALE z przepełnieniem współczynników do zera
+ */
+static void test_scale_overflow_to_zero(void **state) {
+    (void)state;
+
+    init_input_stream("((1,0)+(576460752303423488,1),1)\nSCALE 32\nPRINT\n"
+                      "(576460752303423488,1)\nSCALE 32\nIS_ZERO\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "(32,1)\n1\n");
+    assert_string_equal(fprintf_buffer, "");
+}
+
+/**
+ * Test czytania wejścia - SHIFT wielomianu bez pierścienia i błędne argumenty
+ */
+static void test_shift_constant(void **state) {
+    (void)state;
+
+    init_input_stream("(1,0)+(2,1)\nSHIFT 1 2\nPRINT\nSHIFT 0 0\nPRINT\n"
+                      "SHIFT 1\nSHIFT 1 -1\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer,
+                        "((1,2),0)+((2,2),1)\n((1,2),0)+((2,2),1)\n");
+    assert_string_equal(fprintf_buffer,
+                        "ERROR 6 WRONG VARIABLE\nERROR 7 WRONG EXPONENT\n");
+}
+
+/**
+ * Test czytania wejścia - SHIFT z obcięciem stopnia w pierścieniu
+ */
+static void test_shift_ring(void **state) {
+    (void)state;
+
+    init_input_stream("RING 0 3\n(1,0)+(1,1)\nSHIFT 0 2\nPRINT\n"
+                      "SHIFT 0 1\nIS_ZERO\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "(1,2)\n1\n");
+    assert_string_equal(fprintf_buffer, "");
+}
+
+/**
+ * Test mnożenia przez jednomian - zgodność z PolyScale i PolyShiftVar
+ */
+static void test_mul_by_monomial(void **state) {
+    (void)state;
+
+    Poly p = PolyFromCoeff(3);
+    Mono m = MonoFromPoly(&p, 0);
+    Poly x1_coeff = PolyAddMonos(1, &m);
+    m = MonoFromPoly(&x1_coeff, 2);
+    Poly term = PolyAddMonos(1, &m);      // 3 * x0^2
+    Poly x0 = PolyClone(&term);
+    PolyScaleInPlace(&x0, 2);             // 6 * x0^2
+
+    Poly q = PolyAdd(&term, &x0);         // 9 * x0^2
+    Poly one = PolyFromCoeff(1);
+    PolyAddInPlace(&q, &one);             // 9 * x0^2 + 1
+
+    Poly result = PolyMul(&q, &term);
+    Poly expected = PolyMul(&term, &q);
+    Poly scaled = PolyScale(&q, 3);
+    Poly shifted = PolyShiftVar(&scaled, 0, 2);
+
+    assert_true(PolyIsEq(&result, &expected));
+    assert_true(PolyIsEq(&result, &shifted));
+    assert_int_equal(PolyDeg(&result), 4);
+    assert_int_equal(PolyDegBy(&result, 1), 0);
+
+    PolyDestroy(&term);
+    PolyDestroy(&x0);
+    PolyDestroy(&q);
+    PolyDestroy(&result);
+    PolyDestroy(&expected);
+    PolyDestroy(&scaled);
+    PolyDestroy(&shifted);
+}
+
+/**
+ * Test czytania wejścia - COEFF i błędne wykładniki
+ */
+static void test_coeff_command(void **state) {
+    (void)state;
+
+    init_input_stream("((1,0)+(2,1),0)+(3,1)+((4,2),5)\nCOEFF 0\nCOEFF 5\n"
+                      "COEFF 2\nSCALE -1\nCOEFF 1\nCOEFF\nCOEFF x\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "(1,0)+(2,1)\n(4,2)\n0\n-3\n");
+    assert_string_equal(fprintf_buffer,
+                        "ERROR 7 WRONG EXPONENT\nERROR 8 WRONG EXPONENT\n");
+}
+
+/**
+ * Test dodawania do długiego wielomianu z indeksem jednomianów
+ */
+static void test_indexed_add(void **state) {
+    (void)state;
+
+    const unsigned count = 4096;
+    Mono *monos = calloc(count, sizeof(Mono));
+    assert_true(monos != NULL);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        Poly coeff = PolyFromCoeff(1);
+        monos[i] = MonoFromPoly(&coeff, 2 * i);
+    }
+    Poly p = PolyAddMonos(count, monos);
+    free(monos);
+    Poly expected = PolyClone(&p);
+
+    // Dopisujemy nowy jednomian i go usuwamy, a potem usuwamy jednomian
+    // wskazywany przez indeks i przywracamy go.
+    const poly_exp_t exps[] = {3, 3, 64, 64};
+    const poly_coeff_t coeffs[] = {5, -5, -1, 1};
+    const poly_coeff_t found_coeffs[] = {5, 0, 0, 1};
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        Poly coeff = PolyFromCoeff(coeffs[i]);
+        Mono m = MonoFromPoly(&coeff, exps[i]);
+        Poly small = PolyAddMonos(1, &m);
+        PolyAddInPlace(&p, &small);
+
+        Poly found = PolyCoeff(&p, exps[i]);
+        assert_int_equal(found.constant, found_coeffs[i]);
+        PolyDestroy(&found);
+    }
+
+    assert_true(PolyIsEq(&p, &expected));
+    assert_int_equal(PolyDeg(&p), 2 * (count - 1));
+
+    PolyDestroy(&p);
+    PolyDestroy(&expected);
+}
+
+/**
+ * Test czytania wejścia - rzadkie zmienne przy wypisywaniu i wczytywaniu
+ */
+static void test_sparse_print_parse(void **state) {
+    (void)state;
+
+    init_input_stream("((((1,3),0),0),0)\nPRINT\nDEG_BY 3\nDEG_BY 0\n"
+                      "((((-1,3),0),0),0)+(2,1)\nADD\nPRINT\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "((((1,3),0),0),0)\n3\n0\n(2,1)\n");
+    assert_string_equal(fprintf_buffer, "");
+}
+
+/**
+ * Test wczytywania - jednomiany w dowolnej kolejności i ze stałymi
+ */
+static void test_parse_unsorted(void **state) {
+    (void)state;
+
+    init_input_stream("(1,3)+(2,1)+(-1,3)+(0,2)\nPRINT\n"
+                      "((1,2),0)+(3,0)+((1,0),1)\nPRINT\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "(2,1)\n((3,0)+(1,2),0)+(1,1)\n");
+    assert_string_equal(fprintf_buffer, "");
+}
+
+/**
+ * Test zamiany na napis - leniwy mnożnik i skrajne współczynniki
+ */
+static void test_poly_to_string(void **state) {
+    (void)state;
+
+    Poly c = PolyFromCoeff(2);
+    Mono m = MonoFromPoly(&c, 1);
+    Poly p = PolyAddMonos(1, &m);
+    p.constant = 1;
+    PolyScaleInPlace(&p, -3);
+
+    char *text = PolyToString(&p);
+    assert_string_equal(text, "(-3,0)+(-6,1)");
+    free(text);
+
+    Poly min = PolyFromCoeff(-9223372036854775807L - 1);
+    text = PolyToString(&min);
+    assert_string_equal(text, "-9223372036854775808");
+    free(text);
+
+    PolyPrint(&p);
+    OutputFlush(&standard_output);
+    assert_string_equal(printf_buffer, "(-3,0)+(-6,1)");
+
+    PolyDestroy(&p);
+}
+
+/**
+ * Test operacji na wielomianie ze zmienną o bardzo dużym numerze
+ */
+static void test_sparse_high_variable(void **state) {
+    (void)state;
+
+    const unsigned var = 1000000;
+    Poly one = PolyFromCoeff(1);
+    Poly p = PolyShiftVar(&one, var, 2);         // x_var^2
+    Poly x0 = PolyShiftVar(&one, 0, 1);          // x_0
+    PolyAddInPlace(&p, &x0);                     // x_var^2 + x_0
+
+    assert_int_equal(PolyDegBy(&p, var), 2);
+    assert_int_equal(PolyDegBy(&p, var - 1), 0);
+    assert_int_equal(PolyDegBy(&p, 0), 1);
+
+    Poly square = PolyMul(&p, &p);
+    assert_int_equal(PolyDegBy(&square, var), 4);
+    assert_int_equal(PolyDeg(&square), 4);
+
+    Poly at = PolyAt(&square, 1);                // (x_{var-1}^2 + 1)^2
+    assert_int_equal(PolyDegBy(&at, var - 1), 4);
+
+    Poly neg = PolyNeg(&p);
+    PolyAddInPlace(&neg, &p);
+    assert_true(PolyIsZero(&neg));
+
+    PolyDestroy(&square);
+    PolyDestroy(&at);
+}
+
+/**
+ * Test mnożenia i wyliczania wartości wielomianów w postaci gęstej
+ */
+static void test_dense_mul(void **state) {
+    (void)state;
+
+    // (1 + x^2 + ... + x^38)^2 oraz (y + 1)(1 + x^2 + ... + x^38)
+    const poly_exp_t length = 20;
+    Mono *monos = calloc(length, sizeof(Mono));
+    assert_true(monos != NULL);
+    for (poly_exp_t e = 0; e < length; ++e)
+    {
+        Poly c = PolyFromCoeff(1);
+        monos[e] = MonoFromPoly(&c, 2 * e);
+    }
+    Poly p = PolyAddMonos(length, monos);
+
+    Poly one = PolyFromCoeff(1);
+    Poly y_plus_one = PolyShiftVar(&one, 1, 1);
+    PolyAddInPlace(&y_plus_one, &one);
+    for (poly_exp_t e = 0; e < length; ++e)
+    {
+        Poly c = PolyClone(&y_plus_one);
+        monos[e] = MonoFromPoly(&c, 2 * e);
+    }
+    Poly q = PolyAddMonos(length, monos);
+    free(monos);
+
+    unsigned long muls, evals;
+    PolyDenseStats(&muls, &evals);
+    Poly square = PolyMul(&p, &p);
+    Poly product = PolyMul(&q, &p);
+    unsigned long new_muls, new_evals;
+    PolyDenseStats(&new_muls, &new_evals);
+    assert_true(new_muls >= muls + 2);
+    assert_int_equal(PolyDeg(&square), 4 * (length - 1));
+    for (poly_exp_t e = 0; e <= 4 * (length - 1); ++e)
+    {
+        const poly_coeff_t count = e / 2 < length ? e / 2 + 1
+                                                  : 2 * length - 1 - e / 2;
+        Poly coeff = PolyCoeff(&square, e);
+        assert_true(PolyIsCoeff(&coeff));
+        assert_int_equal(coeff.constant, e % 2 == 0 ? count : 0);
+        PolyDestroy(&coeff);
+
+        Poly expected = PolyScale(&y_plus_one, e % 2 == 0 ? count : 0);
+        coeff = PolyCoeff(&product, e);
+        assert_true(PolyIsEq(&coeff, &expected));
+        PolyDestroy(&coeff);
+        PolyDestroy(&expected);
+    }
+
+    Poly truncated = PolyMulTrunc(&p, &p, 0, 9);
+    assert_int_equal(PolyDeg(&truncated), 8);
+
+    PolyDenseStats(&muls, &evals);
+    Poly value = PolyAt(&square, 3);
+    Poly p_value = PolyAt(&p, 3);
+    PolyDenseStats(&new_muls, &new_evals);
+    assert_int_equal(new_evals, evals + 2);
+    assert_true(PolyIsCoeff(&value));
+    assert_int_equal((unsigned long long)value.constant,
+                     (unsigned long long)p_value.constant *
+                     (unsigned long long)p_value.constant);
+
+    PolyDestroy(&p);
+    PolyDestroy(&q);
+    PolyDestroy(&y_plus_one);
+    PolyDestroy(&square);
+    PolyDestroy(&product);
+    PolyDestroy(&truncated);
+}
+
+/**
+ * Test przechowywania poziomów o stałych współczynnikach w postaci gęstej
+ */
+static void test_dense_storage(void **state) {
+    (void)state;
+
+    // p = 5 + x + 2x^2 + ... + 20x^20, q = -(x + 2x^2 + ... + 18x^18)
+    const poly_exp_t length = 20;
+    Mono *monos = calloc(length, sizeof(Mono));
+    assert_true(monos != NULL);
+    for (poly_exp_t e = 0; e < length; ++e)
+    {
+        Poly c = PolyFromCoeff(e + 1);
+        monos[e] = MonoFromPoly(&c, e + 1);
+    }
+    Poly p = PolyAddMonos(length, monos);
+    Poly five = PolyFromCoeff(5);
+    PolyAddInPlace(&p, &five);
+    for (poly_exp_t e = 0; e < length - 2; ++e)
+    {
+        Poly c = PolyFromCoeff(-(e + 1));
+        monos[e] = MonoFromPoly(&c, e + 1);
+    }
+    Poly q = PolyAddMonos(length - 2, monos);
+    free(monos);
+    assert_true(p.is_dense && q.is_dense);
+
+    char *text = PolyToString(&p);
+    assert_string_equal(text, "(5,0)+(1,1)+(2,2)+(3,3)+(4,4)+(5,5)+(6,6)"
+                              "+(7,7)+(8,8)+(9,9)+(10,10)+(11,11)+(12,12)"
+                              "+(13,13)+(14,14)+(15,15)+(16,16)+(17,17)"
+                              "+(18,18)+(19,19)+(20,20)");
+    free(text);
+
+    Poly coeff = PolyCoeff(&p, 7);
+    assert_int_equal(coeff.constant, 7);
+    coeff = PolyCoeff(&p, 0);
+    assert_int_equal(coeff.constant, 5);
+    Poly value = PolyAt(&p, 1);
+    assert_int_equal(value.constant, 5 + 210);
+
+    // Iloczyn gęstych poziomów zostaje gęsty.
+    Poly square = PolyMul(&p, &p);
+    assert_true(square.is_dense);
+    assert_int_equal(PolyDeg(&square), 2 * length);
+    value = PolyAt(&square, 1);
+    assert_int_equal(value.constant, 215 * 215);
+
+    // Nieparzysty mnożnik jest odkładany, parzysty zeruje co czwarty
+    // współczynnik, a poziom wciąż jest dość gęsty.
+    Poly scaled = PolyScale(&p, 3);
+    PolyScaleInPlace(&scaled, 1L << 62);
+    assert_true(scaled.is_dense);
+    coeff = PolyCoeff(&scaled, 4);
+    assert_true(PolyIsZero(&coeff));
+    coeff = PolyCoeff(&scaled, 5);
+    assert_int_equal(coeff.constant, (poly_coeff_t)(15UL << 62));
+
+    // Po skróceniu zostają dwa jednomiany, więc poziom wraca na listę.
+    Poly sum = PolyClone(&p);
+    PolyAddInPlace(&sum, &q);
+    assert_false(sum.is_dense);
+    text = PolyToString(&sum);
+    assert_string_equal(text, "(5,0)+(19,19)+(20,20)");
+    free(text);
+
+    // Suma z wielomianem o niestałych współczynnikach też jest listą.
+    Poly y = PolyFromCoeff(1);
+    Poly three = PolyFromCoeff(3);
+    Poly term = PolyShiftVar(&y, 1, 1);
+    Poly shifted = PolyShiftVar(&term, 0, 3);
+    PolyAddInPlace(&shifted, &p);
+    assert_false(shifted.is_dense);
+    // Współczynnik przy x^3 to 3 + y, a jego zmienne liczymy od 0.
+    Poly expected = PolyShiftVar(&y, 0, 1);
+    PolyAddInPlace(&expected, &three);
+    coeff = PolyCoeff(&shifted, 3);
+    assert_true(PolyIsEq(&coeff, &expected));
+    PolyAddInPlace(&shifted, &q);
+    PolyDestroy(&shifted);
+
+    PolyDestroy(&coeff);
+    PolyDestroy(&expected);
+    PolyDestroy(&term);
+    PolyDestroy(&sum);
+    PolyDestroy(&scaled);
+    PolyDestroy(&square);
+    PolyDestroy(&p);
+}
+
+/**
+ * Test CoeffMulAddArray i CoeffScaleArray dla różnych długości tablic
+ */
+static void test_coeff_kernels(void **state) {
+    (void)state;
+
+    // Długości obejmują pełne wektory i resztki obsługiwane skalarnie.
+    enum { MAX_LENGTH = 37 };
+    poly_coeff_t dst[MAX_LENGTH], src[MAX_LENGTH], expected[MAX_LENGTH];
+    const poly_coeff_t c = -0x123456789abcdefL;
+    for (size_t n = 0; n <= MAX_LENGTH; ++n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            dst[i] = (poly_coeff_t)(i * 0x9e3779b97f4a7c15UL);
+            src[i] = (poly_coeff_t)(~i * 0xc2b2ae3d27d4eb4fUL);
+            expected[i] = (poly_coeff_t)((unsigned long)dst[i] +
+                                         (unsigned long)c *
+                                         (unsigned long)src[i]);
+        }
+        CoeffMulAddArray(dst, src, c, n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            assert_int_equal(dst[i], expected[i]);
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            expected[i] = (poly_coeff_t)((unsigned long)dst[i] *
+                                         (unsigned long)c);
+        }
+        CoeffScaleArray(dst, c, n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            assert_int_equal(dst[i], expected[i]);
+        }
+    }
+}
+
+/**
+ * Test PolyPermuteVars - przestawienie zmiennych i permutacja odwrotna
+ */
+static void test_permute_vars(void **state) {
+    (void)state;
+
+    Poly one = PolyFromCoeff(1);
+    Poly x0 = PolyShiftVar(&one, 0, 1);
+    Poly x1_sq = PolyShiftVar(&one, 1, 2);
+    Poly x2 = PolyShiftVar(&one, 2, 1);
+    Poly p = PolyMul(&x0, &x1_sq);               // x_0 * x_1^2 + x_2 + 5
+    PolyAddInPlace(&p, &x2);
+    Poly five = PolyFromCoeff(5);
+    PolyAddInPlace(&p, &five);
+
+    const unsigned perm[] = {2, 0, 1};
+    Poly permuted = PolyPermuteVars(&p, 3, perm); // x_2 * x_0^2 + x_1 + 5
+    assert_int_equal(PolyDegBy(&permuted, 0), 2);
+    assert_int_equal(PolyDegBy(&permuted, 1), 1);
+    assert_int_equal(PolyDegBy(&permuted, 2), 1);
+
+    const unsigned inverse[] = {1, 2, 0};
+    Poly back = PolyPermuteVars(&permuted, 3, inverse);
+    assert_true(PolyIsEq(&back, &p));
+
+    PolyDestroy(&x0);
+    PolyDestroy(&x1_sq);
+    PolyDestroy(&x2);
+    PolyDestroy(&p);
+    PolyDestroy(&permuted);
+    PolyDestroy(&back);
+}
+
+/**
+ * Test PolyProductN - zmiana kolejności czynników nie zmienia wyniku
+ */
+static void test_product_reorder(void **state) {
+    (void)state;
+
+    Poly one = PolyFromCoeff(1);
+    Poly factors[3];
+    factors[0] = PolyShiftVar(&one, 0, 5);       // x_0^5 + x_2
+    Poly x2 = PolyShiftVar(&one, 2, 1);
+    PolyAddInPlace(&factors[0], &x2);
+    factors[1] = PolyShiftVar(&one, 1, 1);       // x_1 + 2
+    Poly two = PolyFromCoeff(2);
+    PolyAddInPlace(&factors[1], &two);
+    factors[2] = PolyShiftVar(&one, 0, 3);       // x_0^3
+
+    Poly expected = PolyProductN(3, factors);
+    PolyProductReorder(true);
+    Poly result = PolyProductN(3, factors);
+    PolyProductReorder(false);
+    assert_true(PolyIsEq(&result, &expected));
+
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        PolyDestroy(&factors[i]);
+    }
+    PolyDestroy(&expected);
+    PolyDestroy(&result);
+}
+
+/**
+ * Test czytania wejścia - PERMUTE i błędne permutacje
+ */
+static void test_permute_command(void **state) {
+    (void)state;
+
+    init_input_stream("((1,2)+(3,1),1)+(5,0)\nPERMUTE 2 1 0\nPRINT\n"
+                      "PERMUTE 2 1 1\nPERMUTE 2 2 0\nPERMUTE 0 \nPERMUTE\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "(5,0)+((3,1),1)+((1,1),2)\n");
+    assert_string_equal(fprintf_buffer,
+                        "ERROR 4 WRONG PERMUTATION\n"
+                        "ERROR 5 WRONG PERMUTATION\n"
+                        "ERROR 6 WRONG COUNT\nERROR 7 WRONG COUNT\n");
+}
+
+/**
+ * Test PolySubstitute - zgodność ze złożeniem PolyCompose
+ */
+static void test_subst_matches_compose(void **state) {
+    (void)state;
+
+    Poly one = PolyFromCoeff(1);
+    Poly x0 = PolyShiftVar(&one, 0, 1);
+    Poly x1 = PolyShiftVar(&one, 1, 1);
+    Poly x2 = PolyShiftVar(&one, 2, 1);
+
+    Poly q = PolyAdd(&x0, &x2);                  // x_0 + x_2
+    Poly x1_cubed = PolyShiftVar(&x1, 1, 2);
+    Poly p = PolyMul(&x0, &x1_cubed);            // x_0 * x_1^3 + x_1 + 7
+    PolyAddInPlace(&p, &x1);
+    Poly seven = PolyFromCoeff(7);
+    PolyAddInPlace(&p, &seven);
+
+    Poly x[] = {x0, q, x2};
+    Poly expected = PolyCompose(&p, 3, x);
+    Poly result = PolySubstitute(&p, 1, &q);
+    assert_true(PolyIsEq(&result, &expected));
+
+    Poly untouched = PolySubstitute(&p, 5, &q);
+    assert_true(PolyIsEq(&untouched, &p));
+
+    PolyDestroy(&x0);
+    PolyDestroy(&x1_cubed);
+    PolyDestroy(&x2);
+    PolyDestroy(&q);
+    PolyDestroy(&p);
+    PolyDestroy(&expected);
+    PolyDestroy(&result);
+    PolyDestroy(&untouched);
+}
+
+/**
+ * Test czytania wejścia - SUBST i błędne argumenty
+ */
+static void test_subst_command(void **state) {
+    (void)state;
+
+    init_input_stream("(1,1)+(2,0)\n((1,2),0)+(3,3)\nSUBST 0\nPRINT\n"
+                      "SUBST 0\nSUBST\nSUBST a\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer,
+                        "((24,0)+(1,2),0)+(36,1)+(18,2)+(3,3)\n");
+    assert_string_equal(fprintf_buffer,
+                        "ERROR 5 STACK UNDERFLOW\n"
+                        "ERROR 6 WRONG VARIABLE\nERROR 7 WRONG VARIABLE\n");
+}
+
+/**
+ * Test złożenia z wielomianami liniowymi i PolyShiftVarBy
+ */
+static void test_affine_compose(void **state) {
+    (void)state;
+
+    Poly one = PolyFromCoeff(1);
+    Poly x0 = PolyShiftVar(&one, 0, 1);
+    Poly x1 = PolyShiftVar(&one, 1, 1);
+    Poly p = PolyMul(&x0, &x1);                  // x_0^5 * x_1 + x_0 * x_1
+    Poly x0_4 = PolyShiftVar(&p, 0, 4);
+    PolyAddInPlace(&p, &x0_4);
+
+    Poly three = PolyFromCoeff(3);
+    Poly x[2];
+    x[0] = PolyScale(&x0, 2);                    // 2 x_0 - 3
+    Poly minus_three = PolyFromCoeff(-3);
+    PolyAddInPlace(&x[0], &minus_three);
+    x[1] = PolyAdd(&x1, &three);                 // x_1 + 3
+
+    // Ten sam wynik liczony mnożeniem wielomianów.
+    Poly x0_power = PolyClone(&x[0]);
+    for (int i = 1; i < 5; ++i)
+    {
+        Poly next = PolyMul(&x0_power, &x[0]);
+        PolyDestroy(&x0_power);
+        x0_power = next;
+    }
+    Poly x0_image = PolyClone(&x[0]);
+    PolyAddInPlace(&x0_power, &x0_image);
+    Poly expected = PolyMul(&x0_power, &x[1]);
+
+    Poly result = PolyCompose(&p, 2, x);
+    assert_true(PolyIsEq(&result, &expected));
+
+    Poly shifted = PolyShiftVarBy(&p, 1, 3);
+    Poly back = PolyShiftVarBy(&shifted, 1, -3);
+    assert_true(PolyIsEq(&back, &p));
+
+    PolyDestroy(&x0);
+    PolyDestroy(&x1);
+    PolyDestroy(&p);
+    PolyDestroy(&x[0]);
+    PolyDestroy(&x[1]);
+    PolyDestroy(&x0_power);
+    PolyDestroy(&expected);
+    PolyDestroy(&result);
+    PolyDestroy(&shifted);
+    PolyDestroy(&back);
+}
+
+/**
+ * Test czytania wejścia - SHIFT_VAR i błędne argumenty
+ */
+static void test_shift_var_command(void **state) {
+    (void)state;
+
+    init_input_stream("(1,3)+(2,0)\nSHIFT_VAR 0 1\nPRINT\n"
+                      "SHIFT_VAR 0\nSHIFT_VAR 0 x\nSHIFT_VAR\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "(3,0)+(3,1)+(3,2)+(1,3)\n");
+    assert_string_equal(fprintf_buffer,
+                        "ERROR 4 WRONG VARIABLE\nERROR 5 WRONG VALUE\n"
+                        "ERROR 6 WRONG VARIABLE\n");
+}
+
+/**
+ * Test pamięci podręcznej potęg w PolyCompose
+ */
+static void test_power_cache(void **state) {
+    (void)state;
+
+    PolyPowerCacheSetBudget(1 << 16);
+
+    Poly one = PolyFromCoeff(1);
+    Poly x[1];
+    x[0] = PolyShiftVar(&one, 1, 1);             // x_1 + x_0 + 1
+    Poly x0 = PolyShiftVar(&one, 0, 1);
+    PolyAddInPlace(&x[0], &x0);
+    PolyAddInPlace(&x[0], &one);
+    Poly p = PolyShiftVar(&one, 0, 6);           // x_0^6
+
+    unsigned long hits, misses;
+    Poly first = PolyCompose(&p, 1, x);
+    PolyPowerCacheStats(&hits, &misses);
+    Poly second = PolyCompose(&p, 1, x);
+    unsigned long new_hits, new_misses;
+    PolyPowerCacheStats(&new_hits, &new_misses);
+    assert_int_equal(new_hits, hits + 1);
+    assert_int_equal(new_misses, misses);
+    assert_true(PolyIsEq(&first, &second));
+
+    // Potęgi z pamięci podręcznej nie mogą ominąć obcięcia w pierścieniu.
+    PolyRingSet(1, 2);
+    Poly truncated = PolyCompose(&p, 1, x);
+    PolyRingReset();
+    assert_int_equal(PolyDegBy(&truncated, 1), 1);
+
+    PolyPowerCacheSetBudget(0);
+    PolyDestroy(&x[0]);
+    PolyDestroy(&p);
+    PolyDestroy(&first);
+    PolyDestroy(&second);
+    PolyDestroy(&truncated);
+}
+
+/**
+ * Test czytania poleceń z pliku podanego jako argument
+ */
+static void test_file_input(void **state) {
+    (void)state;
+
+    const char *path = "unit_tests_poly_input.txt";
+    FILE *file = fopen(path, "w");
+    assert_true(file != NULL);
+    fputs("(1,2)+(3,4)\nWRONG x\nCLONE\nADD\nPRINT\n(1,2", file);
+    fclose(file);
+
+    const char *args[] = {"calc_poly", path};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    remove(path);
+    assert_string_equal(printf_buffer, "(2,2)+(6,4)\n");
+    assert_string_equal(fprintf_buffer,
+                        "ERROR 2 WRONG COMMAND\nERROR 6 5\n");
+
+    const char *missing[] = {"calc_poly", path};
+    assert_int_equal(mock_main(array_length(missing), (char **)missing), 1);
+}
+
+/**
+ * Test potokowego przetwarzania pliku (kolejność wyników i błędów)
+ */
+static void test_pipelined_input(void **state) {
+    (void)state;
+
+    const char *path = "unit_tests_poly_pipeline.txt";
+    FILE *file = fopen(path, "w");
+    assert_true(file != NULL);
+    fputs("(1,2)+(3,4)\n(1,2\nRING 0 3\n(1,1)+(1,3)\nPRINT\n#\n"
+          "WRONG x\n5\nADD\nPRINT\n(1,-2)", file);
+    fclose(file);
+
+    const char *args[] = {"calc_poly", "-j", "2", path};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "(1,1)\n(5,0)+(1,1)\n");
+    assert_string_equal(fprintf_buffer, "ERROR 2 5\nERROR 6 1\n"
+                                        "ERROR 7 WRONG COMMAND\n"
+                                        "ERROR 11 5\n");
+
+    const char *wrong[] = {"calc_poly", "-j", "x", path};
+    assert_int_equal(mock_main(array_length(wrong), (char **)wrong), 1);
+    remove(path);
+}
+
+/**
+ * Test niewczytanych literałów (IS_COEFF, IS_ZERO, CLONE, POP i RING)
+ */
+static void test_lazy_literals(void **state) {
+    (void)state;
+
+    const char *path = "unit_tests_poly_literals.txt";
+    FILE *file = fopen(path, "w");
+    assert_true(file != NULL);
+    fputs("(1,2)+(3,4)\n(1,2\n5\nIS_COEFF\nIS_ZERO\nPOP\n(0,1)\nIS_ZERO\n"
+          "CLONE\nADD\nPRINT\n(1,1)+(1,3)\nRING 0 2\nPRINT\nIS_ZERO\n"
+          "(2,5)\nIS_ZERO\nPOP\nPOP\nPOP\nPRINT\n", file);
+    fclose(file);
+
+    const char *args[] = {"calc_poly", "-j", "0", path};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    remove(path);
+    assert_string_equal(printf_buffer, "1\n0\n1\n0\n(1,1)\n0\n1\n0\n");
+    assert_string_equal(fprintf_buffer, "ERROR 2 5\n");
+}
+
+/**
+ * Test niewczytanych literałów przy domyślnej liczbie wątków i w potoku
+ */
+static void test_pipelined_literals(void **state) {
+    (void)state;
+
+    const char *path = "unit_tests_poly_pipeline_literals.txt";
+    FILE *file = fopen(path, "w");
+    assert_true(file != NULL);
+    fputs("(1,2)+(3,4)\n0\n(1,2\n((1,0),1)\nIS_ZERO\nIS_COEFF\nPOP\n"
+          "IS_ZERO\nPOP\nCLONE\nPOP\nIS_COEFF\n", file);
+    fclose(file);
+
+    const char *defaults[] = {"calc_poly", path};
+    const char *pipelined[] = {"calc_poly", "-j", "2", path};
+    char **args[] = {(char **)defaults, (char **)pipelined};
+    const int arg_counts[] = {array_length(defaults), array_length(pipelined)};
+    for (int i = 0; i < 2; ++i)
+    {
+        unsigned long pushed, parsed;
+        PolyLiteralStats(&pushed, &parsed);
+        test_setup(NULL);
+        assert_int_equal(mock_main(arg_counts[i], args[i]), 0);
+        assert_string_equal(printf_buffer, "0\n0\n1\n0\n");
+        assert_string_equal(fprintf_buffer, "ERROR 3 5\n");
+
+        unsigned long new_pushed, new_parsed;
+        PolyLiteralStats(&new_pushed, &new_parsed);
+        assert_int_equal(new_pushed, pushed + 3);
+        assert_int_equal(new_parsed, parsed);
+    }
+    remove(path);
+}
+
+/**
+ * Test wczytywania liczb na granicach zakresu
+ */
+static void test_number_parsing(void **state) {
+    (void)state;
+
+    init_input_stream("(1999999999999999999,1)\nPRINT\n"
+                      "(-9223372036854775808,0999999999)\nDEG\n"
+                      "(9223372036854775808,1)\n(1,2147483648)\n"
+                      "DEG_BY 4294967295\nDEG_BY 4294967296\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "(1999999999999999999,1)\n999999999\n"
+                                       "0\n");
+    assert_string_equal(fprintf_buffer, "ERROR 5 20\nERROR 6 13\n"
+                                        "ERROR 8 WRONG VARIABLE\n");
+}
+
+/**
+ * Test czytania z wyprzedzeniem do małych buforów (-b)
+ */
+static void test_read_ahead_buffers(void **state) {
+    (void)state;
+
+    init_input_stream("(1,2)+(3,4)\nCLONE\nADD\nPRINT\n(1,2\nDEG\nWRONG\n");
+
+    const char *args[] = {"calc_poly", "-b", "3"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    assert_string_equal(printf_buffer, "(2,2)+(6,4)\n4\n");
+    assert_string_equal(fprintf_buffer, "ERROR 5 5\nERROR 7 WRONG COMMAND\n");
+
+    const char *wrong[] = {"calc_poly", "-b", "x"};
+    assert_int_equal(mock_main(array_length(wrong), (char **)wrong), 1);
+}
+
+/// Blokada chroniąca stan rozmowy z kalkulatorem przez potok
+static pthread_mutex_t conversation_lock = PTHREAD_MUTEX_INITIALIZER;
+/// Sygnalizuje nową odpowiedź kalkulatora
+static pthread_cond_t conversation_changed = PTHREAD_COND_INITIALIZER;
+/// Liczba odpowiedzi kalkulatora
+static unsigned conversation_answers;
+/// Liczba odpowiedzi otrzymanych przed zamknięciem potoku
+static unsigned conversation_answers_before_end;
+/// Koniec potoku do zapisu
+static int conversation_pipe;
+/// Wiersz wysyłany dopiero po pierwszej odpowiedzi
+static const char conversation_late_line[] = "0\nIS_ZERO\n";
+
+/**
+ * Czeka podaną liczbę milisekund
+ */
+static void sleep_milliseconds(long milliseconds) {
+    struct timespec duration = {0, milliseconds * 1000000};
+    nanosleep(&duration, NULL);
+}
+
+/**
+ * Wysyła drugi wiersz po pierwszej odpowiedzi, zanim kalkulator zacznie
+ * czekać na wejście, i czeka, aż wątek wczytujący go przeczyta
+ */
+static void conversation_hook(void) {
+    unsigned answers = 0;
+    for (int i = 0; i < printf_position; ++i)
+        answers += printf_buffer[i] == '\n';
+
+    if (answers == 1) {
+        ssize_t length = sizeof(conversation_late_line) - 1;
+        assert_int_equal(write(conversation_pipe, conversation_late_line,
+                               length), length);
+        int pending = 1;
+        for (int i = 0; i < 1000 && pending > 0; ++i) {
+            sleep_milliseconds(1);
+            assert_int_equal(ioctl(input_pipe, FIONREAD, &pending), 0);
+        }
+        sleep_milliseconds(20);
+    }
+
+    pthread_mutex_lock(&conversation_lock);
+    conversation_answers = answers;
+    pthread_cond_broadcast(&conversation_changed);
+    pthread_mutex_unlock(&conversation_lock);
+}
+
+/**
+ * Zamyka potok po drugiej odpowiedzi lub po upływie czasu na nią
+ */
+static void* conversation_watchdog(void *arg) {
+    (void)arg;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 5;
+
+    pthread_mutex_lock(&conversation_lock);
+    while (conversation_answers < 2 &&
+           pthread_cond_timedwait(&conversation_changed, &conversation_lock,
+                                  &deadline) == 0) {
+    }
+    conversation_answers_before_end = conversation_answers;
+    pthread_mutex_unlock(&conversation_lock);
+    close(conversation_pipe);
+    return NULL;
+}
+
+/**
+ * Test czytania z wyprzedzeniem z potoku - wiersz, który nadszedł, gdy
+ * kalkulator wykonywał poprzednie polecenia, jest przetwarzany bez czekania
+ * na dalsze wejście
+ */
+static void test_read_ahead_late_line(void **state) {
+    (void)state;
+
+    int fds[2];
+    assert_int_equal(pipe(fds), 0);
+    input_pipe = fds[0];
+    conversation_pipe = fds[1];
+    conversation_answers = 0;
+    printf_hook = conversation_hook;
+    const char first_line[] = "2\nIS_ZERO\n";
+    assert_int_equal(write(conversation_pipe, first_line,
+                           sizeof(first_line) - 1), sizeof(first_line) - 1);
+
+    pthread_t watchdog;
+    assert_int_equal(pthread_create(&watchdog, NULL, conversation_watchdog,
+                                    NULL), 0);
+    const char *args[] = {"calc_poly", "-b", "16"};
+    int status = mock_main(array_length(args), (char **)args);
+    pthread_join(watchdog, NULL);
+    close(input_pipe);
+    input_pipe = -1;
+
+    assert_int_equal(status, 0);
+    assert_int_equal(conversation_answers_before_end, 2);
+    assert_string_equal(printf_buffer, "0\n1\n");
+    assert_string_equal(fprintf_buffer, "");
+}
+
+/**
+ * Test zapisu binarnego wielomianu z odłożonym mnożnikiem i pominiętymi
+ * zmiennymi
+ */
+static void test_serialize_round_trip(void **state) {
+    (void)state;
+
+    Poly one = PolyFromCoeff(1);
+    Poly p = PolyShiftVar(&one, 5, 300);         // x_5^300
+    Poly x0 = PolyShiftVar(&one, 0, 1);          // x_0
+    PolyAddInPlace(&p, &x0);
+    Poly c = PolyFromCoeff(-7);
+    PolyAddInPlace(&p, &c);                      // x_5^300 + x_0 - 7
+    PolyScaleInPlace(&p, -3);
+
+    const size_t size = PolySerializedSize(&p);
+    unsigned char *buffer = malloc(size);
+    assert_true(buffer != NULL);
+    assert_true(PolySerialize(&p, buffer) == buffer + size);
+
+    Poly q;
+    assert_true(PolyDeserialize(buffer, buffer + size, &q) == buffer + size);
+    assert_true(PolyIsEq(&p, &q));
+    PolyDestroy(&q);
+
+    bool is_coeff, is_zero;
+    PolySerializedFacts(buffer, buffer + size, &is_coeff, &is_zero);
+    assert_false(is_coeff);
+    assert_false(is_zero);
+    const unsigned char zero[] = {0, 0};
+    PolySerializedFacts(zero, zero + sizeof(zero), &is_coeff, &is_zero);
+    assert_true(is_coeff);
+    assert_true(is_zero);
+
+    assert_true(PolyDeserialize(buffer, buffer + size - 1, &q) == NULL);
+    assert_true(PolyIsZero(&q));
+
+    // Jednomian o wykładniku większym niż INT_MAX.
+    const unsigned char wrong_exp[] = {1, 0, 0, 0xff, 0xff, 0xff, 0xff, 0x0f,
+                                       0, 2};
+    assert_true(PolyDeserialize(wrong_exp, wrong_exp + sizeof(wrong_exp),
+                                &q) == NULL);
+    assert_true(PolyIsZero(&q));
+
+    free(buffer);
+    PolyDestroy(&p);
+}
+
+/**
+ * Test poleceń SAVE, SAVE_ALL i LOAD
+ */
+static void test_save_load_commands(void **state) {
+    (void)state;
+
+    FILE *file = fopen("unit_tests_poly_text.bin", "w");
+    assert_true(file != NULL);
+    fputs("(1,2)\n", file);
+    fclose(file);
+
+    init_input_stream("(1,2)+(3,4)\n5\nSAVE_ALL unit_tests_poly_stack.bin\n"
+                      "SAVE unit_tests_poly_top.bin\nPOP\nPOP\n"
+                      "LOAD unit_tests_poly_stack.bin\nPRINT\nPOP\nPRINT\n"
+                      "LOAD unit_tests_poly_top.bin\nPRINT\nSAVE\n"
+                      "LOAD unit_tests_poly_missing.bin\n"
+                      "LOAD unit_tests_poly_text.bin\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    remove("unit_tests_poly_stack.bin");
+    remove("unit_tests_poly_top.bin");
+    remove("unit_tests_poly_text.bin");
+    assert_string_equal(printf_buffer, "5\n(1,2)+(3,4)\n5\n");
+    assert_string_equal(fprintf_buffer, "ERROR 13 WRONG FILE NAME\n"
+                                        "ERROR 14 CANNOT OPEN FILE\n"
+                                        "ERROR 15 WRONG FILE\n");
+}
+
+/**
+ * Test magazynu wielomianów (STORE, OPEN_STORE, FETCH)
+ */
+static void test_store_commands(void **state) {
+    (void)state;
+
+    remove("unit_tests_poly.store");
+    init_input_stream("(1,2)+(3,4)\nSTORE b unit_tests_poly.store\n"
+                      "5\nSTORE a unit_tests_poly.store\n"
+                      "-5\nSTORE b unit_tests_poly.store\n"
+                      "OPEN_STORE unit_tests_poly.store\nFETCH b\nPRINT\n"
+                      "FETCH a\nPRINT\nFETCH c\nSTORE x\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    remove("unit_tests_poly.store");
+    assert_string_equal(printf_buffer, "-5\n5\n");
+    assert_string_equal(fprintf_buffer, "ERROR 12 WRONG NAME\n"
+                                        "ERROR 13 WRONG NAME\n");
+}
+
+/**
+ * Test FETCH - wpis z niepoprawnym zapisem jest odrzucany przy każdym
+ * pobraniu, nie tylko przy pierwszym
+ */
+static void test_store_invalid_entry(void **state) {
+    (void)state;
+
+    remove("unit_tests_poly.store");
+    Poly p = PolyFromCoeff(7);
+    assert_true(PolyStoreAdd("unit_tests_poly.store", "a", 1, &p));
+    p = PolyShiftVar(&p, 0, 2);
+    assert_true(PolyStoreAdd("unit_tests_poly.store", "b", 1, &p));
+    PolyDestroy(&p);
+
+    // Zapis b leży na końcu pliku; jego ostatni bajt to stała
+    // współczynnika, a współczynnik równy zeru jest niepoprawny.
+    FILE *file = fopen("unit_tests_poly.store", "r+b");
+    assert_true(file != NULL);
+    assert_int_equal(fseek(file, -1, SEEK_END), 0);
+    assert_int_equal(fputc(0, file), 0);
+    fclose(file);
+
+    init_input_stream("OPEN_STORE unit_tests_poly.store\nFETCH b\nFETCH b\n"
+                      "FETCH a\nPRINT\n");
+
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    remove("unit_tests_poly.store");
+    assert_string_equal(printf_buffer, "7\n");
+    assert_string_equal(fprintf_buffer, "ERROR 2 WRONG NAME\n"
+                                        "ERROR 3 WRONG NAME\n");
+}
+
+/**
+ * Test FETCH - niewczytane literały z magazynu, wczytywane dopiero
+ * przez polecenia lub przed zamknięciem magazynu
+ */
+static void test_store_literals(void **state) {
+    (void)state;
+
+    remove("unit_tests_poly.store");
+    init_input_stream("7\nSTORE a unit_tests_poly.store\n"
+                      "(1,2)\nSTORE b unit_tests_poly.store\n"
+                      "OPEN_STORE unit_tests_poly.store\nFETCH b\nIS_COEFF\n"
+                      "POP\nFETCH a\nOPEN_STORE unit_tests_poly_none.store\n"
+                      "PRINT\n");
+
+    unsigned long pushed, parsed;
+    PolyLiteralStats(&pushed, &parsed);
+    const char *args[] = {"calc_poly"};
+    assert_int_equal(mock_main(array_length(args), (char **)args), 0);
+    remove("unit_tests_poly.store");
+    assert_string_equal(printf_buffer, "0\n7\n");
+    assert_string_equal(fprintf_buffer, "ERROR 10 CANNOT OPEN FILE\n");
+
+    unsigned long new_pushed, new_parsed;
+    PolyLiteralStats(&new_pushed, &new_parsed);
+    assert_int_equal(new_pushed, pushed + 2);
+    assert_int_equal(new_parsed, parsed + 1);
+}
+
 /**
  * Główna funkcja testów
  */
@@ -466,6 +1843,8 @@ int main(void) {
         cmocka_unit_test(test_x0_poly_zero_count),
         cmocka_unit_test(test_x0_poly_one_count_const),
         cmocka_unit_test(test_x0_poly_one_count_x0),
+        cmocka_unit_test(test_dense_poly_one_count_nonlinear),
+        cmocka_unit_test(test_deflated_poly),
     };
     const struct CMUnitTest COMPOSEParseTests[] = {
         cmocka_unit_test_setup(test_compose_no_param, test_setup),
@@ -477,7 +1856,88 @@ int main(void) {
         cmocka_unit_test_setup(test_compose_letters_param, test_setup),
         cmocka_unit_test_setup(test_compose_letters_numbers_param, test_setup),
     };
+    const struct CMUnitTest PolyProductNTests[] = {
+        cmocka_unit_test(test_product_zero_count),
+        cmocka_unit_test(test_product_matches_mul),
+        cmocka_unit_test_setup(test_product_two_polys, test_setup),
+        cmocka_unit_test_setup(test_product_no_param, test_setup),
+    };
+    const struct CMUnitTest TruncationTests[] = {
+        cmocka_unit_test(test_mul_trunc_square),
+        cmocka_unit_test_setup(test_ring_reduces_stack, test_setup),
+        cmocka_unit_test_setup(test_mul_trunc_no_degree, test_setup),
+    };
+    const struct CMUnitTest ScaleTests[] = {
+        cmocka_unit_test(test_scale_lazy_factor_add),
+        cmocka_unit_test_setup(test_scale_overflow_to_zero, test_setup),
+        cmocka_unit_test_setup(test_shift_constant, test_setup),
+        cmocka_unit_test_setup(test_shift_ring, test_setup),
+        cmocka_unit_test(test_mul_by_monomial),
+        cmocka_unit_test_setup(test_scale_neg_sub, test_setup),
+    };
+    const struct CMUnitTest IndexTests[] = {
+        cmocka_unit_test_setup(test_coeff_command, test_setup),
+        cmocka_unit_test(test_indexed_add),
+    };
+    const struct CMUnitTest SparseTests[] = {
+        cmocka_unit_test_setup(test_sparse_print_parse, test_setup),
+        cmocka_unit_test(test_sparse_high_variable),
+        cmocka_unit_test_setup(test_parse_unsorted, test_setup),
+    };
+    const struct CMUnitTest DenseTests[] = {
+        cmocka_unit_test(test_dense_mul),
+        cmocka_unit_test(test_dense_storage),
+    };
+    const struct CMUnitTest KernelTests[] = {
+        cmocka_unit_test(test_coeff_kernels),
+    };
+    const struct CMUnitTest OutputTests[] = {
+        cmocka_unit_test_setup(test_poly_to_string, test_setup),
+    };
+    const struct CMUnitTest PermuteTests[] = {
+        cmocka_unit_test(test_permute_vars),
+        cmocka_unit_test(test_product_reorder),
+        cmocka_unit_test_setup(test_permute_command, test_setup),
+    };
+    const struct CMUnitTest SubstTests[] = {
+        cmocka_unit_test(test_subst_matches_compose),
+        cmocka_unit_test_setup(test_subst_command, test_setup),
+        cmocka_unit_test(test_affine_compose),
+        cmocka_unit_test_setup(test_shift_var_command, test_setup),
+    };
+    const struct CMUnitTest PowerCacheTests[] = {
+        cmocka_unit_test(test_power_cache),
+    };
+    const struct CMUnitTest InputTests[] = {
+        cmocka_unit_test_setup(test_file_input, test_setup),
+        cmocka_unit_test_setup(test_pipelined_input, test_setup),
+        cmocka_unit_test_setup(test_lazy_literals, test_setup),
+        cmocka_unit_test_setup(test_pipelined_literals, test_setup),
+        cmocka_unit_test_setup(test_number_parsing, test_setup),
+        cmocka_unit_test_setup(test_read_ahead_buffers, test_setup),
+        cmocka_unit_test_setup(test_read_ahead_late_line, test_setup),
+    };
+    const struct CMUnitTest SerializeTests[] = {
+        cmocka_unit_test(test_serialize_round_trip),
+        cmocka_unit_test_setup(test_save_load_commands, test_setup),
+        cmocka_unit_test_setup(test_store_commands, test_setup),
+        cmocka_unit_test_setup(test_store_literals, test_setup),
+        cmocka_unit_test_setup(test_store_invalid_entry, test_setup),
+    };
     bool result = cmocka_run_group_tests(PolyComposeTests, NULL, NULL);
     result |= cmocka_run_group_tests(COMPOSEParseTests, NULL, NULL);
+    result |= cmocka_run_group_tests(PolyProductNTests, NULL, NULL);
+    result |= cmocka_run_group_tests(TruncationTests, NULL, NULL);
+    result |= cmocka_run_group_tests(ScaleTests, NULL, NULL);
+    result |= cmocka_run_group_tests(IndexTests, NULL, NULL);
+    result |= cmocka_run_group_tests(SparseTests, NULL, NULL);
+    result |= cmocka_run_group_tests(DenseTests, NULL, NULL);
+    result |= cmocka_run_group_tests(KernelTests, NULL, NULL);
+    result |= cmocka_run_group_tests(OutputTests, NULL, NULL);
+    result |= cmocka_run_group_tests(PermuteTests, NULL, NULL);
+    result |= cmocka_run_group_tests(SubstTests, NULL, NULL);
+    result |= cmocka_run_group_tests(PowerCacheTests, NULL, NULL);
+    result |= cmocka_run_group_tests(InputTests, NULL, NULL);
+    result |= cmocka_run_group_tests(SerializeTests, NULL, NULL);
     return result;
 }
@@ -79,6 +79,15 @@ extern int mock_getchar();
 #define read(fd, buf, count) mock_read((fd), (buf), (count))
 extern int mock_read(int fd, void *buf, size_t count);
 
+/* Redirect poll to a function in the test application so it's possible to
+ * test the standard input. */
+#ifdef poll
+#undef poll
+#endif /* poll */
+#define poll(fds, count, timeout) mock_poll((fds), (count), (timeout))
+struct pollfd;
+extern int mock_poll(struct pollfd *fds, unsigned long count, int timeout);
+
 /* Redirect ungetc to a function in the test application so it's possible to
  * test the standard input. */
 #ifdef ungetc